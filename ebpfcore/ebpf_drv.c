@@ -47,6 +47,7 @@ static BOOLEAN _ebpf_driver_unloading_flag = FALSE;
 //
 // Pre-Declarations
 //
+static EVT_WDF_FILE_CLEANUP _ebpf_driver_file_cleanup;
 static EVT_WDF_FILE_CLOSE _ebpf_driver_file_close;
 static EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL _ebpf_driver_io_device_control;
 static EVT_WDFDEVICE_WDM_IRP_PREPROCESS _ebpf_driver_query_volume_information;
@@ -128,12 +129,7 @@ _ebpf_driver_initialize_objects(
 
     WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
     attributes.SynchronizationScope = WdfSynchronizationScopeNone;
-    WDF_FILEOBJECT_CONFIG_INIT(
-        &file_object_config,
-        NULL,
-        _ebpf_driver_file_close,
-        WDF_NO_EVENT_CALLBACK // No cleanup callback function
-    );
+    WDF_FILEOBJECT_CONFIG_INIT(&file_object_config, NULL, _ebpf_driver_file_close, _ebpf_driver_file_cleanup);
     WdfDeviceInitSetFileObjectConfig(device_initialize, &file_object_config, &attributes);
 
     // WDF framework doesn't handle IRP_MJ_QUERY_VOLUME_INFORMATION.
@@ -199,6 +195,17 @@ Exit:
     return status;
 }
 
+static void
+_ebpf_driver_file_cleanup(WDFFILEOBJECT wdf_file_object)
+{
+    // The last handle to the file object has been closed. This runs in the context of the process that closed it,
+    // before the close callback releases the object, so the object can undo what it did on behalf of the handle.
+    FILE_OBJECT* file_object = WdfFileObjectWdmGetFileObject(wdf_file_object);
+    if (file_object->FsContext2 != NULL) {
+        ebpf_object_close_instance(file_object->FsContext2, (uintptr_t)file_object);
+    }
+}
+
 static void
 _ebpf_driver_file_close(WDFFILEOBJECT wdf_file_object)
 {
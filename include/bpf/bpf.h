@@ -66,7 +66,8 @@ bpf_link_get_next_id(__u32 start_id, __u32* next_id);
  * @param[in] key_size Size in bytes of keys.
  * @param[in] value_size Size in bytes of values.
  * @param[in] max_entries Maximum number of entries in the map.
- * @param[in] map_flags Flags (currently 0).
+ * @param[in] map_flags Flags (0 or BPF_F_UPDATE_IN_PLACE for hash maps, 0 or BPF_F_RB_OVERWRITE for ring buffer
+ * maps).
  *
  * @returns A new file descriptor that refers to the map.  A negative
  * value indicates an error occurred and errno was set.
@@ -236,6 +237,109 @@ bpf_map_lookup_elem(int fd, const void* key, void* value);
 int
 bpf_map_update_elem(int fd, const void* key, const void* value, __u64 flags);
 
+/**
+ * @brief Look up a batch of elements in a specified map.
+ *
+ * @param[in] fd File descriptor of map.
+ * @param[in] in_batch Pointer to the key written to out_batch by the previous
+ * call, or NULL to start at the first key.
+ * @param[out] out_batch Pointer to memory in which to write the key to pass
+ * as in_batch to the next call.
+ * @param[out] keys Pointer to memory in which to write up to count keys.
+ * @param[out] values Pointer to memory in which to write up to count values.
+ * @param[in,out] count On input, the number of elements that keys and values
+ * can hold. On output, the number of elements written.
+ * @param[in] opts Options (elem_flags must be 0).
+ *
+ * @retval 0 The operation was successful.
+ * @retval <0 An error occured, and errno was set.
+ *
+ * @exception EINVAL An invalid argument was provided.
+ * @exception EBADF The file descriptor was not found.
+ * @exception ENOENT The end of the map was reached, count elements were written.
+ * @exception ENOMEM Out of memory.
+ */
+int
+bpf_map_lookup_batch(
+    int fd,
+    void* in_batch,
+    void* out_batch,
+    void* keys,
+    void* values,
+    __u32* count,
+    const struct bpf_map_batch_opts* opts);
+
+/**
+ * @brief Look up and delete a batch of elements in a specified map.
+ *
+ * @param[in] fd File descriptor of map.
+ * @param[in] in_batch Pointer to the key written to out_batch by the previous
+ * call, or NULL to start at the first key.
+ * @param[out] out_batch Pointer to memory in which to write the key to pass
+ * as in_batch to the next call.
+ * @param[out] keys Pointer to memory in which to write up to count keys.
+ * @param[out] values Pointer to memory in which to write up to count values.
+ * @param[in,out] count On input, the number of elements that keys and values
+ * can hold. On output, the number of elements written and deleted.
+ * @param[in] opts Options (elem_flags must be 0).
+ *
+ * @retval 0 The operation was successful.
+ * @retval <0 An error occured, and errno was set.
+ *
+ * @exception EINVAL An invalid argument was provided.
+ * @exception EBADF The file descriptor was not found.
+ * @exception ENOENT The end of the map was reached, count elements were written.
+ * @exception ENOMEM Out of memory.
+ */
+int
+bpf_map_lookup_and_delete_batch(
+    int fd,
+    void* in_batch,
+    void* out_batch,
+    void* keys,
+    void* values,
+    __u32* count,
+    const struct bpf_map_batch_opts* opts);
+
+/**
+ * @brief Create or update a batch of elements in a specified map.
+ *
+ * @param[in] fd File descriptor of map.
+ * @param[in] keys Pointer to an array of count keys.
+ * @param[in] values Pointer to an array of count values.
+ * @param[in,out] count On input, the number of elements to update. On output,
+ * the number of elements updated.
+ * @param[in] opts Options (elem_flags is BPF_ANY, BPF_NOEXIST or BPF_EXIST).
+ *
+ * @retval 0 The operation was successful.
+ * @retval <0 An error occured, and errno was set.
+ *
+ * @exception EINVAL An invalid argument was provided.
+ * @exception EBADF The file descriptor was not found.
+ * @exception ENOMEM Out of memory.
+ */
+int
+bpf_map_update_batch(int fd, void* keys, void* values, __u32* count, const struct bpf_map_batch_opts* opts);
+
+/**
+ * @brief Delete a batch of elements from a specified map.
+ *
+ * @param[in] fd File descriptor of map.
+ * @param[in] keys Pointer to an array of count keys.
+ * @param[in,out] count On input, the number of keys to delete. On output,
+ * the number of elements deleted.
+ * @param[in] opts Options (elem_flags must be 0).
+ *
+ * @retval 0 The operation was successful.
+ * @retval <0 An error occured, and errno was set.
+ *
+ * @exception EINVAL An invalid argument was provided.
+ * @exception EBADF The file descriptor was not found.
+ * @exception ENOENT A key was not found.
+ */
+int
+bpf_map_delete_batch(int fd, void* keys, __u32* count, const struct bpf_map_batch_opts* opts);
+
 /** @} */
 
 /**
@@ -844,14 +844,15 @@ libbpf_num_possible_cpus(void);
 /* Ring buffer APIs */
 
 /**
- * @brief Creates a new ring buffer manager.
+ * @brief Creates a new ring buffer manager. Records are passed to the callbacks only from
+ * ring_buffer__poll and ring_buffer__consume, on the calling thread.
  *
  * @param[in] map_fd File descriptor to ring buffer map.
  * @param[in] sample_cb Pointer to ring buffer notification callback function.
  * @param[in] ctx Pointer to sample_cb callback function.
  * @param[in] opts Ring buffer options.
  *
- * @returns Pointer to ring buffer manager.
+ * @returns Pointer to ring buffer manager, or NULL on failure with errno set.
  */
 struct ring_buffer*
 ring_buffer__new(int map_fd, ring_buffer_sample_fn sample_cb, void* ctx, const struct ring_buffer_opts* opts);
@@ -864,6 +865,45 @@ ring_buffer__new(int map_fd, ring_buffer_sample_fn sample_cb, void* ctx, const s
  */
 void
 ring_buffer__free(struct ring_buffer* rb);
+
+/**
+ * @brief Add a ring buffer map to a ring buffer manager. The map is waited on together
+ * with the others.
+ *
+ * @param[in] rb Pointer to ring buffer manager.
+ * @param[in] map_fd File descriptor to ring buffer map.
+ * @param[in] sample_cb Pointer to ring buffer notification callback function.
+ * @param[in] ctx Pointer to sample_cb callback function.
+ *
+ * @returns 0 on success, or a negative error code.
+ */
+int
+ring_buffer__add(struct ring_buffer* rb, int map_fd, ring_buffer_sample_fn sample_cb, void* ctx);
+
+/**
+ * @brief Wait for records in any of the ring buffer manager's maps and pass them to the
+ * callbacks.
+ *
+ * @param[in] rb Pointer to ring buffer manager.
+ * @param[in] timeout_ms Milliseconds to wait, or -1 to wait indefinitely.
+ *
+ * @returns Number of records consumed, the non-zero value returned by a callback, or a
+ * negative error code.
+ */
+int
+ring_buffer__poll(struct ring_buffer* rb, int timeout_ms);
+
+/**
+ * @brief Pass the records already in the ring buffer manager's maps to the callbacks
+ * without waiting, whether or not the maps have signaled a wakeup.
+ *
+ * @param[in] rb Pointer to ring buffer manager.
+ *
+ * @returns Number of records consumed, the non-zero value returned by a callback, or a
+ * negative error code.
+ */
+int
+ring_buffer__consume(struct ring_buffer* rb);
 /** @} */
 
 #else
@@ -29,3 +29,12 @@ typedef struct _ebpf_ring_buffer_map_async_query_result
     size_t producer;
     size_t consumer;
 } ebpf_ring_buffer_map_async_query_result_t;
+
+/**
+ * @brief Header at the start of the data of every record in a BPF_MAP_TYPE_PERCPU_RINGBUF map. Consumers use it
+ * to merge the rings in order and only pass the data that follows it on to subscribers.
+ */
+typedef struct _ebpf_per_cpu_ring_buffer_record_header
+{
+    uint64_t timestamp; ///< Time the record was reserved, in 100 nanosecond units since boot.
+} ebpf_per_cpu_ring_buffer_record_header_t;
@@ -28,7 +28,8 @@ typedef enum bpf_map_type
     BPF_MAP_TYPE_QUEUE = 10,           ///< Queue.
     BPF_MAP_TYPE_LRU_PERCPU_HASH = 11, ///< Per-CPU least-recently-used hash table.
     BPF_MAP_TYPE_STACK = 12,           ///< Stack.
-    BPF_MAP_TYPE_RINGBUF = 13          ///< Ring buffer.
+    BPF_MAP_TYPE_RINGBUF = 13,         ///< Ring buffer.
+    BPF_MAP_TYPE_PERCPU_RINGBUF = 14   ///< Windows-specific: ring buffer with one ring per CPU.
 } ebpf_map_type_t;
 
 typedef enum ebpf_map_option
@@ -61,6 +62,7 @@ typedef struct _ebpf_map_definition_in_memory
     uint32_t max_entries; ///< Maximum number of entries allowed in the map.
     ebpf_id_t inner_map_id;
     ebpf_pin_type_t pinning;
+    uint32_t map_flags; ///< Map flags (BPF_F_*).
 } ebpf_map_definition_in_memory_t;
 
 /**
@@ -176,6 +178,14 @@ struct bpf_map_info
 #define BPF_NOEXIST 0x1
 #define BPF_EXIST 0x2
 
+// Map flags.
+#define BPF_F_UPDATE_IN_PLACE 0x10000 ///< Windows-specific: update hash map values in place instead of replacing them.
+#define BPF_F_RB_OVERWRITE 0x20000    ///< Windows-specific: when a ring buffer is full, overwrite its oldest records.
+
+// Ring buffer helper flags.
+#define BPF_RB_NO_WAKEUP 0x1    ///< Don't notify the consumer of new data.
+#define BPF_RB_FORCE_WAKEUP 0x2 ///< Notify the consumer even if the wakeup watermark hasn't been reached.
+
 struct bpf_prog_info
 {
     // Cross-platform fields.
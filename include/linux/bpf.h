@@ -52,6 +52,10 @@ enum bpf_cmd_id
     BPF_OBJ_GET_INFO_BY_FD,
     BPF_LINK_DETACH,
     BPF_PROG_BIND_MAP,
+    BPF_MAP_LOOKUP_BATCH,
+    BPF_MAP_LOOKUP_AND_DELETE_BATCH,
+    BPF_MAP_UPDATE_BATCH,
+    BPF_MAP_DELETE_BATCH,
 };
 
 /// Attributes used by BPF_OBJ_GET_INFO_BY_FD.
@@ -77,6 +81,20 @@ typedef struct
     uint32_t flags;   ///< Flags affecting the bind operation.
 } bpf_prog_bind_map_attr_t;
 
+/// Attributes used by BPF_MAP_LOOKUP_BATCH, BPF_MAP_LOOKUP_AND_DELETE_BATCH, BPF_MAP_UPDATE_BATCH, and
+/// BPF_MAP_DELETE_BATCH.
+typedef struct
+{
+    uint64_t in_batch;   ///< Pointer to the key to resume after, or 0 to start at the first key.
+    uint64_t out_batch;  ///< Pointer to memory in which to write the key to resume after.
+    uint64_t keys;       ///< Pointer to an array of count keys.
+    uint64_t values;     ///< Pointer to an array of count values.
+    uint32_t count;      ///< On input, the number of elements in keys and values. On output, the number processed.
+    uint32_t map_fd;     ///< File descriptor of map.
+    uint64_t elem_flags; ///< Flags applied to each element.
+    uint64_t flags;      ///< Flags (currently 0).
+} bpf_map_batch_attr_t;
+
 #pragma warning(push)
 #pragma warning(disable : 4201) // nonstandard extension used: nameless struct/union
 /// Parameters used by the bpf() API.
@@ -89,7 +107,7 @@ union bpf_attr
         uint32_t key_size;          ///< Size in bytes of keys.
         uint32_t value_size;        ///< Size in bytes of values.
         uint32_t max_entries;       ///< Maximum number of entries in the map.
-        uint32_t map_flags;         ///< Flags (currently 0).
+        uint32_t map_flags;         ///< Flags (0, BPF_F_UPDATE_IN_PLACE or BPF_F_RB_OVERWRITE).
     };                              ///< Attributes used by BPF_MAP_CREATE.
 
     // BPF_MAP_LOOKUP_ELEM
@@ -155,6 +173,12 @@ union bpf_attr
 
     // BPF_PROG_BIND_MAP
     bpf_prog_bind_map_attr_t prog_bind_map; ///< Attributes used by BPF_PROG_BIND_MAP.
+
+    // BPF_MAP_LOOKUP_BATCH
+    // BPF_MAP_LOOKUP_AND_DELETE_BATCH
+    // BPF_MAP_UPDATE_BATCH
+    // BPF_MAP_DELETE_BATCH
+    bpf_map_batch_attr_t batch; ///< Attributes used by the batch map operations.
 };
 #pragma warning(pop)
 
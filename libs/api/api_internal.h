@@ -11,6 +11,7 @@
 struct bpf_object;
 
 typedef struct _ebpf_ring_buffer_subscription ring_buffer_subscription_t;
+typedef struct _ebpf_ring_buffer_poller ring_buffer_poller_t;
 
 typedef struct bpf_program
 {
@@ -336,6 +337,88 @@ ebpf_map_lookup_and_delete_element(fd_t map_fd, _In_ const void* key, _Out_ void
 ebpf_result_t
 ebpf_map_get_next_key(fd_t map_fd, _In_opt_ const void* previous_key, _Out_ void* next_key);
 
+/**
+ * @brief Look up a batch of elements in an eBPF map.
+ *
+ * @param[in] map_fd File descriptor for the eBPF map.
+ * @param[in] in_batch Pointer to the key returned in out_batch by the
+ *  previous call or NULL to start from the first key.
+ * @param[out] out_batch Pointer to buffer that receives the last key
+ *  returned, to be passed as in_batch by the next call.
+ * @param[out] keys Pointer to buffer that receives up to count keys.
+ * @param[out] values Pointer to buffer that receives up to count values.
+ * @param[in,out] count On input, the number of entries that keys and values
+ *  can hold. On output, the number of entries returned.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_NO_MORE_KEYS The end of the map was reached, count entries
+ *  were returned.
+ */
+ebpf_result_t
+ebpf_map_lookup_element_batch(
+    fd_t map_fd,
+    _In_opt_ const void* in_batch,
+    _Out_ void* out_batch,
+    _Out_ void* keys,
+    _Out_ void* values,
+    _Inout_ uint32_t* count);
+
+/**
+ * @brief Look up and delete a batch of elements in an eBPF map.
+ *
+ * @param[in] map_fd File descriptor for the eBPF map.
+ * @param[in] in_batch Pointer to the key returned in out_batch by the
+ *  previous call or NULL to start from the first key.
+ * @param[out] out_batch Pointer to buffer that receives the last key
+ *  returned, to be passed as in_batch by the next call.
+ * @param[out] keys Pointer to buffer that receives up to count keys.
+ * @param[out] values Pointer to buffer that receives up to count values.
+ * @param[in,out] count On input, the number of entries that keys and values
+ *  can hold. On output, the number of entries returned and deleted.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_NO_MORE_KEYS The end of the map was reached, count entries
+ *  were returned.
+ */
+ebpf_result_t
+ebpf_map_lookup_and_delete_element_batch(
+    fd_t map_fd,
+    _In_opt_ const void* in_batch,
+    _Out_ void* out_batch,
+    _Out_ void* keys,
+    _Out_ void* values,
+    _Inout_ uint32_t* count);
+
+/**
+ * @brief Update a batch of elements in an eBPF map.
+ *
+ * @param[in] map_fd File descriptor for the eBPF map.
+ * @param[in] keys Pointer to buffer containing count keys.
+ * @param[in] values Pointer to buffer containing count values.
+ * @param[in,out] count On input, the number of entries to update. On output,
+ *  the number of entries known to have been updated.
+ * @param[in] flags EBPF_ANY, EBPF_NOEXIST or EBPF_EXIST.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_OPERATION_NOT_SUPPORTED The map values are file descriptors.
+ */
+ebpf_result_t
+ebpf_map_update_element_batch(
+    fd_t map_fd, _In_ const void* keys, _In_ const void* values, _Inout_ uint32_t* count, uint64_t flags);
+
+/**
+ * @brief Delete a batch of elements in an eBPF map.
+ *
+ * @param[in] map_fd File descriptor for the eBPF map.
+ * @param[in] keys Pointer to buffer containing count keys.
+ * @param[in,out] count On input, the number of keys to delete. On output,
+ *  the number of entries known to have been deleted.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ */
+ebpf_result_t
+ebpf_map_delete_element_batch(fd_t map_fd, _In_ const void* keys, _Inout_ uint32_t* count);
+
 /**
  * @brief Detach a link given a file descriptor.
  *
@@ -520,24 +603,71 @@ ebpf_object_unload(_In_ struct bpf_object* object);
 
 typedef int (*ring_buffer_sample_fn)(void* ctx, void* data, size_t size);
 
+// Deliver the records of a per-CPU ring buffer map in the order they were reserved, rather than ring by ring.
+#define EBPF_RING_BUFFER_SUBSCRIBE_FLAG_ORDERED 0x1
+
 /**
- * @brief Subscribe for notifications from the input ring buffer map.
+ * @brief Subscribe for notifications from the input ring buffer map. The records of all the rings of a per-CPU
+ * ring buffer map are passed to the same callback, one at a time.
+ *
+ * With EBPF_RING_BUFFER_SUBSCRIBE_FLAG_ORDERED, each notification merges the records the rings hold at that time
+ * by the time they were reserved. A record that reaches its ring after a notification may still be older than
+ * records already delivered.
  *
  * @param[in] ring_buffer_map_fd File descriptor to the ring buffer map.
  * @param[in] sample_callback_context Pointer to supplied context to be passed in notification callback.
  * @param[in] sample_callback Function pointer to notification handler.
+ * @param[in] flags 0 or EBPF_RING_BUFFER_SUBSCRIBE_FLAG_ORDERED, which requires a per-CPU ring buffer map.
  * @param[out] subscription Opaque pointer to ring buffer subscription object.
  *
  * @retval EBPF_SUCCESS The operation was successful.
  * @retval EBPF_NO_MEMORY Out of memory.
+ * @retval EBPF_INVALID_ARGUMENT Unsupported flags.
  */
 ebpf_result_t
 ebpf_ring_buffer_map_subscribe(
     fd_t ring_buffer_map_fd,
     _In_opt_ void* sample_callback_context,
     ring_buffer_sample_fn sample_callback,
+    uint32_t flags,
     _Outptr_ ring_buffer_subscription_t** subscription);
 
+/**
+ * @brief Set how much unconsumed data must accumulate in a ring buffer map before its subscriber is notified.
+ * Programs can still notify the subscriber early by passing BPF_RB_FORCE_WAKEUP to the ring buffer helpers.
+ *
+ * @param[in] ring_buffer_map_fd File descriptor to the ring buffer map.
+ * @param[in] wakeup_watermark Number of bytes, or 0 to notify as soon as any data is available.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_INVALID_FD The file descriptor was invalid.
+ * @retval EBPF_INVALID_ARGUMENT The map isn't a ring buffer or the watermark isn't smaller than the ring.
+ */
+ebpf_result_t
+ebpf_ring_buffer_map_set_wakeup_watermark(fd_t ring_buffer_map_fd, size_t wakeup_watermark);
+
+/**
+ * @brief Pass the records currently held by one ring of a ring buffer map to a callback, without consuming them.
+ * The ring is frozen while it is copied, so on a BPF_F_RB_OVERWRITE map producers drop new records rather than
+ * overwrite the ones being copied. Records that are still reserved or were discarded are skipped.
+ *
+ * @param[in] ring_buffer_map_fd File descriptor to the ring buffer map.
+ * @param[in] ring_index Index of the ring to copy; 0 unless the map is a per-CPU ring buffer map.
+ * @param[in] sample_callback_context Pointer to supplied context to be passed in the callback.
+ * @param[in] sample_callback Function called for each record, oldest first. Returning non-zero stops the walk.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_NO_MEMORY Out of memory.
+ * @retval EBPF_INVALID_FD The file descriptor was invalid.
+ * @retval EBPF_INVALID_ARGUMENT The map isn't a ring buffer or has no such ring.
+ */
+ebpf_result_t
+ebpf_ring_buffer_map_snapshot(
+    fd_t ring_buffer_map_fd,
+    uint32_t ring_index,
+    _In_opt_ void* sample_callback_context,
+    ring_buffer_sample_fn sample_callback);
+
 /**
  * @brief Unsubscribe from the ring buffer map event notifications.
  *
@@ -545,3 +675,76 @@ ebpf_ring_buffer_map_subscribe(
  */
 bool
 ebpf_ring_buffer_map_unsubscribe(_Inout_ _Post_invalid_ ring_buffer_subscription_t* subscription);
+
+/**
+ * @brief Create a ring buffer poller. Unlike a subscription, a poller never calls back on its own: the records of
+ * all the maps added to it are delivered from ebpf_ring_buffer_poller_poll and ebpf_ring_buffer_poller_consume, on
+ * the calling thread. Every ring of every map signals the same event, so any number of maps is waited on at once.
+ *
+ * @param[out] poller Pointer to the new poller.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_NO_MEMORY Out of memory.
+ */
+ebpf_result_t
+ebpf_ring_buffer_poller_create(_Outptr_ ring_buffer_poller_t** poller);
+
+/**
+ * @brief Add a ring buffer map to a poller. A ring can only have one consumer at a time, so the map must not also be
+ * subscribed to.
+ *
+ * @param[in, out] poller Poller to add the map to.
+ * @param[in] ring_buffer_map_fd File descriptor to the ring buffer map.
+ * @param[in] sample_callback_context Pointer to supplied context to be passed in the callback.
+ * @param[in] sample_callback Function called for each record of the map.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_NO_MEMORY Out of memory.
+ * @retval EBPF_INVALID_FD The file descriptor was invalid.
+ * @retval EBPF_INVALID_ARGUMENT The map isn't a ring buffer or already has a consumer.
+ */
+ebpf_result_t
+ebpf_ring_buffer_poller_add(
+    _Inout_ ring_buffer_poller_t* poller,
+    fd_t ring_buffer_map_fd,
+    _In_opt_ void* sample_callback_context,
+    ring_buffer_sample_fn sample_callback);
+
+/**
+ * @brief Deliver the records that are ready in any of the poller's maps, without waiting. Every ring is read, including
+ * rings that haven't reached their wakeup watermark.
+ *
+ * @param[in, out] poller Poller to consume from.
+ * @param[out] record_count Number of records delivered.
+ * @param[out] callback_result Zero, or the non-zero value returned by the callback that stopped the delivery. The
+ * record it was passed stays in the ring.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_FAILED Waiting for new records failed on one of the maps.
+ */
+ebpf_result_t
+ebpf_ring_buffer_poller_consume(
+    _Inout_ ring_buffer_poller_t* poller, _Out_ uint32_t* record_count, _Out_ int* callback_result);
+
+/**
+ * @brief Wait until records are ready in any of the poller's maps, or the timeout expires, and deliver them.
+ *
+ * @param[in, out] poller Poller to wait on.
+ * @param[in] timeout_ms Milliseconds to wait, or a negative value to wait indefinitely.
+ * @param[out] record_count Number of records delivered, which is 0 if the timeout expired.
+ * @param[out] callback_result Zero, or the non-zero value returned by the callback that stopped the delivery.
+ *
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_FAILED Waiting for new records failed.
+ */
+ebpf_result_t
+ebpf_ring_buffer_poller_poll(
+    _Inout_ ring_buffer_poller_t* poller, int timeout_ms, _Out_ uint32_t* record_count, _Out_ int* callback_result);
+
+/**
+ * @brief Free a poller, canceling its pending waits. No callback runs after this returns.
+ *
+ * @param[in] poller Poller to free.
+ */
+void
+ebpf_ring_buffer_poller_free(_In_opt_ _Post_invalid_ ring_buffer_poller_t* poller);
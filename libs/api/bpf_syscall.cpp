@@ -26,6 +26,11 @@ bpf(int cmd, union bpf_attr* attr, unsigned int size)
     case BPF_MAP_CREATE:
         CHECK_SIZE(map_flags);
         return bpf_create_map(attr->map_type, attr->key_size, attr->value_size, attr->max_entries, attr->map_flags);
+    case BPF_MAP_DELETE_BATCH: {
+        CHECK_SIZE(batch.flags);
+        struct bpf_map_batch_opts opts = {sizeof(struct bpf_map_batch_opts), attr->batch.elem_flags, attr->batch.flags};
+        return bpf_map_delete_batch(attr->batch.map_fd, (void*)attr->batch.keys, &attr->batch.count, &opts);
+    }
     case BPF_MAP_DELETE_ELEM:
         CHECK_SIZE(key);
         return bpf_map_delete_elem(attr->map_fd, (const void*)attr->key);
@@ -38,9 +43,28 @@ bpf(int cmd, union bpf_attr* attr, unsigned int size)
     case BPF_MAP_GET_NEXT_KEY:
         CHECK_SIZE(next_key);
         return bpf_map_get_next_key(attr->map_fd, (const void*)attr->key, (void*)attr->next_key);
+    case BPF_MAP_LOOKUP_AND_DELETE_BATCH:
+    case BPF_MAP_LOOKUP_BATCH: {
+        CHECK_SIZE(batch.flags);
+        struct bpf_map_batch_opts opts = {sizeof(struct bpf_map_batch_opts), attr->batch.elem_flags, attr->batch.flags};
+        return ((cmd == BPF_MAP_LOOKUP_BATCH) ? bpf_map_lookup_batch : bpf_map_lookup_and_delete_batch)(
+            attr->batch.map_fd,
+            (void*)attr->batch.in_batch,
+            (void*)attr->batch.out_batch,
+            (void*)attr->batch.keys,
+            (void*)attr->batch.values,
+            &attr->batch.count,
+            &opts);
+    }
     case BPF_MAP_LOOKUP_ELEM:
         CHECK_SIZE(value);
         return bpf_map_lookup_elem(attr->map_fd, (const void*)attr->key, (void*)attr->value);
+    case BPF_MAP_UPDATE_BATCH: {
+        CHECK_SIZE(batch.flags);
+        struct bpf_map_batch_opts opts = {sizeof(struct bpf_map_batch_opts), attr->batch.elem_flags, attr->batch.flags};
+        return bpf_map_update_batch(
+            attr->batch.map_fd, (void*)attr->batch.keys, (void*)attr->batch.values, &attr->batch.count, &opts);
+    }
     case BPF_MAP_UPDATE_ELEM:
         CHECK_SIZE(flags);
         return bpf_map_update_elem(attr->map_fd, (const void*)attr->key, (const void*)attr->value, attr->flags);
@@ -172,7 +172,7 @@ ebpf_map_create(
     ebpf_handle_t inner_map_handle = ebpf_handle_invalid;
     ebpf_map_definition_in_memory_t map_definition = {0};
 
-    if ((opts && opts->map_flags != 0) || map_fd == nullptr) {
+    if ((opts && (opts->map_flags & ~(BPF_F_UPDATE_IN_PLACE | BPF_F_RB_OVERWRITE)) != 0) || map_fd == nullptr) {
         result = EBPF_INVALID_ARGUMENT;
         goto Exit;
     }
@@ -184,6 +184,7 @@ ebpf_map_create(
         map_definition.key_size = key_size;
         map_definition.value_size = value_size;
         map_definition.max_entries = max_entries;
+        map_definition.map_flags = (opts) ? opts->map_flags : 0;
 
         inner_map_handle = (opts) ? _get_handle_from_file_descriptor(opts->inner_map_fd) : ebpf_handle_invalid;
 
@@ -584,6 +585,349 @@ Exit:
     return result;
 }
 
+// Number of key and value pairs that fit in a single batch IOCTL.
+static inline uint32_t
+_map_batch_entries_per_request(size_t header_size, size_t entry_size)
+{
+    if (entry_size == 0 || header_size >= UINT16_MAX) {
+        return 0;
+    }
+    return static_cast<uint32_t>((UINT16_MAX - header_size) / entry_size);
+}
+
+static ebpf_result_t
+_ebpf_map_lookup_element_batch_helper(
+    fd_t map_fd,
+    bool find_and_delete,
+    _In_opt_ const void* in_batch,
+    _Out_ void* out_batch,
+    _Out_ void* keys,
+    _Out_ void* values,
+    _Inout_ uint32_t* count) noexcept
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_handle_t map_handle;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    uint32_t max_entries = 0;
+    uint32_t type;
+    uint32_t requested;
+    uint32_t returned = 0;
+    uint32_t entries_per_request;
+    const uint8_t* previous_key = reinterpret_cast<const uint8_t*>(in_batch);
+    ebpf_operation_id_t operation_id = find_and_delete ? ebpf_operation_id_t::EBPF_OPERATION_MAP_LOOKUP_AND_DELETE_BATCH
+                                                       : ebpf_operation_id_t::EBPF_OPERATION_MAP_LOOKUP_BATCH;
+
+    if (map_fd <= 0 || out_batch == nullptr || keys == nullptr || values == nullptr || count == nullptr ||
+        *count == 0) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+    requested = *count;
+    *count = 0;
+
+    map_handle = _get_handle_from_file_descriptor(map_fd);
+    if (map_handle == ebpf_handle_invalid) {
+        result = EBPF_INVALID_FD;
+        goto Exit;
+    }
+
+    // Get map properties, either from local cache or from EC.
+    result = _get_map_descriptor_properties(map_handle, &type, &key_size, &value_size, &max_entries);
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+    assert(key_size != 0);
+    assert(value_size != 0);
+
+    entries_per_request = _map_batch_entries_per_request(
+        EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_reply_t, data), key_size + value_size);
+    if (entries_per_request == 0) {
+        result = EBPF_OPERATION_NOT_SUPPORTED;
+        goto Exit;
+    }
+
+    try {
+        ebpf_protocol_buffer_t request_buffer(
+            EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_request_t, previous_key) + key_size);
+        ebpf_protocol_buffer_t reply_buffer;
+        auto request = reinterpret_cast<ebpf_operation_map_lookup_batch_request_t*>(request_buffer.data());
+
+        // Each IOCTL returns at most 64KB, so a large batch is assembled from several requests, each one
+        // resuming after the last key returned by the previous one.
+        while (returned < requested) {
+            uint32_t chunk = (requested - returned < entries_per_request) ? requested - returned : entries_per_request;
+            reply_buffer.resize(
+                EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_reply_t, data) +
+                static_cast<size_t>(chunk) * (key_size + value_size));
+            auto reply = reinterpret_cast<ebpf_operation_map_lookup_batch_reply_t*>(reply_buffer.data());
+
+            request->header.id = operation_id;
+            request->handle = map_handle;
+            if (previous_key) {
+                request->header.length = static_cast<uint16_t>(request_buffer.size());
+                std::copy(previous_key, previous_key + key_size, request->previous_key);
+            } else {
+                request->header.length = EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_request_t, previous_key);
+            }
+            reply->header.length = static_cast<uint16_t>(reply_buffer.size());
+
+            result = win32_error_code_to_ebpf_result(invoke_ioctl(request_buffer, reply_buffer));
+            if (result != EBPF_SUCCESS) {
+                break;
+            }
+
+            if (reply->header.id != operation_id) {
+                result = EBPF_INVALID_ARGUMENT;
+                break;
+            }
+
+            size_t data_length = reply->header.length - EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_reply_t, data);
+            uint32_t entries = static_cast<uint32_t>(data_length / (key_size + value_size));
+            if (entries == 0 || entries > chunk) {
+                result = EBPF_FAILED;
+                break;
+            }
+
+            for (uint32_t index = 0; index < entries; index++) {
+                const uint8_t* key = reply->data + static_cast<size_t>(index) * (key_size + value_size);
+                std::copy(
+                    key, key + key_size, reinterpret_cast<uint8_t*>(keys) + (size_t)(returned + index) * key_size);
+                std::copy(
+                    key + key_size,
+                    key + key_size + value_size,
+                    reinterpret_cast<uint8_t*>(values) + (size_t)(returned + index) * value_size);
+            }
+            returned += entries;
+            previous_key = reinterpret_cast<const uint8_t*>(keys) + (size_t)(returned - 1) * key_size;
+        }
+    } catch (const std::bad_alloc&) {
+        result = EBPF_NO_MEMORY;
+    } catch (...) {
+        result = EBPF_FAILED;
+    }
+
+    // Entries that were returned are reported even if a later request failed or ran out of keys, so the
+    // caller can resume the enumeration from out_batch.
+    *count = returned;
+    if (returned != 0) {
+        std::copy(previous_key, previous_key + key_size, reinterpret_cast<uint8_t*>(out_batch));
+    }
+
+Exit:
+    return result;
+}
+
+ebpf_result_t
+ebpf_map_lookup_element_batch(
+    fd_t map_fd,
+    _In_opt_ const void* in_batch,
+    _Out_ void* out_batch,
+    _Out_ void* keys,
+    _Out_ void* values,
+    _Inout_ uint32_t* count)
+{
+    return _ebpf_map_lookup_element_batch_helper(map_fd, false, in_batch, out_batch, keys, values, count);
+}
+
+ebpf_result_t
+ebpf_map_lookup_and_delete_element_batch(
+    fd_t map_fd,
+    _In_opt_ const void* in_batch,
+    _Out_ void* out_batch,
+    _Out_ void* keys,
+    _Out_ void* values,
+    _Inout_ uint32_t* count)
+{
+    return _ebpf_map_lookup_element_batch_helper(map_fd, true, in_batch, out_batch, keys, values, count);
+}
+
+ebpf_result_t
+ebpf_map_update_element_batch(
+    fd_t map_fd, _In_ const void* keys, _In_ const void* values, _Inout_ uint32_t* count, uint64_t flags)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_handle_t map_handle;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    uint32_t max_entries = 0;
+    uint32_t type;
+    uint32_t requested;
+    uint32_t updated = 0;
+    uint32_t entries_per_request;
+
+    if (map_fd <= 0 || keys == nullptr || values == nullptr || count == nullptr) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+    requested = *count;
+    *count = 0;
+
+    switch (flags) {
+    case EBPF_ANY:
+    case EBPF_NOEXIST:
+    case EBPF_EXIST:
+        break;
+    default:
+        return EBPF_INVALID_ARGUMENT;
+    }
+
+    map_handle = _get_handle_from_file_descriptor(map_fd);
+    if (map_handle == ebpf_handle_invalid) {
+        return EBPF_INVALID_FD;
+    }
+
+    // Get map properties, either from local cache or from EC.
+    result = _get_map_descriptor_properties(map_handle, &type, &key_size, &value_size, &max_entries);
+    if (result != EBPF_SUCCESS) {
+        return result;
+    }
+    assert(key_size != 0);
+    assert(value_size != 0);
+    assert(type != 0);
+
+    // Values of these maps are file descriptors that must be resolved to handles one at a time.
+    if ((type == BPF_MAP_TYPE_PROG_ARRAY) || (type == BPF_MAP_TYPE_HASH_OF_MAPS) ||
+        (type == BPF_MAP_TYPE_ARRAY_OF_MAPS)) {
+        return EBPF_OPERATION_NOT_SUPPORTED;
+    }
+
+    entries_per_request = _map_batch_entries_per_request(
+        EBPF_OFFSET_OF(ebpf_operation_map_update_batch_request_t, data), key_size + value_size);
+    if (entries_per_request == 0) {
+        return EBPF_OPERATION_NOT_SUPPORTED;
+    }
+
+    try {
+        ebpf_protocol_buffer_t request_buffer;
+        while (updated < requested) {
+            uint32_t chunk = (requested - updated < entries_per_request) ? requested - updated : entries_per_request;
+            request_buffer.resize(
+                EBPF_OFFSET_OF(ebpf_operation_map_update_batch_request_t, data) +
+                static_cast<size_t>(chunk) * (key_size + value_size));
+            auto request = reinterpret_cast<ebpf_operation_map_update_batch_request_t*>(request_buffer.data());
+
+            request->header.length = static_cast<uint16_t>(request_buffer.size());
+            request->header.id = ebpf_operation_id_t::EBPF_OPERATION_MAP_UPDATE_BATCH;
+            request->handle = map_handle;
+            request->option = static_cast<ebpf_map_option_t>(flags);
+            for (uint32_t index = 0; index < chunk; index++) {
+                const uint8_t* key = reinterpret_cast<const uint8_t*>(keys) + (size_t)(updated + index) * key_size;
+                const uint8_t* value =
+                    reinterpret_cast<const uint8_t*>(values) + (size_t)(updated + index) * value_size;
+                uint8_t* entry = request->data + static_cast<size_t>(index) * (key_size + value_size);
+                std::copy(key, key + key_size, entry);
+                std::copy(value, value + value_size, entry + key_size);
+            }
+
+            ebpf_operation_map_batch_reply_t reply;
+            result = win32_error_code_to_ebpf_result(invoke_ioctl(request_buffer, reply));
+            if (result != EBPF_SUCCESS) {
+                break;
+            }
+            if (reply.header.id != ebpf_operation_id_t::EBPF_OPERATION_MAP_UPDATE_BATCH || reply.count > chunk) {
+                result = EBPF_FAILED;
+                break;
+            }
+
+            // Entries before the one that failed were updated, so they are counted even if the chunk failed.
+            updated += reply.count;
+            result = reply.result;
+            if (result != EBPF_SUCCESS) {
+                break;
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        result = EBPF_NO_MEMORY;
+    } catch (...) {
+        result = EBPF_FAILED;
+    }
+
+    *count = updated;
+    return result;
+}
+
+ebpf_result_t
+ebpf_map_delete_element_batch(fd_t map_fd, _In_ const void* keys, _Inout_ uint32_t* count)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_handle_t map_handle;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    uint32_t max_entries = 0;
+    uint32_t type;
+    uint32_t requested;
+    uint32_t deleted = 0;
+    uint32_t entries_per_request;
+
+    if (map_fd <= 0 || keys == nullptr || count == nullptr) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+    requested = *count;
+    *count = 0;
+
+    map_handle = _get_handle_from_file_descriptor(map_fd);
+    if (map_handle == ebpf_handle_invalid) {
+        return EBPF_INVALID_FD;
+    }
+
+    // Get map properties, either from local cache or from EC.
+    result = _get_map_descriptor_properties(map_handle, &type, &key_size, &value_size, &max_entries);
+    if (result != EBPF_SUCCESS) {
+        return result;
+    }
+    assert(key_size != 0);
+
+    entries_per_request =
+        _map_batch_entries_per_request(EBPF_OFFSET_OF(ebpf_operation_map_delete_batch_request_t, keys), key_size);
+    if (entries_per_request == 0) {
+        return EBPF_OPERATION_NOT_SUPPORTED;
+    }
+
+    try {
+        ebpf_protocol_buffer_t request_buffer;
+        while (deleted < requested) {
+            uint32_t chunk = (requested - deleted < entries_per_request) ? requested - deleted : entries_per_request;
+            request_buffer.resize(
+                EBPF_OFFSET_OF(ebpf_operation_map_delete_batch_request_t, keys) +
+                static_cast<size_t>(chunk) * key_size);
+            auto request = reinterpret_cast<ebpf_operation_map_delete_batch_request_t*>(request_buffer.data());
+
+            request->header.length = static_cast<uint16_t>(request_buffer.size());
+            request->header.id = ebpf_operation_id_t::EBPF_OPERATION_MAP_DELETE_BATCH;
+            request->handle = map_handle;
+            const uint8_t* first_key = reinterpret_cast<const uint8_t*>(keys) + (size_t)deleted * key_size;
+            std::copy(first_key, first_key + static_cast<size_t>(chunk) * key_size, request->keys);
+
+            ebpf_operation_map_batch_reply_t reply;
+            result = win32_error_code_to_ebpf_result(invoke_ioctl(request_buffer, reply));
+            if (result != EBPF_SUCCESS) {
+                if (result == EBPF_INVALID_OBJECT) {
+                    result = EBPF_INVALID_FD;
+                }
+                break;
+            }
+            if (reply.header.id != ebpf_operation_id_t::EBPF_OPERATION_MAP_DELETE_BATCH || reply.count > chunk) {
+                result = EBPF_FAILED;
+                break;
+            }
+
+            // Keys before the one that failed were deleted, so they are counted even if the chunk failed.
+            deleted += reply.count;
+            result = reply.result;
+            if (result != EBPF_SUCCESS) {
+                break;
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        result = EBPF_NO_MEMORY;
+    } catch (...) {
+        result = EBPF_FAILED;
+    }
+
+    *count = deleted;
+    return result;
+}
+
 static ebpf_result_t
 _create_program(
     ebpf_program_type_t program_type,
@@ -1384,6 +1728,7 @@ initialize_map(_Out_ ebpf_map_t* map, _In_ const map_cache_t& map_cache)
     map->map_definition.value_size = map_cache.verifier_map_descriptor.value_size;
     map->map_definition.max_entries = map_cache.verifier_map_descriptor.max_entries;
     map->map_definition.pinning = map_cache.pinning;
+    map->map_definition.map_flags = 0;
 
     // Set the inner map ID if we have a real inner map fd.
     map->map_definition.inner_map_id = EBPF_ID_NONE;
@@ -2331,18 +2676,180 @@ ebpf_program_bind_map(fd_t program_fd, fd_t map_fd)
     return win32_error_code_to_ebpf_result(invoke_ioctl(request));
 }
 
+ebpf_result_t
+ebpf_ring_buffer_map_set_wakeup_watermark(fd_t ring_buffer_map_fd, size_t wakeup_watermark)
+{
+    ebpf_handle_t map_handle = _get_handle_from_file_descriptor(ring_buffer_map_fd);
+    if (map_handle == ebpf_handle_invalid) {
+        return EBPF_INVALID_FD;
+    }
+
+    ebpf_operation_ring_buffer_map_set_wakeup_watermark_request_t request;
+    request.header.id = EBPF_OPERATION_RING_BUFFER_MAP_SET_WAKEUP_WATERMARK;
+    request.header.length = sizeof(request);
+    request.map_handle = map_handle;
+    request.wakeup_watermark = wakeup_watermark;
+
+    return win32_error_code_to_ebpf_result(invoke_ioctl(request));
+}
+
+static ebpf_result_t
+_ring_buffer_map_freeze(
+    ebpf_handle_t map_handle,
+    uint32_t ring_index,
+    bool freeze,
+    _Out_opt_ size_t* consumer_offset,
+    _Out_opt_ size_t* producer_offset)
+{
+    ebpf_operation_ring_buffer_map_freeze_request_t request{
+        sizeof(request), EBPF_OPERATION_RING_BUFFER_MAP_FREEZE, map_handle, ring_index, freeze ? 1u : 0u};
+    ebpf_operation_ring_buffer_map_freeze_reply_t reply{};
+
+    ebpf_result_t result = win32_error_code_to_ebpf_result(invoke_ioctl(request, reply));
+    if (result == EBPF_SUCCESS && consumer_offset != nullptr && producer_offset != nullptr) {
+        *consumer_offset = static_cast<size_t>(reply.consumer_offset);
+        *producer_offset = static_cast<size_t>(reply.producer_offset);
+    }
+    return result;
+}
+
+static ebpf_result_t
+_ring_buffer_map_read(ebpf_handle_t map_handle, uint32_t ring_index, size_t offset, _Inout_ std::vector<uint8_t>& data)
+{
+    // Replies are limited to 64KB, so large rings are read a piece at a time.
+    const size_t maximum_chunk_length = UINT16_MAX - EBPF_OFFSET_OF(ebpf_operation_ring_buffer_map_read_reply_t, data);
+    ebpf_operation_ring_buffer_map_read_request_t request{
+        sizeof(request), EBPF_OPERATION_RING_BUFFER_MAP_READ, map_handle, ring_index, 0};
+    ebpf_protocol_buffer_t reply_buffer;
+
+    for (size_t position = 0; position < data.size();) {
+        size_t chunk_length = data.size() - position;
+        if (chunk_length > maximum_chunk_length) {
+            chunk_length = maximum_chunk_length;
+        }
+        reply_buffer.resize(EBPF_OFFSET_OF(ebpf_operation_ring_buffer_map_read_reply_t, data) + chunk_length);
+        auto reply = reinterpret_cast<ebpf_operation_ring_buffer_map_read_reply_t*>(reply_buffer.data());
+        request.offset = offset + position;
+        ebpf_result_t result = win32_error_code_to_ebpf_result(invoke_ioctl(request, reply_buffer));
+        if (result != EBPF_SUCCESS) {
+            return result;
+        }
+        memcpy(data.data() + position, reply->data, chunk_length);
+        position += chunk_length;
+    }
+    return EBPF_SUCCESS;
+}
+
+ebpf_result_t
+ebpf_ring_buffer_map_snapshot(
+    fd_t ring_buffer_map_fd,
+    uint32_t ring_index,
+    _In_opt_ void* sample_callback_context,
+    ring_buffer_sample_fn sample_callback)
+{
+    EBPF_LOG_ENTRY();
+    if (sample_callback == nullptr) {
+        EBPF_RETURN_RESULT(EBPF_INVALID_ARGUMENT);
+    }
+    ebpf_handle_t map_handle = _get_handle_from_file_descriptor(ring_buffer_map_fd);
+    if (map_handle == ebpf_handle_invalid) {
+        EBPF_RETURN_RESULT(EBPF_INVALID_FD);
+    }
+
+    uint32_t type;
+    uint32_t dummy;
+    ebpf_result_t result = _get_map_descriptor_properties(map_handle, &type, &dummy, &dummy, &dummy);
+    if (result != EBPF_SUCCESS) {
+        EBPF_RETURN_RESULT(result);
+    }
+    bool timestamped = (type == BPF_MAP_TYPE_PERCPU_RINGBUF);
+
+    size_t consumer_offset;
+    size_t producer_offset;
+    result = _ring_buffer_map_freeze(map_handle, ring_index, true, &consumer_offset, &producer_offset);
+    if (result != EBPF_SUCCESS) {
+        EBPF_RETURN_RESULT(result);
+    }
+
+    std::vector<uint8_t> data;
+    try {
+        data.resize(producer_offset - consumer_offset);
+        result = _ring_buffer_map_read(map_handle, ring_index, consumer_offset, data);
+    } catch (const std::bad_alloc&) {
+        result = EBPF_NO_MEMORY;
+    }
+
+    // The copy is ours now, so let producers overwrite the ring again before running the callbacks.
+    ebpf_result_t thaw_result = _ring_buffer_map_freeze(map_handle, ring_index, false, nullptr, nullptr);
+    if (result == EBPF_SUCCESS) {
+        result = thaw_result;
+    }
+    if (result != EBPF_SUCCESS) {
+        EBPF_RETURN_RESULT(result);
+    }
+
+    size_t header_length = EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data);
+    if (timestamped) {
+        header_length += sizeof(ebpf_per_cpu_ring_buffer_record_header_t);
+    }
+    for (size_t position = 0; position < data.size();) {
+        auto record = reinterpret_cast<const ebpf_ring_buffer_record_t*>(data.data() + position);
+        size_t record_length = record->header.length;
+        if (record_length < header_length || record_length > data.size() - position) {
+            result = EBPF_FAILED;
+            break;
+        }
+        position += record_length;
+        if (record->header.locked || record->header.discarded) {
+            continue;
+        }
+        void* record_data = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(record)) + header_length;
+        if (sample_callback(sample_callback_context, record_data, record_length - header_length) != 0) {
+            break;
+        }
+    }
+
+    EBPF_RETURN_RESULT(result);
+}
+
+typedef struct _ebpf_ring_buffer_subscription ebpf_ring_buffer_subscription_t;
+
+// State of one ring of a subscribed ring buffer map. BPF_MAP_TYPE_RINGBUF maps have a single ring and
+// BPF_MAP_TYPE_PERCPU_RINGBUF maps have one per CPU, each with its own async query.
+typedef struct _ebpf_ring_buffer_subscription_ring
+{
+    _ebpf_ring_buffer_subscription_ring()
+        : subscription(nullptr), ring_index(0), buffer(nullptr), consumer_offset(nullptr), consumer(0), producer(0),
+          reply({}), async_ioctl_completion(nullptr)
+    {}
+    ~_ebpf_ring_buffer_subscription_ring()
+    {
+        if (async_ioctl_completion != nullptr)
+            clean_up_async_ioctl_completion(async_ioctl_completion);
+    }
+    ebpf_ring_buffer_subscription_t* subscription;
+    uint32_t ring_index;
+    uint8_t* buffer;
+    volatile size_t* consumer_offset;
+    // Offset of the next record to deliver and the producer offset reported by the last completed async query.
+    // Both are guarded by the subscription's callback_lock.
+    size_t consumer;
+    size_t producer;
+    ebpf_operation_ring_buffer_map_async_query_reply_t reply;
+    async_ioctl_completion_t* async_ioctl_completion;
+} ebpf_ring_buffer_subscription_ring_t;
+
 typedef struct _ebpf_ring_buffer_subscription
 {
     _ebpf_ring_buffer_subscription()
         : unsubscribed(false), ring_buffer_map_handle(ebpf_handle_invalid), sample_callback_context(nullptr),
-          sample_callback(nullptr), buffer(nullptr), reply({}), async_ioctl_completion(nullptr),
+          sample_callback(nullptr), flags(0), ring_buffer_size(0), timestamped(false), pending_ring_count(0),
           async_ioctl_failed(false)
     {}
     ~_ebpf_ring_buffer_subscription()
     {
         EBPF_LOG_ENTRY();
-        if (async_ioctl_completion != nullptr)
-            clean_up_async_ioctl_completion(async_ioctl_completion);
+        rings.clear();
         if (ring_buffer_map_handle != ebpf_handle_invalid)
             Platform::CloseHandle(ring_buffer_map_handle);
     }
@@ -2351,14 +2858,141 @@ typedef struct _ebpf_ring_buffer_subscription
     ebpf_handle_t ring_buffer_map_handle;
     void* sample_callback_context;
     ring_buffer_sample_fn sample_callback;
-    uint8_t* buffer;
-    ebpf_operation_ring_buffer_map_async_query_reply_t reply;
-    _Write_guarded_by_(lock) async_ioctl_completion_t* async_ioctl_completion;
+    uint32_t flags;
+    size_t ring_buffer_size;
+    // Records start with an ebpf_per_cpu_ring_buffer_record_header_t.
+    bool timestamped;
+    // Serializes calls to the sample callback, which the completion of any ring's async query can trigger.
+    std::mutex callback_lock;
+    std::vector<std::unique_ptr<ebpf_ring_buffer_subscription_ring_t>> rings;
+    // Number of rings with an async query outstanding. The last one to complete after unsubscribing frees the
+    // subscription.
+    _Write_guarded_by_(lock) uint32_t pending_ring_count;
     _Write_guarded_by_(lock) bool async_ioctl_failed;
 } ebpf_ring_buffer_subscription_t;
 
 typedef std::unique_ptr<ebpf_ring_buffer_subscription_t> ebpf_ring_buffer_subscription_ptr;
 
+/**
+ * @brief Find the next record to deliver from a ring, returning discarded records to the ring on the way. The
+ * returned record may still be locked by its producer, in which case it must not be read yet.
+ */
+static _Requires_lock_held_(subscription->callback_lock) _Must_inspect_result_ const ebpf_ring_buffer_record_t*
+    _ebpf_ring_buffer_subscription_next_record(
+        _In_ const ebpf_ring_buffer_subscription_t* subscription, _Inout_ ebpf_ring_buffer_subscription_ring_t* ring)
+{
+    for (;;) {
+        auto record =
+            ebpf_ring_buffer_next_record(ring->buffer, subscription->ring_buffer_size, ring->consumer, ring->producer);
+        if (record == nullptr || record->header.locked || !record->header.discarded)
+            return record;
+        ring->consumer += record->header.length;
+        *ring->consumer_offset = ring->consumer;
+    }
+}
+
+/**
+ * @brief Pass a record to the sample callback and, if the callback accepts it, return it to the ring.
+ *
+ * @returns The result of the sample callback.
+ */
+static _Requires_lock_held_(subscription->callback_lock) int _ebpf_ring_buffer_subscription_deliver_record(
+    _Inout_ ebpf_ring_buffer_subscription_t* subscription,
+    _Inout_ ebpf_ring_buffer_subscription_ring_t* ring,
+    _In_ const ebpf_ring_buffer_record_t* record)
+{
+    const uint8_t* data = record->data;
+    size_t size = record->header.length - EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data);
+    if (subscription->timestamped) {
+        data += sizeof(ebpf_per_cpu_ring_buffer_record_header_t);
+        size -= sizeof(ebpf_per_cpu_ring_buffer_record_header_t);
+    }
+
+    int callback_result = subscription->sample_callback(
+        subscription->sample_callback_context, const_cast<void*>(reinterpret_cast<const void*>(data)), size);
+    if (callback_result == 0) {
+        ring->consumer += record->header.length;
+        // Return the record right away, so producers can reuse the space while later records are handled.
+        *ring->consumer_offset = ring->consumer;
+    }
+    return callback_result;
+}
+
+/**
+ * @brief Deliver the records available after an async query on the ring completed. With
+ * EBPF_RING_BUFFER_SUBSCRIBE_FLAG_ORDERED, the records of all the rings are delivered in timestamp order instead,
+ * as far as each ring's last completed async query has reported them.
+ */
+static _Requires_lock_held_(subscription->callback_lock) void _ebpf_ring_buffer_subscription_deliver(
+    _Inout_ ebpf_ring_buffer_subscription_t* subscription, _Inout_ ebpf_ring_buffer_subscription_ring_t* ring)
+{
+    if (!(subscription->flags & EBPF_RING_BUFFER_SUBSCRIBE_FLAG_ORDERED)) {
+        for (;;) {
+            auto record = _ebpf_ring_buffer_subscription_next_record(subscription, ring);
+            if (record == nullptr)
+                // No more records.
+                break;
+            if (record->header.locked)
+                // The producer may still be writing it; it is delivered once it is submitted.
+                break;
+            if (_ebpf_ring_buffer_subscription_deliver_record(subscription, ring, record) != 0)
+                break;
+        }
+        return;
+    }
+
+    for (;;) {
+        ebpf_ring_buffer_subscription_ring_t* oldest_ring = nullptr;
+        const ebpf_ring_buffer_record_t* oldest_record = nullptr;
+        uint64_t oldest_timestamp = 0;
+        for (auto& candidate_ring : subscription->rings) {
+            auto record = _ebpf_ring_buffer_subscription_next_record(subscription, candidate_ring.get());
+            if (record == nullptr)
+                continue;
+            if (record->header.locked) {
+                // Its timestamp isn't written yet, so no record can be known to be the oldest until it is submitted.
+                oldest_record = nullptr;
+                break;
+            }
+            uint64_t timestamp =
+                reinterpret_cast<const ebpf_per_cpu_ring_buffer_record_header_t*>(record->data)->timestamp;
+            if (oldest_record == nullptr || timestamp < oldest_timestamp) {
+                oldest_ring = candidate_ring.get();
+                oldest_record = record;
+                oldest_timestamp = timestamp;
+            }
+        }
+        if (oldest_record == nullptr)
+            // No more records.
+            break;
+        if (_ebpf_ring_buffer_subscription_deliver_record(subscription, oldest_ring, oldest_record) != 0)
+            break;
+    }
+}
+
+/**
+ * @brief Post the next async query for a ring. The consumer offset passed to the query must not fall behind the
+ * offset stored in the consumer page, so the callback lock is held until the query has been issued.
+ */
+static _Requires_lock_held_(subscription->lock) ebpf_result_t
+    _ebpf_ring_buffer_subscription_post_async_query(
+        _Inout_ ebpf_ring_buffer_subscription_t* subscription, _Inout_ ebpf_ring_buffer_subscription_ring_t* ring)
+{
+    std::scoped_lock callback_lock{subscription->callback_lock};
+    ebpf_operation_ring_buffer_map_async_query_request_t async_query_request{
+        sizeof(async_query_request),
+        EBPF_OPERATION_RING_BUFFER_MAP_ASYNC_QUERY,
+        subscription->ring_buffer_map_handle,
+        ring->consumer,
+        ring->ring_index};
+    memset(&ring->reply, 0, sizeof(ebpf_operation_ring_buffer_map_async_query_reply_t));
+    ebpf_result_t result = win32_error_code_to_ebpf_result(invoke_ioctl(
+        async_query_request, ring->reply, get_async_ioctl_operation_overlapped(ring->async_ioctl_completion)));
+    if (result == EBPF_PENDING)
+        result = EBPF_SUCCESS;
+    return result;
+}
+
 static ebpf_result_t
 _ebpf_ring_buffer_map_async_query_completion(_Inout_opt_ void* completion_context)
 {
@@ -2366,101 +3000,63 @@ _ebpf_ring_buffer_map_async_query_completion(_Inout_opt_ void* completion_contex
     if (completion_context == nullptr)
         return EBPF_INVALID_ARGUMENT;
 
-    ebpf_ring_buffer_subscription_t* subscription =
-        reinterpret_cast<ebpf_ring_buffer_subscription_t*>(completion_context);
-
-    size_t consumer = 0;
-    size_t producer = 0;
+    ebpf_ring_buffer_subscription_ring_t* ring =
+        reinterpret_cast<ebpf_ring_buffer_subscription_ring_t*>(completion_context);
+    ebpf_ring_buffer_subscription_t* subscription = ring->subscription;
 
     ebpf_result_t result = EBPF_SUCCESS;
     // Check the result of the completed async IOCTL call.
-    result = get_async_ioctl_result(subscription->async_ioctl_completion);
+    result = get_async_ioctl_result(ring->async_ioctl_completion);
 
-    if (result != EBPF_SUCCESS) {
-        if (result != EBPF_CANCELED) {
-            // The async IOCTL was not canceled, but completed with a failure status. Mark the subscription object as
-            // such, so that it gets freed when the user eventually unsubscribes.
-            std::scoped_lock lock{subscription->lock};
-            subscription->async_ioctl_failed = true;
-            EBPF_RETURN_RESULT(result);
-        } else {
-            // User has canceled subscription. Invoke user specified callback for the final time with NULL record. This
-            // will let the user app clean up its state.
-            subscription->sample_callback(subscription->sample_callback_context, nullptr, 0);
-        }
-    } else {
-        // Async IOCTL operation returned with success status. Read the ring buffer records and indicate it to the
+    if (result == EBPF_SUCCESS) {
+        // Async IOCTL operation returned with success status. Read the ring buffer records and indicate them to the
         // subscriber.
-
-        size_t ring_buffer_size;
-        uint32_t dummy;
-
-        result = _get_map_descriptor_properties(
-            subscription->ring_buffer_map_handle,
-            &dummy,
-            &dummy,
-            &dummy,
-            reinterpret_cast<uint32_t*>(&ring_buffer_size));
-        if (result != EBPF_SUCCESS)
-            EBPF_RETURN_RESULT(result);
-
-        ebpf_operation_ring_buffer_map_async_query_reply_t* reply = &subscription->reply;
-        ebpf_ring_buffer_map_async_query_result_t* async_query_result = &reply->async_query_result;
-        consumer = async_query_result->consumer;
-        producer = async_query_result->producer;
-        for (;;) {
-            auto record = ebpf_ring_buffer_next_record(subscription->buffer, ring_buffer_size, consumer, producer);
-
-            if (record == nullptr)
-                // No more records.
-                break;
-
-            int callback_result = subscription->sample_callback(
-                subscription->sample_callback_context,
-                const_cast<void*>(reinterpret_cast<const void*>(record->data)),
-                record->header.length - EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
-            if (callback_result != 0)
-                break;
-
-            consumer += record->header.length;
-        }
+        std::scoped_lock callback_lock{subscription->callback_lock};
+        ebpf_ring_buffer_map_async_query_result_t* async_query_result = &ring->reply.async_query_result;
+        ring->producer = async_query_result->producer;
+        if (ring->consumer < async_query_result->consumer)
+            ring->consumer = async_query_result->consumer;
+        _ebpf_ring_buffer_subscription_deliver(subscription, ring);
     }
 
     bool free_subscription = false;
     {
         std::scoped_lock lock{subscription->lock};
 
-        if (subscription->unsubscribed) {
-            //  If the user has unsubscribed, this is the final callback. Mark the
-            //  subscription context for deletion.
-            result = EBPF_CANCELED;
-            free_subscription = true;
+        if (result != EBPF_SUCCESS && result != EBPF_CANCELED) {
+            // The async IOCTL was not canceled, but completed with a failure status. Mark the subscription object as
+            // such, so that it gets freed when the user eventually unsubscribes.
+            subscription->async_ioctl_failed = true;
+        }
+
+        if (subscription->unsubscribed || result != EBPF_SUCCESS) {
+            // No further async query is posted for this ring. If the user has unsubscribed and this was the last
+            // ring with a query outstanding, this is the final callback, so mark the subscription for deletion.
+            subscription->pending_ring_count--;
+            free_subscription = subscription->unsubscribed && (subscription->pending_ring_count == 0);
+            if (result == EBPF_SUCCESS)
+                result = EBPF_CANCELED;
         } else {
             // If still subscribed, post the next async IOCTL call while holding the lock. It is safe to do so as the
             // async call is not blocking.
 
             // First, register wait for the new async IOCTL operation completion.
-            result = register_wait_async_ioctl_operation(subscription->async_ioctl_completion);
-            if (result != EBPF_SUCCESS)
-                EBPF_RETURN_RESULT(result);
-
-            // Then, post the async IOCTL.
-            ebpf_operation_ring_buffer_map_async_query_request_t async_query_request{
-                sizeof(async_query_request),
-                EBPF_OPERATION_RING_BUFFER_MAP_ASYNC_QUERY,
-                subscription->ring_buffer_map_handle,
-                consumer};
-            memset(&subscription->reply, 0, sizeof(ebpf_operation_ring_buffer_map_async_query_reply_t));
-            result = win32_error_code_to_ebpf_result(invoke_ioctl(
-                async_query_request,
-                subscription->reply,
-                get_async_ioctl_operation_overlapped(subscription->async_ioctl_completion)));
-            if (result == EBPF_PENDING)
-                result = EBPF_SUCCESS;
+            result = register_wait_async_ioctl_operation(ring->async_ioctl_completion);
+            if (result == EBPF_SUCCESS)
+                // Then, post the async IOCTL.
+                result = _ebpf_ring_buffer_subscription_post_async_query(subscription, ring);
+            if (result != EBPF_SUCCESS) {
+                subscription->async_ioctl_failed = true;
+                subscription->pending_ring_count--;
+            }
         }
     }
-    if (free_subscription)
+    if (free_subscription) {
+        // Invoke user specified callback for the final time with NULL record. This will let the user app clean up
+        // its state.
+        subscription->sample_callback(subscription->sample_callback_context, nullptr, 0);
         delete subscription;
+    }
 
     EBPF_RETURN_RESULT(result);
 }
@@ -2470,6 +3066,7 @@ ebpf_ring_buffer_map_subscribe(
     fd_t ring_buffer_map_fd,
     _In_opt_ void* sample_callback_context,
     ring_buffer_sample_fn sample_callback,
+    uint32_t flags,
     _Outptr_ ring_buffer_subscription_t** subscription)
 {
     EBPF_LOG_ENTRY();
@@ -2478,6 +3075,10 @@ ebpf_ring_buffer_map_subscribe(
 
     *subscription = nullptr;
 
+    if (flags & ~EBPF_RING_BUFFER_SUBSCRIBE_FLAG_ORDERED) {
+        EBPF_RETURN_RESULT(EBPF_INVALID_ARGUMENT);
+    }
+
     ebpf_ring_buffer_subscription_ptr local_subscription = std::make_unique<ebpf_ring_buffer_subscription_t>();
 
     local_subscription->ring_buffer_map_handle = ebpf_handle_invalid;
@@ -2503,41 +3104,77 @@ ebpf_ring_buffer_map_subscribe(
         return result;
     }
 
-    // Get user-mode address to ring buffer shared data.
-    ebpf_operation_ring_buffer_map_query_buffer_request_t query_buffer_request{
-        sizeof(query_buffer_request),
-        EBPF_OPERATION_RING_BUFFER_MAP_QUERY_BUFFER,
-        local_subscription->ring_buffer_map_handle};
-    ebpf_operation_ring_buffer_map_query_buffer_reply_t query_buffer_reply{};
-    result = win32_error_code_to_ebpf_result(invoke_ioctl(query_buffer_request, query_buffer_reply));
+    // Every ring of the map is max_entries bytes long.
+    uint32_t type;
+    uint32_t dummy;
+    uint32_t ring_buffer_size;
+    result = _get_map_descriptor_properties(
+        local_subscription->ring_buffer_map_handle, &type, &dummy, &dummy, &ring_buffer_size);
     if (result != EBPF_SUCCESS)
         EBPF_RETURN_RESULT(result);
-    local_subscription->buffer = reinterpret_cast<uint8_t*>(static_cast<uintptr_t>(query_buffer_reply.buffer_address));
+    local_subscription->ring_buffer_size = ring_buffer_size;
+    local_subscription->timestamped = (type == BPF_MAP_TYPE_PERCPU_RINGBUF);
+    if ((flags & EBPF_RING_BUFFER_SUBSCRIBE_FLAG_ORDERED) && !local_subscription->timestamped) {
+        EBPF_RETURN_RESULT(EBPF_INVALID_ARGUMENT);
+    }
 
-    // Initialize the async IOCTL operation.
     local_subscription->sample_callback_context = sample_callback_context;
     local_subscription->sample_callback = sample_callback;
-    memset(&local_subscription->reply, 0, sizeof(ebpf_operation_ring_buffer_map_async_query_reply_t));
-    result = initialize_async_ioctl_operation(
-        local_subscription.get(),
-        _ebpf_ring_buffer_map_async_query_completion,
-        &local_subscription->async_ioctl_completion);
-    if (result != EBPF_SUCCESS)
-        EBPF_RETURN_RESULT(result);
+    local_subscription->flags = flags;
+
+    // Get user-mode addresses to the shared data of each ring. The first query also reports the number of rings.
+    uint32_t ring_count = 1;
+    for (uint32_t ring_index = 0; ring_index < ring_count; ring_index++) {
+        ebpf_operation_ring_buffer_map_query_buffer_request_t query_buffer_request{
+            sizeof(query_buffer_request),
+            EBPF_OPERATION_RING_BUFFER_MAP_QUERY_BUFFER,
+            local_subscription->ring_buffer_map_handle,
+            ring_index};
+        ebpf_operation_ring_buffer_map_query_buffer_reply_t query_buffer_reply{};
+        result = win32_error_code_to_ebpf_result(invoke_ioctl(query_buffer_request, query_buffer_reply));
+        if (result != EBPF_SUCCESS)
+            EBPF_RETURN_RESULT(result);
+        ring_count = query_buffer_reply.ring_count;
+
+        auto ring = std::make_unique<ebpf_ring_buffer_subscription_ring_t>();
+        ring->subscription = local_subscription.get();
+        ring->ring_index = ring_index;
+        ring->buffer = reinterpret_cast<uint8_t*>(static_cast<uintptr_t>(query_buffer_reply.buffer_address));
+        ring->consumer_offset =
+            reinterpret_cast<volatile size_t*>(static_cast<uintptr_t>(query_buffer_reply.consumer_offset_address));
+        // Resume after the records returned by earlier subscribers.
+        ring->consumer = *ring->consumer_offset;
+
+        // Initialize the async IOCTL operation.
+        result = initialize_async_ioctl_operation(
+            ring.get(), _ebpf_ring_buffer_map_async_query_completion, &ring->async_ioctl_completion);
+        if (result != EBPF_SUCCESS)
+            EBPF_RETURN_RESULT(result);
+        local_subscription->rings.push_back(std::move(ring));
+    }
 
-    // Issue the async query IOCTL.
-    ebpf_operation_ring_buffer_map_async_query_request_t async_query_request{
-        sizeof(async_query_request),
-        EBPF_OPERATION_RING_BUFFER_MAP_ASYNC_QUERY,
-        local_subscription->ring_buffer_map_handle};
-    result = win32_error_code_to_ebpf_result(invoke_ioctl(
-        async_query_request,
-        local_subscription->reply,
-        get_async_ioctl_operation_overlapped(local_subscription->async_ioctl_completion)));
-    if (result == EBPF_PENDING)
-        result = EBPF_SUCCESS;
+    // Issue the async query IOCTL on every ring. Completions wait for the lock, so they only run once all the
+    // queries have been issued.
+    ebpf_ring_buffer_subscription_t* new_subscription = local_subscription.release();
+    {
+        std::scoped_lock lock{new_subscription->lock};
+        for (auto& ring : new_subscription->rings) {
+            result = _ebpf_ring_buffer_subscription_post_async_query(new_subscription, ring.get());
+            if (result != EBPF_SUCCESS) {
+                new_subscription->async_ioctl_failed = true;
+                break;
+            }
+            new_subscription->pending_ring_count++;
+        }
+    }
 
-    *subscription = local_subscription.release();
+    if (result != EBPF_SUCCESS) {
+        // Cancel the queries already issued. The subscription is freed once they have completed.
+        (void)ebpf_ring_buffer_map_unsubscribe(new_subscription);
+        EBPF_RETURN_RESULT(result);
+    }
+
+    *subscription = new_subscription;
 
     EBPF_RETURN_RESULT(result);
 }
@@ -2553,18 +3190,20 @@ ebpf_ring_buffer_map_unsubscribe(_Inout_ _Post_invalid_ ring_buffer_subscription
         // Set the unsubscribed flag, so that if a completion callback is ongoing, it does not issue another async
         // IOCTL.
         subscription->unsubscribed = true;
-        // Check if an earlier async opeeration has failed. In that case a new async operation will not be queued. This
-        // is the only case in which the subscription object can be freed in this function.
-        if (subscription->async_ioctl_failed)
+        // Check if every ring has stopped posting async operations, for example because they failed. In that case no
+        // completion callback is left to free the subscription object, so it is freed in this function.
+        if (subscription->pending_ring_count == 0)
             free_subscription = true;
         else {
-            // Attempt to cancel an ongoing async IOCTL.
-            cancel_result =
-                cancel_async_ioctl(get_async_ioctl_operation_overlapped(subscription->async_ioctl_completion));
-            // If the async operation could be canceled, a final completion callback would be invoked with EBPF_CANCELED
-            // status. If the async operation could not be canceled, that would mean a callback is ongoing which would
+            // Attempt to cancel the ongoing async IOCTLs. Canceling one that already completed fails harmlessly.
+            for (auto& ring : subscription->rings) {
+                if (!cancel_async_ioctl(get_async_ioctl_operation_overlapped(ring->async_ioctl_completion)))
+                    cancel_result = false;
+            }
+            // If an async operation could be canceled, a final completion callback would be invoked with
+            // EBPF_CANCELED status. If it could not be canceled, that would mean a callback is ongoing which would
             // eventually find out the subscription is canceled and will not post another async operation. In either
-            // case the final callback would free the subscription object.
+            // case the last of these callbacks would free the subscription object.
         }
     }
 
@@ -2573,3 +3212,308 @@ ebpf_ring_buffer_map_unsubscribe(_Inout_ _Post_invalid_ ring_buffer_subscription
 
     EBPF_RETURN_BOOL(cancel_result);
 }
+
+// One ring of a map added to a poller. Its async query completes into the poller's shared event.
+typedef struct _ebpf_ring_buffer_poller_ring
+{
+    _ebpf_ring_buffer_poller_ring()
+        : map_handle(ebpf_handle_invalid), ring_index(0), ring_buffer_size(0), timestamped(false),
+          sample_callback_context(nullptr), sample_callback(nullptr), buffer(nullptr), consumer_page(nullptr),
+          consumer(0), query_posted(false), overlapped({}), reply({})
+    {}
+    ebpf_handle_t map_handle; // Shared by the rings of a map and owned by the poller.
+    uint32_t ring_index;
+    size_t ring_buffer_size;
+    bool timestamped;
+    void* sample_callback_context;
+    ring_buffer_sample_fn sample_callback;
+    uint8_t* buffer;
+    // Producers copy their offset here, so the ring can be read without waiting for the query.
+    ebpf_ring_buffer_consumer_page_t* consumer_page;
+    size_t consumer;
+    bool query_posted;
+    OVERLAPPED overlapped;
+    ebpf_operation_ring_buffer_map_async_query_reply_t reply;
+} ebpf_ring_buffer_poller_ring_t;
+
+/**
+ * @brief Cancel the ring's async query, if one is outstanding, and wait for it to complete.
+ */
+static void
+_ebpf_ring_buffer_poller_cancel_ring(HANDLE event, _Inout_ ebpf_ring_buffer_poller_ring_t* ring)
+{
+    if (!ring->query_posted)
+        return;
+    (void)cancel_async_ioctl(&ring->overlapped);
+    // The event is shared with the other rings, so it may be set without this query having completed.
+    while (!HasOverlappedIoCompleted(&ring->overlapped)) {
+        ResetEvent(event);
+        if (!HasOverlappedIoCompleted(&ring->overlapped))
+            WaitForSingleObject(event, INFINITE);
+    }
+    ring->query_posted = false;
+}
+
+typedef struct _ebpf_ring_buffer_poller
+{
+    _ebpf_ring_buffer_poller() : event(nullptr) {}
+    ~_ebpf_ring_buffer_poller()
+    {
+        // Every query must have completed before the OVERLAPPED structures and replies they write to go away.
+        for (auto& ring : rings)
+            _ebpf_ring_buffer_poller_cancel_ring(event, ring.get());
+        rings.clear();
+        for (auto map_handle : map_handles)
+            Platform::CloseHandle(map_handle);
+        if (event != nullptr)
+            ::CloseHandle(event);
+    }
+    // Manual-reset event signaled by the completion of any ring's async query.
+    HANDLE event;
+    std::vector<ebpf_handle_t> map_handles;
+    std::vector<std::unique_ptr<ebpf_ring_buffer_poller_ring_t>> rings;
+} ebpf_ring_buffer_poller_t;
+
+static ebpf_result_t
+_ebpf_ring_buffer_poller_post_async_query(
+    _In_ const ebpf_ring_buffer_poller_t* poller, _Inout_ ebpf_ring_buffer_poller_ring_t* ring)
+{
+    ebpf_operation_ring_buffer_map_async_query_request_t async_query_request{
+        sizeof(async_query_request),
+        EBPF_OPERATION_RING_BUFFER_MAP_ASYNC_QUERY,
+        ring->map_handle,
+        ring->consumer,
+        ring->ring_index};
+    memset(&ring->reply, 0, sizeof(ring->reply));
+    memset(&ring->overlapped, 0, sizeof(ring->overlapped));
+    ring->overlapped.hEvent = poller->event;
+    // The event is shared, so completion is detected through the status instead.
+    ring->overlapped.Internal = STATUS_PENDING;
+    ebpf_result_t result =
+        win32_error_code_to_ebpf_result(invoke_ioctl(async_query_request, ring->reply, &ring->overlapped));
+    if (result == EBPF_PENDING || result == EBPF_SUCCESS) {
+        ring->query_posted = true;
+        result = EBPF_SUCCESS;
+    }
+    return result;
+}
+
+/**
+ * @brief Deliver the records a ring holds, whether or not its async query has completed. The query is only a
+ * wakeup, and it isn't signaled until the ring reaches its wakeup watermark. If the query has completed, post the
+ * next one.
+ */
+static ebpf_result_t
+_ebpf_ring_buffer_poller_consume_ring(
+    _In_ const ebpf_ring_buffer_poller_t* poller,
+    _Inout_ ebpf_ring_buffer_poller_ring_t* ring,
+    _Inout_ uint32_t* record_count,
+    _Inout_ int* callback_result)
+{
+    if (ring->query_posted && HasOverlappedIoCompleted(&ring->overlapped)) {
+        DWORD dummy;
+        ring->query_posted = false;
+        if (!GetOverlappedResult(reinterpret_cast<HANDLE>(get_device_handle()), &ring->overlapped, &dummy, FALSE))
+            return win32_error_code_to_ebpf_result(GetLastError());
+        // The consumer offset moves past records that were overwritten.
+        if (ring->consumer < ring->reply.async_query_result.consumer)
+            ring->consumer = ring->reply.async_query_result.consumer;
+    }
+
+    size_t producer = ring->consumer_page->producer_offset;
+    // Order reading the producer offset before reading the headers of the records it covers.
+    MemoryBarrier();
+
+    size_t header_length = EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data);
+    if (ring->timestamped)
+        header_length += sizeof(ebpf_per_cpu_ring_buffer_record_header_t);
+
+    for (;;) {
+        auto record = ebpf_ring_buffer_next_record(ring->buffer, ring->ring_buffer_size, ring->consumer, producer);
+        if (record == nullptr)
+            break;
+        // The producer may still be writing it; the next query completes once it is submitted.
+        if (record->header.locked)
+            break;
+        if (!record->header.discarded) {
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(record) + header_length;
+            int result = ring->sample_callback(
+                ring->sample_callback_context,
+                const_cast<uint8_t*>(data),
+                record->header.length - header_length);
+            if (result != 0) {
+                *callback_result = result;
+                break;
+            }
+            (*record_count)++;
+        }
+        ring->consumer += record->header.length;
+    }
+    ring->consumer_page->consumer_offset = ring->consumer;
+
+    if (ring->query_posted)
+        return EBPF_SUCCESS;
+    return _ebpf_ring_buffer_poller_post_async_query(poller, ring);
+}
+
+ebpf_result_t
+ebpf_ring_buffer_poller_create(_Outptr_ ring_buffer_poller_t** poller)
+{
+    EBPF_LOG_ENTRY();
+    *poller = nullptr;
+    try {
+        std::unique_ptr<ebpf_ring_buffer_poller_t> local_poller = std::make_unique<ebpf_ring_buffer_poller_t>();
+        local_poller->event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (local_poller->event == nullptr) {
+            ebpf_result_t result = win32_error_code_to_ebpf_result(GetLastError());
+            EBPF_LOG_WIN32_API_FAILURE(EBPF_TRACELOG_KEYWORD_API, CreateEvent);
+            EBPF_RETURN_RESULT(result);
+        }
+        *poller = local_poller.release();
+    } catch (const std::bad_alloc&) {
+        EBPF_RETURN_RESULT(EBPF_NO_MEMORY);
+    }
+    EBPF_RETURN_RESULT(EBPF_SUCCESS);
+}
+
+ebpf_result_t
+ebpf_ring_buffer_poller_add(
+    _Inout_ ring_buffer_poller_t* poller,
+    fd_t ring_buffer_map_fd,
+    _In_opt_ void* sample_callback_context,
+    ring_buffer_sample_fn sample_callback)
+{
+    EBPF_LOG_ENTRY();
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_handle_t map_handle = ebpf_handle_invalid;
+    size_t first_new_ring = poller->rings.size();
+
+    if (sample_callback == nullptr)
+        EBPF_RETURN_RESULT(EBPF_INVALID_ARGUMENT);
+
+    ebpf_handle_t ring_buffer_map_handle = _get_handle_from_file_descriptor(ring_buffer_map_fd);
+    if (ring_buffer_map_handle == ebpf_handle_invalid)
+        EBPF_RETURN_RESULT(EBPF_INVALID_FD);
+
+    if (!Platform::DuplicateHandle(
+            reinterpret_cast<ebpf_handle_t>(GetCurrentProcess()),
+            ring_buffer_map_handle,
+            reinterpret_cast<ebpf_handle_t>(GetCurrentProcess()),
+            &map_handle,
+            0,
+            FALSE,
+            DUPLICATE_SAME_ACCESS)) {
+        result = win32_error_code_to_ebpf_result(GetLastError());
+        _Analysis_assume_(result != EBPF_SUCCESS);
+        EBPF_LOG_WIN32_API_FAILURE(EBPF_TRACELOG_KEYWORD_API, DuplicateHandle);
+        EBPF_RETURN_RESULT(result);
+    }
+
+    try {
+        poller->map_handles.push_back(map_handle);
+    } catch (const std::bad_alloc&) {
+        Platform::CloseHandle(map_handle);
+        EBPF_RETURN_RESULT(EBPF_NO_MEMORY);
+    }
+
+    uint32_t type;
+    uint32_t dummy;
+    uint32_t ring_buffer_size;
+    result = _get_map_descriptor_properties(map_handle, &type, &dummy, &dummy, &ring_buffer_size);
+    if (result != EBPF_SUCCESS)
+        goto Exit;
+
+    try {
+        // The first query also reports the number of rings.
+        uint32_t ring_count = 1;
+        for (uint32_t ring_index = 0; ring_index < ring_count; ring_index++) {
+            ebpf_operation_ring_buffer_map_query_buffer_request_t query_buffer_request{
+                sizeof(query_buffer_request), EBPF_OPERATION_RING_BUFFER_MAP_QUERY_BUFFER, map_handle, ring_index};
+            ebpf_operation_ring_buffer_map_query_buffer_reply_t query_buffer_reply{};
+            result = win32_error_code_to_ebpf_result(invoke_ioctl(query_buffer_request, query_buffer_reply));
+            if (result != EBPF_SUCCESS)
+                goto Exit;
+            ring_count = query_buffer_reply.ring_count;
+
+            auto ring = std::make_unique<ebpf_ring_buffer_poller_ring_t>();
+            ring->map_handle = map_handle;
+            ring->ring_index = ring_index;
+            ring->ring_buffer_size = ring_buffer_size;
+            ring->timestamped = (type == BPF_MAP_TYPE_PERCPU_RINGBUF);
+            ring->sample_callback_context = sample_callback_context;
+            ring->sample_callback = sample_callback;
+            ring->buffer = reinterpret_cast<uint8_t*>(static_cast<uintptr_t>(query_buffer_reply.buffer_address));
+            ring->consumer_page = reinterpret_cast<ebpf_ring_buffer_consumer_page_t*>(
+                static_cast<uintptr_t>(query_buffer_reply.consumer_offset_address));
+            ring->consumer = ring->consumer_page->consumer_offset;
+            poller->rings.push_back(std::move(ring));
+
+            result = _ebpf_ring_buffer_poller_post_async_query(poller, poller->rings.back().get());
+            if (result != EBPF_SUCCESS)
+                goto Exit;
+        }
+    } catch (const std::bad_alloc&) {
+        result = EBPF_NO_MEMORY;
+    }
+
+Exit:
+    if (result != EBPF_SUCCESS) {
+        // Take back the rings already added for this map. Their queries must finish before they can be freed.
+        for (size_t i = first_new_ring; i < poller->rings.size(); i++)
+            _ebpf_ring_buffer_poller_cancel_ring(poller->event, poller->rings[i].get());
+        poller->rings.resize(first_new_ring);
+        poller->map_handles.pop_back();
+        Platform::CloseHandle(map_handle);
+    }
+    EBPF_RETURN_RESULT(result);
+}
+
+ebpf_result_t
+ebpf_ring_buffer_poller_consume(
+    _Inout_ ring_buffer_poller_t* poller, _Out_ uint32_t* record_count, _Out_ int* callback_result)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    *record_count = 0;
+    *callback_result = 0;
+    for (auto& ring : poller->rings) {
+        result = _ebpf_ring_buffer_poller_consume_ring(poller, ring.get(), record_count, callback_result);
+        if (result != EBPF_SUCCESS || *callback_result != 0)
+            break;
+    }
+    return result;
+}
+
+ebpf_result_t
+ebpf_ring_buffer_poller_poll(
+    _Inout_ ring_buffer_poller_t* poller, int timeout_ms, _Out_ uint32_t* record_count, _Out_ int* callback_result)
+{
+    uint64_t deadline = GetTickCount64() + ((timeout_ms > 0) ? timeout_ms : 0);
+    for (;;) {
+        // Reset the event before looking at the rings, so a query that completes afterwards sets it again.
+        ResetEvent(poller->event);
+        ebpf_result_t result = ebpf_ring_buffer_poller_consume(poller, record_count, callback_result);
+        if (result != EBPF_SUCCESS || *record_count != 0 || *callback_result != 0)
+            return result;
+
+        DWORD wait_ms = INFINITE;
+        if (timeout_ms >= 0) {
+            uint64_t now = GetTickCount64();
+            if (now >= deadline)
+                return EBPF_SUCCESS;
+            wait_ms = static_cast<DWORD>(deadline - now);
+        }
+        DWORD wait_result = WaitForSingleObject(poller->event, wait_ms);
+        if (wait_result == WAIT_TIMEOUT)
+            return EBPF_SUCCESS;
+        if (wait_result != WAIT_OBJECT_0)
+            return EBPF_FAILED;
+    }
+}
+
+void
+ebpf_ring_buffer_poller_free(_In_opt_ _Post_invalid_ ring_buffer_poller_t* poller)
+{
+    EBPF_LOG_ENTRY();
+    delete poller;
+    EBPF_LOG_EXIT();
+}
@@ -279,6 +279,61 @@ bpf_map_get_next_key(int fd, const void* key, void* next_key)
     return libbpf_result_err(ebpf_map_get_next_key(fd, key, next_key));
 }
 
+static uint64_t
+_bpf_map_batch_elem_flags(_In_opt_ const struct bpf_map_batch_opts* opts)
+{
+    return (opts != nullptr && opts->sz >= offsetof(struct bpf_map_batch_opts, elem_flags) + sizeof(opts->elem_flags))
+               ? opts->elem_flags
+               : 0;
+}
+
+int
+bpf_map_lookup_batch(
+    int fd,
+    void* in_batch,
+    void* out_batch,
+    void* keys,
+    void* values,
+    __u32* count,
+    const struct bpf_map_batch_opts* opts)
+{
+    if (_bpf_map_batch_elem_flags(opts) != 0) {
+        return libbpf_err(-EINVAL);
+    }
+    return libbpf_result_err(ebpf_map_lookup_element_batch(fd, in_batch, out_batch, keys, values, count));
+}
+
+int
+bpf_map_lookup_and_delete_batch(
+    int fd,
+    void* in_batch,
+    void* out_batch,
+    void* keys,
+    void* values,
+    __u32* count,
+    const struct bpf_map_batch_opts* opts)
+{
+    if (_bpf_map_batch_elem_flags(opts) != 0) {
+        return libbpf_err(-EINVAL);
+    }
+    return libbpf_result_err(ebpf_map_lookup_and_delete_element_batch(fd, in_batch, out_batch, keys, values, count));
+}
+
+int
+bpf_map_update_batch(int fd, void* keys, void* values, __u32* count, const struct bpf_map_batch_opts* opts)
+{
+    return libbpf_result_err(ebpf_map_update_element_batch(fd, keys, values, count, _bpf_map_batch_elem_flags(opts)));
+}
+
+int
+bpf_map_delete_batch(int fd, void* keys, __u32* count, const struct bpf_map_batch_opts* opts)
+{
+    if (_bpf_map_batch_elem_flags(opts) != 0) {
+        return libbpf_err(-EINVAL);
+    }
+    return libbpf_result_err(ebpf_map_delete_element_batch(fd, keys, count));
+}
+
 int
 bpf_map_get_fd_by_id(uint32_t id)
 {
@@ -298,31 +353,69 @@ bpf_map_get_next_id(uint32_t start_id, uint32_t* next_id)
 
 typedef struct ring_buffer
 {
-    std::vector<ring_buffer_subscription_t*> subscriptions;
+    // Every map of the manager is read only by ring_buffer__poll and ring_buffer__consume.
+    ring_buffer_poller_t* poller = nullptr;
 } ring_buffer_t;
 
 struct ring_buffer*
 ring_buffer__new(int map_fd, ring_buffer_sample_fn sample_cb, void* ctx, const struct ring_buffer_opts* opts)
 {
     ebpf_result result = EBPF_SUCCESS;
-    ring_buffer_subscription_t* subscription = nullptr;
     UNREFERENCED_PARAMETER(opts);
-    ring_buffer_t* ring_buffer = new ring_buffer_t();
-    if (ring_buffer == nullptr)
+    ring_buffer_t* ring_buffer = new (std::nothrow) ring_buffer_t();
+    if (ring_buffer == nullptr) {
+        result = EBPF_NO_MEMORY;
         goto Exit;
-    result = ebpf_ring_buffer_map_subscribe(map_fd, ctx, sample_cb, &subscription);
+    }
+    result = ebpf_ring_buffer_poller_create(&ring_buffer->poller);
     if (result != EBPF_SUCCESS)
         goto Exit;
-    ring_buffer->subscriptions.push_back(subscription);
+    result = ebpf_ring_buffer_poller_add(ring_buffer->poller, map_fd, ctx, sample_cb);
 Exit:
+    if (result != EBPF_SUCCESS) {
+        if (ring_buffer != nullptr)
+            ring_buffer__free(ring_buffer);
+        return (struct ring_buffer*)libbpf_err_ptr(-ebpf_result_to_errno(result));
+    }
     return ring_buffer;
 }
 
+int
+ring_buffer__add(struct ring_buffer* ring_buffer, int map_fd, ring_buffer_sample_fn sample_cb, void* ctx)
+{
+    return libbpf_result_err(ebpf_ring_buffer_poller_add(ring_buffer->poller, map_fd, ctx, sample_cb));
+}
+
+int
+ring_buffer__poll(struct ring_buffer* ring_buffer, int timeout_ms)
+{
+    uint32_t record_count;
+    int callback_result;
+    ebpf_result_t result =
+        ebpf_ring_buffer_poller_poll(ring_buffer->poller, timeout_ms, &record_count, &callback_result);
+    if (result != EBPF_SUCCESS)
+        return libbpf_result_err(result);
+    if (callback_result != 0)
+        return callback_result;
+    return (record_count > INT_MAX) ? INT_MAX : static_cast<int>(record_count);
+}
+
+int
+ring_buffer__consume(struct ring_buffer* ring_buffer)
+{
+    uint32_t record_count;
+    int callback_result;
+    ebpf_result_t result = ebpf_ring_buffer_poller_consume(ring_buffer->poller, &record_count, &callback_result);
+    if (result != EBPF_SUCCESS)
+        return libbpf_result_err(result);
+    if (callback_result != 0)
+        return callback_result;
+    return (record_count > INT_MAX) ? INT_MAX : static_cast<int>(record_count);
+}
+
 void
 ring_buffer__free(struct ring_buffer* ring_buffer)
 {
-    for (auto it = ring_buffer->subscriptions.begin(); it != ring_buffer->subscriptions.end(); it++)
-        (void)ebpf_ring_buffer_map_unsubscribe(*it);
-    ring_buffer->subscriptions.clear();
+    ebpf_ring_buffer_poller_free(ring_buffer->poller);
     delete ring_buffer;
 }
@@ -24,6 +24,82 @@ static ebpf_pinning_table_t* _ebpf_core_map_pinning_table = NULL;
 // Assume enabled until we can query it.
 static ebpf_code_integrity_state_t _ebpf_core_code_integrity_state = EBPF_CODE_INTEGRITY_HYPERVISOR_KERNEL_MODE;
 
+static ebpf_result_t
+_ebpf_core_protocol_ring_buffer_map_freeze(
+    _In_ const ebpf_operation_ring_buffer_map_freeze_request_t* request,
+    _Out_ ebpf_operation_ring_buffer_map_freeze_reply_t* reply,
+    uint16_t reply_length)
+{
+    EBPF_LOG_ENTRY();
+    ebpf_map_t* map;
+    uintptr_t instance;
+    size_t consumer_offset = 0;
+    size_t producer_offset = 0;
+    ebpf_result_t result = ebpf_reference_object_by_handle(request->map_handle, EBPF_OBJECT_MAP, (ebpf_object_t**)&map);
+    if (result != EBPF_SUCCESS) {
+        EBPF_RETURN_RESULT(result);
+    }
+
+    // Freezes belong to the handle, so only its holder can thaw them and closing it thaws the ones left behind.
+    result = ebpf_handle_get_instance(request->map_handle, &instance);
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+
+    if (request->freeze) {
+        result = ebpf_ring_buffer_map_freeze(map, request->ring_index, instance, &consumer_offset, &producer_offset);
+    } else {
+        result = ebpf_ring_buffer_map_thaw(map, request->ring_index, instance);
+    }
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+
+    reply->header.length = reply_length;
+    reply->consumer_offset = consumer_offset;
+    reply->producer_offset = producer_offset;
+
+Exit:
+    ebpf_object_release_reference((ebpf_object_t*)map);
+    EBPF_RETURN_RESULT(result);
+}
+
+static ebpf_result_t
+_ebpf_core_protocol_ring_buffer_map_read(
+    _In_ const ebpf_operation_ring_buffer_map_read_request_t* request,
+    _Out_ ebpf_operation_ring_buffer_map_read_reply_t* reply,
+    uint16_t reply_length)
+{
+    EBPF_LOG_ENTRY();
+    ebpf_map_t* map = NULL;
+    size_t data_length;
+    size_t offset = (size_t)request->offset;
+    uint32_t ring_index = request->ring_index;
+
+    ebpf_result_t result = ebpf_reference_object_by_handle(request->map_handle, EBPF_OBJECT_MAP, (ebpf_object_t**)&map);
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+
+    result = ebpf_safe_size_t_subtract(
+        reply_length, EBPF_OFFSET_OF(ebpf_operation_ring_buffer_map_read_reply_t, data), &data_length);
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+
+    // Request and reply may share a buffer, so the request fields were copied above.
+    result = ebpf_ring_buffer_map_read(map, ring_index, offset, reply->data, data_length);
+    if (result != EBPF_SUCCESS) {
+        goto Exit;
+    }
+
+    reply->header.length = reply_length;
+
+Exit:
+    ebpf_object_release_reference((ebpf_object_t*)map);
+    EBPF_RETURN_RESULT(result);
+}
+
 static void*
 _ebpf_core_map_find_element(ebpf_map_t* map, const uint8_t* key);
 static int64_t
@@ -62,7 +138,7 @@ static const void* _ebpf_general_helpers[] = {
     (void*)&_ebpf_core_get_time_ns,
     (void*)&ebpf_core_csum_diff,
     // Ring buffer output.
-    (void*)&ebpf_ring_buffer_map_output};
+    (void*)&_ebpf_core_ring_buffer_output};
 
 static ebpf_extension_provider_t* _ebpf_global_helper_function_provider_context = NULL;
 static ebpf_helper_function_addresses_t _ebpf_global_helper_function_dispatch_table = {
@@ -586,6 +662,119 @@ Done:
     EBPF_RETURN_RESULT(retval);
 }
 
+static ebpf_result_t
+_ebpf_core_protocol_map_lookup_batch(
+    _In_ const ebpf_operation_map_lookup_batch_request_t* request,
+    _Inout_ ebpf_operation_map_lookup_batch_reply_t* reply,
+    uint16_t reply_length)
+{
+    EBPF_LOG_ENTRY();
+    ebpf_result_t retval;
+    ebpf_map_t* map = NULL;
+    size_t previous_key_length;
+    size_t data_length;
+    bool find_and_delete = request->header.id == EBPF_OPERATION_MAP_LOOKUP_AND_DELETE_BATCH;
+
+    retval = ebpf_reference_object_by_handle(request->handle, EBPF_OBJECT_MAP, (ebpf_object_t**)&map);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    retval = ebpf_safe_size_t_subtract(
+        request->header.length,
+        EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_request_t, previous_key),
+        &previous_key_length);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    retval = ebpf_safe_size_t_subtract(
+        reply_length, EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_reply_t, data), &data_length);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    // Request and reply may share a buffer, ebpf_map_lookup_batch copies previous_key before writing data.
+    retval = ebpf_map_lookup_batch(
+        map,
+        previous_key_length,
+        previous_key_length == 0 ? NULL : request->previous_key,
+        find_and_delete,
+        &data_length,
+        reply->data);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    reply->header.length = (uint16_t)(EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_reply_t, data) + data_length);
+
+Done:
+    ebpf_object_release_reference((ebpf_object_t*)map);
+    EBPF_RETURN_RESULT(retval);
+}
+
+static ebpf_result_t
+_ebpf_core_protocol_map_update_batch(
+    _In_ const ebpf_operation_map_update_batch_request_t* request,
+    _Out_ ebpf_operation_map_batch_reply_t* reply,
+    uint16_t reply_length)
+{
+    EBPF_LOG_ENTRY();
+    UNREFERENCED_PARAMETER(reply_length);
+    ebpf_result_t retval;
+    ebpf_map_t* map = NULL;
+    size_t data_length;
+    size_t count;
+
+    retval = ebpf_reference_object_by_handle(request->handle, EBPF_OBJECT_MAP, (ebpf_object_t**)&map);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    retval = ebpf_safe_size_t_subtract(
+        request->header.length, EBPF_OFFSET_OF(ebpf_operation_map_update_batch_request_t, data), &data_length);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    // A failed IOCTL returns no reply, so a per-entry failure is reported in the reply along with the number
+    // of entries processed before it.
+    reply->result = ebpf_map_update_batch(map, data_length, request->data, request->option, &count);
+    reply->count = (uint32_t)count;
+    reply->header.length = sizeof(*reply);
+
+Done:
+    ebpf_object_release_reference((ebpf_object_t*)map);
+    EBPF_RETURN_RESULT(retval);
+}
+
+static ebpf_result_t
+_ebpf_core_protocol_map_delete_batch(
+    _In_ const ebpf_operation_map_delete_batch_request_t* request,
+    _Out_ ebpf_operation_map_batch_reply_t* reply,
+    uint16_t reply_length)
+{
+    EBPF_LOG_ENTRY();
+    UNREFERENCED_PARAMETER(reply_length);
+    ebpf_result_t retval;
+    ebpf_map_t* map = NULL;
+    size_t keys_length;
+    size_t count;
+
+    retval = ebpf_reference_object_by_handle(request->handle, EBPF_OBJECT_MAP, (ebpf_object_t**)&map);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    retval = ebpf_safe_size_t_subtract(
+        request->header.length, EBPF_OFFSET_OF(ebpf_operation_map_delete_batch_request_t, keys), &keys_length);
+    if (retval != EBPF_SUCCESS)
+        goto Done;
+
+    // A failed IOCTL returns no reply, so a per-entry failure is reported in the reply along with the number
+    // of entries processed before it.
+    reply->result = ebpf_map_delete_batch(map, keys_length, request->keys, &count);
+    reply->count = (uint32_t)count;
+    reply->header.length = sizeof(*reply);
+
+Done:
+    ebpf_object_release_reference((ebpf_object_t*)map);
+    EBPF_RETURN_RESULT(retval);
+}
+
 static ebpf_result_t
 _ebpf_core_get_next_handle(ebpf_handle_t previous_handle, ebpf_object_type_t type, ebpf_handle_t* next_handle)
 {
@@ -1211,12 +1400,23 @@ _ebpf_core_protocol_ring_buffer_map_query_buffer(
     UNREFERENCED_PARAMETER(reply_length);
 
     ebpf_map_t* map;
+    uintptr_t instance;
     ebpf_result_t result = ebpf_reference_object_by_handle(request->map_handle, EBPF_OBJECT_MAP, (ebpf_object_t**)&map);
     if (result != EBPF_SUCCESS) {
         return result;
     }
 
-    result = ebpf_ring_buffer_map_query_buffer(map, (uint8_t**)(uintptr_t*)&reply->buffer_address);
+    // The mappings belong to the handle and are removed when it is closed, before the ring memory is freed.
+    result = ebpf_handle_get_instance(request->map_handle, &instance);
+    if (result == EBPF_SUCCESS) {
+        result = ebpf_ring_buffer_map_query_buffer(
+            map,
+            request->ring_index,
+            instance,
+            (uint8_t**)(uintptr_t*)&reply->buffer_address,
+            (size_t**)(uintptr_t*)&reply->consumer_offset_address);
+    }
+    reply->ring_count = ebpf_ring_buffer_map_get_ring_count(map);
 
     ebpf_object_release_reference((ebpf_object_t*)map);
     EBPF_RETURN_RESULT(result);
@@ -1240,11 +1440,11 @@ _ebpf_core_protocol_ring_buffer_map_async_query(
     reference_taken = TRUE;
 
     // Return buffer already consumed by caller in previous notification.
-    result = ebpf_ring_buffer_map_return_buffer(map, request->consumer_offset);
+    result = ebpf_ring_buffer_map_return_buffer(map, request->ring_index, request->consumer_offset);
     if (result != EBPF_SUCCESS)
         goto Exit;
 
-    result = ebpf_ring_buffer_map_async_query(map, &reply->async_query_result, async_context);
+    result = ebpf_ring_buffer_map_async_query(map, request->ring_index, &reply->async_query_result, async_context);
 
 Exit:
     if (reference_taken)
@@ -1252,6 +1452,23 @@ Exit:
     return result;
 }
 
+static ebpf_result_t
+_ebpf_core_protocol_ring_buffer_map_set_wakeup_watermark(
+    _In_ const ebpf_operation_ring_buffer_map_set_wakeup_watermark_request_t* request)
+{
+    EBPF_LOG_ENTRY();
+    ebpf_map_t* map;
+    ebpf_result_t result = ebpf_reference_object_by_handle(request->map_handle, EBPF_OBJECT_MAP, (ebpf_object_t**)&map);
+    if (result != EBPF_SUCCESS) {
+        EBPF_RETURN_RESULT(result);
+    }
+
+    result = ebpf_ring_buffer_map_set_wakeup_watermark(map, (size_t)request->wakeup_watermark);
+
+    ebpf_object_release_reference((ebpf_object_t*)map);
+    EBPF_RETURN_RESULT(result);
+}
+
 static void*
 _ebpf_core_map_find_element(ebpf_map_t* map, const uint8_t* key)
 {
@@ -1360,8 +1577,7 @@ _ebpf_core_ring_buffer_output(
     _In_ ebpf_map_t* map, _In_reads_bytes_(length) uint8_t* data, size_t length, uint64_t flags)
 {
     // This function implements bpf_ringbuf_output helper function, which returns negative error in case of failure.
-    UNREFERENCED_PARAMETER(flags);
-    return -ebpf_ring_buffer_map_output(map, data, length);
+    return -ebpf_ring_buffer_map_output(map, data, length, flags);
 }
 
 typedef struct _ebpf_protocol_handler
@@ -1537,6 +1753,41 @@ static ebpf_protocol_handler_t _ebpf_protocol_handlers[] = {
      sizeof(ebpf_operation_ring_buffer_map_async_query_request_t),
      sizeof(ebpf_operation_ring_buffer_map_async_query_reply_t),
      true},
+
+    // EBPF_OPERATION_MAP_LOOKUP_BATCH
+    {(ebpf_result_t(__cdecl*)(const void*))_ebpf_core_protocol_map_lookup_batch,
+     EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_request_t, previous_key),
+     EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_reply_t, data)},
+
+    // EBPF_OPERATION_MAP_LOOKUP_AND_DELETE_BATCH
+    {(ebpf_result_t(__cdecl*)(const void*))_ebpf_core_protocol_map_lookup_batch,
+     EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_request_t, previous_key),
+     EBPF_OFFSET_OF(ebpf_operation_map_lookup_batch_reply_t, data)},
+
+    // EBPF_OPERATION_MAP_UPDATE_BATCH
+    {(ebpf_result_t(__cdecl*)(const void*))_ebpf_core_protocol_map_update_batch,
+     EBPF_OFFSET_OF(ebpf_operation_map_update_batch_request_t, data),
+     sizeof(ebpf_operation_map_batch_reply_t)},
+
+    // EBPF_OPERATION_MAP_DELETE_BATCH
+    {(ebpf_result_t(__cdecl*)(const void*))_ebpf_core_protocol_map_delete_batch,
+     EBPF_OFFSET_OF(ebpf_operation_map_delete_batch_request_t, keys),
+     sizeof(ebpf_operation_map_batch_reply_t)},
+
+    // EBPF_OPERATION_RING_BUFFER_MAP_SET_WAKEUP_WATERMARK
+    {(ebpf_result_t(__cdecl*)(const void*))_ebpf_core_protocol_ring_buffer_map_set_wakeup_watermark,
+     sizeof(ebpf_operation_ring_buffer_map_set_wakeup_watermark_request_t),
+     0},
+
+    // EBPF_OPERATION_RING_BUFFER_MAP_FREEZE
+    {(ebpf_result_t(__cdecl*)(const void*))_ebpf_core_protocol_ring_buffer_map_freeze,
+     sizeof(ebpf_operation_ring_buffer_map_freeze_request_t),
+     sizeof(ebpf_operation_ring_buffer_map_freeze_reply_t)},
+
+    // EBPF_OPERATION_RING_BUFFER_MAP_READ
+    {(ebpf_result_t(__cdecl*)(const void*))_ebpf_core_protocol_ring_buffer_map_read,
+     sizeof(ebpf_operation_ring_buffer_map_read_request_t),
+     EBPF_OFFSET_OF(ebpf_operation_ring_buffer_map_read_reply_t, data)},
 };
 
 ebpf_result_t
@@ -26,11 +26,21 @@ static ebpf_result_t
 _ebpf_link_instance_invoke(
     _In_ const void* extension_client_binding_context, _In_ void* program_context, _Out_ uint32_t* result);
 
+static ebpf_result_t
+_ebpf_link_instance_invoke_batch(
+    _In_ const void* extension_client_binding_context,
+    _In_reads_(count) void** program_contexts,
+    uint32_t count,
+    _Out_writes_(count) uint32_t* results);
+
+// Laid out as an ebpf_extension_dispatch_table_t, so that providers can check the size before using function[1].
 static struct
 {
-    size_t size;
-    _ebpf_extension_dispatch_function function[1];
-} _ebpf_link_dispatch_table = {1, {_ebpf_link_instance_invoke}};
+    uint16_t version;
+    uint16_t size;
+    _ebpf_extension_dispatch_function function[2];
+} _ebpf_link_dispatch_table = {
+    0, sizeof(_ebpf_link_dispatch_table), {_ebpf_link_instance_invoke, _ebpf_link_instance_invoke_batch}};
 
 static void
 _ebpf_link_free(ebpf_object_t* object)
@@ -204,6 +214,36 @@ Exit:
     EBPF_RETURN_RESULT(return_value);
 }
 
+static ebpf_result_t
+_ebpf_link_instance_invoke_batch(
+    _In_ const void* extension_client_binding_context,
+    _In_reads_(count) void** program_contexts,
+    uint32_t count,
+    _Out_writes_(count) uint32_t* results)
+{
+    // No function entry exit traces as this is a high volume function.
+    ebpf_result_t return_value;
+    ebpf_link_t* link = (ebpf_link_t*)ebpf_extension_get_client_context(extension_client_binding_context);
+
+    if (link == NULL) {
+        GUID npi_id = ebpf_extension_get_provider_guid(extension_client_binding_context);
+        EBPF_LOG_MESSAGE_GUID(
+            EBPF_TRACELOG_LEVEL_WARNING, EBPF_TRACELOG_KEYWORD_LINK, "Client context is null", npi_id);
+        return_value = EBPF_FAILED;
+        goto Exit;
+    }
+
+    // One epoch for the whole batch.
+    return_value = ebpf_epoch_enter();
+    if (return_value != EBPF_SUCCESS)
+        goto Exit;
+    ebpf_program_invoke_batch(link->program, program_contexts, count, results);
+    ebpf_epoch_exit();
+
+Exit:
+    EBPF_RETURN_RESULT(return_value);
+}
+
 ebpf_result_t
 ebpf_link_get_info(
     _In_ const ebpf_link_t* link, _Out_writes_to_(*info_size, *info_size) uint8_t* buffer, _Inout_ uint16_t* info_size)
@@ -2,7 +2,6 @@
 // SPDX-License-Identifier: MIT
 
 #include "ebpf_async.h"
-#include "ebpf_bitmap.h"
 #include "ebpf_epoch.h"
 #include "ebpf_handle.h"
 #include "ebpf_maps.h"
@@ -12,6 +11,9 @@
 
 #define PAD_CACHE(X) ((X + EBPF_CACHE_LINE_SIZE - 1) & ~(EBPF_CACHE_LINE_SIZE - 1))
 
+// Hash tables grow on demand, so hash maps start small rather than sized for max_entries.
+#define EBPF_HASH_MAP_INITIAL_BUCKET_COUNT 64
+
 typedef struct _ebpf_core_map
 {
     ebpf_object_t object;
@@ -19,6 +21,10 @@ typedef struct _ebpf_core_map
     ebpf_map_definition_in_memory_t ebpf_map_definition;
     uint32_t original_value_size;
     uint8_t* data;
+    // Position of the last key returned by next_key on hash maps, shared by
+    // all callers and protected by next_key_cursor_lock.
+    ebpf_lock_t next_key_cursor_lock;
+    ebpf_hash_table_cursor_t next_key_cursor;
 } ebpf_core_map_t;
 
 typedef struct _ebpf_core_object_map
@@ -28,22 +34,92 @@ typedef struct _ebpf_core_object_map
     struct _ebpf_core_map* inner_map_template;
     bool is_program_type_set;
     ebpf_program_type_t program_type;
+    // Object array maps only: the object referenced by each entry, indexed by key. The entry's reference keeps
+    // the object alive and objects are freed through the epoch, so readers in an epoch need no reference.
+    ebpf_object_t* volatile* objects;
 } ebpf_core_object_map_t;
 
+/**
+ * Core map structure for BPF_MAP_TYPE_HASH and BPF_MAP_TYPE_PERCPU_HASH maps
+ * created with BPF_F_UPDATE_IN_PLACE. Each value in the hash table is prefixed
+ * with an ebpf_in_place_value_header_t and updates overwrite the existing value
+ * rather than replacing it, which avoids an allocation and an epoch free per
+ * update. Writers of a value serialize on one of a small set of locks selected
+ * by the address of the value.
+ */
+typedef struct _ebpf_core_in_place_hash_map
+{
+    ebpf_core_map_t core_map;
+    ebpf_lock_t locks[16];
+} ebpf_core_in_place_hash_map_t;
+
+/**
+ * Header that precedes each value in an in-place hash map. The sequence number
+ * is odd while a writer is modifying the value and advances to the next even
+ * number once the write completes, which allows readers that copy the value to
+ * detect a concurrent write and retry. A sequence number of zero means the
+ * entry has been inserted but the value hasn't been written yet.
+ */
+typedef struct _ebpf_in_place_value_header
+{
+    volatile int32_t sequence;
+    uint32_t reserved; // Keeps the value 8-byte aligned.
+} ebpf_in_place_value_header_t;
+
+/**
+ * Core map structure for BPF_MAP_TYPE_LRU_HASH and BPF_MAP_TYPE_LRU_PERCPU_HASH
+ * maps. Every value in the hash table carries an ebpf_lru_entry_t as its
+ * supplemental value and the entries are kept on a list ordered from least to
+ * most recently inserted. Lookups only set the referenced flag on the entry, so
+ * they never take the lock. Eviction walks the list from the head, giving
+ * referenced entries a second chance by moving them to the tail.
+ */
 typedef struct _ebpf_core_lru_map
 {
     ebpf_core_map_t core_map;
-    // https://github.com/microsoft/ebpf-for-windows/issues/557
-    // Investigate replacing this with a heap to speed up finding oldest key.
-    ebpf_hash_table_t* key_history;
+    ebpf_lock_t lock;
+    ebpf_list_entry_t entries; // Protected by lock.
 } ebpf_core_lru_map_t;
 
+typedef struct _ebpf_lru_entry
+{
+    ebpf_list_entry_t list_entry; // Protected by ebpf_core_lru_map_t::lock.
+    bool freed;                   // Set when the value is freed. Protected by ebpf_core_lru_map_t::lock.
+    volatile bool referenced;     // Set when the entry is found, cleared by eviction.
+    uint8_t* value;               // Value in the hash table this entry belongs to.
+    uint8_t key[1];
+} ebpf_lru_entry_t;
+
+// Maximum number of referenced entries eviction skips before evicting one regardless.
+#define EBPF_LRU_MAXIMUM_EVICTION_SCAN 64
+
+/**
+ * Node of the path-compressed binary trie used to find the longest matching
+ * prefix in a BPF_MAP_TYPE_LPM_TRIE map. Each node holds a prefix and the value
+ * stored for it in the map's hash table. Nodes without a value join two
+ * subtries that diverge after prefix_length bits. The child taken after a node
+ * is selected by the bit that follows its prefix.
+ */
+typedef struct _ebpf_lpm_trie_node
+{
+    struct _ebpf_lpm_trie_node* volatile children[2];
+    uint8_t* volatile value; // Value in the hash table or NULL for intermediate nodes.
+    uint32_t prefix_length;
+    uint8_t prefix[1];
+} ebpf_lpm_trie_node_t;
+
+/**
+ * Core map structure for BPF_MAP_TYPE_LPM_TRIE maps. Entries are stored in the
+ * hash table and indexed by the trie. Writers serialize on the lock and publish
+ * nodes with interlocked operations; readers walk the trie without locks and
+ * rely on the epoch to keep nodes and values alive.
+ */
 typedef struct _ebpf_core_lpm_map
 {
     ebpf_core_map_t core_map;
+    ebpf_lock_t lock;
     uint32_t max_prefix;
-    // Bitmap of prefix lengths inserted into the map.
-    uint8_t data[1];
+    ebpf_lpm_trie_node_t* volatile root;
 } ebpf_core_lpm_map_t;
 
 typedef struct _ebpf_core_ring_buffer_map
@@ -57,8 +133,27 @@ typedef struct _ebpf_core_ring_buffer_map
     // for all subsequent updates, so should only be allowed to admin.
     bool async_contexts_trip_wire;
     ebpf_list_entry_t async_contexts;
+    // Bytes of unconsumed data that must accumulate before a pending async query is completed, or 0 to complete
+    // it as soon as any data is available. Lets consumers handle records in batches instead of one wakeup each.
+    volatile size_t wakeup_watermark;
+    // Set on the rings of a per-CPU ring buffer map, where each record starts with an
+    // ebpf_per_cpu_ring_buffer_record_header_t.
+    bool timestamped;
 } ebpf_core_ring_buffer_map_t;
 
+/**
+ * Core map structure for BPF_MAP_TYPE_PERCPU_RINGBUF maps. The map holds one ring of max_entries bytes per CPU and
+ * producers write to the ring of the CPU they run on, so producers on different CPUs never touch the same offsets.
+ * Each record starts with the time it was reserved, which lets the consumer merge the rings in order. The rings
+ * aren't objects of their own; they are only reachable through this map.
+ */
+typedef struct _ebpf_core_per_cpu_ring_buffer_map
+{
+    ebpf_core_map_t core_map;
+    uint32_t ring_count;
+    ebpf_core_ring_buffer_map_t* rings[1];
+} ebpf_core_per_cpu_ring_buffer_map_t;
+
 typedef struct _ebpf_core_ring_buffer_map_async_query_context
 {
     ebpf_list_entry_t entry;
@@ -128,6 +223,12 @@ typedef struct _ebpf_map_function_table
 
 ebpf_map_function_table_t ebpf_map_function_tables[];
 
+static inline bool
+_is_in_place_map(_In_ const ebpf_core_map_t* map)
+{
+    return (map->ebpf_map_definition.map_flags & BPF_F_UPDATE_IN_PLACE) != 0;
+}
+
 const ebpf_map_definition_in_memory_t*
 ebpf_map_get_definition(_In_ const ebpf_map_t* map)
 {
@@ -322,6 +423,7 @@ _delete_object_array_map(_In_ _Post_invalid_ ebpf_core_map_t* map, ebpf_object_t
         ebpf_object_release_reference(&object_map->inner_map_template->object);
     }
 
+    ebpf_epoch_free((void*)object_map->objects);
     _delete_array_map(map);
 }
 
@@ -333,6 +435,7 @@ _create_object_array_map(
 {
     ebpf_core_map_t* local_map = NULL;
     ebpf_result_t result = EBPF_SUCCESS;
+    size_t objects_size;
 
     EBPF_LOG_ENTRY();
 
@@ -343,6 +446,17 @@ _create_object_array_map(
         goto Exit;
 
     ebpf_core_object_map_t* object_map = EBPF_FROM_FIELD(ebpf_core_object_map_t, core_map, local_map);
+
+    result = ebpf_safe_size_t_multiply(map_definition->max_entries, sizeof(ebpf_object_t*), &objects_size);
+    if (result != EBPF_SUCCESS)
+        goto Exit;
+
+    object_map->objects = (ebpf_object_t* volatile*)ebpf_epoch_allocate(objects_size);
+    if (object_map->objects == NULL) {
+        result = EBPF_NO_MEMORY;
+        goto Exit;
+    }
+
     result = _associate_inner_map(object_map, inner_map_handle);
     if (result != EBPF_SUCCESS)
         goto Exit;
@@ -496,6 +610,10 @@ _update_array_map_entry_with_handle(
         }
     }
 
+    // Publish the new object before the old one can be freed, so that a reader that
+    // starts after the old reference is released cannot observe the old object.
+    object_map->objects[index] = value_object;
+
     // Release the reference on the old ID stored here, if any.
     uint8_t* entry = &map->data[*key * map->ebpf_map_definition.value_size];
     ebpf_id_t old_id = *(ebpf_id_t*)entry;
@@ -541,6 +659,7 @@ _delete_array_map_entry_with_reference(
     result = _find_array_map_entry(map, key, false, &entry);
     if (result == EBPF_SUCCESS) {
         ebpf_id_t id = *(ebpf_id_t*)entry;
+        object_map->objects[*(uint32_t*)key] = NULL;
         ebpf_object_dereference_by_id(id, value_type);
         _delete_array_map_entry(map, key);
     }
@@ -596,12 +715,29 @@ _get_object_from_array_map_entry(_In_ ebpf_core_map_t* map, _In_ const uint8_t*
     return object;
 }
 
+static uint32_t
+_get_initial_bucket_count(uint32_t max_entries)
+{
+    // A map that never grows past its initial size doesn't need more buckets than entries.
+    if (max_entries == 0 || max_entries > EBPF_HASH_MAP_INITIAL_BUCKET_COUNT) {
+        return EBPF_HASH_MAP_INITIAL_BUCKET_COUNT;
+    }
+    return max_entries;
+}
+
 static ebpf_result_t
 _create_hash_map_internal(
     size_t map_struct_size,
     _In_ const ebpf_map_definition_in_memory_t* map_definition,
+    size_t supplemental_value_size,
     _In_opt_ void (*extract_function)(
         _In_ const uint8_t* value, _Outptr_ const uint8_t** data, _Out_ size_t* length_in_bits),
+    _In_opt_ void (*notification_callback)(
+        _In_opt_ void* context,
+        ebpf_hash_table_notification_type_t type,
+        _In_ const uint8_t* key,
+        _Inout_ uint8_t* value,
+        _Inout_opt_ uint8_t* supplemental_value),
     _Outptr_ ebpf_core_map_t** map)
 {
     ebpf_result_t retval;
@@ -617,18 +753,28 @@ _create_hash_map_internal(
 
     local_map->ebpf_map_definition = *map_definition;
     local_map->data = NULL;
+    ebpf_lock_create(&local_map->next_key_cursor_lock);
+
+    size_t value_size = local_map->ebpf_map_definition.value_size;
+    if (_is_in_place_map(local_map)) {
+        value_size += sizeof(ebpf_in_place_value_header_t);
+    }
 
     // Note:
     // ebpf_hash_table_t doesn't require synchronization as long as allocations
     // are performed using the epoch allocator.
-    retval = ebpf_hash_table_create(
-        (ebpf_hash_table_t**)&local_map->data,
-        ebpf_epoch_allocate,
-        ebpf_epoch_free,
-        local_map->ebpf_map_definition.key_size,
-        local_map->ebpf_map_definition.value_size,
-        local_map->ebpf_map_definition.max_entries,
-        extract_function);
+    ebpf_hash_table_creation_options_t options = {
+        .allocate = ebpf_epoch_allocate,
+        .free = ebpf_epoch_free,
+        .key_size = local_map->ebpf_map_definition.key_size,
+        .value_size = value_size,
+        .bucket_count = _get_initial_bucket_count(local_map->ebpf_map_definition.max_entries),
+        .extract_function = extract_function,
+        .supplemental_value_size = supplemental_value_size,
+        .notification_context = local_map,
+        .notification_callback = notification_callback,
+    };
+    retval = ebpf_hash_table_create_with_options((ebpf_hash_table_t**)&local_map->data, &options);
     if (retval != EBPF_SUCCESS) {
         goto Done;
     }
@@ -642,6 +788,9 @@ Done:
         if (local_map && local_map->data) {
             ebpf_hash_table_destroy((ebpf_hash_table_t*)local_map->data);
         }
+        if (local_map) {
+            ebpf_lock_destroy(&local_map->next_key_cursor_lock);
+        }
         ebpf_epoch_free(local_map);
         local_map = NULL;
     }
@@ -654,18 +803,127 @@ _create_hash_map(
     ebpf_handle_t inner_map_handle,
     _Outptr_ ebpf_core_map_t** map)
 {
+    ebpf_result_t result;
     if (inner_map_handle != ebpf_handle_invalid)
         return EBPF_INVALID_ARGUMENT;
-    return _create_hash_map_internal(sizeof(ebpf_core_map_t), map_definition, NULL, map);
+
+    if (!(map_definition->map_flags & BPF_F_UPDATE_IN_PLACE)) {
+        return _create_hash_map_internal(sizeof(ebpf_core_map_t), map_definition, 0, NULL, NULL, map);
+    }
+
+    result = _create_hash_map_internal(sizeof(ebpf_core_in_place_hash_map_t), map_definition, 0, NULL, NULL, map);
+    if (result != EBPF_SUCCESS) {
+        return result;
+    }
+
+    ebpf_core_in_place_hash_map_t* in_place_map = EBPF_FROM_FIELD(ebpf_core_in_place_hash_map_t, core_map, *map);
+    for (size_t index = 0; index < EBPF_COUNT_OF(in_place_map->locks); index++) {
+        ebpf_lock_create(&in_place_map->locks[index]);
+    }
+    return EBPF_SUCCESS;
 }
 
 static void
 _delete_hash_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
 {
+    if (_is_in_place_map(map)) {
+        ebpf_core_in_place_hash_map_t* in_place_map = EBPF_FROM_FIELD(ebpf_core_in_place_hash_map_t, core_map, map);
+        for (size_t index = 0; index < EBPF_COUNT_OF(in_place_map->locks); index++) {
+            ebpf_lock_destroy(&in_place_map->locks[index]);
+        }
+    }
     ebpf_hash_table_destroy((ebpf_hash_table_t*)map->data);
+    ebpf_lock_destroy(&map->next_key_cursor_lock);
     ebpf_epoch_free(map);
 }
 
+/**
+ * @brief Overwrite part of a value in an in-place hash map.
+ *
+ * @param[in] map In-place hash map containing the value.
+ * @param[in,out] value Pointer to the value, following its header.
+ * @param[in] offset Offset of the bytes to overwrite in the value.
+ * @param[in] data New bytes, or NULL to zero them.
+ * @param[in] size Count of bytes to overwrite.
+ */
+static void
+_write_in_place_value_range(
+    _In_ ebpf_core_map_t* map,
+    _Inout_ uint8_t* value,
+    size_t offset,
+    _In_reads_opt_(size) const uint8_t* data,
+    size_t size)
+{
+    ebpf_core_in_place_hash_map_t* in_place_map = EBPF_FROM_FIELD(ebpf_core_in_place_hash_map_t, core_map, map);
+    ebpf_in_place_value_header_t* header = ((ebpf_in_place_value_header_t*)value) - 1;
+    ebpf_lock_t* lock =
+        &in_place_map->locks[((uintptr_t)value / EBPF_CACHE_LINE_SIZE) % EBPF_COUNT_OF(in_place_map->locks)];
+
+    ebpf_assert(offset + size <= map->ebpf_map_definition.value_size);
+    ebpf_lock_state_t state = ebpf_lock_lock(lock);
+    uint32_t sequence = (uint32_t)header->sequence;
+    header->sequence = (int32_t)(sequence + 1);
+    MemoryBarrier();
+
+    if (data) {
+        memcpy(value + offset, data, size);
+    } else {
+        memset(value + offset, 0, size);
+    }
+
+    MemoryBarrier();
+    sequence += 2;
+    // Zero is reserved for entries that have never been written.
+    if (sequence == 0) {
+        sequence = 2;
+    }
+    header->sequence = (int32_t)sequence;
+    ebpf_lock_unlock(lock, state);
+}
+
+/**
+ * @brief Overwrite a value in an in-place hash map.
+ *
+ * @param[in] map In-place hash map containing the value.
+ * @param[in,out] value Pointer to the value, following its header.
+ * @param[in] data New value, or NULL to zero the value.
+ */
+static void
+_write_in_place_value(_In_ ebpf_core_map_t* map, _Inout_ uint8_t* value, _In_opt_ const uint8_t* data)
+{
+    _write_in_place_value_range(map, value, 0, data, map->ebpf_map_definition.value_size);
+}
+
+/**
+ * @brief Copy a value out of an in-place hash map, retrying if a writer
+ * modified the value during the copy.
+ *
+ * @param[in] map In-place hash map containing the value.
+ * @param[in] value Pointer to the value, following its header.
+ * @param[out] data Buffer to copy the value into.
+ */
+static void
+_read_in_place_value(
+    _In_ const ebpf_core_map_t* map,
+    _In_ const uint8_t* value,
+    _Out_writes_(map->ebpf_map_definition.value_size) uint8_t* data)
+{
+    const ebpf_in_place_value_header_t* header = ((const ebpf_in_place_value_header_t*)value) - 1;
+    for (;;) {
+        int32_t sequence = header->sequence;
+        if (sequence & 1) {
+            // Writers hold a spin lock, so the write completes shortly.
+            continue;
+        }
+        MemoryBarrier();
+        memcpy(data, value, map->ebpf_map_definition.value_size);
+        MemoryBarrier();
+        if (header->sequence == sequence) {
+            break;
+        }
+    }
+}
+
 static void
 _delete_object_hash_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
 {
@@ -704,7 +962,7 @@ _create_object_hash_map(
 
     *map = NULL;
 
-    result = _create_hash_map_internal(sizeof(ebpf_core_object_map_t), map_definition, NULL, &local_map);
+    result = _create_hash_map_internal(sizeof(ebpf_core_object_map_t), map_definition, 0, NULL, NULL, &local_map);
     if (result != EBPF_SUCCESS)
         goto Exit;
 
@@ -725,6 +983,63 @@ Exit:
     EBPF_RETURN_RESULT(result);
 }
 
+/**
+ * @brief Track values of an LRU map as the hash table allocates, uses and
+ * frees them.
+ *
+ * @param[in] context The LRU map the hash table belongs to.
+ * @param[in] type Type of notification.
+ * @param[in] key Key of the value.
+ * @param[in, out] value Value the notification is for.
+ * @param[in, out] supplemental_value The ebpf_lru_entry_t for this value.
+ */
+static void
+_lru_hash_map_notification(
+    _In_opt_ void* context,
+    ebpf_hash_table_notification_type_t type,
+    _In_ const uint8_t* key,
+    _Inout_ uint8_t* value,
+    _Inout_opt_ uint8_t* supplemental_value)
+{
+    ebpf_core_lru_map_t* lru_map = EBPF_FROM_FIELD(ebpf_core_lru_map_t, core_map, (ebpf_core_map_t*)context);
+    ebpf_lru_entry_t* entry = (ebpf_lru_entry_t*)supplemental_value;
+    ebpf_lock_state_t state;
+
+    if (!lru_map || !entry) {
+        return;
+    }
+
+    switch (type) {
+    case EBPF_HASH_TABLE_NOTIFICATION_TYPE_ALLOCATE:
+        entry->value = value;
+        memcpy(entry->key, key, lru_map->core_map.ebpf_map_definition.key_size);
+        // The entry only joins the list once the hash table has published it, so that eviction never claims a
+        // key it can't delete yet.
+        ebpf_list_initialize(&entry->list_entry);
+        break;
+    case EBPF_HASH_TABLE_NOTIFICATION_TYPE_INSERT:
+        state = ebpf_lock_lock(&lru_map->lock);
+        // A concurrent delete may already have freed the value it just published.
+        if (!entry->freed) {
+            ebpf_list_insert_tail(&lru_map->entries, &entry->list_entry);
+        }
+        ebpf_lock_unlock(&lru_map->lock, state);
+        break;
+    case EBPF_HASH_TABLE_NOTIFICATION_TYPE_FREE:
+        state = ebpf_lock_lock(&lru_map->lock);
+        entry->freed = true;
+        ebpf_list_remove_entry(&entry->list_entry);
+        ebpf_lock_unlock(&lru_map->lock, state);
+        break;
+    case EBPF_HASH_TABLE_NOTIFICATION_TYPE_USE:
+        // Avoid dirtying the cache line if the entry is already marked.
+        if (!entry->referenced) {
+            entry->referenced = true;
+        }
+        break;
+    }
+}
+
 static ebpf_result_t
 _create_lru_hash_map(
     _In_ const ebpf_map_definition_in_memory_t* map_definition,
@@ -743,35 +1058,22 @@ _create_lru_hash_map(
         goto Exit;
     }
 
-    retval = _create_hash_map_internal(sizeof(ebpf_core_lru_map_t), map_definition, NULL, (ebpf_core_map_t**)&lru_map);
+    retval = _create_hash_map_internal(
+        sizeof(ebpf_core_lru_map_t),
+        map_definition,
+        EBPF_OFFSET_OF(ebpf_lru_entry_t, key) + map_definition->key_size,
+        NULL,
+        _lru_hash_map_notification,
+        (ebpf_core_map_t**)&lru_map);
     if (retval != EBPF_SUCCESS)
         goto Exit;
 
-    // Note:
-    // ebpf_hash_table_t doesn't require synchronization as long as allocations
-    // are performed using the epoch allocator.
-    retval = ebpf_hash_table_create(
-        &lru_map->key_history,
-        ebpf_epoch_allocate,
-        ebpf_epoch_free,
-        lru_map->core_map.ebpf_map_definition.key_size,
-        sizeof(uint64_t),
-        lru_map->core_map.ebpf_map_definition.max_entries,
-        NULL);
-
-    if (retval != EBPF_SUCCESS)
-        goto Exit;
+    ebpf_lock_create(&lru_map->lock);
+    ebpf_list_initialize(&lru_map->entries);
 
     *map = &lru_map->core_map;
 
 Exit:
-    if (retval != EBPF_SUCCESS) {
-        if (lru_map && lru_map->core_map.data)
-            ebpf_hash_table_destroy((ebpf_hash_table_t*)lru_map->core_map.data);
-        ebpf_epoch_free(lru_map);
-        lru_map = NULL;
-    }
-
     EBPF_RETURN_RESULT(retval);
 }
 
@@ -779,44 +1081,28 @@ static void
 _delete_lru_hash_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
 {
     ebpf_core_lru_map_t* lru_map = EBPF_FROM_FIELD(ebpf_core_lru_map_t, core_map, map);
-    ebpf_hash_table_destroy(lru_map->key_history);
+    // Destroying the hash table removes each entry from the list, so the lock must outlive it.
     ebpf_hash_table_destroy((ebpf_hash_table_t*)lru_map->core_map.data);
+    ebpf_lock_destroy(&lru_map->lock);
+    ebpf_lock_destroy(&map->next_key_cursor_lock);
     ebpf_epoch_free(map);
 }
 
-static ebpf_result_t
-_update_key_history(_In_ ebpf_core_map_t* map, _In_ const uint8_t* key, bool remove)
-{
-    uint64_t now;
-    ebpf_core_lru_map_t* lru_map;
-    switch (map->ebpf_map_definition.type) {
-    case BPF_MAP_TYPE_LRU_HASH:
-    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
-        break;
-
-    default:
-        return EBPF_SUCCESS;
-    }
-    lru_map = EBPF_FROM_FIELD(ebpf_core_lru_map_t, core_map, map);
-    now = ebpf_query_time_since_boot(true);
-
-    if (!remove) {
-        return ebpf_hash_table_update(lru_map->key_history, key, (uint8_t*)&now, EBPF_HASH_TABLE_OPERATION_ANY);
-    } else {
-        return ebpf_hash_table_delete(lru_map->key_history, key);
-    }
-}
-
+/**
+ * @brief Evict the least recently used entry from an LRU map. Entries that were
+ * found since eviction last looked at them are moved to the tail of the list
+ * instead, up to EBPF_LRU_MAXIMUM_EVICTION_SCAN of them.
+ *
+ * @param[in] map Map to evict an entry from.
+ * @retval true An entry was evicted.
+ * @retval false The map isn't an LRU map or is empty.
+ */
 static bool
 _reap_oldest_map_entry(_In_ ebpf_core_map_t* map)
 {
-    uint8_t* previous_key = NULL;
-    uint8_t* next_key = NULL;
-    uint8_t* oldest_key = NULL;
-    uint64_t* key_age = NULL;
-    uint64_t oldest_key_age = MAXUINT64;
-    ebpf_result_t result;
     ebpf_core_lru_map_t* lru_map;
+    ebpf_lru_entry_t* entry = NULL;
+    ebpf_lock_state_t state;
 
     switch (map->ebpf_map_definition.type) {
     case BPF_MAP_TYPE_LRU_HASH:
@@ -829,28 +1115,39 @@ _reap_oldest_map_entry(_In_ ebpf_core_map_t* map)
 
     lru_map = EBPF_FROM_FIELD(ebpf_core_lru_map_t, core_map, map);
 
-    // Walk through all the keys and values and find the oldest one.
     for (;;) {
-        result = ebpf_hash_table_next_key_pointer_and_value(
-            lru_map->key_history, previous_key, &next_key, (uint8_t**)&key_age);
-        if (result != EBPF_SUCCESS) {
-            break;
+        entry = NULL;
+        state = ebpf_lock_lock(&lru_map->lock);
+        for (size_t scanned = 0; !ebpf_list_is_empty(&lru_map->entries); scanned++) {
+            entry = EBPF_FROM_FIELD(ebpf_lru_entry_t, list_entry, lru_map->entries.Flink);
+            if (!entry->referenced || scanned == EBPF_LRU_MAXIMUM_EVICTION_SCAN) {
+                break;
+            }
+            entry->referenced = false;
+            ebpf_list_remove_entry(&entry->list_entry);
+            ebpf_list_insert_tail(&lru_map->entries, &entry->list_entry);
+            entry = NULL;
         }
+        if (entry) {
+            // Claim the victim so that no other reaper picks it. The free notification's removal of the
+            // self-linked entry is then a no-op.
+            ebpf_list_remove_entry(&entry->list_entry);
+            ebpf_list_initialize(&entry->list_entry);
+        }
+        ebpf_lock_unlock(&lru_map->lock, state);
 
-        if (*key_age < oldest_key_age) {
-            oldest_key_age = *key_age;
-            oldest_key = next_key;
+        if (!entry) {
+            return false;
         }
-        previous_key = next_key;
-    }
 
-    // If we reached the end of the keys, delete the oldest one found.
-    if (result == EBPF_NO_MORE_KEYS && oldest_key != NULL) {
-        ebpf_hash_table_delete((ebpf_hash_table_t*)lru_map->core_map.data, oldest_key);
-        _update_key_history(map, oldest_key, true);
-        return true;
+        // The entry is freed through the epoch allocator, so its key remains valid even if another thread
+        // deletes it first. Only delete the key if it still maps to the victim's value: if it was deleted or
+        // replaced in the meantime, the victim is already gone, so pick another.
+        if (ebpf_hash_table_delete_value((ebpf_hash_table_t*)lru_map->core_map.data, entry->key, entry->value) ==
+            EBPF_SUCCESS) {
+            return true;
+        }
     }
-    return false;
 }
 
 static ebpf_result_t
@@ -868,10 +1165,16 @@ _find_hash_map_entry(
         value = NULL;
     }
 
-    if (value)
-        _update_key_history(map, key, false);
+    if (value && _is_in_place_map(map)) {
+        // Hide entries that have been inserted but not yet written.
+        if (((ebpf_in_place_value_header_t*)value)->sequence == 0) {
+            value = NULL;
+        } else {
+            value += sizeof(ebpf_in_place_value_header_t);
+        }
+    }
 
-    if (delete_on_success) {
+    if (delete_on_success && value) {
         // Delete is atomic.
         // Only return value of both find and delete succeeded.
         if (_delete_hash_map_entry(map, key) != EBPF_SUCCESS) {
@@ -914,6 +1217,54 @@ _get_object_from_hash_map_entry(_In_ ebpf_core_map_t* map, _In_ const uint8_t* k
     return object;
 }
 
+/**
+ * @brief Insert or update an entry in an in-place hash map. Existing values are
+ * overwritten in place; new entries are inserted zeroed and then written.
+ *
+ * @param[in] map In-place hash map to update.
+ * @param[in] key Key of the entry to update.
+ * @param[in] data New value, or NULL to zero the value.
+ * @param[in] option One of the ebpf_map_option_t options.
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_OBJECT_ALREADY_EXISTS The key exists and option is EBPF_NOEXIST.
+ * @retval EBPF_KEY_NOT_FOUND The key doesn't exist and option is EBPF_EXIST.
+ * @retval EBPF_OUT_OF_SPACE The map is full.
+ * @retval EBPF_NO_MEMORY Unable to allocate resources for this entry.
+ */
+static ebpf_result_t
+_update_hash_map_entry_in_place(
+    _In_ ebpf_core_map_t* map, _In_ const uint8_t* key, _In_opt_ const uint8_t* data, ebpf_map_option_t option)
+{
+    ebpf_hash_table_t* hash_table = (ebpf_hash_table_t*)map->data;
+    uint8_t* value;
+
+    for (;;) {
+        if (ebpf_hash_table_find(hash_table, key, &value) == EBPF_SUCCESS) {
+            if (option == EBPF_NOEXIST) {
+                return EBPF_OBJECT_ALREADY_EXISTS;
+            }
+            _write_in_place_value(map, value + sizeof(ebpf_in_place_value_header_t), data);
+            return EBPF_SUCCESS;
+        }
+
+        if (option == EBPF_EXIST) {
+            return EBPF_KEY_NOT_FOUND;
+        }
+
+        if (ebpf_hash_table_key_count(hash_table) >= map->ebpf_map_definition.max_entries) {
+            return EBPF_OUT_OF_SPACE;
+        }
+
+        // Insert a zeroed entry that readers ignore until it has been written,
+        // then look it up again. If another writer raced with the insert, or
+        // deleted the entry before it was found, start over.
+        ebpf_result_t result = ebpf_hash_table_update(hash_table, key, NULL, EBPF_HASH_TABLE_OPERATION_INSERT);
+        if (result != EBPF_SUCCESS && result != EBPF_OBJECT_ALREADY_EXISTS) {
+            return result;
+        }
+    }
+}
+
 static ebpf_result_t
 _update_hash_map_entry(
     _In_ ebpf_core_map_t* map, _In_ const uint8_t* key, _In_opt_ const uint8_t* data, ebpf_map_option_t option)
@@ -940,6 +1291,10 @@ _update_hash_map_entry(
         return EBPF_INVALID_ARGUMENT;
     }
 
+    if (_is_in_place_map(map)) {
+        return _update_hash_map_entry_in_place(map, key, data, option);
+    }
+
     entry_count = ebpf_hash_table_key_count((ebpf_hash_table_t*)map->data);
 
     if ((entry_count >= map->ebpf_map_definition.max_entries) &&
@@ -949,9 +1304,6 @@ _update_hash_map_entry(
     else
         result = ebpf_hash_table_update((ebpf_hash_table_t*)map->data, key, data, hash_table_operation);
 
-    if (result == EBPF_SUCCESS)
-        _update_key_history(map, key, false);
-
     return result;
 }
 
@@ -1061,7 +1413,6 @@ _delete_hash_map_entry(_In_ ebpf_core_map_t* map, _In_ const uint8_t* key)
     if (!map || !key)
         return EBPF_INVALID_ARGUMENT;
 
-    _update_key_history(map, key, true);
     return ebpf_hash_table_delete((ebpf_hash_table_t*)map->data, key);
 }
 
@@ -1069,10 +1420,21 @@ static ebpf_result_t
 _next_hash_map_key(_In_ ebpf_core_map_t* map, _In_opt_ const uint8_t* previous_key, _Out_ uint8_t* next_key)
 {
     ebpf_result_t result;
+    ebpf_hash_table_cursor_t cursor;
+    uint8_t* next_key_pointer;
     if (!map || !next_key)
         return EBPF_INVALID_ARGUMENT;
 
-    result = ebpf_hash_table_next_key((ebpf_hash_table_t*)map->data, previous_key, next_key);
+    // The cursor is only read and written under the lock, so callers never see a torn position.
+    ebpf_lock_state_t state = ebpf_lock_lock(&map->next_key_cursor_lock);
+    cursor = map->next_key_cursor;
+    result = ebpf_hash_table_next_key_with_cursor(
+        (ebpf_hash_table_t*)map->data, &cursor, previous_key, &next_key_pointer, NULL);
+    if (result == EBPF_SUCCESS) {
+        memcpy(next_key, next_key_pointer, map->ebpf_map_definition.key_size);
+        map->next_key_cursor = cursor;
+    }
+    ebpf_lock_unlock(&map->next_key_cursor_lock, state);
     return result;
 }
 
@@ -1117,6 +1479,7 @@ ebpf_result_t
 _update_entry_per_cpu(
     _In_ ebpf_core_map_t* map, _In_ const uint8_t* key, _In_ const uint8_t* value, ebpf_map_option_t option)
 {
+    uint8_t* entry;
     uint8_t* target;
     if (ebpf_map_function_tables[map->ebpf_map_definition.type].find_entry(map, key, false, &target) != EBPF_SUCCESS) {
         ebpf_result_t return_value =
@@ -1129,11 +1492,17 @@ _update_entry_per_cpu(
             return EBPF_NO_MEMORY;
         }
     }
+    entry = target;
     if (_ebpf_adjust_value_pointer(map, &target) != EBPF_SUCCESS) {
         return EBPF_INVALID_ARGUMENT;
     }
 
-    memcpy(target, value, ebpf_map_get_effective_value_size(map));
+    if (_is_in_place_map(map)) {
+        // The per-CPU slices share the sequence number of the entry, so readers copying the entry see the write.
+        _write_in_place_value_range(map, entry, target - entry, value, ebpf_map_get_effective_value_size(map));
+    } else {
+        memcpy(target, value, ebpf_map_get_effective_value_size(map));
+    }
     return EBPF_SUCCESS;
 }
 
@@ -1145,84 +1514,363 @@ _lpm_extract(_In_ const uint8_t* value, _Outptr_ const uint8_t** data, _Out_ siz
     *length_in_bits = sizeof(uint32_t) * 8 + prefix_length;
 }
 
-static ebpf_result_t
-_create_lpm_map(
-    _In_ const ebpf_map_definition_in_memory_t* map_definition,
-    ebpf_handle_t inner_map_handle,
-    _Outptr_ ebpf_core_map_t** map)
+/**
+ * @brief Get the bit of a prefix at a given position, counting from the most
+ * significant bit of the first byte.
+ *
+ * @param[in] prefix Prefix to read from.
+ * @param[in] index Position of the bit.
+ * @return Value of the bit.
+ */
+static inline uint32_t
+_lpm_trie_bit(_In_ const uint8_t* prefix, uint32_t index)
 {
-    ebpf_result_t result = EBPF_SUCCESS;
-    size_t max_prefix_length = (map_definition->key_size - sizeof(uint32_t)) * 8 + 1;
-    ebpf_core_lpm_map_t* lpm_map = NULL;
-
-    EBPF_LOG_ENTRY();
+    return (prefix[index / 8] >> (7 - (index % 8))) & 1;
+}
 
-    *map = NULL;
+/**
+ * @brief Count the leading bits two prefixes have in common.
+ *
+ * @param[in] prefix_a First prefix.
+ * @param[in] prefix_b Second prefix.
+ * @param[in] limit Maximum number of bits to compare.
+ * @return Number of matching leading bits, at most limit.
+ */
+static inline uint32_t
+_lpm_trie_match_length(_In_ const uint8_t* prefix_a, _In_ const uint8_t* prefix_b, uint32_t limit)
+{
+    uint32_t length = 0;
+    while (length < limit) {
+        uint8_t difference = prefix_a[length / 8] ^ prefix_b[length / 8];
+        if (difference) {
+            while (!(difference & 0x80)) {
+                difference <<= 1;
+                length++;
+            }
+            break;
+        }
+        length += 8;
+    }
+    return length < limit ? length : limit;
+}
 
-    if (inner_map_handle != ebpf_handle_invalid) {
-        result = EBPF_INVALID_ARGUMENT;
-        goto Exit;
+/**
+ * @brief Allocate a trie node for a prefix.
+ *
+ * @param[in] lpm_map Map the node belongs to.
+ * @param[in] prefix Prefix bytes of the node.
+ * @param[in] prefix_length Length of the prefix in bits.
+ * @param[in] value Value stored for the prefix or NULL.
+ * @return Pointer to the node or NULL if out of memory.
+ */
+static _Ret_maybenull_ ebpf_lpm_trie_node_t*
+_lpm_trie_allocate_node(
+    _In_ const ebpf_core_lpm_map_t* lpm_map,
+    _In_ const uint8_t* prefix,
+    uint32_t prefix_length,
+    _In_opt_ uint8_t* value)
+{
+    size_t prefix_size = lpm_map->core_map.ebpf_map_definition.key_size - sizeof(uint32_t);
+    ebpf_lpm_trie_node_t* node = ebpf_epoch_allocate(EBPF_OFFSET_OF(ebpf_lpm_trie_node_t, prefix) + prefix_size);
+    if (!node) {
+        return NULL;
     }
+    memcpy(node->prefix, prefix, prefix_size);
+    node->prefix_length = prefix_length;
+    node->value = value;
+    return node;
+}
 
-    result = _create_hash_map_internal(
-        EBPF_OFFSET_OF(ebpf_core_lpm_map_t, data) + ebpf_bitmap_size(max_prefix_length),
-        map_definition,
-        _lpm_extract,
-        (ebpf_core_map_t**)&lpm_map);
-    if (result != EBPF_SUCCESS)
-        goto Exit;
-    lpm_map->max_prefix = (uint32_t)max_prefix_length;
-    ebpf_bitmap_initialize((ebpf_bitmap_t*)lpm_map->data, max_prefix_length);
+/**
+ * @brief Replace the node in a slot of the trie, making the new node and
+ * everything reachable from it visible to readers.
+ *
+ * @param[in, out] slot Root or child pointer to update.
+ * @param[in] node Node to store in the slot or NULL.
+ */
+static inline void
+_lpm_trie_publish(_Inout_ ebpf_lpm_trie_node_t* volatile* slot, _In_opt_ ebpf_lpm_trie_node_t* node)
+{
+    ebpf_interlocked_compare_exchange_pointer((void* volatile*)slot, node, *slot);
+}
 
-    *map = &lpm_map->core_map;
+/**
+ * @brief Find the value of the longest prefix in the trie that matches a
+ * prefix. Safe to call without the map lock while in an epoch.
+ *
+ * @param[in] lpm_map Map to search.
+ * @param[in] prefix Prefix to match.
+ * @param[in] prefix_length Number of bits of prefix to match.
+ * @return Value of the longest matching prefix or NULL if none match.
+ */
+static _Ret_maybenull_ uint8_t*
+_lpm_trie_find(_In_ const ebpf_core_lpm_map_t* lpm_map, _In_ const uint8_t* prefix, uint32_t prefix_length)
+{
+    uint8_t* found = NULL;
+    const ebpf_lpm_trie_node_t* node = lpm_map->root;
 
-Exit:
-    EBPF_RETURN_RESULT(result);
+    while (node) {
+        if (node->prefix_length > prefix_length ||
+            _lpm_trie_match_length(node->prefix, prefix, node->prefix_length) != node->prefix_length) {
+            break;
+        }
+        uint8_t* value = node->value;
+        if (value) {
+            found = value;
+        }
+        if (node->prefix_length == prefix_length) {
+            break;
+        }
+        node = node->children[_lpm_trie_bit(prefix, node->prefix_length)];
+    }
+    return found;
 }
 
+/**
+ * @brief Insert a prefix into the trie or update the value of an existing
+ * prefix. Must be called with the map lock held.
+ *
+ * @param[in] lpm_map Map to update.
+ * @param[in] prefix Prefix to insert.
+ * @param[in] prefix_length Length of the prefix in bits.
+ * @param[in] value Value stored for the prefix.
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_NO_MEMORY Unable to allocate resources for this prefix.
+ */
 static ebpf_result_t
-_find_lpm_map_entry(
-    _In_ ebpf_core_map_t* map, _In_ const uint8_t* key, _In_ bool delete_on_success, _Outptr_ uint8_t** data)
-{
-    uint32_t* prefix_length = (uint32_t*)key;
-    uint32_t original_prefix_length = *prefix_length;
-    uint8_t* value = NULL;
-    ebpf_core_lpm_map_t* trie_map = EBPF_FROM_FIELD(ebpf_core_lpm_map_t, core_map, map);
-    if (!map || !key || delete_on_success)
-        return EBPF_INVALID_ARGUMENT;
-
-    ebpf_bitmap_cursor_t cursor;
-    ebpf_bitmap_start_reverse_search((ebpf_bitmap_t*)trie_map->data, &cursor);
-    while (*prefix_length != MAXUINT32) {
-        *prefix_length = (uint32_t)ebpf_bitmap_reverse_search_next_bit(&cursor);
-        if (_find_hash_map_entry(map, key, false, &value) == EBPF_SUCCESS) {
+_lpm_trie_insert(
+    _Inout_ ebpf_core_lpm_map_t* lpm_map, _In_ const uint8_t* prefix, uint32_t prefix_length, _In_ uint8_t* value)
+{
+    ebpf_lpm_trie_node_t* volatile* slot = &lpm_map->root;
+    ebpf_lpm_trie_node_t* node;
+    ebpf_lpm_trie_node_t* new_node;
+    ebpf_lpm_trie_node_t* intermediate_node;
+    uint32_t match_length = 0;
+
+    // Find the first node that isn't a prefix of the new prefix, or the node for the prefix itself.
+    while ((node = *slot) != NULL) {
+        uint32_t limit = node->prefix_length < prefix_length ? node->prefix_length : prefix_length;
+        match_length = _lpm_trie_match_length(node->prefix, prefix, limit);
+        if (match_length != node->prefix_length || node->prefix_length == prefix_length) {
             break;
         }
+        slot = &node->children[_lpm_trie_bit(prefix, node->prefix_length)];
     }
-    *prefix_length = original_prefix_length;
 
-    if (!value) {
-        return EBPF_KEY_NOT_FOUND;
-    } else {
-        *data = value;
+    if (node && match_length == node->prefix_length) {
+        // The prefix is already in the trie, possibly as an intermediate node.
+        node->value = value;
         return EBPF_SUCCESS;
     }
-}
 
-static ebpf_result_t
-_update_lpm_map_entry(
-    _In_ ebpf_core_map_t* map, _In_ const uint8_t* key, _In_opt_ const uint8_t* data, ebpf_map_option_t option)
-{
-    ebpf_core_lpm_map_t* trie_map = EBPF_FROM_FIELD(ebpf_core_lpm_map_t, core_map, map);
-    uint32_t prefix_length = *(uint32_t*)key;
-    if (prefix_length > trie_map->max_prefix) {
-        return EBPF_INVALID_ARGUMENT;
+    new_node = _lpm_trie_allocate_node(lpm_map, prefix, prefix_length, value);
+    if (!new_node) {
+        return EBPF_NO_MEMORY;
     }
 
-    ebpf_result_t result = _update_hash_map_entry(map, key, data, option);
-    if (result == EBPF_SUCCESS) {
-        ebpf_bitmap_set_bit((ebpf_bitmap_t*)trie_map->data, prefix_length, true);
+    if (!node) {
+        _lpm_trie_publish(slot, new_node);
+        return EBPF_SUCCESS;
+    }
+
+    if (match_length == prefix_length) {
+        // The new prefix is a prefix of the node, so it goes above it.
+        new_node->children[_lpm_trie_bit(node->prefix, prefix_length)] = node;
+        _lpm_trie_publish(slot, new_node);
+        return EBPF_SUCCESS;
+    }
+
+    // The prefixes diverge after match_length bits, so join them with an intermediate node.
+    intermediate_node = _lpm_trie_allocate_node(lpm_map, prefix, match_length, NULL);
+    if (!intermediate_node) {
+        ebpf_epoch_free(new_node);
+        return EBPF_NO_MEMORY;
+    }
+    intermediate_node->children[_lpm_trie_bit(prefix, match_length)] = new_node;
+    intermediate_node->children[_lpm_trie_bit(node->prefix, match_length)] = node;
+    _lpm_trie_publish(slot, intermediate_node);
+    return EBPF_SUCCESS;
+}
+
+/**
+ * @brief Remove a prefix from the trie. Must be called with the map lock held.
+ *
+ * @param[in] lpm_map Map to update.
+ * @param[in] prefix Prefix to remove.
+ * @param[in] prefix_length Length of the prefix in bits.
+ */
+static void
+_lpm_trie_remove(_Inout_ ebpf_core_lpm_map_t* lpm_map, _In_ const uint8_t* prefix, uint32_t prefix_length)
+{
+    ebpf_lpm_trie_node_t* volatile* slot = &lpm_map->root;
+    ebpf_lpm_trie_node_t* volatile* parent_slot = NULL;
+    ebpf_lpm_trie_node_t* parent = NULL;
+    ebpf_lpm_trie_node_t* node;
+
+    while ((node = *slot) != NULL) {
+        if (node->prefix_length > prefix_length ||
+            _lpm_trie_match_length(node->prefix, prefix, node->prefix_length) != node->prefix_length) {
+            return;
+        }
+        if (node->prefix_length == prefix_length) {
+            break;
+        }
+        parent = node;
+        parent_slot = slot;
+        slot = &node->children[_lpm_trie_bit(prefix, node->prefix_length)];
+    }
+
+    if (!node || !node->value) {
+        return;
+    }
+
+    if (node->children[0] && node->children[1]) {
+        // The node still joins two subtries.
+        node->value = NULL;
+        return;
+    }
+
+    if (!node->children[0] && !node->children[1] && parent && !parent->value) {
+        // Removing a leaf leaves its intermediate parent with a single child, so remove the parent too.
+        _lpm_trie_publish(parent_slot, parent->children[parent->children[0] == node ? 1 : 0]);
+        ebpf_epoch_free(parent);
+        ebpf_epoch_free(node);
+        return;
+    }
+
+    _lpm_trie_publish(slot, node->children[0] ? node->children[0] : node->children[1]);
+    ebpf_epoch_free(node);
+}
+
+static ebpf_result_t
+_create_lpm_map(
+    _In_ const ebpf_map_definition_in_memory_t* map_definition,
+    ebpf_handle_t inner_map_handle,
+    _Outptr_ ebpf_core_map_t** map)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_core_lpm_map_t* lpm_map = NULL;
+
+    EBPF_LOG_ENTRY();
+
+    *map = NULL;
+
+    if (inner_map_handle != ebpf_handle_invalid || map_definition->key_size <= sizeof(uint32_t)) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    result = _create_hash_map_internal(
+        sizeof(ebpf_core_lpm_map_t), map_definition, 0, _lpm_extract, NULL, (ebpf_core_map_t**)&lpm_map);
+    if (result != EBPF_SUCCESS)
+        goto Exit;
+    ebpf_lock_create(&lpm_map->lock);
+    lpm_map->max_prefix = (uint32_t)((map_definition->key_size - sizeof(uint32_t)) * 8);
+    lpm_map->root = NULL;
+
+    *map = &lpm_map->core_map;
+
+Exit:
+    EBPF_RETURN_RESULT(result);
+}
+
+static void
+_delete_lpm_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
+{
+    ebpf_core_lpm_map_t* lpm_map = EBPF_FROM_FIELD(ebpf_core_lpm_map_t, core_map, map);
+    ebpf_lpm_trie_node_t* node = lpm_map->root;
+
+    // Free the trie without recursion by rotating left children up until each node has none.
+    while (node) {
+        ebpf_lpm_trie_node_t* next = node->children[0];
+        if (next) {
+            node->children[0] = next->children[1];
+            next->children[1] = node;
+        } else {
+            next = node->children[1];
+            ebpf_epoch_free(node);
+        }
+        node = next;
+    }
+
+    ebpf_lock_destroy(&lpm_map->lock);
+    _delete_hash_map(map);
+}
+
+static ebpf_result_t
+_find_lpm_map_entry(
+    _In_ ebpf_core_map_t* map, _In_ const uint8_t* key, _In_ bool delete_on_success, _Outptr_ uint8_t** data)
+{
+    if (!map || !key || delete_on_success)
+        return EBPF_INVALID_ARGUMENT;
+
+    ebpf_core_lpm_map_t* lpm_map = EBPF_FROM_FIELD(ebpf_core_lpm_map_t, core_map, map);
+    uint32_t prefix_length = *(uint32_t*)key;
+    if (prefix_length > lpm_map->max_prefix) {
+        prefix_length = lpm_map->max_prefix;
+    }
+
+    uint8_t* value = _lpm_trie_find(lpm_map, key + sizeof(uint32_t), prefix_length);
+    if (!value) {
+        return EBPF_KEY_NOT_FOUND;
+    } else {
+        *data = value;
+        return EBPF_SUCCESS;
     }
+}
+
+static ebpf_result_t
+_update_lpm_map_entry(
+    _In_ ebpf_core_map_t* map, _In_ const uint8_t* key, _In_opt_ const uint8_t* data, ebpf_map_option_t option)
+{
+    ebpf_core_lpm_map_t* lpm_map = EBPF_FROM_FIELD(ebpf_core_lpm_map_t, core_map, map);
+    uint32_t prefix_length = *(uint32_t*)key;
+    uint8_t* value;
+    if (prefix_length > lpm_map->max_prefix) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+
+    ebpf_lock_state_t state = ebpf_lock_lock(&lpm_map->lock);
+    ebpf_result_t result = _update_hash_map_entry(map, key, data, option);
+    if (result != EBPF_SUCCESS) {
+        goto Done;
+    }
+
+    // The value is replaced on every update, so the trie has to be pointed at the new one.
+    result = ebpf_hash_table_find((ebpf_hash_table_t*)map->data, key, &value);
+    ebpf_assert(result == EBPF_SUCCESS);
+    if (result != EBPF_SUCCESS) {
+        goto Done;
+    }
+
+    result = _lpm_trie_insert(lpm_map, key + sizeof(uint32_t), prefix_length, value);
+    if (result != EBPF_SUCCESS) {
+        (void)ebpf_hash_table_delete((ebpf_hash_table_t*)map->data, key);
+    }
+
+Done:
+    ebpf_lock_unlock(&lpm_map->lock, state);
+    return result;
+}
+
+static ebpf_result_t
+_delete_lpm_map_entry(_In_ ebpf_core_map_t* map, _In_ const uint8_t* key)
+{
+    if (!map || !key)
+        return EBPF_INVALID_ARGUMENT;
+
+    ebpf_core_lpm_map_t* lpm_map = EBPF_FROM_FIELD(ebpf_core_lpm_map_t, core_map, map);
+    uint32_t prefix_length = *(uint32_t*)key;
+    if (prefix_length > lpm_map->max_prefix) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+
+    ebpf_lock_state_t state = ebpf_lock_lock(&lpm_map->lock);
+    ebpf_result_t result = ebpf_hash_table_delete((ebpf_hash_table_t*)map->data, key);
+    if (result == EBPF_SUCCESS) {
+        _lpm_trie_remove(lpm_map, key + sizeof(uint32_t), prefix_length);
+    }
+    ebpf_lock_unlock(&lpm_map->lock, state);
     return result;
 }
 
@@ -1413,14 +2061,53 @@ static _Requires_lock_held_(ring_buffer_map->lock) void _ebpf_ring_buffer_map_si
     }
 }
 
+static bool
+_ebpf_ring_buffer_map_watermark_reached(_In_ const ebpf_core_ring_buffer_map_t* ring_buffer_map)
+{
+    size_t consumer_offset;
+    size_t producer_offset;
+    ebpf_ring_buffer_query((ebpf_ring_buffer_t*)ring_buffer_map->core_map.data, &consumer_offset, &producer_offset);
+    size_t available = producer_offset - consumer_offset;
+    return (available != 0) && (available >= ring_buffer_map->wakeup_watermark);
+}
+
+/**
+ * @brief Complete the pending async query, if any, after a producer has added a record.
+ *
+ * Producers only take the map lock once the wakeup watermark is reached, so a consumer that asked for batches
+ * isn't woken and the producer doesn't contend on the lock for every record.
+ */
 static void
-_delete_ring_buffer_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
+_ebpf_ring_buffer_map_notify(_In_ ebpf_core_ring_buffer_map_t* ring_buffer_map, uint64_t flags)
+{
+    if (flags & BPF_RB_NO_WAKEUP) {
+        return;
+    }
+
+    // Order publishing the record before checking for a pending query. This pairs with the barrier in
+    // ebpf_ring_buffer_map_async_query, so either the producer sees the query or the query sees the record.
+    MemoryBarrier();
+    if (!ring_buffer_map->async_contexts_trip_wire) {
+        return;
+    }
+    if (!(flags & BPF_RB_FORCE_WAKEUP) && !_ebpf_ring_buffer_map_watermark_reached(ring_buffer_map)) {
+        return;
+    }
+
+    ebpf_lock_state_t state = ebpf_lock_lock(&ring_buffer_map->lock);
+    _ebpf_ring_buffer_map_signal_async_query_complete(ring_buffer_map);
+    ebpf_lock_unlock(&ring_buffer_map->lock, state);
+}
+
+static void
+_ebpf_ring_buffer_map_delete_ring(_In_ _Post_invalid_ ebpf_core_ring_buffer_map_t* ring_buffer_map)
 {
     EBPF_LOG_ENTRY();
+    ebpf_core_map_t* map = &ring_buffer_map->core_map;
+
     // Free the ring buffer.
     ebpf_ring_buffer_destroy((ebpf_ring_buffer_t*)map->data);
 
-    ebpf_core_ring_buffer_map_t* ring_buffer_map = EBPF_FROM_FIELD(ebpf_core_ring_buffer_map_t, core_map, map);
     // Snap the async context list.
     ebpf_list_entry_t temp_list;
     ebpf_list_initialize(&temp_list);
@@ -1441,23 +2128,16 @@ _delete_ring_buffer_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
 }
 
 static ebpf_result_t
-_create_ring_buffer_map(
+_ebpf_ring_buffer_map_create_ring(
     _In_ const ebpf_map_definition_in_memory_t* map_definition,
-    ebpf_handle_t inner_map_handle,
-    _Outptr_ ebpf_core_map_t** map)
+    bool timestamped,
+    _Outptr_ ebpf_core_ring_buffer_map_t** ring)
 {
     ebpf_result_t result;
     ebpf_core_ring_buffer_map_t* ring_buffer_map = NULL;
     ebpf_ring_buffer_t* ring_buffer = NULL;
 
-    EBPF_LOG_ENTRY();
-
-    *map = NULL;
-
-    if (inner_map_handle != ebpf_handle_invalid) {
-        result = EBPF_INVALID_ARGUMENT;
-        goto Exit;
-    }
+    *ring = NULL;
 
     ring_buffer_map = ebpf_epoch_allocate(sizeof(ebpf_core_ring_buffer_map_t));
     if (ring_buffer_map == NULL) {
@@ -1467,15 +2147,18 @@ _create_ring_buffer_map(
     memset(ring_buffer_map, 0, sizeof(ebpf_core_ring_buffer_map_t));
 
     ring_buffer_map->core_map.ebpf_map_definition = *map_definition;
-    result =
-        ebpf_ring_buffer_create((ebpf_ring_buffer_t**)&ring_buffer_map->core_map.data, map_definition->max_entries);
+    ring_buffer_map->timestamped = timestamped;
+    result = ebpf_ring_buffer_create_with_flags(
+        (ebpf_ring_buffer_t**)&ring_buffer_map->core_map.data,
+        map_definition->max_entries,
+        (map_definition->map_flags & BPF_F_RB_OVERWRITE) ? EBPF_RING_BUFFER_FLAG_OVERWRITE : 0);
     if (result != EBPF_SUCCESS)
         goto Exit;
     ring_buffer = (ebpf_ring_buffer_t*)ring_buffer_map->core_map.data;
 
     ebpf_list_initialize(&ring_buffer_map->async_contexts);
 
-    *map = &ring_buffer_map->core_map;
+    *ring = ring_buffer_map;
     ring_buffer = NULL;
     ring_buffer_map = NULL;
 
@@ -1483,30 +2166,247 @@ Exit:
     ebpf_ring_buffer_destroy(ring_buffer);
     ebpf_epoch_free(ring_buffer_map);
 
+    return result;
+}
+
+static void
+_delete_ring_buffer_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
+{
+    _ebpf_ring_buffer_map_delete_ring(EBPF_FROM_FIELD(ebpf_core_ring_buffer_map_t, core_map, map));
+}
+
+static ebpf_result_t
+_create_ring_buffer_map(
+    _In_ const ebpf_map_definition_in_memory_t* map_definition,
+    ebpf_handle_t inner_map_handle,
+    _Outptr_ ebpf_core_map_t** map)
+{
+    ebpf_result_t result;
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = NULL;
+
+    EBPF_LOG_ENTRY();
+
+    *map = NULL;
+
+    if (inner_map_handle != ebpf_handle_invalid) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    result = _ebpf_ring_buffer_map_create_ring(map_definition, false, &ring_buffer_map);
+    if (result != EBPF_SUCCESS)
+        goto Exit;
+
+    *map = &ring_buffer_map->core_map;
+
+Exit:
     EBPF_RETURN_RESULT(result);
 }
 
+static void
+_delete_per_cpu_ring_buffer_map(_In_ _Post_invalid_ ebpf_core_map_t* map)
+{
+    EBPF_LOG_ENTRY();
+    ebpf_core_per_cpu_ring_buffer_map_t* per_cpu_map =
+        EBPF_FROM_FIELD(ebpf_core_per_cpu_ring_buffer_map_t, core_map, map);
+
+    for (uint32_t i = 0; i < per_cpu_map->ring_count; i++) {
+        _ebpf_ring_buffer_map_delete_ring(per_cpu_map->rings[i]);
+    }
+    ebpf_epoch_free(per_cpu_map);
+    EBPF_RETURN_VOID();
+}
+
+static ebpf_result_t
+_create_per_cpu_ring_buffer_map(
+    _In_ const ebpf_map_definition_in_memory_t* map_definition,
+    ebpf_handle_t inner_map_handle,
+    _Outptr_ ebpf_core_map_t** map)
+{
+    ebpf_result_t result;
+    ebpf_core_per_cpu_ring_buffer_map_t* per_cpu_map = NULL;
+    uint32_t cpu_count = ebpf_get_cpu_count();
+    size_t per_cpu_map_size;
+
+    EBPF_LOG_ENTRY();
+
+    *map = NULL;
+
+    if (inner_map_handle != ebpf_handle_invalid) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    result = ebpf_safe_size_t_multiply(sizeof(ebpf_core_ring_buffer_map_t*), cpu_count, &per_cpu_map_size);
+    if (result != EBPF_SUCCESS)
+        goto Exit;
+
+    result = ebpf_safe_size_t_add(
+        EBPF_OFFSET_OF(ebpf_core_per_cpu_ring_buffer_map_t, rings), per_cpu_map_size, &per_cpu_map_size);
+    if (result != EBPF_SUCCESS)
+        goto Exit;
+
+    per_cpu_map = ebpf_epoch_allocate(per_cpu_map_size);
+    if (per_cpu_map == NULL) {
+        result = EBPF_NO_MEMORY;
+        goto Exit;
+    }
+    memset(per_cpu_map, 0, per_cpu_map_size);
+
+    per_cpu_map->core_map.ebpf_map_definition = *map_definition;
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        result = _ebpf_ring_buffer_map_create_ring(map_definition, true, &per_cpu_map->rings[i]);
+        if (result != EBPF_SUCCESS)
+            goto Exit;
+        per_cpu_map->ring_count++;
+    }
+
+    *map = &per_cpu_map->core_map;
+    per_cpu_map = NULL;
+
+Exit:
+    if (per_cpu_map) {
+        _delete_per_cpu_ring_buffer_map(&per_cpu_map->core_map);
+    }
+
+    EBPF_RETURN_RESULT(result);
+}
+
+/**
+ * @brief Find one of the rings of a ring buffer map.
+ *
+ * @param[in] map Map of type BPF_MAP_TYPE_RINGBUF or BPF_MAP_TYPE_PERCPU_RINGBUF.
+ * @param[in] ring_index Index of the ring, which is always 0 for BPF_MAP_TYPE_RINGBUF maps.
+ * @return The ring, or NULL if the map isn't a ring buffer map or has no such ring.
+ */
+static _Ret_maybenull_ ebpf_core_ring_buffer_map_t*
+_ebpf_ring_buffer_map_get_ring(_In_ const ebpf_map_t* map, uint32_t ring_index)
+{
+    if (map->ebpf_map_definition.type == BPF_MAP_TYPE_RINGBUF) {
+        return (ring_index == 0) ? EBPF_FROM_FIELD(ebpf_core_ring_buffer_map_t, core_map, map) : NULL;
+    }
+    if (map->ebpf_map_definition.type == BPF_MAP_TYPE_PERCPU_RINGBUF) {
+        ebpf_core_per_cpu_ring_buffer_map_t* per_cpu_map =
+            EBPF_FROM_FIELD(ebpf_core_per_cpu_ring_buffer_map_t, core_map, map);
+        return (ring_index < per_cpu_map->ring_count) ? per_cpu_map->rings[ring_index] : NULL;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the ring a producer running on the current CPU writes to. Producers that are preempted and resume
+ * on another CPU still write to the ring they started with, which is safe as rings accept records from any CPU.
+ */
+static _Ret_maybenull_ ebpf_core_ring_buffer_map_t*
+_ebpf_ring_buffer_map_get_producer_ring(_In_ const ebpf_map_t* map)
+{
+    uint32_t ring_index = 0;
+    if (map->ebpf_map_definition.type == BPF_MAP_TYPE_PERCPU_RINGBUF) {
+        ring_index = ebpf_get_current_cpu();
+    }
+    return _ebpf_ring_buffer_map_get_ring(map, ring_index);
+}
+
+/**
+ * @brief Reserve a record in a ring, skipping over the timestamp header on timestamped rings.
+ */
+static ebpf_result_t
+_ebpf_ring_buffer_map_reserve_record(
+    _Inout_ ebpf_core_ring_buffer_map_t* ring_buffer_map, size_t length, _Outptr_ uint8_t** data)
+{
+    ebpf_ring_buffer_t* ring_buffer = (ebpf_ring_buffer_t*)ring_buffer_map->core_map.data;
+    if (!ring_buffer_map->timestamped) {
+        return ebpf_ring_buffer_reserve(ring_buffer, data, length);
+    }
+
+    uint8_t* record_data;
+    ebpf_result_t result =
+        ebpf_ring_buffer_reserve(ring_buffer, &record_data, length + sizeof(ebpf_per_cpu_ring_buffer_record_header_t));
+    if (result != EBPF_SUCCESS) {
+        return result;
+    }
+    ((ebpf_per_cpu_ring_buffer_record_header_t*)record_data)->timestamp = ebpf_query_time_since_boot(false);
+    *data = record_data + sizeof(ebpf_per_cpu_ring_buffer_record_header_t);
+    return EBPF_SUCCESS;
+}
+
+uint32_t
+ebpf_ring_buffer_map_get_ring_count(_In_ const ebpf_map_t* map)
+{
+    if (map->ebpf_map_definition.type == BPF_MAP_TYPE_PERCPU_RINGBUF) {
+        return EBPF_FROM_FIELD(ebpf_core_per_cpu_ring_buffer_map_t, core_map, map)->ring_count;
+    }
+    return (map->ebpf_map_definition.type == BPF_MAP_TYPE_RINGBUF) ? 1 : 0;
+}
+
 ebpf_result_t
-ebpf_ring_buffer_map_output(_In_ ebpf_core_map_t* map, _In_reads_bytes_(length) uint8_t* data, size_t length)
+ebpf_ring_buffer_map_output(
+    _In_ ebpf_core_map_t* map, _In_reads_bytes_(length) uint8_t* data, size_t length, uint64_t flags)
 {
     ebpf_result_t result = EBPF_SUCCESS;
 
     EBPF_LOG_ENTRY();
 
-    result = ebpf_ring_buffer_output((ebpf_ring_buffer_t*)map->data, data, length);
-    if (result != EBPF_SUCCESS)
+    if (flags & ~(BPF_RB_NO_WAKEUP | BPF_RB_FORCE_WAKEUP)) {
+        result = EBPF_INVALID_ARGUMENT;
         goto Exit;
+    }
 
-    ebpf_core_ring_buffer_map_t* ring_buffer_map = EBPF_FROM_FIELD(ebpf_core_ring_buffer_map_t, core_map, map);
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_producer_ring(map);
+    if (ring_buffer_map == NULL) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
 
-    ebpf_lock_state_t state = ebpf_lock_lock(&ring_buffer_map->lock);
-    _ebpf_ring_buffer_map_signal_async_query_complete(ring_buffer_map);
-    ebpf_lock_unlock(&ring_buffer_map->lock, state);
+    if (ring_buffer_map->timestamped) {
+        uint8_t* record_data;
+        if (_ebpf_ring_buffer_map_reserve_record(ring_buffer_map, length, &record_data) != EBPF_SUCCESS) {
+            result = EBPF_OUT_OF_SPACE;
+            goto Exit;
+        }
+        memcpy(record_data, data, length);
+        result = ebpf_ring_buffer_submit(record_data - sizeof(ebpf_per_cpu_ring_buffer_record_header_t));
+    } else {
+        result = ebpf_ring_buffer_output((ebpf_ring_buffer_t*)ring_buffer_map->core_map.data, data, length);
+    }
+    if (result != EBPF_SUCCESS)
+        goto Exit;
+
+    _ebpf_ring_buffer_map_notify(ring_buffer_map, flags);
 
 Exit:
     EBPF_RETURN_RESULT(result);
 }
 
+ebpf_result_t
+ebpf_ring_buffer_map_set_wakeup_watermark(_In_ ebpf_map_t* map, size_t wakeup_watermark)
+{
+    EBPF_LOG_ENTRY();
+    uint32_t ring_count = ebpf_ring_buffer_map_get_ring_count(map);
+    if (ring_count == 0) {
+        EBPF_RETURN_RESULT(EBPF_INVALID_ARGUMENT);
+    }
+
+    // A record can never fill the whole ring, so a watermark this large would never be reached.
+    if (wakeup_watermark >= map->ebpf_map_definition.max_entries) {
+        EBPF_RETURN_RESULT(EBPF_INVALID_ARGUMENT);
+    }
+
+    // Each ring of a per-CPU map wakes its consumer on its own.
+    for (uint32_t i = 0; i < ring_count; i++) {
+        ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, i);
+        ebpf_lock_state_t state = ebpf_lock_lock(&ring_buffer_map->lock);
+        ring_buffer_map->wakeup_watermark = wakeup_watermark;
+        // Lowering the watermark can satisfy a query that is already pending.
+        if (_ebpf_ring_buffer_map_watermark_reached(ring_buffer_map)) {
+            _ebpf_ring_buffer_map_signal_async_query_complete(ring_buffer_map);
+        }
+        ebpf_lock_unlock(&ring_buffer_map->lock, state);
+    }
+
+    EBPF_RETURN_RESULT(EBPF_SUCCESS);
+}
+
 static void
 _ebpf_ring_buffer_map_cancel_async_query(_In_ _Frees_ptr_ void* cancel_context)
 {
@@ -1523,37 +2423,118 @@ _ebpf_ring_buffer_map_cancel_async_query(_In_ _Frees_ptr_ void* cancel_context)
 }
 
 ebpf_result_t
-ebpf_ring_buffer_map_query_buffer(_In_ const ebpf_map_t* map, _Outptr_ uint8_t** buffer)
+ebpf_ring_buffer_map_query_buffer(
+    _In_ const ebpf_map_t* map,
+    uint32_t ring_index,
+    uintptr_t instance,
+    _Outptr_ uint8_t** buffer,
+    _Outptr_ size_t** consumer_offset)
+{
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, ring_index);
+    if (ring_buffer_map == NULL) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+    return ebpf_ring_buffer_map_user(
+        (ebpf_ring_buffer_t*)ring_buffer_map->core_map.data, instance, buffer, consumer_offset);
+}
+
+/**
+ * @brief Release the views of the rings that a handle instance mapped into its process, and its freezes.
+ */
+static void
+_ebpf_ring_buffer_map_close_instance(_In_ const ebpf_map_t* map, uintptr_t instance)
 {
-    return ebpf_ring_buffer_map_buffer((ebpf_ring_buffer_t*)map->data, buffer);
+    uint32_t ring_count = ebpf_ring_buffer_map_get_ring_count(map);
+    for (uint32_t ring_index = 0; ring_index < ring_count; ring_index++) {
+        ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, ring_index);
+        ebpf_ring_buffer_close_instance((ebpf_ring_buffer_t*)ring_buffer_map->core_map.data, instance);
+    }
 }
 
 ebpf_result_t
-ebpf_ring_buffer_map_return_buffer(_In_ const ebpf_map_t* map, size_t consumer_offset)
+ebpf_ring_buffer_map_return_buffer(_In_ const ebpf_map_t* map, uint32_t ring_index, size_t consumer_offset)
 {
     size_t producer_offset;
     size_t old_consumer_offset;
     size_t consumed_data_length;
+    ebpf_result_t result;
     EBPF_LOG_ENTRY();
-    ebpf_ring_buffer_query((ebpf_ring_buffer_t*)map->data, &old_consumer_offset, &producer_offset);
-    ebpf_result_t result = ebpf_safe_size_t_subtract(consumer_offset, old_consumer_offset, &consumed_data_length);
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, ring_index);
+    if (ring_buffer_map == NULL) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+    ebpf_ring_buffer_t* ring_buffer = (ebpf_ring_buffer_t*)ring_buffer_map->core_map.data;
+    ebpf_ring_buffer_query(ring_buffer, &old_consumer_offset, &producer_offset);
+    // Producers on an overwriting map may already have dropped the records the consumer is returning.
+    if ((map->ebpf_map_definition.map_flags & BPF_F_RB_OVERWRITE) && (consumer_offset <= old_consumer_offset)) {
+        result = EBPF_SUCCESS;
+        goto Exit;
+    }
+    result = ebpf_safe_size_t_subtract(consumer_offset, old_consumer_offset, &consumed_data_length);
     if (result != EBPF_SUCCESS)
         goto Exit;
-    result = ebpf_ring_buffer_return((ebpf_ring_buffer_t*)map->data, consumed_data_length);
+    result = ebpf_ring_buffer_return(ring_buffer, consumed_data_length);
 Exit:
     EBPF_RETURN_RESULT(result);
 }
 
+ebpf_result_t
+ebpf_ring_buffer_map_freeze(
+    _In_ const ebpf_map_t* map,
+    uint32_t ring_index,
+    uintptr_t instance,
+    _Out_ size_t* consumer_offset,
+    _Out_ size_t* producer_offset)
+{
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, ring_index);
+    if (ring_buffer_map == NULL) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+    return ebpf_ring_buffer_freeze(
+        (ebpf_ring_buffer_t*)ring_buffer_map->core_map.data, instance, consumer_offset, producer_offset);
+}
+
+ebpf_result_t
+ebpf_ring_buffer_map_thaw(_In_ const ebpf_map_t* map, uint32_t ring_index, uintptr_t instance)
+{
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, ring_index);
+    if (ring_buffer_map == NULL) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+    return ebpf_ring_buffer_thaw((ebpf_ring_buffer_t*)ring_buffer_map->core_map.data, instance);
+}
+
+ebpf_result_t
+ebpf_ring_buffer_map_read(
+    _In_ const ebpf_map_t* map,
+    uint32_t ring_index,
+    size_t offset,
+    _Out_writes_bytes_(length) uint8_t* buffer,
+    size_t length)
+{
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, ring_index);
+    if (ring_buffer_map == NULL) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+    return ebpf_ring_buffer_read((ebpf_ring_buffer_t*)ring_buffer_map->core_map.data, offset, buffer, length);
+}
+
 ebpf_result_t
 ebpf_ring_buffer_map_async_query(
     _In_ ebpf_map_t* map,
+    uint32_t ring_index,
     _Inout_ ebpf_ring_buffer_map_async_query_result_t* async_query_result,
     _In_ void* async_context)
 {
     ebpf_result_t result = EBPF_PENDING;
     EBPF_LOG_ENTRY();
 
-    ebpf_core_ring_buffer_map_t* ring_buffer_map = EBPF_FROM_FIELD(ebpf_core_ring_buffer_map_t, core_map, map);
+    ebpf_core_ring_buffer_map_t* ring_buffer_map = _ebpf_ring_buffer_map_get_ring(map, ring_index);
+    if (ring_buffer_map == NULL) {
+        EBPF_RETURN_RESULT(EBPF_INVALID_ARGUMENT);
+    }
+    ebpf_ring_buffer_t* ring_buffer = (ebpf_ring_buffer_t*)ring_buffer_map->core_map.data;
 
     ebpf_lock_state_t state = ebpf_lock_lock(&ring_buffer_map->lock);
 
@@ -1580,11 +2561,17 @@ ebpf_ring_buffer_map_async_query(
     ebpf_list_insert_tail(&ring_buffer_map->async_contexts, &context->entry);
     ring_buffer_map->async_contexts_trip_wire = true;
 
-    // If there is already some data available in the ring buffer, indicate the results right away.
-    ebpf_ring_buffer_query(
-        (ebpf_ring_buffer_t*)map->data, &async_query_result->consumer, &async_query_result->producer);
+    // Order queueing the query before checking for data. This pairs with the barrier in
+    // _ebpf_ring_buffer_map_notify, which producers run without the lock.
+    MemoryBarrier();
+
+    // If enough data is already available in the ring buffer, indicate the results right away.
+    ebpf_ring_buffer_query(ring_buffer, &async_query_result->consumer, &async_query_result->producer);
 
-    if (async_query_result->producer != async_query_result->consumer)
+    // Unless the consumer is stuck behind a record that is still being written: it would find nothing it can read
+    // and query again straight away. The query is completed instead when the producer submits or discards it.
+    if (_ebpf_ring_buffer_map_watermark_reached(ring_buffer_map) &&
+        !ebpf_ring_buffer_is_oldest_record_locked(ring_buffer))
         _ebpf_ring_buffer_map_signal_async_query_complete(ring_buffer_map);
 
 Exit:
@@ -1684,17 +2671,17 @@ ebpf_map_function_table_t ebpf_map_function_tables[] = {
      NULL,
      _delete_hash_map_entry,
      _next_hash_map_key},
-    // LPM_TRIE is currently a hash-map with special behavior for find.
+    // LPM_TRIE stores entries in a hash-map and finds them with a trie.
     {// BPF_MAP_TYPE_LPM_TRIE
      _create_lpm_map,
-     _delete_hash_map,
+     _delete_lpm_map,
      NULL,
      _find_lpm_map_entry,
      NULL,
      _update_lpm_map_entry,
      NULL,
      NULL,
-     _delete_hash_map_entry,
+     _delete_lpm_map_entry,
      _next_hash_map_key},
     {// BPF_MAP_TYPE_QUEUE
      _create_queue_map,
@@ -1740,6 +2727,17 @@ ebpf_map_function_table_t ebpf_map_function_tables[] = {
      NULL,
      NULL,
      NULL},
+    {// BPF_MAP_TYPE_PERCPU_RINGBUF
+     _create_per_cpu_ring_buffer_map,
+     _delete_per_cpu_ring_buffer_map,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL,
+     NULL},
 };
 
 static void
@@ -1753,6 +2751,16 @@ _ebpf_map_delete(_In_ ebpf_object_t* object)
     EBPF_RETURN_VOID();
 }
 
+static void
+_ebpf_map_close_instance(_Inout_ ebpf_object_t* object, uintptr_t instance)
+{
+    const ebpf_map_t* map = (const ebpf_map_t*)object;
+
+    if (ebpf_ring_buffer_map_get_ring_count(map) != 0) {
+        _ebpf_ring_buffer_map_close_instance(map, instance);
+    }
+}
+
 ebpf_result_t
 ebpf_map_create(
     _In_ const ebpf_utf8_string_t* map_name,
@@ -1806,6 +2814,32 @@ ebpf_map_create(
         goto Exit;
     }
 
+    if (local_map_definition.map_flags & ~(BPF_F_UPDATE_IN_PLACE | BPF_F_RB_OVERWRITE)) {
+        EBPF_LOG_MESSAGE_UINT64(
+            EBPF_TRACELOG_LEVEL_ERROR,
+            EBPF_TRACELOG_KEYWORD_MAP,
+            "Unsupported map flags",
+            local_map_definition.map_flags);
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    if ((local_map_definition.map_flags & BPF_F_UPDATE_IN_PLACE) && (type != BPF_MAP_TYPE_HASH) &&
+        (type != BPF_MAP_TYPE_PERCPU_HASH)) {
+        EBPF_LOG_MESSAGE_UINT64(
+            EBPF_TRACELOG_LEVEL_ERROR, EBPF_TRACELOG_KEYWORD_MAP, "BPF_F_UPDATE_IN_PLACE not supported on map", type);
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
+    if ((local_map_definition.map_flags & BPF_F_RB_OVERWRITE) && (type != BPF_MAP_TYPE_RINGBUF) &&
+        (type != BPF_MAP_TYPE_PERCPU_RINGBUF)) {
+        EBPF_LOG_MESSAGE_UINT64(
+            EBPF_TRACELOG_LEVEL_ERROR, EBPF_TRACELOG_KEYWORD_MAP, "BPF_F_RB_OVERWRITE not supported on map", type);
+        result = EBPF_INVALID_ARGUMENT;
+        goto Exit;
+    }
+
     result = ebpf_map_function_tables[type].create_map(&local_map_definition, inner_map_handle, &local_map);
     if (result != EBPF_SUCCESS)
         goto Exit;
@@ -1823,6 +2857,7 @@ ebpf_map_create(
     if (result != EBPF_SUCCESS) {
         goto Exit;
     }
+    local_map->object.close_instance_function = _ebpf_map_close_instance;
 
     *ebpf_map = local_map;
 
@@ -1903,7 +2938,11 @@ ebpf_map_find_entry(
             return EBPF_INVALID_ARGUMENT;
         }
 
+        // Programs access values of in-place maps without the sequence number,
+        // so they may observe a partially written value.
         *(uint8_t**)value = return_value;
+    } else if (_is_in_place_map(map)) {
+        _read_in_place_value(map, return_value, value);
     } else {
         memcpy(value, return_value, map->ebpf_map_definition.value_size);
     }
@@ -1939,10 +2978,15 @@ ebpf_map_get_program_from_entry(_In_ ebpf_map_t* map, size_t key_size, _In_reads
         return NULL;
     }
 
-    if (ebpf_map_function_tables[type].get_object_from_entry == NULL) {
+    uint32_t index = *(uint32_t*)key;
+    if (index >= map->ebpf_map_definition.max_entries) {
         return NULL;
     }
-    return (ebpf_program_t*)ebpf_map_function_tables[type].get_object_from_entry(map, key);
+
+    // No lock or reference is needed: the entry's reference is only released after the
+    // entry is cleared, and the program is freed once the caller's epoch exits.
+    ebpf_core_object_map_t* program_array = EBPF_FROM_FIELD(ebpf_core_object_map_t, core_map, map);
+    return (ebpf_program_t*)program_array->objects[index];
 }
 
 ebpf_result_t
@@ -2064,6 +3108,138 @@ ebpf_map_next_key(
     return ebpf_map_function_tables[map->ebpf_map_definition.type].next_key(map, previous_key, next_key);
 }
 
+ebpf_result_t
+ebpf_map_lookup_batch(
+    _In_ ebpf_map_t* map,
+    size_t previous_key_size,
+    _In_reads_opt_(previous_key_size) const uint8_t* previous_key,
+    bool find_and_delete,
+    _Inout_ size_t* key_and_value_size,
+    _Out_writes_bytes_to_(*key_and_value_size, *key_and_value_size) uint8_t* key_and_value)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    size_t key_size = map->ebpf_map_definition.key_size;
+    size_t value_size = map->ebpf_map_definition.value_size;
+    size_t capacity = *key_and_value_size;
+    size_t offset = 0;
+    uint8_t* last_key = NULL;
+    bool have_last_key = false;
+
+    *key_and_value_size = 0;
+
+    if ((previous_key_size != 0 && previous_key_size != key_size) ||
+        ebpf_map_function_tables[map->ebpf_map_definition.type].next_key == NULL) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Done;
+    }
+
+    if (capacity < key_size + value_size) {
+        result = EBPF_INSUFFICIENT_BUFFER;
+        goto Done;
+    }
+
+    // The output may overlap previous_key, so keep a copy of the last key visited.
+    last_key = ebpf_allocate(key_size);
+    if (!last_key) {
+        result = EBPF_NO_MEMORY;
+        goto Done;
+    }
+    if (previous_key_size != 0) {
+        memcpy(last_key, previous_key, key_size);
+        have_last_key = true;
+    }
+
+    while (capacity - offset >= key_size + value_size) {
+        uint8_t* key = key_and_value + offset;
+        result = ebpf_map_next_key(map, key_size, have_last_key ? last_key : NULL, key);
+        if (result != EBPF_SUCCESS) {
+            break;
+        }
+        memcpy(last_key, key, key_size);
+        have_last_key = true;
+
+        result = ebpf_map_find_entry(
+            map, key_size, key, value_size, key + key_size, find_and_delete ? EPBF_MAP_FIND_FLAG_DELETE : 0);
+        if (result == EBPF_OBJECT_NOT_FOUND || result == EBPF_KEY_NOT_FOUND) {
+            // The entry was deleted after next_key returned it.
+            continue;
+        }
+        if (result != EBPF_SUCCESS) {
+            break;
+        }
+        offset += key_size + value_size;
+    }
+
+    // Return the entries already copied, which may have been deleted, and
+    // report running out of keys or any failure on the next call.
+    if (offset != 0) {
+        result = EBPF_SUCCESS;
+    }
+    if (result != EBPF_SUCCESS) {
+        goto Done;
+    }
+
+    *key_and_value_size = offset;
+
+Done:
+    ebpf_free(last_key);
+    return result;
+}
+
+ebpf_result_t
+ebpf_map_update_batch(
+    _In_ ebpf_map_t* map,
+    size_t key_and_value_size,
+    _In_reads_bytes_(key_and_value_size) const uint8_t* key_and_value,
+    ebpf_map_option_t option,
+    _Out_ size_t* count)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    size_t key_size = map->ebpf_map_definition.key_size;
+    size_t value_size = map->ebpf_map_definition.value_size;
+    size_t offset;
+
+    *count = 0;
+
+    if (key_and_value_size % (key_size + value_size) != 0) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+
+    for (offset = 0; offset < key_and_value_size; offset += key_size + value_size) {
+        result = ebpf_map_update_entry(
+            map, key_size, key_and_value + offset, value_size, key_and_value + offset + key_size, option, 0);
+        if (result != EBPF_SUCCESS) {
+            break;
+        }
+        (*count)++;
+    }
+    return result;
+}
+
+ebpf_result_t
+ebpf_map_delete_batch(
+    _In_ ebpf_map_t* map, size_t keys_size, _In_reads_bytes_(keys_size) const uint8_t* keys, _Out_ size_t* count)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    size_t key_size = map->ebpf_map_definition.key_size;
+    size_t offset;
+
+    *count = 0;
+
+    if (keys_size % key_size != 0) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+
+    for (offset = 0; offset < keys_size; offset += key_size) {
+        result = ebpf_map_delete_entry(map, key_size, keys + offset, 0);
+        if (result != EBPF_SUCCESS) {
+            break;
+        }
+        (*count)++;
+    }
+    return result;
+}
+
 ebpf_result_t
 ebpf_map_get_info(
     _In_ const ebpf_map_t* map, _Out_writes_to_(*info_size, *info_size) uint8_t* buffer, _Inout_ uint16_t* info_size)
@@ -2086,6 +3262,7 @@ ebpf_map_get_info(
     info->key_size = map->ebpf_map_definition.key_size;
     info->value_size = map->original_value_size;
     info->max_entries = map->ebpf_map_definition.max_entries;
+    info->map_flags = map->ebpf_map_definition.map_flags;
     if (info->type == BPF_MAP_TYPE_ARRAY_OF_MAPS || info->type == BPF_MAP_TYPE_HASH_OF_MAPS) {
         ebpf_core_object_map_t* object_map = EBPF_FROM_FIELD(ebpf_core_object_map_t, core_map, map);
         info->inner_map_id =
@@ -144,10 +144,75 @@ extern "C"
         _In_reads_opt_(key_size) const uint8_t* previous_key,
         _Out_writes_(key_size) uint8_t* next_key);
 
+    /**
+     * @brief Copy a sequence of keys and their values from the map, starting
+     * with the key that follows previous_key.
+     *
+     * @param[in] map Map to search.
+     * @param[in] previous_key_size Size of previous_key or 0 to start with the
+     *  first key.
+     * @param[in] previous_key Key to start after.
+     * @param[in] find_and_delete Remove each entry from the map once copied.
+     * @param[in, out] key_and_value_size On input, size of key_and_value. On
+     *  output, number of bytes written.
+     * @param[out] key_and_value Buffer that receives a sequence of key+value.
+     *  May overlap previous_key.
+     * @retval EBPF_SUCCESS The operation was successful.
+     * @retval EBPF_NO_MORE_KEYS There is no key following previous_key.
+     * @retval EBPF_INSUFFICIENT_BUFFER key_and_value can't hold a key and
+     *  value.
+     * @retval EBPF_INVALID_ARGUMENT One or more parameters are invalid.
+     * @retval EBPF_NO_MEMORY Unable to allocate resources for this
+     *  operation.
+     */
+    ebpf_result_t
+    ebpf_map_lookup_batch(
+        _In_ ebpf_map_t* map,
+        size_t previous_key_size,
+        _In_reads_opt_(previous_key_size) const uint8_t* previous_key,
+        bool find_and_delete,
+        _Inout_ size_t* key_and_value_size,
+        _Out_writes_bytes_to_(*key_and_value_size, *key_and_value_size) uint8_t* key_and_value);
+
+    /**
+     * @brief Insert or update a sequence of entries in the map, stopping at
+     * the first failure.
+     *
+     * @param[in] map Map to update.
+     * @param[in] key_and_value_size Size of key_and_value.
+     * @param[in] key_and_value Sequence of key+value to write.
+     * @param[in] option One of ebpf_map_option_t options.
+     * @param[out] count Number of entries written.
+     * @retval EBPF_SUCCESS The operation was successful.
+     * @retval EBPF_INVALID_ARGUMENT One or more parameters are invalid.
+     */
+    ebpf_result_t
+    ebpf_map_update_batch(
+        _In_ ebpf_map_t* map,
+        size_t key_and_value_size,
+        _In_reads_bytes_(key_and_value_size) const uint8_t* key_and_value,
+        ebpf_map_option_t option,
+        _Out_ size_t* count);
+
+    /**
+     * @brief Remove a sequence of keys from the map, stopping at the first
+     * failure.
+     *
+     * @param[in] map Map to update.
+     * @param[in] keys_size Size of keys.
+     * @param[in] keys Sequence of keys to remove.
+     * @param[out] count Number of entries removed.
+     * @retval EBPF_SUCCESS The operation was successful.
+     * @retval EBPF_INVALID_ARGUMENT One or more parameters are invalid.
+     */
+    ebpf_result_t
+    ebpf_map_delete_batch(
+        _In_ ebpf_map_t* map, size_t keys_size, _In_reads_bytes_(keys_size) const uint8_t* keys, _Out_ size_t* count);
+
     /**
      * @brief Get a program from an entry in a map that holds programs.  The
-     * program returned holds a reference that the caller is responsible for
-     * releasing.
+     * program returned does not hold a reference; the caller must be in an
+     * epoch and must not use the program after leaving it.
      *
      * @param[in] map Map to search.
      * @param[in] key Pointer to key to search for.
@@ -188,53 +253,150 @@ extern "C"
         _Inout_ uint16_t* info_size);
 
     /**
-     * @brief Get pointer to the ring buffer map's shared data.
+     * @brief Get the number of rings in a ring buffer map. BPF_MAP_TYPE_RINGBUF maps have a single ring and
+     * BPF_MAP_TYPE_PERCPU_RINGBUF maps have one ring per CPU. The consumer side functions below take the index
+     * of the ring to operate on.
+     *
+     * @param[in] map Ring buffer map to query.
+     * @return Number of rings, or 0 if the map isn't a ring buffer map.
+     */
+    uint32_t
+    ebpf_ring_buffer_map_get_ring_count(_In_ const ebpf_map_t* map);
+
+    /**
+     * @brief Map one of the ring buffer map's rings into the calling process. The mappings are removed when the
+     * handle instance closes. The consumer stores its offset through the consumer offset pointer to return consumed
+     * records without calling ebpf_ring_buffer_map_return_buffer.
      *
      * @param[in] map Ring buffer map to query.
+     * @param[in] ring_index Index of the ring to query.
+     * @param[in] instance Instance of the handle through which the map was queried.
      * @param[out] buffer Pointer to ring buffer data.
+     * @param[out] consumer_offset Pointer to the published consumer offset.
      * @retval EPBF_SUCCESS Successfully mapped the ring buffer.
+     * @retval EBPF_NO_MEMORY Unable to allocate resources for this operation.
      * @retval EBPF_INVALID_ARGUMENT Unable to map the ring buffer.
      */
     ebpf_result_t
-    ebpf_ring_buffer_map_query_buffer(_In_ const ebpf_map_t* map, _Outptr_ uint8_t** buffer);
+    ebpf_ring_buffer_map_query_buffer(
+        _In_ const ebpf_map_t* map,
+        uint32_t ring_index,
+        uintptr_t instance,
+        _Outptr_ uint8_t** buffer,
+        _Outptr_ size_t** consumer_offset);
 
     /**
      * @brief Return consumed buffer back to the ring buffer map.
      *
      * @param[in] map Ring buffer map.
-     * @param[in] length Length of bytes to return to the ring buffer.
+     * @param[in] ring_index Index of the ring to return the buffer to.
+     * @param[in] consumer_offset Offset up to which the consumer has read the ring.
      * @retval EPBF_SUCCESS Successfully returned records to the ring buffer.
      * @retval EBPF_INVALID_ARGUMENT Unable to return records to the ring buffer.
      */
     ebpf_result_t
-    ebpf_ring_buffer_map_return_buffer(_In_ const ebpf_map_t* map, size_t length);
+    ebpf_ring_buffer_map_return_buffer(_In_ const ebpf_map_t* map, uint32_t ring_index, size_t consumer_offset);
+
+    /**
+     * @brief Stop producers on a BPF_F_RB_OVERWRITE ring buffer map from overwriting the records currently in a
+     * ring, so they can be read with ebpf_ring_buffer_map_read. Each call should be matched by a call to
+     * ebpf_ring_buffer_map_thaw through the same handle instance; the freezes an instance still holds are released
+     * when it closes. Records that don't fit while the ring is frozen are dropped.
+     *
+     * @param[in] map Ring buffer map.
+     * @param[in] ring_index Index of the ring to freeze.
+     * @param[in] instance Instance of the handle through which the map is frozen.
+     * @param[out] consumer_offset Offset of the oldest record in the ring.
+     * @param[out] producer_offset Offset of the end of the newest record in the ring.
+     * @retval EPBF_SUCCESS Successfully froze the ring.
+     * @retval EBPF_INVALID_ARGUMENT The map has no such ring.
+     * @retval EBPF_NO_MEMORY Unable to allocate resources for this operation.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_map_freeze(
+        _In_ const ebpf_map_t* map,
+        uint32_t ring_index,
+        uintptr_t instance,
+        _Out_ size_t* consumer_offset,
+        _Out_ size_t* producer_offset);
+
+    /**
+     * @brief Undo a call to ebpf_ring_buffer_map_freeze made through the same handle instance.
+     *
+     * @param[in] map Ring buffer map.
+     * @param[in] ring_index Index of the ring to thaw.
+     * @param[in] instance Instance of the handle through which the map was frozen.
+     * @retval EPBF_SUCCESS Successfully thawed the ring.
+     * @retval EBPF_INVALID_ARGUMENT The map has no such ring, or the instance hasn't frozen it.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_map_thaw(_In_ const ebpf_map_t* map, uint32_t ring_index, uintptr_t instance);
+
+    /**
+     * @brief Copy the contents of a ring without consuming them.
+     *
+     * @param[in] map Ring buffer map.
+     * @param[in] ring_index Index of the ring to read.
+     * @param[in] offset Offset of the first byte to copy.
+     * @param[out] buffer Buffer to copy into.
+     * @param[in] length Number of bytes to copy.
+     * @retval EPBF_SUCCESS Successfully copied the bytes.
+     * @retval EBPF_INVALID_ARGUMENT The map has no such ring, or the bytes are no longer in it.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_map_read(
+        _In_ const ebpf_map_t* map,
+        uint32_t ring_index,
+        size_t offset,
+        _Out_writes_bytes_(length) uint8_t* buffer,
+        size_t length);
 
     /**
      * @brief Issue an asynchronous query to ring buffer map.
      *
      * @param[in] map Ring buffer map to issue the async query on.
+     * @param[in] ring_index Index of the ring to wait for.
      * @param[in, out] async_query_result Pointer to structure for storing result of the async query.
      * @param[in] async_context Async context associated with the query.
      * @retval EBPF_SUCCESS The operation was successful.
      * @retval EBPF_NO_MEMORY Insufficient memory to complete this operation.
+     * @retval EBPF_INVALID_ARGUMENT The map has no such ring, or a query is already pending on it.
      */
     ebpf_result_t
     ebpf_ring_buffer_map_async_query(
         _In_ ebpf_map_t* map,
+        uint32_t ring_index,
         _Inout_ ebpf_ring_buffer_map_async_query_result_t* async_query_result,
         _In_ void* async_context);
 
     /**
-     * @brief Write out a variable sized record to the ring buffer map.
+     * @brief Write out a variable sized record to the ring buffer map. On per-CPU ring buffer maps the record is
+     * written to the ring of the current CPU.
      *
-     * @param[in] map Pointer to map of type EBPF_MAP_TYPE_RINGBUF.
+     * @param[in] map Pointer to map of type EBPF_MAP_TYPE_RINGBUF or EBPF_MAP_TYPE_PERCPU_RINGBUF.
      * @param[in] data Data of record to write into ring buffer map.
      * @param[in] length Length of data.
+     * @param[in] flags Wakeup flags (0, BPF_RB_NO_WAKEUP or BPF_RB_FORCE_WAKEUP).
      * @retval EPBF_SUCCESS Successfully wrote record into ring buffer.
      * @retval EBPF_OUT_OF_SPACE Unable to output to ring buffer due to inadequate space.
+     * @retval EBPF_INVALID_ARGUMENT Unsupported flags.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_map_output(
+        _In_ ebpf_map_t* map, _In_reads_bytes_(length) uint8_t* data, size_t length, uint64_t flags);
+
+    /**
+     * @brief Set how much unconsumed data must accumulate in the ring buffer map before a pending async query is
+     * completed. Records written with BPF_RB_FORCE_WAKEUP complete the query regardless. The watermark applies
+     * to each ring of a per-CPU ring buffer map separately.
+     *
+     * @param[in] map Ring buffer map to update.
+     * @param[in] wakeup_watermark Number of bytes, or 0 to complete the query as soon as any data is available.
+     * @retval EPBF_SUCCESS Successfully set the watermark.
+     * @retval EBPF_INVALID_ARGUMENT The map isn't a ring buffer or the watermark isn't smaller than the ring.
      */
     ebpf_result_t
-    ebpf_ring_buffer_map_output(_In_ ebpf_map_t* map, _In_reads_bytes_(length) uint8_t* data, size_t length);
+    ebpf_ring_buffer_map_set_wakeup_watermark(_In_ ebpf_map_t* map, size_t wakeup_watermark);
 
 #ifdef __cplusplus
 }
@@ -51,6 +51,8 @@ typedef struct _ebpf_program
     // Array of helper function ids referred by this program.
     size_t helper_function_count;
     uint32_t* helper_function_ids;
+    // Set if helper_function_ids contains BPF_FUNC_tail_call.
+    bool calls_tail_call_helper;
 
     ebpf_epoch_work_item_t* cleanup_work_item;
 
@@ -208,7 +210,6 @@ static void
 _ebpf_program_free(ebpf_object_t* object)
 {
     EBPF_LOG_ENTRY();
-    size_t index;
     ebpf_program_t* program = (ebpf_program_t*)object;
     if (!program)
         EBPF_RETURN_VOID();
@@ -217,9 +218,8 @@ _ebpf_program_free(ebpf_object_t* object)
     _ebpf_program_detach_links(program);
     ebpf_assert(ebpf_list_is_empty(&program->links));
 
-    for (index = 0; index < program->count_of_maps; index++)
-        ebpf_object_release_reference((ebpf_object_t*)program->maps[index]);
-
+    // The program can still be running as a tail call callee, which is read from the program array without a
+    // reference, so the references on its maps are released by _ebpf_program_epoch_free once the epoch ends.
     ebpf_epoch_schedule_work_item(program->cleanup_work_item);
     EBPF_RETURN_VOID();
 }
@@ -242,6 +242,7 @@ _ebpf_program_epoch_free(void* context)
 {
     EBPF_LOG_ENTRY();
     ebpf_program_t* program = (ebpf_program_t*)context;
+    size_t index;
 
     ebpf_lock_destroy(&program->lock);
 
@@ -265,6 +266,8 @@ _ebpf_program_epoch_free(void* context)
     ebpf_free(program->parameters.section_name.value);
     ebpf_free(program->parameters.file_name.value);
 
+    for (index = 0; index < program->count_of_maps; index++)
+        ebpf_object_release_reference((ebpf_object_t*)program->maps[index]);
     ebpf_free(program->maps);
 
     ebpf_free_trampoline_table(program->trampoline_table);
@@ -755,24 +758,19 @@ ebpf_program_set_tail_call(_In_ const ebpf_program_t* next_program)
     return EBPF_SUCCESS;
 }
 
-void
-ebpf_program_invoke(_In_ const ebpf_program_t* program, _In_ void* context, _Out_ uint32_t* result)
+static inline void
+_ebpf_program_invoke_chain(
+    _In_ const ebpf_program_t* program,
+    _In_ void* context,
+    _Inout_ ebpf_program_tail_call_state_t* state,
+    _Out_ uint32_t* result)
 {
-    // High volume call - Skip entry/exit logging.
-    ebpf_program_tail_call_state_t state = {0};
     const ebpf_program_t* current_program = program;
 
-    if (!program || program->program_invalidated) {
-        *result = 0;
-        return;
-    }
-
-    if (!ebpf_state_store(_ebpf_program_state_index, (uintptr_t)&state) == EBPF_SUCCESS) {
-        *result = 0;
-        return;
-    }
-
-    for (state.count = 0; state.count < MAX_TAIL_CALL_CNT; state.count++) {
+    // The last program of a chain that ran out of tail calls can leave a callee behind, which must not leak into
+    // the next chain of a batch.
+    state->next_program = NULL;
+    for (state->count = 0; state->count < MAX_TAIL_CALL_CNT; state->count++) {
         if (current_program->parameters.code_type == EBPF_CODE_NATIVE) {
             ebpf_program_entry_point_t function_pointer;
             function_pointer = (ebpf_program_entry_point_t)(current_program->code_or_vm.code.code_pointer);
@@ -791,20 +789,72 @@ ebpf_program_invoke(_In_ const ebpf_program_t* program, _In_ void* context, _Out
 #endif
         }
 
-        if (state.count != 0) {
-            ebpf_object_release_reference((ebpf_object_t*)current_program);
-            current_program = NULL;
-        }
-
-        if (state.next_program == NULL) {
+        if (state->next_program == NULL) {
             break;
         } else {
-            current_program = state.next_program;
-            state.next_program = NULL;
+            // The callee was read from a program array without a reference and stays valid for this epoch.
+            current_program = state->next_program;
+            state->next_program = NULL;
+        }
+    }
+}
+
+void
+ebpf_program_invoke(_In_ const ebpf_program_t* program, _In_ void* context, _Out_ uint32_t* result)
+{
+    // High volume call - Skip entry/exit logging.
+    ebpf_program_tail_call_state_t state = {0};
+
+    if (!program || program->program_invalidated) {
+        *result = 0;
+        return;
+    }
+
+    // The tail call state lives in this frame and is only published to ebpf_program_set_tail_call when the
+    // program can reach bpf_tail_call. A program can only be tail called by a program that calls the helper, so
+    // checking the first program in the chain is sufficient and the common case never touches the state table.
+    if (program->calls_tail_call_helper) {
+        if (ebpf_state_store(_ebpf_program_state_index, (uintptr_t)&state) != EBPF_SUCCESS) {
+            *result = 0;
+            return;
         }
     }
 
-    ebpf_state_store(_ebpf_program_state_index, 0);
+    _ebpf_program_invoke_chain(program, context, &state, result);
+
+    if (program->calls_tail_call_helper)
+        ebpf_state_store(_ebpf_program_state_index, 0);
+}
+
+void
+ebpf_program_invoke_batch(
+    _In_ const ebpf_program_t* program,
+    _In_reads_(count) void** contexts,
+    size_t count,
+    _Out_writes_(count) uint32_t* results)
+{
+    // High volume call - Skip entry/exit logging.
+    ebpf_program_tail_call_state_t state = {0};
+
+    if (!program || program->program_invalidated) {
+        memset(results, 0, count * sizeof(*results));
+        return;
+    }
+
+    // Publish the tail call state once for the whole batch; each context starts a fresh chain.
+    if (program->calls_tail_call_helper) {
+        if (ebpf_state_store(_ebpf_program_state_index, (uintptr_t)&state) != EBPF_SUCCESS) {
+            memset(results, 0, count * sizeof(*results));
+            return;
+        }
+    }
+
+    for (size_t index = 0; index < count; index++) {
+        _ebpf_program_invoke_chain(program, contexts[index], &state, &results[index]);
+    }
+
+    if (program->calls_tail_call_helper)
+        ebpf_state_store(_ebpf_program_state_index, 0);
 }
 
 static ebpf_result_t
@@ -893,8 +943,11 @@ ebpf_program_set_helper_function_ids(
         goto Exit;
     }
 
-    for (size_t index = 0; index < helper_function_count; index++)
+    for (size_t index = 0; index < helper_function_count; index++) {
         program->helper_function_ids[index] = helper_function_ids[index];
+        if (helper_function_ids[index] == BPF_FUNC_tail_call)
+            program->calls_tail_call_helper = true;
+    }
 
 Exit:
     EBPF_RETURN_RESULT(result);
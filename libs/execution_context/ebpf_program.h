@@ -163,6 +163,22 @@ extern "C"
     void
     ebpf_program_invoke(_In_ const ebpf_program_t* program, _In_ void* context, _Out_ uint32_t* result);
 
+    /**
+     * @brief Invoke an ebpf_program_t instance once for each context in a batch.
+     * The caller must be in an epoch for the duration of the call.
+     *
+     * @param[in] program Program to invoke.
+     * @param[in] contexts Array of pointers to eBPF contexts for this program.
+     * @param[in] count Number of contexts in the batch.
+     * @param[out] results Output from the program for each context.
+     */
+    void
+    ebpf_program_invoke_batch(
+        _In_ const ebpf_program_t* program,
+        _In_reads_(count) void** contexts,
+        size_t count,
+        _Out_writes_(count) uint32_t* results);
+
     /**
      * @brief Store the helper function IDs that are used by the eBPF program in an array
      *  inside the program object. The array index is the helper function ID to be used by
@@ -41,6 +41,13 @@ typedef enum _ebpf_operation_id
     EBPF_OPERATION_BIND_MAP,
     EBPF_OPERATION_RING_BUFFER_MAP_QUERY_BUFFER,
     EBPF_OPERATION_RING_BUFFER_MAP_ASYNC_QUERY,
+    EBPF_OPERATION_MAP_LOOKUP_BATCH,
+    EBPF_OPERATION_MAP_LOOKUP_AND_DELETE_BATCH,
+    EBPF_OPERATION_MAP_UPDATE_BATCH,
+    EBPF_OPERATION_MAP_DELETE_BATCH,
+    EBPF_OPERATION_RING_BUFFER_MAP_SET_WAKEUP_WATERMARK,
+    EBPF_OPERATION_RING_BUFFER_MAP_FREEZE,
+    EBPF_OPERATION_RING_BUFFER_MAP_READ,
 } ebpf_operation_id_t;
 
 typedef enum _ebpf_code_type
@@ -162,6 +169,43 @@ typedef struct _ebpf_operation_map_delete_element_request
     uint8_t key[1];
 } ebpf_operation_map_delete_element_request_t;
 
+// Used by both EBPF_OPERATION_MAP_LOOKUP_BATCH and EBPF_OPERATION_MAP_LOOKUP_AND_DELETE_BATCH.
+typedef struct _ebpf_operation_map_lookup_batch_request
+{
+    struct _ebpf_operation_header header;
+    ebpf_handle_t handle;
+    uint8_t previous_key[1]; // Empty to start with the first key.
+} ebpf_operation_map_lookup_batch_request_t;
+
+typedef struct _ebpf_operation_map_lookup_batch_reply
+{
+    struct _ebpf_operation_header header;
+    uint8_t data[1]; // data is a sequence of key+value
+} ebpf_operation_map_lookup_batch_reply_t;
+
+typedef struct _ebpf_operation_map_update_batch_request
+{
+    struct _ebpf_operation_header header;
+    ebpf_handle_t handle;
+    ebpf_map_option_t option;
+    uint8_t data[1]; // data is a sequence of key+value
+} ebpf_operation_map_update_batch_request_t;
+
+typedef struct _ebpf_operation_map_delete_batch_request
+{
+    struct _ebpf_operation_header header;
+    ebpf_handle_t handle;
+    uint8_t keys[1];
+} ebpf_operation_map_delete_batch_request_t;
+
+// Used by both EBPF_OPERATION_MAP_UPDATE_BATCH and EBPF_OPERATION_MAP_DELETE_BATCH.
+typedef struct _ebpf_operation_map_batch_reply
+{
+    struct _ebpf_operation_header header;
+    uint32_t count;       // Number of entries processed before result was hit.
+    ebpf_result_t result; // Result of the first entry that failed, EBPF_SUCCESS if none did.
+} ebpf_operation_map_batch_reply_t;
+
 typedef struct _ebpf_operation_get_next_map_request
 {
     struct _ebpf_operation_header header;
@@ -360,6 +404,8 @@ typedef struct _ebpf_operation_ring_buffer_map_query_buffer_request
 {
     struct _ebpf_operation_header header;
     ebpf_handle_t map_handle;
+    // Index of the ring to map; 0 unless the map is a per-CPU ring buffer.
+    uint32_t ring_index;
 } ebpf_operation_ring_buffer_map_query_buffer_request_t;
 
 typedef struct _ebpf_operation_ring_buffer_map_query_buffer_reply
@@ -367,6 +413,10 @@ typedef struct _ebpf_operation_ring_buffer_map_query_buffer_reply
     struct _ebpf_operation_header header;
     // Address to user-space read-only buffer for the ring-buffer records.
     uint64_t buffer_address;
+    // Address to user-space writable consumer offset. Storing to it returns consumed records to the ring.
+    uint64_t consumer_offset_address;
+    // Number of rings in the map.
+    uint32_t ring_count;
 } ebpf_operation_ring_buffer_map_query_buffer_reply_t;
 
 typedef struct _ebpf_operation_ring_buffer_map_async_query_request
@@ -375,10 +425,54 @@ typedef struct _ebpf_operation_ring_buffer_map_async_query_request
     ebpf_handle_t map_handle;
     // Offset till which the consumer has read data so far.
     size_t consumer_offset;
+    // Index of the ring to wait for; 0 unless the map is a per-CPU ring buffer.
+    uint32_t ring_index;
 } ebpf_operation_ring_buffer_map_async_query_request_t;
 
 typedef struct _ebpf_operation_ring_buffer_map_async_query_reply
 {
     struct _ebpf_operation_header header;
     ebpf_ring_buffer_map_async_query_result_t async_query_result;
-} ebpf_operation_ring_buffer_map_async_query_reply_t;
\ No newline at end of file
+} ebpf_operation_ring_buffer_map_async_query_reply_t;
+
+typedef struct _ebpf_operation_ring_buffer_map_set_wakeup_watermark_request
+{
+    struct _ebpf_operation_header header;
+    ebpf_handle_t map_handle;
+    // Bytes of unconsumed data needed before an async query completes, or 0 to complete on any data.
+    uint64_t wakeup_watermark;
+} ebpf_operation_ring_buffer_map_set_wakeup_watermark_request_t;
+
+typedef struct _ebpf_operation_ring_buffer_map_freeze_request
+{
+    struct _ebpf_operation_header header;
+    ebpf_handle_t map_handle;
+    // Index of the ring to freeze or thaw; 0 unless the map is a per-CPU ring buffer.
+    uint32_t ring_index;
+    // Non-zero to freeze the ring, zero to thaw it.
+    uint32_t freeze;
+} ebpf_operation_ring_buffer_map_freeze_request_t;
+
+typedef struct _ebpf_operation_ring_buffer_map_freeze_reply
+{
+    struct _ebpf_operation_header header;
+    // Range of the ring holding records when it was frozen. Zero when thawing.
+    uint64_t consumer_offset;
+    uint64_t producer_offset;
+} ebpf_operation_ring_buffer_map_freeze_reply_t;
+
+typedef struct _ebpf_operation_ring_buffer_map_read_request
+{
+    struct _ebpf_operation_header header;
+    ebpf_handle_t map_handle;
+    // Index of the ring to read; 0 unless the map is a per-CPU ring buffer.
+    uint32_t ring_index;
+    // Offset of the first byte to read. The reply is filled with the bytes that follow.
+    uint64_t offset;
+} ebpf_operation_ring_buffer_map_read_request_t;
+
+typedef struct _ebpf_operation_ring_buffer_map_read_reply
+{
+    struct _ebpf_operation_header header;
+    uint8_t data[1];
+} ebpf_operation_ring_buffer_map_read_reply_t;
\ No newline at end of file
@@ -36,7 +36,7 @@ typedef std::unique_ptr<ebpf_map_t, ebpf_object_deleter<ebpf_map_t>> map_ptr;
 typedef std::unique_ptr<ebpf_program_t, ebpf_object_deleter<ebpf_program_t>> program_ptr;
 
 static void
-_test_crud_operations(ebpf_map_type_t map_type)
+_test_crud_operations(ebpf_map_type_t map_type, uint32_t map_flags = 0)
 {
     _ebpf_core_initializer core;
     bool is_array;
@@ -98,6 +98,7 @@ _test_crud_operations(ebpf_map_type_t map_type)
 
     ebpf_map_definition_in_memory_t map_definition{
         sizeof(ebpf_map_definition_in_memory_t), map_type, sizeof(uint32_t), sizeof(uint64_t), 10};
+    map_definition.map_flags = map_flags;
     map_ptr map;
     {
         ebpf_map_t* local_map;
@@ -235,6 +236,279 @@ MAP_TEST(BPF_MAP_TYPE_PERCPU_ARRAY);
 MAP_TEST(BPF_MAP_TYPE_LRU_HASH);
 MAP_TEST(BPF_MAP_TYPE_LRU_PERCPU_HASH);
 
+#define MAP_TEST_IN_PLACE(MAP_TYPE) \
+    TEST_CASE("map_crud_operations_in_place:" #MAP_TYPE, "[execution_context]") \
+    { \
+        _test_crud_operations(MAP_TYPE, BPF_F_UPDATE_IN_PLACE); \
+    }
+
+MAP_TEST_IN_PLACE(BPF_MAP_TYPE_HASH);
+MAP_TEST_IN_PLACE(BPF_MAP_TYPE_PERCPU_HASH);
+
+TEST_CASE("map_update_in_place", "[execution_context]")
+{
+    _ebpf_core_initializer core;
+
+    ebpf_map_definition_in_memory_t map_definition{
+        sizeof(ebpf_map_definition_in_memory_t), BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint64_t), 10};
+    map_definition.map_flags = BPF_F_UPDATE_IN_PLACE;
+    map_ptr map;
+    {
+        ebpf_map_t* local_map;
+        ebpf_utf8_string_t map_name = {0};
+        REQUIRE(
+            ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) == EBPF_SUCCESS);
+        map.reset(local_map);
+    }
+
+    uint32_t key = 0;
+    uint64_t value = 1;
+    REQUIRE(
+        ebpf_map_update_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value),
+            reinterpret_cast<const uint8_t*>(&value),
+            EBPF_EXIST,
+            0) == EBPF_KEY_NOT_FOUND);
+    REQUIRE(
+        ebpf_map_update_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value),
+            reinterpret_cast<const uint8_t*>(&value),
+            EBPF_NOEXIST,
+            0) == EBPF_SUCCESS);
+
+    // Updates must not move the value.
+    uint64_t* value_pointer = nullptr;
+    REQUIRE(
+        ebpf_map_find_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value_pointer),
+            reinterpret_cast<uint8_t*>(&value_pointer),
+            EBPF_MAP_FLAG_HELPER) == EBPF_SUCCESS);
+    REQUIRE(*value_pointer == 1);
+
+    value = 2;
+    REQUIRE(
+        ebpf_map_update_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value),
+            reinterpret_cast<const uint8_t*>(&value),
+            EBPF_NOEXIST,
+            0) == EBPF_OBJECT_ALREADY_EXISTS);
+    REQUIRE(
+        ebpf_map_update_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value),
+            reinterpret_cast<const uint8_t*>(&value),
+            EBPF_EXIST,
+            0) == EBPF_SUCCESS);
+    REQUIRE(*value_pointer == 2);
+
+    value = 0;
+    REQUIRE(
+        ebpf_map_find_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value),
+            reinterpret_cast<uint8_t*>(&value),
+            0) == EBPF_SUCCESS);
+    REQUIRE(value == 2);
+
+    // The flag is only supported on hash maps.
+    map_definition.type = BPF_MAP_TYPE_ARRAY;
+    ebpf_map_t* local_map;
+    ebpf_utf8_string_t map_name = {0};
+    REQUIRE(
+        ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) ==
+        EBPF_INVALID_ARGUMENT);
+}
+
+TEST_CASE("map_lru_second_chance", "[execution_context]")
+{
+    _ebpf_core_initializer core;
+
+    ebpf_map_definition_in_memory_t map_definition{
+        sizeof(ebpf_map_definition_in_memory_t), BPF_MAP_TYPE_LRU_HASH, sizeof(uint32_t), sizeof(uint64_t), 10};
+    map_ptr map;
+    {
+        ebpf_map_t* local_map;
+        ebpf_utf8_string_t map_name = {0};
+        REQUIRE(
+            ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) == EBPF_SUCCESS);
+        map.reset(local_map);
+    }
+
+    uint64_t value = 0;
+    for (uint32_t key = 0; key < 10; key++) {
+        REQUIRE(
+            ebpf_map_update_entry(
+                map.get(),
+                sizeof(key),
+                reinterpret_cast<const uint8_t*>(&key),
+                sizeof(value),
+                reinterpret_cast<const uint8_t*>(&value),
+                EBPF_ANY,
+                0) == EBPF_SUCCESS);
+    }
+
+    // Looking up the oldest key gives it a second chance, so the next oldest is evicted instead.
+    uint32_t key = 0;
+    REQUIRE(
+        ebpf_map_find_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value),
+            reinterpret_cast<uint8_t*>(&value),
+            0) == EBPF_SUCCESS);
+
+    key = 10;
+    REQUIRE(
+        ebpf_map_update_entry(
+            map.get(),
+            sizeof(key),
+            reinterpret_cast<const uint8_t*>(&key),
+            sizeof(value),
+            reinterpret_cast<const uint8_t*>(&value),
+            EBPF_ANY,
+            0) == EBPF_SUCCESS);
+
+    for (key = 0; key <= 10; key++) {
+        REQUIRE(
+            ebpf_map_find_entry(
+                map.get(),
+                sizeof(key),
+                reinterpret_cast<const uint8_t*>(&key),
+                sizeof(value),
+                reinterpret_cast<uint8_t*>(&value),
+                0) == (key == 1 ? EBPF_OBJECT_NOT_FOUND : EBPF_SUCCESS));
+    }
+}
+
+TEST_CASE("map_batch_operations", "[execution_context]")
+{
+    _ebpf_core_initializer core;
+
+    ebpf_map_definition_in_memory_t map_definition{
+        sizeof(ebpf_map_definition_in_memory_t), BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint64_t), 10};
+    map_ptr map;
+    {
+        ebpf_map_t* local_map;
+        ebpf_utf8_string_t map_name = {0};
+        REQUIRE(
+            ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) == EBPF_SUCCESS);
+        map.reset(local_map);
+    }
+
+    const size_t entry_size = sizeof(uint32_t) + sizeof(uint64_t);
+    std::vector<uint8_t> entries(10 * entry_size);
+    for (uint32_t key = 0; key < 10; key++) {
+        uint64_t value = static_cast<uint64_t>(key) * static_cast<uint64_t>(key);
+        memcpy(entries.data() + key * entry_size, &key, sizeof(key));
+        memcpy(entries.data() + key * entry_size + sizeof(key), &value, sizeof(value));
+    }
+
+    size_t count;
+    REQUIRE(
+        ebpf_map_update_batch(map.get(), entries.size() - 1, entries.data(), EBPF_ANY, &count) ==
+        EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_map_update_batch(map.get(), entries.size(), entries.data(), EBPF_ANY, &count) == EBPF_SUCCESS);
+    REQUIRE(count == 10);
+    REQUIRE(ebpf_map_update_batch(map.get(), entries.size(), entries.data(), EBPF_NOEXIST, &count) != EBPF_SUCCESS);
+    REQUIRE(count == 0);
+
+    // A batch stops at the first entry that fails and reports how many entries were processed before it.
+    std::vector<uint32_t> partial_keys = {0, 1, 42, 2};
+    REQUIRE(
+        ebpf_map_delete_batch(
+            map.get(),
+            partial_keys.size() * sizeof(uint32_t),
+            reinterpret_cast<uint8_t*>(partial_keys.data()),
+            &count) == EBPF_KEY_NOT_FOUND);
+    REQUIRE(count == 2);
+    REQUIRE(ebpf_map_update_batch(map.get(), entries.size(), entries.data(), EBPF_NOEXIST, &count) != EBPF_SUCCESS);
+    REQUIRE(count == 2);
+
+    // Read the map back three entries at a time, resuming after the last key returned.
+    std::vector<uint8_t> batch(3 * entry_size);
+    std::set<uint32_t> keys;
+    uint32_t last_key = 0;
+    size_t batch_size;
+    ebpf_result_t result;
+    for (;;) {
+        batch_size = batch.size();
+        result = ebpf_map_lookup_batch(
+            map.get(),
+            keys.empty() ? 0 : sizeof(last_key),
+            keys.empty() ? nullptr : reinterpret_cast<const uint8_t*>(&last_key),
+            false,
+            &batch_size,
+            batch.data());
+        if (result != EBPF_SUCCESS) {
+            break;
+        }
+        REQUIRE(batch_size % entry_size == 0);
+        REQUIRE(batch_size != 0);
+        for (size_t offset = 0; offset < batch_size; offset += entry_size) {
+            uint32_t key;
+            uint64_t value;
+            memcpy(&key, batch.data() + offset, sizeof(key));
+            memcpy(&value, batch.data() + offset + sizeof(key), sizeof(value));
+            REQUIRE(value == static_cast<uint64_t>(key) * static_cast<uint64_t>(key));
+            keys.insert(key);
+            last_key = key;
+        }
+    }
+    REQUIRE(result == EBPF_NO_MORE_KEYS);
+    REQUIRE(keys.size() == 10);
+
+    // A buffer too small for a single entry is rejected.
+    batch_size = entry_size - 1;
+    REQUIRE(ebpf_map_lookup_batch(map.get(), 0, nullptr, false, &batch_size, batch.data()) == EBPF_INSUFFICIENT_BUFFER);
+
+    // Look up and delete the first entries, then delete the rest by key.
+    batch_size = batch.size();
+    REQUIRE(ebpf_map_lookup_batch(map.get(), 0, nullptr, true, &batch_size, batch.data()) == EBPF_SUCCESS);
+    REQUIRE(batch_size == batch.size());
+    for (size_t offset = 0; offset < batch_size; offset += entry_size) {
+        uint32_t key;
+        uint64_t value;
+        memcpy(&key, batch.data() + offset, sizeof(key));
+        REQUIRE(
+            ebpf_map_find_entry(
+                map.get(),
+                sizeof(key),
+                reinterpret_cast<const uint8_t*>(&key),
+                sizeof(value),
+                reinterpret_cast<uint8_t*>(&value),
+                0) == EBPF_OBJECT_NOT_FOUND);
+        keys.erase(key);
+    }
+    REQUIRE(keys.size() == 7);
+
+    std::vector<uint32_t> remaining(keys.begin(), keys.end());
+    REQUIRE(
+        ebpf_map_delete_batch(
+            map.get(), remaining.size() * sizeof(uint32_t), reinterpret_cast<uint8_t*>(remaining.data()), &count) ==
+        EBPF_SUCCESS);
+    REQUIRE(count == 7);
+
+    batch_size = batch.size();
+    REQUIRE(ebpf_map_lookup_batch(map.get(), 0, nullptr, false, &batch_size, batch.data()) == EBPF_NO_MORE_KEYS);
+}
+
 TEST_CASE("map_crud_operations_lpm_trie_32", "[execution_context]")
 {
     _ebpf_core_initializer core;
@@ -303,6 +577,23 @@ TEST_CASE("map_crud_operations_lpm_trie_32", "[execution_context]")
                 EBPF_MAP_FLAG_HELPER) == EBPF_SUCCESS);
         REQUIRE(std::string(value) == result);
     }
+
+    // Removing a prefix exposes the next longest one.
+    lpm_trie_key_t removed_key{31, 192, 168, 14, 0};
+    REQUIRE(
+        ebpf_map_delete_entry(map.get(), 0, reinterpret_cast<const uint8_t*>(&removed_key), EBPF_MAP_FLAG_HELPER) ==
+        EBPF_SUCCESS);
+    lpm_trie_key_t lookup_key{32, 192, 168, 14, 1};
+    char* value = nullptr;
+    REQUIRE(
+        ebpf_map_find_entry(
+            map.get(),
+            0,
+            reinterpret_cast<const uint8_t*>(&lookup_key),
+            0,
+            reinterpret_cast<uint8_t*>(&value),
+            EBPF_MAP_FLAG_HELPER) == EBPF_SUCCESS);
+    REQUIRE(std::string(value) == "192.168.14.0/30");
 }
 
 void
@@ -676,11 +967,14 @@ TEST_CASE("ring_buffer_async_query", "[execution_context]")
     struct _completion
     {
         uint8_t* buffer;
+        size_t* consumer_offset;
         ebpf_ring_buffer_map_async_query_result_t async_query_result = {};
         uint64_t value;
     } completion;
 
-    REQUIRE(ebpf_ring_buffer_map_query_buffer(map.get(), &completion.buffer) == EBPF_SUCCESS);
+    REQUIRE(
+        ebpf_ring_buffer_map_query_buffer(map.get(), 0, 1, &completion.buffer, &completion.consumer_offset) ==
+        EBPF_SUCCESS);
 
     REQUIRE(
         ebpf_async_set_completion_callback(
@@ -694,10 +988,207 @@ TEST_CASE("ring_buffer_async_query", "[execution_context]")
                 REQUIRE(result == EBPF_SUCCESS);
             }) == EBPF_SUCCESS);
 
-    REQUIRE(ebpf_ring_buffer_map_async_query(map.get(), &completion.async_query_result, &completion) == EBPF_PENDING);
+    REQUIRE(
+        ebpf_ring_buffer_map_async_query(map.get(), 0, &completion.async_query_result, &completion) == EBPF_PENDING);
 
     uint64_t value = 1;
-    REQUIRE(ebpf_ring_buffer_map_output(map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value)) == EBPF_SUCCESS);
+    REQUIRE(
+        ebpf_ring_buffer_map_output(map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), 0) == EBPF_SUCCESS);
 
     REQUIRE(completion.value == value);
-}
\ No newline at end of file
+}
+TEST_CASE("ring_buffer_wakeup_watermark", "[execution_context]")
+{
+    _ebpf_core_initializer core;
+    ebpf_map_definition_in_memory_t map_definition{
+        sizeof(ebpf_map_definition_in_memory_t), BPF_MAP_TYPE_RINGBUF, 0, 0, 64 * 1024};
+    map_ptr map;
+    {
+        ebpf_map_t* local_map;
+        ebpf_utf8_string_t map_name = {0};
+        REQUIRE(
+            ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) == EBPF_SUCCESS);
+        map.reset(local_map);
+    }
+
+    struct _completion
+    {
+        ebpf_ring_buffer_map_async_query_result_t async_query_result = {};
+        uint32_t count = 0;
+    } completion;
+
+    auto on_complete = [](void* context, size_t output_buffer_length, ebpf_result_t result) {
+        UNREFERENCED_PARAMETER(output_buffer_length);
+        UNREFERENCED_PARAMETER(result);
+        reinterpret_cast<_completion*>(context)->count++;
+    };
+    REQUIRE(ebpf_async_set_completion_callback(&completion, on_complete) == EBPF_SUCCESS);
+
+    // Each record is a header followed by the value.
+    uint64_t value = 1;
+    size_t record_size = EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data) + sizeof(value);
+    REQUIRE(ebpf_ring_buffer_map_set_wakeup_watermark(map.get(), 4 * record_size) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_set_wakeup_watermark(map.get(), 64 * 1024) == EBPF_INVALID_ARGUMENT);
+
+    REQUIRE(
+        ebpf_ring_buffer_map_async_query(map.get(), 0, &completion.async_query_result, &completion) == EBPF_PENDING);
+
+    // Records below the watermark don't complete the query.
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(
+            ebpf_ring_buffer_map_output(map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), 0) ==
+            EBPF_SUCCESS);
+    }
+    REQUIRE(completion.count == 0);
+
+    // Nor do records written with BPF_RB_NO_WAKEUP, even once the watermark is passed.
+    REQUIRE(
+        ebpf_ring_buffer_map_output(
+            map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), BPF_RB_NO_WAKEUP) == EBPF_SUCCESS);
+    REQUIRE(completion.count == 0);
+
+    // The next record completes the query.
+    REQUIRE(
+        ebpf_ring_buffer_map_output(map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), 0) == EBPF_SUCCESS);
+    REQUIRE(completion.count == 1);
+    REQUIRE(completion.async_query_result.producer - completion.async_query_result.consumer == 5 * record_size);
+
+    // Consume everything, then check that BPF_RB_FORCE_WAKEUP ignores the watermark.
+    REQUIRE(ebpf_ring_buffer_map_return_buffer(map.get(), 0, completion.async_query_result.producer) == EBPF_SUCCESS);
+    REQUIRE(ebpf_async_set_completion_callback(&completion, on_complete) == EBPF_SUCCESS);
+    REQUIRE(
+        ebpf_ring_buffer_map_async_query(map.get(), 0, &completion.async_query_result, &completion) == EBPF_PENDING);
+    REQUIRE(
+        ebpf_ring_buffer_map_output(
+            map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), BPF_RB_FORCE_WAKEUP) == EBPF_SUCCESS);
+    REQUIRE(completion.count == 2);
+
+    // Unknown flags are rejected.
+    REQUIRE(
+        ebpf_ring_buffer_map_output(map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), 0x100) ==
+        EBPF_INVALID_ARGUMENT);
+}
+
+TEST_CASE("ring_buffer_per_cpu", "[execution_context]")
+{
+    _ebpf_core_initializer core;
+    ebpf_map_definition_in_memory_t map_definition{
+        sizeof(ebpf_map_definition_in_memory_t), BPF_MAP_TYPE_PERCPU_RINGBUF, 0, 0, 64 * 1024};
+    map_ptr map;
+    {
+        ebpf_map_t* local_map;
+        ebpf_utf8_string_t map_name = {0};
+        REQUIRE(
+            ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) == EBPF_SUCCESS);
+        map.reset(local_map);
+    }
+
+    // There is one ring per CPU.
+    uint32_t ring_count = ebpf_ring_buffer_map_get_ring_count(map.get());
+    REQUIRE(ring_count == ebpf_get_cpu_count());
+    uint8_t* buffer;
+    size_t* consumer_offset;
+    REQUIRE(
+        ebpf_ring_buffer_map_query_buffer(map.get(), ring_count, 1, &buffer, &consumer_offset) ==
+        EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_ring_buffer_map_query_buffer(map.get(), 0, 1, &buffer, &consumer_offset) == EBPF_SUCCESS);
+
+    // Write from CPU 0, so the records land in the first ring.
+    uintptr_t old_affinity_mask;
+    REQUIRE(ebpf_set_current_thread_affinity(1, &old_affinity_mask) == EBPF_SUCCESS);
+    uint64_t value = 1;
+    REQUIRE(
+        ebpf_ring_buffer_map_output(map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), 0) == EBPF_SUCCESS);
+    value = 2;
+    REQUIRE(
+        ebpf_ring_buffer_map_output(map.get(), reinterpret_cast<uint8_t*>(&value), sizeof(value), 0) == EBPF_SUCCESS);
+    ebpf_restore_current_thread_affinity(old_affinity_mask);
+
+    struct _completion
+    {
+        ebpf_ring_buffer_map_async_query_result_t async_query_result = {};
+        uint32_t count = 0;
+    } completion;
+    REQUIRE(
+        ebpf_async_set_completion_callback(
+            &completion, [](void* context, size_t output_buffer_length, ebpf_result_t result) {
+                UNREFERENCED_PARAMETER(output_buffer_length);
+                REQUIRE(result == EBPF_SUCCESS);
+                reinterpret_cast<_completion*>(context)->count++;
+            }) == EBPF_SUCCESS);
+    REQUIRE(
+        ebpf_ring_buffer_map_async_query(map.get(), 0, &completion.async_query_result, &completion) == EBPF_PENDING);
+    REQUIRE(completion.count == 1);
+
+    // Each record starts with the time it was reserved, followed by the value.
+    size_t record_size = EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data) +
+                         sizeof(ebpf_per_cpu_ring_buffer_record_header_t) + sizeof(value);
+    size_t consumer = completion.async_query_result.consumer;
+    size_t producer = completion.async_query_result.producer;
+    REQUIRE(producer - consumer == 2 * record_size);
+    uint64_t previous_timestamp = 0;
+    for (uint64_t expected_value = 1; expected_value <= 2; expected_value++) {
+        auto record = ebpf_ring_buffer_next_record(buffer, 64 * 1024, consumer, producer);
+        REQUIRE(record != nullptr);
+        REQUIRE(record->header.length == record_size);
+        auto header = reinterpret_cast<const ebpf_per_cpu_ring_buffer_record_header_t*>(record->data);
+        REQUIRE(header->timestamp >= previous_timestamp);
+        previous_timestamp = header->timestamp;
+        REQUIRE(*reinterpret_cast<const uint64_t*>(header + 1) == expected_value);
+        consumer += record->header.length;
+    }
+    REQUIRE(ebpf_ring_buffer_map_return_buffer(map.get(), 0, consumer) == EBPF_SUCCESS);
+
+    // The watermark applies to every ring.
+    REQUIRE(ebpf_ring_buffer_map_set_wakeup_watermark(map.get(), 4 * record_size) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_set_wakeup_watermark(map.get(), 64 * 1024) == EBPF_INVALID_ARGUMENT);
+}
+
+TEST_CASE("ring_buffer_overwrite", "[execution_context]")
+{
+    _ebpf_core_initializer core;
+    ebpf_map_definition_in_memory_t map_definition{
+        sizeof(ebpf_map_definition_in_memory_t), BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint32_t), 10};
+    map_definition.map_flags = BPF_F_RB_OVERWRITE;
+    ebpf_utf8_string_t map_name = {0};
+    map_ptr map;
+    {
+        // Only ring buffer maps can overwrite.
+        ebpf_map_t* local_map;
+        REQUIRE(
+            ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) ==
+            EBPF_INVALID_ARGUMENT);
+        map_definition = {sizeof(ebpf_map_definition_in_memory_t), BPF_MAP_TYPE_RINGBUF, 0, 0, 64 * 1024};
+        map_definition.map_flags = BPF_F_RB_OVERWRITE;
+        REQUIRE(
+            ebpf_map_create(&map_name, &map_definition, (uintptr_t)ebpf_handle_invalid, &local_map) == EBPF_SUCCESS);
+        map.reset(local_map);
+    }
+
+    // Keep writing well past the capacity of the ring with no consumer.
+    std::vector<uint8_t> data(1024 - EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
+    uint32_t record_count = 200;
+    for (uint32_t sequence = 0; sequence < record_count; sequence++) {
+        *(uint32_t*)data.data() = sequence;
+        REQUIRE(ebpf_ring_buffer_map_output(map.get(), data.data(), data.size(), BPF_RB_NO_WAKEUP) == EBPF_SUCCESS);
+    }
+
+    // The ring holds the newest records.
+    size_t consumer;
+    size_t producer;
+    REQUIRE(ebpf_ring_buffer_map_freeze(map.get(), 1, 1, &consumer, &producer) == EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_ring_buffer_map_freeze(map.get(), 0, 1, &consumer, &producer) == EBPF_SUCCESS);
+    REQUIRE(producer == record_count * 1024);
+    std::vector<uint8_t> snapshot(producer - consumer);
+    REQUIRE(ebpf_ring_buffer_map_read(map.get(), 0, consumer, snapshot.data(), snapshot.size()) == EBPF_SUCCESS);
+    auto last_record = reinterpret_cast<const ebpf_ring_buffer_record_t*>(snapshot.data() + snapshot.size() - 1024);
+    REQUIRE(*(const uint32_t*)last_record->data == record_count - 1);
+    // Only the instance that froze the ring can thaw it, and only as many times as it froze it.
+    REQUIRE(ebpf_ring_buffer_map_thaw(map.get(), 0, 2) == EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_ring_buffer_map_thaw(map.get(), 0, 1) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_thaw(map.get(), 0, 1) == EBPF_INVALID_ARGUMENT);
+
+    // A consumer that falls behind the overwriting producers can still return what it has read.
+    REQUIRE(ebpf_ring_buffer_map_return_buffer(map.get(), 0, 1024) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_return_buffer(map.get(), 0, consumer + 1024) == EBPF_SUCCESS);
+}
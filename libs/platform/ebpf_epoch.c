@@ -4,39 +4,73 @@
 #include "ebpf_epoch.h"
 
 // Brief summary of how epoch tracking works.
-// Each free operation increments the _ebpf_current_epoch, the freed memory is stamped with that epoch, and the
-// memory is inserted into a per-CPU free list.
+// Each free operation stamps the freed memory with the current value of _ebpf_current_epoch and inserts the memory
+// into a per-CPU free list. Free operations only read _ebpf_current_epoch, so they don't contend on it. The epoch is
+// advanced by ebpf_flush, which runs periodically from the _ebpf_flush_timer while any free-list is non-empty.
+//
+// Each per-CPU free list is split into a small ring of generations, one per epoch in which memory was freed. A
+// generation is released as a whole by splicing its list onto a local list, so releasing memory doesn't walk the
+// freed entries under the lock. If the ring is full, the newest generation absorbs new frees and its epoch is raised
+// to the current epoch, which only delays the release of the entries already in it.
 //
 // Each block of code that accesses epoch freed memory wraps access in calls to ebpf_epoch_enter/ebpf_epoch_exit.
 //
-// The per-CPU state is protected by a single per-CPU lock.
+// The per-CPU free list is protected by a single per-CPU lock. Entering and exiting an epoch does not take any lock.
 //
 // ebpf_epoch_enter:
-// The current epoch is recorded in either a per thread (preemptible) or per CPU (non-preemptible) ebpf_epoch_state_t
-// and it is marked as active.
+// Non-preemptible: The current epoch is recorded in the per CPU ebpf_epoch_state_t and it is marked as active. Only
+// code running on this CPU writes this state, so this is a pair of plain stores followed by a memory barrier that
+// orders them before any access to epoch protected memory.
+// Preemptible: The thread claims a slot in _ebpf_epoch_thread_slots by hashing its thread id and probing for the
+// first slot that is either free or already owned by this thread (a nested enter). The slot table is shared by all
+// CPUs, so a thread that switches CPUs between enter and exit still finds its slot. If every slot is owned by other
+// threads, the thread is counted in the overflow state instead, so entering never fails.
 //
 // ebpf_epoch_exit:
 // First:
-// The current epoch is recorded in either a per thread or per CPU ebpf_epoch_state_t and it is marked as inactive.
-// For the per-thread case, the current CPUs per-thread table is first checked for an active epoch record. If not
-// found then each CPUs per-thread table is checked until the active record is found. This deals with the case where
-// a thread may switch CPUs between enter and exit.
+// Non-preemptible: The per CPU ebpf_epoch_state_t is marked as inactive.
+// Preemptible: The first slot in probe order owned by this thread is released once its nesting depth reaches zero.
+// A thread that owns no slot entered through the overflow state and is removed from its count.
 //
 // Second:
-// Any entries in the per CPU free-list with epoch older than _ebpf_release_epoch are freed.
+// Any generations in the per CPU free-list with epoch older than _ebpf_release_epoch are freed.
 //
 // Third:
-// If the free-list still contains entries, the _ebpf_flush_timer is set (if not already set).
+// If the free-list still contains entries, the _ebpf_flush_timer is set (if not already set). The delay before it
+// runs shrinks as the number of entries waiting on this CPU grows.
 //
 // ebpf_flush:
-// Compute the global lowest epoch across all active CPU and thread ebpf_epoch_state_t and set _ebpf_release_epoch.
+// Advance _ebpf_current_epoch, then compute the global lowest epoch across all active CPU ebpf_epoch_state_t, thread
+// slots and the overflow state, and set _ebpf_release_epoch. Memory stamped with an epoch before the one it advanced
+// to is released once no CPU or thread that entered in that epoch is still active.
 //
 // _ebpf_flush_timer:
 // Calls ebpf_flush and clears the _ebpf_flush_timer_set flag.
 //
+// Memory returned by ebpf_epoch_allocate is rounded up to one of a small set of size classes and is served from a
+// per-CPU cache of blocks of that size when possible. Once released, a block is returned to the cache of the CPU that
+// freed it rather than to the system allocator, up to EBPF_EPOCH_CACHE_MAX_BLOCKS blocks per size class.
+//
 
-// Delay after the _ebpf_flush_timer is set before it runs.
+// Longest and shortest delay after the _ebpf_flush_timer is set before it runs.
 #define EBPF_EPOCH_FLUSH_DELAY_IN_MICROSECONDS 1000
+#define EBPF_EPOCH_MIN_FLUSH_DELAY_IN_MICROSECONDS 50
+
+// The flush delay is halved each time the backlog of entries waiting on a CPU doubles past this count.
+#define EBPF_EPOCH_FLUSH_BACKLOG_THRESHOLD 1024
+
+// Number of generations in each per CPU free list.
+#define EBPF_EPOCH_GENERATION_COUNT 8
+
+// Number of size classes cached per CPU and the most blocks of each size class a CPU caches.
+#define EBPF_EPOCH_CACHE_SIZE_CLASS_COUNT 5
+#define EBPF_EPOCH_CACHE_MAX_BLOCKS 64
+
+// Size class of allocations that are too large to be cached.
+#define EBPF_EPOCH_CACHE_NO_SIZE_CLASS UINT32_MAX
+
+// Size of blocks in each size class, including the allocation header.
+static const size_t _ebpf_epoch_cache_block_sizes[EBPF_EPOCH_CACHE_SIZE_CLASS_COUNT] = {64, 128, 256, 512, 1024};
 
 typedef struct _ebpf_epoch_state
 {
@@ -44,29 +78,85 @@ typedef struct _ebpf_epoch_state
     bool active;
 } ebpf_epoch_state_t;
 
+// Entries freed on a CPU in the same epoch.
+typedef struct _ebpf_epoch_generation
+{
+    int64_t epoch;
+    ebpf_list_entry_t entries;
+    size_t entry_count; // Approximate, as work items can be removed by ebpf_epoch_free_work_item.
+} ebpf_epoch_generation_t;
+
 // Table to track per CPU state.
 // This table must fit into a multiple of EBPF_CACHE_LINE_SIZE.
 typedef struct _ebpf_epoch_cpu_entry
 {
     ebpf_lock_t lock;
-    _Requires_lock_held_(lock) ebpf_epoch_state_t cpu_epoch_state;
-    _Requires_lock_held_(lock) ebpf_list_entry_t free_list;
-    _Requires_lock_held_(lock) ebpf_hash_table_t* thread_table;
+    volatile ebpf_epoch_state_t cpu_epoch_state;
+    _Requires_lock_held_(lock) ebpf_epoch_generation_t generations[EBPF_EPOCH_GENERATION_COUNT];
+    _Requires_lock_held_(lock) uint32_t oldest_generation;
+    uint32_t generation_count; // Read without the lock to check if the free list is empty.
     struct
     {
         int timer_armed : 1;
     } flags;
-    uintptr_t padding;
+    uintptr_t padding[3];
 } ebpf_epoch_cpu_entry_t;
 
 C_ASSERT(sizeof(ebpf_epoch_cpu_entry_t) % EBPF_CACHE_LINE_SIZE == 0);
 
+// Slot to track a preemptible thread that is in an epoch.
+// Each slot occupies its own cache line so that threads don't contend on enter and exit.
+typedef struct _ebpf_epoch_thread_slot
+{
+    void* volatile owner; // Thread id of the owning thread or NULL if the slot is free.
+    volatile int64_t epoch;
+    uint64_t nesting_depth; // Only accessed by the owning thread.
+    uintptr_t padding[5];
+} ebpf_epoch_thread_slot_t;
+
+C_ASSERT(sizeof(ebpf_epoch_thread_slot_t) % EBPF_CACHE_LINE_SIZE == 0);
+
+typedef struct _ebpf_epoch_cache_size_class
+{
+    ebpf_list_entry_t blocks;
+    size_t block_count;
+} ebpf_epoch_cache_size_class_t;
+
+// Table to track per CPU cached blocks.
+// This table must fit into a multiple of EBPF_CACHE_LINE_SIZE.
+typedef struct _ebpf_epoch_cache_entry
+{
+    ebpf_lock_t lock;
+    _Requires_lock_held_(lock) ebpf_epoch_cache_size_class_t size_classes[EBPF_EPOCH_CACHE_SIZE_CLASS_COUNT];
+    _Requires_lock_held_(lock) uint64_t hit_count;
+    _Requires_lock_held_(lock) uint64_t miss_count;
+    uintptr_t padding[6];
+} ebpf_epoch_cache_entry_t;
+
+C_ASSERT(sizeof(ebpf_epoch_cache_entry_t) % EBPF_CACHE_LINE_SIZE == 0);
+
 static _Writable_elements_(_ebpf_epoch_cpu_count) ebpf_epoch_cpu_entry_t* _ebpf_epoch_cpu_table = NULL;
 static uint32_t _ebpf_epoch_cpu_count = 0;
 
+static _Writable_elements_(EBPF_THREAD_SLOT_COUNT) ebpf_epoch_thread_slot_t* _ebpf_epoch_thread_slots = NULL;
+
+// Preemptible threads that are in an epoch but found no free thread slot. They don't record their own epoch; the
+// overflow state keeps the epoch of the oldest of them until the last one exits, which can only delay releases.
+typedef struct _ebpf_epoch_overflow_state
+{
+    ebpf_lock_t lock;
+    _Requires_lock_held_(lock) int64_t epoch;
+    _Requires_lock_held_(lock) uint64_t thread_count;
+} ebpf_epoch_overflow_state_t;
+
+static ebpf_epoch_overflow_state_t _ebpf_epoch_overflow_state;
+
+static _Writable_elements_(_ebpf_epoch_cpu_count) ebpf_epoch_cache_entry_t* _ebpf_epoch_cache_table = NULL;
+
 /**
- * @brief _ebpf_current_epoch indicates the newest active epoch. All memory free
- * operations were performed prior to this value.
+ * @brief _ebpf_current_epoch indicates the newest active epoch. Memory freed
+ * in this epoch can't be released until the epoch has been advanced by
+ * ebpf_epoch_flush.
  */
 static volatile int64_t _ebpf_current_epoch = 1;
 /**
@@ -99,6 +189,7 @@ typedef struct _ebpf_epoch_allocation_header
     ebpf_list_entry_t list_entry;
     int64_t freed_epoch;
     ebpf_epoch_allocation_type_t entry_type;
+    uint32_t size_class; // Index into _ebpf_epoch_cache_block_sizes or EBPF_EPOCH_CACHE_NO_SIZE_CLASS.
 } ebpf_epoch_allocation_header_t;
 
 /**
@@ -114,16 +205,28 @@ typedef struct _ebpf_epoch_work_item
 } ebpf_epoch_work_item_t;
 
 static void
-_ebpf_epoch_release_free_list(_In_ ebpf_epoch_cpu_entry_t* cpu_entry, int64_t released_epoch);
+_ebpf_epoch_insert_free_list(uint32_t cpu_id, _Inout_ ebpf_epoch_allocation_header_t* header);
 
-static ebpf_result_t
-_ebpf_epoch_get_release_epoch(_Out_ int64_t* released_epoch);
+static void
+_ebpf_epoch_release_free_list(uint32_t cpu_id, int64_t released_epoch);
+
+static _Ret_maybenull_ ebpf_epoch_allocation_header_t*
+_ebpf_epoch_cache_allocate(uint32_t size_class);
+
+static void
+_ebpf_epoch_cache_free(uint32_t cpu_id, _Frees_ptr_ ebpf_epoch_allocation_header_t* header);
+
+static int64_t
+_ebpf_epoch_get_release_epoch();
 
 static void
 _ebpf_flush_worker(_In_ void* context);
 
-ebpf_result_t
-_ebpf_epoch_update_thread_state(uint32_t cpu_id, uintptr_t thread_id, int64_t current_epoch, bool enter);
+static void
+_ebpf_epoch_enter_thread_slot(uintptr_t thread_id);
+
+static void
+_ebpf_epoch_exit_thread_slot(uintptr_t thread_id);
 
 ebpf_result_t
 ebpf_epoch_initiate()
@@ -153,18 +256,33 @@ ebpf_epoch_initiate()
         _ebpf_epoch_cpu_table[cpu_id].cpu_epoch_state.active = false;
         ebpf_lock_create(&_ebpf_epoch_cpu_table[cpu_id].lock);
 
-        ebpf_list_initialize(&_ebpf_epoch_cpu_table[cpu_id].free_list);
-
-        return_value = ebpf_hash_table_create(
-            &_ebpf_epoch_cpu_table[cpu_id].thread_table,
-            ebpf_allocate,
-            ebpf_free,
-            sizeof(uintptr_t),
-            sizeof(ebpf_epoch_state_t),
-            _ebpf_epoch_cpu_count,
-            NULL);
-        if (return_value != EBPF_SUCCESS) {
-            goto Error;
+        for (uint32_t generation = 0; generation < EBPF_EPOCH_GENERATION_COUNT; generation++) {
+            ebpf_list_initialize(&_ebpf_epoch_cpu_table[cpu_id].generations[generation].entries);
+        }
+    }
+
+    _ebpf_epoch_thread_slots =
+        ebpf_allocate_cache_aligned(sizeof(ebpf_epoch_thread_slot_t) * EBPF_THREAD_SLOT_COUNT);
+    if (!_ebpf_epoch_thread_slots) {
+        return_value = EBPF_NO_MEMORY;
+        goto Error;
+    }
+
+    ebpf_lock_create(&_ebpf_epoch_overflow_state.lock);
+    _ebpf_epoch_overflow_state.epoch = 0;
+    _ebpf_epoch_overflow_state.thread_count = 0;
+
+    _ebpf_epoch_cache_table = ebpf_allocate_cache_aligned(sizeof(ebpf_epoch_cache_entry_t) * cpu_count);
+    if (!_ebpf_epoch_cache_table) {
+        return_value = EBPF_NO_MEMORY;
+        goto Error;
+    }
+
+    for (cpu_id = 0; cpu_id < _ebpf_epoch_cpu_count; cpu_id++) {
+        ebpf_epoch_cache_entry_t* cache_entry = &_ebpf_epoch_cache_table[cpu_id];
+        ebpf_lock_create(&cache_entry->lock);
+        for (uint32_t size_class = 0; size_class < EBPF_EPOCH_CACHE_SIZE_CLASS_COUNT; size_class++) {
+            ebpf_list_initialize(&cache_entry->size_classes[size_class].blocks);
         }
     }
 
@@ -191,15 +309,39 @@ ebpf_epoch_terminate()
 
     _ebpf_epoch_rundown = true;
     for (cpu_id = 0; cpu_id < _ebpf_epoch_cpu_count; cpu_id++) {
-        _ebpf_epoch_release_free_list(&_ebpf_epoch_cpu_table[cpu_id], MAXINT64);
-        ebpf_assert(ebpf_list_is_empty(&_ebpf_epoch_cpu_table[cpu_id].free_list));
+        _ebpf_epoch_release_free_list(cpu_id, MAXINT64);
+        ebpf_assert(_ebpf_epoch_cpu_table[cpu_id].generation_count == 0);
         ebpf_lock_destroy(&_ebpf_epoch_cpu_table[cpu_id].lock);
-        ebpf_hash_table_destroy(_ebpf_epoch_cpu_table[cpu_id].thread_table);
-        _ebpf_epoch_cpu_table[cpu_id].thread_table = NULL;
+    }
+
+    // Return all cached blocks to the system allocator.
+    for (cpu_id = 0; _ebpf_epoch_cache_table && cpu_id < _ebpf_epoch_cpu_count; cpu_id++) {
+        ebpf_epoch_cache_entry_t* cache_entry = &_ebpf_epoch_cache_table[cpu_id];
+        for (uint32_t size_class = 0; size_class < EBPF_EPOCH_CACHE_SIZE_CLASS_COUNT; size_class++) {
+            ebpf_list_entry_t* blocks = &cache_entry->size_classes[size_class].blocks;
+            while (!ebpf_list_is_empty(blocks)) {
+                ebpf_list_entry_t* entry = blocks->Flink;
+                ebpf_list_remove_entry(entry);
+                ebpf_free(CONTAINING_RECORD(entry, ebpf_epoch_allocation_header_t, list_entry));
+            }
+            cache_entry->size_classes[size_class].block_count = 0;
+        }
+        ebpf_lock_destroy(&cache_entry->lock);
     }
     _ebpf_epoch_cpu_count = 0;
 
     ebpf_free_cache_aligned(_ebpf_epoch_cpu_table);
+    _ebpf_epoch_cpu_table = NULL;
+
+    if (_ebpf_epoch_thread_slots) {
+        ebpf_assert(_ebpf_epoch_overflow_state.thread_count == 0);
+        ebpf_lock_destroy(&_ebpf_epoch_overflow_state.lock);
+    }
+    ebpf_free_cache_aligned(_ebpf_epoch_thread_slots);
+    _ebpf_epoch_thread_slots = NULL;
+
+    ebpf_free_cache_aligned(_ebpf_epoch_cache_table);
+    _ebpf_epoch_cache_table = NULL;
     EBPF_RETURN_VOID();
 }
 
@@ -213,12 +355,15 @@ ebpf_epoch_enter()
     }
 
     if (ebpf_is_preemptible()) {
-        return _ebpf_epoch_update_thread_state(current_cpu, ebpf_get_current_thread_id(), _ebpf_current_epoch, true);
+        _ebpf_epoch_enter_thread_slot(ebpf_get_current_thread_id());
+        return EBPF_SUCCESS;
     } else {
-        ebpf_lock_state_t state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[current_cpu].lock);
-        _ebpf_epoch_cpu_table[current_cpu].cpu_epoch_state.epoch = _ebpf_current_epoch;
-        _ebpf_epoch_cpu_table[current_cpu].cpu_epoch_state.active = true;
-        ebpf_lock_unlock(&_ebpf_epoch_cpu_table[current_cpu].lock, state);
+        volatile ebpf_epoch_state_t* cpu_epoch_state = &_ebpf_epoch_cpu_table[current_cpu].cpu_epoch_state;
+        cpu_epoch_state->epoch = _ebpf_current_epoch;
+        cpu_epoch_state->active = true;
+        // Make the active state visible before touching any epoch protected memory. Pairs with the read of the
+        // per-CPU state in _ebpf_epoch_get_release_epoch.
+        MemoryBarrier();
         return EBPF_SUCCESS;
     }
 }
@@ -232,50 +377,82 @@ ebpf_epoch_exit()
     }
 
     if (ebpf_is_preemptible()) {
-        _ebpf_epoch_update_thread_state(current_cpu, ebpf_get_current_thread_id(), _ebpf_current_epoch, false);
+        _ebpf_epoch_exit_thread_slot(ebpf_get_current_thread_id());
     } else {
-        ebpf_lock_state_t state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[current_cpu].lock);
-        _ebpf_epoch_cpu_table[current_cpu].cpu_epoch_state.epoch = _ebpf_current_epoch;
+        // Complete all access to epoch protected memory before the CPU is marked as inactive.
+        MemoryBarrier();
         _ebpf_epoch_cpu_table[current_cpu].cpu_epoch_state.active = false;
-        ebpf_lock_unlock(&_ebpf_epoch_cpu_table[current_cpu].lock, state);
     }
 
     // Reap the free list.
-    if (!ebpf_list_is_empty(&_ebpf_epoch_cpu_table[current_cpu].free_list)) {
-        _ebpf_epoch_release_free_list(&_ebpf_epoch_cpu_table[current_cpu], _ebpf_release_epoch);
+    if (_ebpf_epoch_cpu_table[current_cpu].generation_count != 0) {
+        _ebpf_epoch_release_free_list(current_cpu, _ebpf_release_epoch);
     }
 }
 
 void
 ebpf_epoch_flush()
 {
-    int64_t released_epoch;
-    ebpf_result_t return_value = _ebpf_epoch_get_release_epoch(&released_epoch);
-    if (return_value == EBPF_SUCCESS) {
-        EBPF_LOG_MESSAGE_UINT64(
-            EBPF_TRACELOG_LEVEL_VERBOSE, EBPF_TRACELOG_KEYWORD_EPOCH, "_ebpf_release_epoch updated", released_epoch);
-        _ebpf_release_epoch = released_epoch;
-    }
+    int64_t released_epoch = _ebpf_epoch_get_release_epoch();
+    EBPF_LOG_MESSAGE_UINT64(
+        EBPF_TRACELOG_LEVEL_VERBOSE, EBPF_TRACELOG_KEYWORD_EPOCH, "_ebpf_release_epoch updated", released_epoch);
+    _ebpf_release_epoch = released_epoch;
 }
 
 void*
 ebpf_epoch_allocate(size_t size)
 {
-    ebpf_epoch_allocation_header_t* header;
+    ebpf_epoch_allocation_header_t* header = NULL;
+    uint32_t size_class;
 
     size += sizeof(ebpf_epoch_allocation_header_t);
-    header = (ebpf_epoch_allocation_header_t*)ebpf_allocate(size);
-    if (header)
+
+    // Find the smallest size class that fits this allocation.
+    for (size_class = 0; size_class < EBPF_EPOCH_CACHE_SIZE_CLASS_COUNT; size_class++) {
+        if (size <= _ebpf_epoch_cache_block_sizes[size_class]) {
+            break;
+        }
+    }
+
+    if (size_class < EBPF_EPOCH_CACHE_SIZE_CLASS_COUNT) {
+        size = _ebpf_epoch_cache_block_sizes[size_class];
+        header = _ebpf_epoch_cache_allocate(size_class);
+    } else {
+        size_class = EBPF_EPOCH_CACHE_NO_SIZE_CLASS;
+    }
+
+    if (!header) {
+        header = (ebpf_epoch_allocation_header_t*)ebpf_allocate(size);
+    }
+
+    if (header) {
+        header->size_class = size_class;
         header++;
+    }
 
     return header;
 }
 
+void
+ebpf_epoch_get_cache_statistics(_Out_ uint64_t* hit_count, _Out_ uint64_t* miss_count)
+{
+    uint32_t cpu_id;
+    *hit_count = 0;
+    *miss_count = 0;
+
+    for (cpu_id = 0; cpu_id < _ebpf_epoch_cpu_count; cpu_id++) {
+        ebpf_epoch_cache_entry_t* cache_entry = &_ebpf_epoch_cache_table[cpu_id];
+        ebpf_lock_state_t lock_state = ebpf_lock_lock(&cache_entry->lock);
+        *hit_count += cache_entry->hit_count;
+        *miss_count += cache_entry->miss_count;
+        ebpf_lock_unlock(&cache_entry->lock, lock_state);
+    }
+}
+
 void
 ebpf_epoch_free(_Frees_ptr_opt_ void* memory)
 {
     ebpf_epoch_allocation_header_t* header = (ebpf_epoch_allocation_header_t*)memory;
-    ebpf_lock_state_t lock_state;
     uint32_t current_cpu;
     current_cpu = ebpf_get_current_cpu();
     if (current_cpu >= _ebpf_epoch_cpu_count) {
@@ -294,11 +471,7 @@ ebpf_epoch_free(_Frees_ptr_opt_ void* memory)
     ebpf_assert(header->freed_epoch == 0);
     header->entry_type = EBPF_EPOCH_ALLOCATION_MEMORY;
 
-    // Items are inserted into the free list in increasing epoch order.
-    lock_state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[current_cpu].lock);
-    header->freed_epoch = ebpf_interlocked_increment_int64(&_ebpf_current_epoch) - 1;
-    ebpf_list_insert_tail(&_ebpf_epoch_cpu_table[current_cpu].free_list, &header->list_entry);
-    ebpf_lock_unlock(&_ebpf_epoch_cpu_table[current_cpu].lock, lock_state);
+    _ebpf_epoch_insert_free_list(current_cpu, header);
 }
 
 ebpf_epoch_work_item_t*
@@ -319,7 +492,6 @@ ebpf_epoch_allocate_work_item(_In_ void* callback_context, _In_ void (*callback)
 void
 ebpf_epoch_schedule_work_item(_In_ ebpf_epoch_work_item_t* work_item)
 {
-    ebpf_lock_state_t lock_state;
     uint32_t current_cpu;
     current_cpu = ebpf_get_current_cpu();
     if (current_cpu >= _ebpf_epoch_cpu_count) {
@@ -331,11 +503,7 @@ ebpf_epoch_schedule_work_item(_In_ ebpf_epoch_work_item_t* work_item)
         return;
     }
 
-    // Items are inserted into the free list in increasing epoch order.
-    lock_state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[current_cpu].lock);
-    work_item->header.freed_epoch = ebpf_interlocked_increment_int64(&_ebpf_current_epoch) - 1;
-    ebpf_list_insert_tail(&_ebpf_epoch_cpu_table[current_cpu].free_list, &work_item->header.list_entry);
-    ebpf_lock_unlock(&_ebpf_epoch_cpu_table[current_cpu].lock, lock_state);
+    _ebpf_epoch_insert_free_list(current_cpu, &work_item->header);
 }
 
 void
@@ -358,39 +526,125 @@ ebpf_epoch_free_work_item(_Frees_ptr_opt_ ebpf_epoch_work_item_t* work_item)
 }
 
 /**
- * @brief Remove all entries from the per-CPU free list that have an epoch that is before released_epoch.
+ * @brief Compute the delay before the flush timer runs from the number of entries waiting to be released.
+ *
+ * @param[in] backlog Number of entries waiting to be released.
+ * @return Delay in microseconds.
+ */
+static uint32_t
+_ebpf_epoch_get_flush_delay(size_t backlog)
+{
+    uint32_t delay = EBPF_EPOCH_FLUSH_DELAY_IN_MICROSECONDS;
+    size_t threshold;
+
+    for (threshold = EBPF_EPOCH_FLUSH_BACKLOG_THRESHOLD;
+         backlog >= threshold && delay > EBPF_EPOCH_MIN_FLUSH_DELAY_IN_MICROSECONDS;
+         threshold *= 2) {
+        delay /= 2;
+    }
+
+    return max(delay, EBPF_EPOCH_MIN_FLUSH_DELAY_IN_MICROSECONDS);
+}
+
+/**
+ * @brief Insert an entry into the newest generation of the per-CPU free list.
+ *
+ * @param[in] cpu_id The per-CPU free list to insert into.
+ * @param[in,out] header The entry to insert.
+ */
+static void
+_ebpf_epoch_insert_free_list(uint32_t cpu_id, _Inout_ ebpf_epoch_allocation_header_t* header)
+{
+    ebpf_epoch_cpu_entry_t* cpu_entry = &_ebpf_epoch_cpu_table[cpu_id];
+    ebpf_epoch_generation_t* generation = NULL;
+    ebpf_lock_state_t lock_state;
+    int64_t current_epoch;
+
+    // Generations are kept in increasing epoch order.
+    // Acquiring the lock only has acquire semantics, which on ARM64 doesn't keep the read of _ebpf_current_epoch
+    // from moving ahead of the caller's stores that unlinked the memory. The full barrier orders the read after them,
+    // so any thread that can still reference the memory entered in this epoch or an earlier one.
+    lock_state = ebpf_lock_lock(&cpu_entry->lock);
+    MemoryBarrier();
+    current_epoch = ReadAcquire64(&_ebpf_current_epoch);
+    header->freed_epoch = current_epoch;
+
+    if (cpu_entry->generation_count != 0) {
+        generation = &cpu_entry->generations
+                          [(cpu_entry->oldest_generation + cpu_entry->generation_count - 1) %
+                           EBPF_EPOCH_GENERATION_COUNT];
+        if (generation->epoch < current_epoch) {
+            if (cpu_entry->generation_count < EBPF_EPOCH_GENERATION_COUNT) {
+                generation = NULL;
+            } else {
+                // Out of generations. Merge into the newest one, delaying the release of its entries.
+                generation->epoch = current_epoch;
+            }
+        }
+    }
+
+    if (!generation) {
+        generation = &cpu_entry->generations
+                          [(cpu_entry->oldest_generation + cpu_entry->generation_count) % EBPF_EPOCH_GENERATION_COUNT];
+        generation->epoch = current_epoch;
+        generation->entry_count = 0;
+        ebpf_assert(ebpf_list_is_empty(&generation->entries));
+        cpu_entry->generation_count++;
+    }
+
+    ebpf_list_insert_tail(&generation->entries, &header->list_entry);
+    generation->entry_count++;
+    ebpf_lock_unlock(&cpu_entry->lock, lock_state);
+}
+
+/**
+ * @brief Remove all generations from the per-CPU free list that have an epoch that is before released_epoch.
  *
  * @param[in] cpu_id The per-CPU free list to search.
  * @param[in] released_epoch The epoch to release.
  */
 static void
-_ebpf_epoch_release_free_list(_In_ ebpf_epoch_cpu_entry_t* cpu_entry, int64_t released_epoch)
+_ebpf_epoch_release_free_list(uint32_t cpu_id, int64_t released_epoch)
 {
+    ebpf_epoch_cpu_entry_t* cpu_entry = &_ebpf_epoch_cpu_table[cpu_id];
     ebpf_lock_state_t lock_state;
     ebpf_list_entry_t* entry;
     ebpf_epoch_allocation_header_t* header;
     ebpf_list_entry_t free_list;
+    size_t backlog = 0;
+    uint32_t index;
 
     ebpf_list_initialize(&free_list);
 
-    // Move all expired items to the free list.
+    // Splice all expired generations onto the free list.
     lock_state = ebpf_lock_lock(&cpu_entry->lock);
-    while (!ebpf_list_is_empty(&cpu_entry->free_list)) {
-        entry = cpu_entry->free_list.Flink;
-        header = CONTAINING_RECORD(entry, ebpf_epoch_allocation_header_t, list_entry);
-        if (header->freed_epoch <= released_epoch) {
-            ebpf_list_remove_entry(entry);
-            ebpf_list_insert_tail(&free_list, entry);
-        } else {
+    while (cpu_entry->generation_count != 0) {
+        ebpf_epoch_generation_t* generation = &cpu_entry->generations[cpu_entry->oldest_generation];
+        if (generation->epoch > released_epoch) {
             break;
         }
+        if (!ebpf_list_is_empty(&generation->entries)) {
+            entry = generation->entries.Flink;
+            // Unlink the list head, leaving the entries as a list without a head, and append them.
+            ebpf_list_remove_entry(&generation->entries);
+            ebpf_list_append_tail_list(&free_list, entry);
+            ebpf_list_initialize(&generation->entries);
+        }
+        cpu_entry->oldest_generation = (cpu_entry->oldest_generation + 1) % EBPF_EPOCH_GENERATION_COUNT;
+        cpu_entry->generation_count--;
+    }
+
+    for (index = 0; index < cpu_entry->generation_count; index++) {
+        backlog +=
+            cpu_entry->generations[(cpu_entry->oldest_generation + index) % EBPF_EPOCH_GENERATION_COUNT].entry_count;
     }
+
     // If there are still items in the free list, schedule a timer to reap them in the future.
-    if (!ebpf_list_is_empty(&cpu_entry->free_list) && !cpu_entry->flags.timer_armed) {
+    if (cpu_entry->generation_count != 0 && !cpu_entry->flags.timer_armed) {
         // We will arm the timer once per CPU that sees entries it can't release.
         // That's acceptable as arming the timer is idempotent.
         cpu_entry->flags.timer_armed = true;
-        ebpf_schedule_timer_work_item(_ebpf_flush_timer, EBPF_EPOCH_FLUSH_DELAY_IN_MICROSECONDS);
+        ebpf_schedule_timer_work_item(_ebpf_flush_timer, _ebpf_epoch_get_flush_delay(backlog));
     }
 
     ebpf_lock_unlock(&cpu_entry->lock, lock_state);
@@ -402,7 +656,7 @@ _ebpf_epoch_release_free_list(_In_ ebpf_epoch_cpu_entry_t* cpu_entry, int64_t re
         ebpf_list_remove_entry(entry);
         switch (header->entry_type) {
         case EBPF_EPOCH_ALLOCATION_MEMORY:
-            ebpf_free(header);
+            _ebpf_epoch_cache_free(cpu_id, header);
             break;
         case EBPF_EPOCH_ALLOCATION_WORK_ITEM: {
             ebpf_epoch_work_item_t* work_item = CONTAINING_RECORD(header, ebpf_epoch_work_item_t, header);
@@ -413,74 +667,138 @@ _ebpf_epoch_release_free_list(_In_ ebpf_epoch_cpu_entry_t* cpu_entry, int64_t re
     }
 }
 
+/**
+ * @brief Take a block of the given size class from the current CPU's cache.
+ *
+ * @param[in] size_class Size class of the block.
+ * @return Pointer to a zeroed block, or NULL if the cache is empty.
+ */
+static _Ret_maybenull_ ebpf_epoch_allocation_header_t*
+_ebpf_epoch_cache_allocate(uint32_t size_class)
+{
+    ebpf_epoch_allocation_header_t* header = NULL;
+    ebpf_epoch_cache_entry_t* cache_entry;
+    ebpf_epoch_cache_size_class_t* cache_size_class;
+    ebpf_lock_state_t lock_state;
+    uint32_t current_cpu = ebpf_get_current_cpu();
+    if (current_cpu >= _ebpf_epoch_cpu_count) {
+        return NULL;
+    }
+
+    cache_entry = &_ebpf_epoch_cache_table[current_cpu];
+    cache_size_class = &cache_entry->size_classes[size_class];
+
+    lock_state = ebpf_lock_lock(&cache_entry->lock);
+    if (!ebpf_list_is_empty(&cache_size_class->blocks)) {
+        ebpf_list_entry_t* entry = cache_size_class->blocks.Flink;
+        ebpf_list_remove_entry(entry);
+        cache_size_class->block_count--;
+        cache_entry->hit_count++;
+        header = CONTAINING_RECORD(entry, ebpf_epoch_allocation_header_t, list_entry);
+    } else {
+        cache_entry->miss_count++;
+    }
+    ebpf_lock_unlock(&cache_entry->lock, lock_state);
+
+    // Blocks from the system allocator are zeroed, so cached blocks are too.
+    if (header) {
+        memset(header, 0, _ebpf_epoch_cache_block_sizes[size_class]);
+    }
+
+    return header;
+}
+
+/**
+ * @brief Return a released block to the cache of the CPU that freed it, or to the system allocator if the block
+ * isn't cacheable or that cache is full.
+ *
+ * @param[in] cpu_id CPU whose free list held the block.
+ * @param[in] header Block to free.
+ */
+static void
+_ebpf_epoch_cache_free(uint32_t cpu_id, _Frees_ptr_ ebpf_epoch_allocation_header_t* header)
+{
+    ebpf_epoch_cache_entry_t* cache_entry;
+    ebpf_epoch_cache_size_class_t* cache_size_class;
+    ebpf_lock_state_t lock_state;
+    bool cached = false;
+
+    if (_ebpf_epoch_rundown || header->size_class == EBPF_EPOCH_CACHE_NO_SIZE_CLASS) {
+        ebpf_free(header);
+        return;
+    }
+
+    cache_entry = &_ebpf_epoch_cache_table[cpu_id];
+    cache_size_class = &cache_entry->size_classes[header->size_class];
+
+    lock_state = ebpf_lock_lock(&cache_entry->lock);
+    if (cache_size_class->block_count < EBPF_EPOCH_CACHE_MAX_BLOCKS) {
+        ebpf_list_insert_tail(&cache_size_class->blocks, &header->list_entry);
+        cache_size_class->block_count++;
+        cached = true;
+    }
+    ebpf_lock_unlock(&cache_entry->lock, lock_state);
+
+    if (!cached) {
+        ebpf_free(header);
+    }
+}
+
 /**
  * @brief Determine the newest inactive epoch and return it.
  *
- * @param[out] release_epoch The newest inactive epoch.
- * @retval EBPF_SUCCESS Found the newest inactive epoch.
- * @retval EBPF_NO_MEMORY Insufficient memory to complete this operation.
+ * @return The newest inactive epoch.
  */
-static ebpf_result_t
-_ebpf_epoch_get_release_epoch(_Out_ int64_t* release_epoch)
+static int64_t
+_ebpf_epoch_get_release_epoch()
 {
-    // Grab an non-authoritative version of _ebpf_current_epoch.
+    // Advance the epoch so that memory freed in the current epoch can be released once all threads and CPUs that
+    // entered in it have exited.
     // Note: If there are no active threads or non-preemptible work items then we need to assign
     // an epoch that is guaranteed to be older than any thread that starts after this point.
-    // Grabbing the current epoch guarantees that, even if we have a stale value of _ebpf_current_epoch.
-    int64_t lowest_epoch = _ebpf_current_epoch;
+    // The newly advanced epoch guarantees that, as every thread that starts after this point observes it or a newer
+    // one.
+    int64_t lowest_epoch = ebpf_interlocked_increment_int64(&_ebpf_current_epoch);
     uint32_t cpu_id;
+    uint32_t slot_index;
     ebpf_lock_state_t lock_state;
-    ebpf_result_t return_value;
     EBPF_LOG_MESSAGE_UINT64(
         EBPF_TRACELOG_LEVEL_VERBOSE,
         EBPF_TRACELOG_KEYWORD_EPOCH,
-        "Captured value of _ebpf_current_epoch",
+        "Advanced _ebpf_current_epoch",
         lowest_epoch);
 
-    for (cpu_id = 0; cpu_id < _ebpf_epoch_cpu_count; cpu_id++) {
-        ebpf_epoch_state_t* thread_epoch_state = NULL;
-        uintptr_t thread_id = 0;
-
-        // Grab the CPU epoch.
-        lock_state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[cpu_id].lock);
+    // The interlocked increment is a full barrier, which orders it before the reads of the per-CPU and per-thread
+    // state. Any CPU or thread that isn't observed as active entered after this point and can't reference memory
+    // freed before it.
 
+    for (cpu_id = 0; cpu_id < _ebpf_epoch_cpu_count; cpu_id++) {
         // Clear the flush timer flag.
+        lock_state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[cpu_id].lock);
         _ebpf_epoch_cpu_table[cpu_id].flags.timer_armed = false;
+        ebpf_lock_unlock(&_ebpf_epoch_cpu_table[cpu_id].lock, lock_state);
 
+        // Grab the CPU epoch.
         if (_ebpf_epoch_cpu_table[cpu_id].cpu_epoch_state.active) {
             lowest_epoch = min(lowest_epoch, _ebpf_epoch_cpu_table[cpu_id].cpu_epoch_state.epoch);
         }
+    }
 
-        // Loop over all the threads in this CPU entry.
-        do {
-            // Get the next per-thread entry from this CPU.
-            return_value = ebpf_hash_table_next_key_and_value(
-                _ebpf_epoch_cpu_table[cpu_id].thread_table,
-                thread_id == 0 ? NULL : (uint8_t*)&thread_id,
-                (uint8_t*)&thread_id,
-                (uint8_t**)&thread_epoch_state);
-
-            if (return_value != EBPF_SUCCESS) {
-                break;
-            }
-            if (thread_epoch_state->active) {
-                lowest_epoch = min(lowest_epoch, thread_epoch_state->epoch);
-            }
-        } while (return_value == EBPF_SUCCESS);
-
-        ebpf_lock_unlock(&_ebpf_epoch_cpu_table[cpu_id].lock, lock_state);
-        if (return_value != EBPF_NO_MORE_KEYS) {
-            goto Exit;
+    // Grab the epoch of each thread that owns a slot.
+    for (slot_index = 0; slot_index < EBPF_THREAD_SLOT_COUNT; slot_index++) {
+        if (_ebpf_epoch_thread_slots[slot_index].owner != NULL) {
+            lowest_epoch = min(lowest_epoch, _ebpf_epoch_thread_slots[slot_index].epoch);
         }
-        return_value = EBPF_SUCCESS;
     }
 
-    return_value = EBPF_SUCCESS;
-
-Exit:
+    // Grab the epoch of the oldest thread that didn't get a slot.
+    lock_state = ebpf_lock_lock(&_ebpf_epoch_overflow_state.lock);
+    if (_ebpf_epoch_overflow_state.thread_count != 0) {
+        lowest_epoch = min(lowest_epoch, _ebpf_epoch_overflow_state.epoch);
+    }
+    ebpf_lock_unlock(&_ebpf_epoch_overflow_state.lock, lock_state);
 
-    *release_epoch = lowest_epoch - 1;
-    return return_value;
+    return lowest_epoch - 1;
 }
 
 /**
@@ -496,66 +814,96 @@ _ebpf_flush_worker(_In_ void* context)
     ebpf_epoch_flush();
 }
 
-ebpf_result_t
-_ebpf_epoch_update_thread_state(uint32_t cpu_id, uintptr_t thread_id, int64_t current_epoch, bool enter)
+/**
+ * @brief Compute the first slot to probe for a given thread.
+ *
+ * @param[in] thread_id Thread id to hash.
+ * @return Index of the first slot to probe.
+ */
+static inline uint32_t
+_ebpf_epoch_thread_slot_hash(uintptr_t thread_id)
+{
+    // Fibonacci hashing spreads thread ids (which are typically aligned pointers or multiples of 4) across the table.
+    return (uint32_t)(((uint64_t)thread_id * 0x9E3779B97F4A7C15ull) >> 32) & (EBPF_THREAD_SLOT_COUNT - 1);
+}
+
+/**
+ * @brief Claim a thread slot and record the current epoch in it. A nested enter reuses the slot claimed by the outer
+ * enter if it is the first candidate in probe order, otherwise it claims a new slot that precedes the outer one. If
+ * every slot is owned by another thread, the thread is counted in the overflow state instead. A thread that owns a
+ * slot always finds it, so only a thread without one can overflow.
+ *
+ * @param[in] thread_id Thread id of the calling thread.
+ */
+static void
+_ebpf_epoch_enter_thread_slot(uintptr_t thread_id)
 {
-    ebpf_result_t return_value;
+    uint32_t start = _ebpf_epoch_thread_slot_hash(thread_id);
+    uint32_t probe;
     ebpf_lock_state_t lock_state;
-    ebpf_epoch_state_t* thread_epoch;
-    ebpf_epoch_state_t local_thread_epoch = {current_epoch, true};
-    bool active_entry_found = false;
-    lock_state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[cpu_id].lock);
-    return_value = ebpf_hash_table_find(
-        _ebpf_epoch_cpu_table[cpu_id].thread_table, (uint8_t*)&thread_id, (uint8_t**)&thread_epoch);
-    if (return_value == EBPF_SUCCESS) {
-        if (enter) {
-            thread_epoch->epoch = current_epoch;
-            thread_epoch->active = true;
-        } else {
-            // https://github.com/microsoft/ebpf-for-windows/issues/437
-            // Consider pruning inactive entries.
-            if (thread_epoch->active) {
-                thread_epoch->active = false;
-                active_entry_found = true;
-            }
+
+    for (probe = 0; probe < EBPF_THREAD_SLOT_COUNT; probe++) {
+        ebpf_epoch_thread_slot_t* slot = &_ebpf_epoch_thread_slots[(start + probe) % EBPF_THREAD_SLOT_COUNT];
+        void* owner = slot->owner;
+        if (owner == (void*)thread_id) {
+            slot->nesting_depth++;
+            return;
         }
-        return_value = EBPF_SUCCESS;
-    } else if (return_value == EBPF_KEY_NOT_FOUND) {
-        return_value = ebpf_hash_table_update(
-            _ebpf_epoch_cpu_table[cpu_id].thread_table,
-            (const uint8_t*)&thread_id,
-            (const uint8_t*)&local_thread_epoch,
-            EBPF_HASH_TABLE_OPERATION_INSERT);
-    }
-    ebpf_lock_unlock(&_ebpf_epoch_cpu_table[cpu_id].lock, lock_state);
-
-    if (return_value == EBPF_SUCCESS) {
-        goto Exit;
-    }
-
-    if (enter) {
-        goto Exit;
-    }
-    EBPF_LOG_MESSAGE(EBPF_TRACELOG_LEVEL_VERBOSE, EBPF_TRACELOG_KEYWORD_EPOCH, "Thread state not found on current CPU");
-
-    // If this is an exit call and the current CPU doesn't have the active entry
-    // then scan all CPUs until we find it.
-    if (!active_entry_found) {
-        for (cpu_id = 0; cpu_id < _ebpf_epoch_cpu_count; cpu_id++) {
-            lock_state = ebpf_lock_lock(&_ebpf_epoch_cpu_table[cpu_id].lock);
-            return_value = ebpf_hash_table_find(
-                _ebpf_epoch_cpu_table[cpu_id].thread_table, (uint8_t*)&thread_id, (uint8_t**)&thread_epoch);
-            ebpf_lock_unlock(&_ebpf_epoch_cpu_table[cpu_id].lock, lock_state);
-
-            if (return_value == EBPF_SUCCESS && thread_epoch->active) {
-                thread_epoch->active = false;
-                active_entry_found = true;
-                break;
-            }
+        if (owner != NULL) {
+            continue;
+        }
+        // The interlocked operation is a full barrier, which orders claiming the slot before any access to epoch
+        // protected memory. A stale epoch recorded by the previous owner is older than the current epoch, so a
+        // concurrent flush that observes it is conservative.
+        if (ebpf_interlocked_compare_exchange_pointer(&slot->owner, (void*)thread_id, NULL) == NULL) {
+            slot->epoch = _ebpf_current_epoch;
+            slot->nesting_depth = 1;
+            return;
         }
     }
-    ebpf_assert(active_entry_found);
 
-Exit:
-    return return_value;
+    EBPF_LOG_MESSAGE(EBPF_TRACELOG_LEVEL_VERBOSE, EBPF_TRACELOG_KEYWORD_EPOCH, "No free epoch thread slots");
+    lock_state = ebpf_lock_lock(&_ebpf_epoch_overflow_state.lock);
+    if (_ebpf_epoch_overflow_state.thread_count++ == 0) {
+        _ebpf_epoch_overflow_state.epoch = _ebpf_current_epoch;
+    }
+    ebpf_lock_unlock(&_ebpf_epoch_overflow_state.lock, lock_state);
+    // Releasing the lock doesn't order later reads before it. Make the count visible before touching any epoch
+    // protected memory.
+    MemoryBarrier();
+}
+
+/**
+ * @brief Release the innermost thread slot owned by this thread. This is the first slot in probe order owned by this
+ * thread, as a nested enter never claims a slot behind the one claimed by the outer enter. If the thread owns no
+ * slot, the innermost enter overflowed, so the thread is removed from the overflow count instead.
+ *
+ * @param[in] thread_id Thread id of the calling thread.
+ */
+static void
+_ebpf_epoch_exit_thread_slot(uintptr_t thread_id)
+{
+    uint32_t start = _ebpf_epoch_thread_slot_hash(thread_id);
+    uint32_t probe;
+    ebpf_lock_state_t lock_state;
+
+    for (probe = 0; probe < EBPF_THREAD_SLOT_COUNT; probe++) {
+        ebpf_epoch_thread_slot_t* slot = &_ebpf_epoch_thread_slots[(start + probe) % EBPF_THREAD_SLOT_COUNT];
+        if (slot->owner != (void*)thread_id) {
+            continue;
+        }
+        if (--slot->nesting_depth == 0) {
+            // The interlocked operation is a full barrier, which completes all access to epoch protected memory
+            // before the slot is released.
+            ebpf_interlocked_compare_exchange_pointer(&slot->owner, NULL, (void*)thread_id);
+        }
+        return;
+    }
+
+    // Complete all access to epoch protected memory before the thread is removed from the overflow count.
+    MemoryBarrier();
+    lock_state = ebpf_lock_lock(&_ebpf_epoch_overflow_state.lock);
+    ebpf_assert(_ebpf_epoch_overflow_state.thread_count != 0);
+    _ebpf_epoch_overflow_state.thread_count--;
+    ebpf_lock_unlock(&_ebpf_epoch_overflow_state.lock, lock_state);
 }
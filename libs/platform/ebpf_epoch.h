@@ -59,6 +59,17 @@ extern "C"
     void
     ebpf_epoch_free(_Frees_ptr_opt_ void* memory);
 
+    /**
+     * @brief Get the number of allocations that were and were not satisfied
+     * from the per-CPU caches of epoch memory.
+     *
+     * @param[out] hit_count Number of allocations satisfied from a cache.
+     * @param[out] miss_count Number of cacheable allocations that found the
+     *  cache empty.
+     */
+    void
+    ebpf_epoch_get_cache_statistics(_Out_ uint64_t* hit_count, _Out_ uint64_t* miss_count);
+
     /**
      * @Brief Release any memory that is associated with expired epochs.
      */
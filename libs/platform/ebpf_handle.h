@@ -62,6 +62,18 @@ extern "C"
     ebpf_result_t
     ebpf_reference_object_by_handle(ebpf_handle_t handle, ebpf_object_type_t object_type, struct _ebpf_object** object);
 
+    /**
+     * @brief Get a value that identifies the handle instance a handle refers to. Duplicates of a handle refer to the
+     *  same instance, which is closed when the last of them is closed.
+     *
+     * @param[in] handle Handle to query.
+     * @param[out] instance Identifier of the handle instance.
+     * @retval EBPF_SUCCESS The operation was successful.
+     * @retval EBPF_INVALID_OBJECT The provided handle is not valid.
+     */
+    ebpf_result_t
+    ebpf_handle_get_instance(ebpf_handle_t handle, _Out_ uintptr_t* instance);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,15 +3,42 @@
 
 #include "ebpf_platform.h"
 
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define EBPF_HASH_TABLE_USE_SSE2
+#endif
+
 // Buckets contain an array of pointers to value and keys.
 // Buckets are immutable once inserted in to the hash-table and replaced when
 // modified.
 
 // Layout is:
-// ebpf_hash_table_t.buckets->ebpf_hash_bucket_header_t.entries->data
+// ebpf_hash_table_t.bucket_array->buckets->ebpf_hash_bucket_header_t.entries->data
 // Keys are stored contiguously in ebpf_hash_bucket_header_t for fast
 // searching, data is stored separately to prevent read-copy-update semantics
 // from causing loss of updates.
+// Each bucket starts with an array of one byte fingerprints, one per entry,
+// derived from the hash of the entry's key. Lookups match the fingerprints
+// 16 at a time and only compare the full key of entries whose fingerprint
+// matches.
+
+// Resizing:
+// The table grows or shrinks by a factor of two when the load factor leaves
+// the range [1 / EBPF_HASH_TABLE_SHRINK_LOAD_FACTOR, EBPF_HASH_TABLE_GROW_LOAD_FACTOR].
+// A resize publishes a new bucket array that points at the previous one and
+// then migrates a few buckets from the previous array on each update. While a
+// bucket in the previous array has not been migrated it remains the
+// authoritative copy for its keys. Once migrated it is replaced with
+// EBPF_HASH_BUCKET_MOVED and lookups continue in the new array. Readers never
+// block; writers that touch an unmigrated bucket migrate it first. Iteration
+// reads keys that have not been migrated from the previous array.
+
+#define EBPF_HASH_TABLE_GROW_LOAD_FACTOR 2
+#define EBPF_HASH_TABLE_SHRINK_LOAD_FACTOR 8
+#define EBPF_HASH_TABLE_MIGRATION_BATCH_SIZE 4
+
+// Fingerprint arrays are padded to a multiple of this size so they can be read a vector at a time.
+#define EBPF_HASH_BUCKET_FINGERPRINT_ALIGNMENT 16
 
 typedef struct _ebpf_hash_bucket_entry
 {
@@ -22,20 +49,39 @@ typedef struct _ebpf_hash_bucket_entry
 typedef struct _ebpf_hash_bucket_header
 {
     size_t count;
-    _Field_size_(count) ebpf_hash_bucket_entry_t entries[1];
+    size_t capacity;
+    // Followed by the entries, after the fingerprint array is padded to EBPF_HASH_BUCKET_FINGERPRINT_ALIGNMENT.
+    _Field_size_(capacity) uint8_t fingerprints[1];
 } ebpf_hash_bucket_header_t;
 
-struct _ebpf_hash_table
+typedef struct _ebpf_hash_bucket_array
 {
     uint32_t bucket_count;
+    uint32_t migration_index; // Next bucket in previous to migrate, protected by resize_lock.
+    struct _ebpf_hash_bucket_array* volatile previous; // Array being migrated into this one or NULL.
+    _Field_size_(bucket_count) ebpf_hash_bucket_header_t* volatile buckets[1];
+} ebpf_hash_bucket_array_t;
+
+struct _ebpf_hash_table
+{
+    ebpf_hash_bucket_array_t* volatile bucket_array;
+    uint32_t minimum_bucket_count;
     volatile int32_t entry_count;
     uint32_t seed;
     size_t key_size;
     size_t value_size;
+    size_t supplemental_value_size;
     void* (*allocate)(size_t size);
     void (*free)(void* memory);
     void (*extract)(_In_ const uint8_t* value, _Outptr_ const uint8_t** data, _Out_ size_t* num);
-    _Field_size_(bucket_count) ebpf_hash_bucket_header_t* volatile buckets[1];
+    void* notification_context;
+    void (*notification_callback)(
+        _In_opt_ void* context,
+        ebpf_hash_table_notification_type_t type,
+        _In_ const uint8_t* key,
+        _Inout_ uint8_t* value,
+        _Inout_opt_ uint8_t* supplemental_value);
+    ebpf_lock_t resize_lock;
 };
 
 typedef enum _ebpf_hash_bucket_operation
@@ -44,8 +90,31 @@ typedef enum _ebpf_hash_bucket_operation
     EBPF_HASH_BUCKET_OPERATION_INSERT,
     EBPF_HASH_BUCKET_OPERATION_UPDATE,
     EBPF_HASH_BUCKET_OPERATION_DELETE,
+    EBPF_HASH_BUCKET_OPERATION_DELETE_VALUE, // Delete only if the key still maps to the given value.
 } ebpf_hash_bucket_operation_t;
 
+// Marker stored in a bucket of the previous array once its entries have been
+// moved to the new array.
+static ebpf_hash_bucket_header_t _ebpf_hash_bucket_moved = {0};
+#define EBPF_HASH_BUCKET_MOVED (&_ebpf_hash_bucket_moved)
+
+// Low bit set on a bucket pointer while the bucket is being migrated. A frozen
+// bucket is still valid for readers, but can't be replaced by writers.
+#define EBPF_HASH_BUCKET_FROZEN ((uintptr_t)1)
+
+static inline bool
+_ebpf_hash_bucket_is_frozen(_In_opt_ const ebpf_hash_bucket_header_t* bucket)
+{
+    return ((uintptr_t)bucket & EBPF_HASH_BUCKET_FROZEN) != 0;
+}
+
+static inline ebpf_hash_bucket_header_t*
+_ebpf_hash_bucket_unfrozen(_In_opt_ ebpf_hash_bucket_header_t* bucket)
+{
+    return (ebpf_hash_bucket_header_t*)((uintptr_t)bucket & ~EBPF_HASH_BUCKET_FROZEN);
+}
+
+
 /**
  * @brief Perform a rotate left on a value.
  *
@@ -197,6 +266,92 @@ _ebpf_hash_table_compute_hash(_In_ const ebpf_hash_table_t* hash_table, _In_ con
     return _ebpf_murmur3_32(data, length, hash_table->seed);
 }
 
+/**
+ * @brief Compute the offset of the supplemental value from the start of a
+ * value, keeping it pointer aligned.
+ *
+ * @param[in] hash_table Hash table the value belongs to.
+ * @return Offset of the supplemental value.
+ */
+static inline size_t
+_ebpf_hash_table_supplemental_value_offset(_In_ const ebpf_hash_table_t* hash_table)
+{
+    return (hash_table->value_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+}
+
+/**
+ * @brief Invoke the notification callback of the hash table, if any.
+ *
+ * @param[in] hash_table Hash table the value belongs to.
+ * @param[in] type Type of notification.
+ * @param[in] key Key of the value.
+ * @param[in, out] value Value the notification is for.
+ */
+static inline void
+_ebpf_hash_table_notify(
+    _In_ const ebpf_hash_table_t* hash_table,
+    ebpf_hash_table_notification_type_t type,
+    _In_ const uint8_t* key,
+    _Inout_ uint8_t* value)
+{
+    if (hash_table->notification_callback) {
+        hash_table->notification_callback(
+            hash_table->notification_context,
+            type,
+            key,
+            value,
+            hash_table->supplemental_value_size ? value + _ebpf_hash_table_supplemental_value_offset(hash_table)
+                                                : NULL);
+    }
+}
+
+/**
+ * @brief Given two keys, determine if they are equal. Keys of tables without
+ * an extract function are compared directly.
+ *
+ * @param[in] hash_table Hash table the keys belong to.
+ * @param[in] key_a First key.
+ * @param[in] key_b Second key.
+ * @retval true The keys are equal.
+ * @retval false The keys are not equal.
+ */
+static inline bool
+_ebpf_hash_table_key_equal(
+    _In_ const ebpf_hash_table_t* hash_table, _In_ const uint8_t* key_a, _In_ const uint8_t* key_b)
+{
+    if (!hash_table->extract) {
+        return memcmp(key_a, key_b, hash_table->key_size) == 0;
+    }
+    return _ebpf_hash_table_compare(hash_table, key_a, key_b) == 0;
+}
+
+/**
+ * @brief Compute the fingerprint stored in a bucket for a key. The bucket
+ * index is taken from the low order bits of the hash, so the fingerprint uses
+ * the high order bits.
+ *
+ * @param[in] hash Hash of the key.
+ * @return Fingerprint of the key.
+ */
+static inline uint8_t
+_ebpf_hash_table_fingerprint(uint32_t hash)
+{
+    return (uint8_t)(hash >> 24);
+}
+
+/**
+ * @brief Compute the size of the fingerprint array of a bucket.
+ *
+ * @param[in] capacity Count of entries the bucket can hold.
+ * @return Size in bytes of the padded fingerprint array.
+ */
+static inline size_t
+_ebpf_hash_bucket_fingerprint_size(size_t capacity)
+{
+    return (capacity + EBPF_HASH_BUCKET_FINGERPRINT_ALIGNMENT - 1) &
+           ~((size_t)EBPF_HASH_BUCKET_FINGERPRINT_ALIGNMENT - 1);
+}
+
 /**
  * @brief Given a pointer to a bucket, compute the offset of a bucket entry.
  *
@@ -208,22 +363,384 @@ _ebpf_hash_table_compute_hash(_In_ const ebpf_hash_table_t* hash_table, _In_ con
 ebpf_hash_bucket_entry_t*
 _ebpf_hash_table_bucket_entry(size_t key_size, _In_ ebpf_hash_bucket_header_t* bucket, size_t index)
 {
-    uint8_t* offset = (uint8_t*)bucket->entries;
+    uint8_t* offset = bucket->fingerprints + _ebpf_hash_bucket_fingerprint_size(bucket->capacity);
     size_t entry_size = EBPF_OFFSET_OF(ebpf_hash_bucket_entry_t, key) + key_size;
 
     return (ebpf_hash_bucket_entry_t*)(offset + (size_t)index * entry_size);
 }
 
+/**
+ * @brief Allocate an empty bucket.
+ *
+ * @param[in] hash_table Hash table the bucket belongs to.
+ * @param[in] capacity Count of entries the bucket can hold.
+ * @return Pointer to the bucket or NULL on failure.
+ */
+static ebpf_hash_bucket_header_t*
+_ebpf_hash_table_allocate_bucket(_In_ const ebpf_hash_table_t* hash_table, size_t capacity)
+{
+    size_t entry_size = EBPF_OFFSET_OF(ebpf_hash_bucket_entry_t, key) + hash_table->key_size;
+    ebpf_hash_bucket_header_t* bucket = hash_table->allocate(
+        EBPF_OFFSET_OF(ebpf_hash_bucket_header_t, fingerprints) + _ebpf_hash_bucket_fingerprint_size(capacity) +
+        entry_size * capacity);
+    if (bucket) {
+        bucket->capacity = capacity;
+    }
+    return bucket;
+}
+
+/**
+ * @brief Append an entry to a bucket that is being constructed.
+ *
+ * @param[in] key_size Size of key.
+ * @param[in, out] bucket Bucket to append to.
+ * @param[in] fingerprint Fingerprint of the entry's key.
+ * @param[in] key Key of the entry.
+ * @param[in] data Data of the entry.
+ */
+static void
+_ebpf_hash_bucket_append(
+    size_t key_size,
+    _Inout_ ebpf_hash_bucket_header_t* bucket,
+    uint8_t fingerprint,
+    _In_ const uint8_t* key,
+    _In_ uint8_t* data)
+{
+    ebpf_assert(bucket->count < bucket->capacity);
+    ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(key_size, bucket, bucket->count);
+    entry->data = data;
+    memcpy(entry->key, key, key_size);
+    bucket->fingerprints[bucket->count] = fingerprint;
+    bucket->count++;
+}
+
+/**
+ * @brief Find the entry for a key in a bucket. Only entries whose fingerprint
+ * matches have their key compared.
+ *
+ * @param[in] hash_table Hash table the bucket belongs to.
+ * @param[in] bucket Bucket to search.
+ * @param[in] key Key to find.
+ * @param[in] fingerprint Fingerprint of the key.
+ * @return Index of the entry or MAXSIZE_T if the key isn't present.
+ */
+static size_t
+_ebpf_hash_bucket_find(
+    _In_ const ebpf_hash_table_t* hash_table,
+    _In_ ebpf_hash_bucket_header_t* bucket,
+    _In_ const uint8_t* key,
+    uint8_t fingerprint)
+{
+    size_t index;
+#if defined(EBPF_HASH_TABLE_USE_SSE2)
+    __m128i pattern = _mm_set1_epi8((char)fingerprint);
+    for (index = 0; index < bucket->count; index += EBPF_HASH_BUCKET_FINGERPRINT_ALIGNMENT) {
+        __m128i fingerprints = _mm_loadu_si128((const __m128i*)&bucket->fingerprints[index]);
+        uint32_t matches = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(fingerprints, pattern));
+        // Ignore the padding after the last entry.
+        if (bucket->count - index < EBPF_HASH_BUCKET_FINGERPRINT_ALIGNMENT) {
+            matches &= (1u << (bucket->count - index)) - 1;
+        }
+        while (matches) {
+            unsigned long bit;
+            _BitScanForward(&bit, matches);
+            ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, index + bit);
+            if (_ebpf_hash_table_key_equal(hash_table, key, entry->key)) {
+                return index + bit;
+            }
+            matches &= matches - 1;
+        }
+    }
+#else
+    for (index = 0; index < bucket->count; index++) {
+        if (bucket->fingerprints[index] != fingerprint) {
+            continue;
+        }
+        ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, index);
+        if (_ebpf_hash_table_key_equal(hash_table, key, entry->key)) {
+            return index;
+        }
+    }
+#endif
+    return MAXSIZE_T;
+}
+
+/**
+ * @brief Allocate an empty bucket array.
+ *
+ * @param[in] allocate Function to use when allocating the array.
+ * @param[in] bucket_count Count of buckets in the array.
+ * @return Pointer to the bucket array or NULL on failure.
+ */
+static ebpf_hash_bucket_array_t*
+_ebpf_hash_table_allocate_bucket_array(_In_ void* (*allocate)(size_t size), size_t bucket_count)
+{
+    ebpf_hash_bucket_array_t* bucket_array;
+    size_t array_size;
+
+    if (ebpf_safe_size_t_multiply(sizeof(ebpf_hash_bucket_header_t*), bucket_count, &array_size) != EBPF_SUCCESS) {
+        return NULL;
+    }
+    if (ebpf_safe_size_t_add(array_size, EBPF_OFFSET_OF(ebpf_hash_bucket_array_t, buckets), &array_size) !=
+        EBPF_SUCCESS) {
+        return NULL;
+    }
+
+    bucket_array = allocate(array_size);
+    if (bucket_array) {
+        bucket_array->bucket_count = (uint32_t)bucket_count;
+    }
+    return bucket_array;
+}
+
+/**
+ * @brief Find the bucket that holds keys with the given hash. While a resize
+ * is in progress the bucket in the previous array is authoritative until it
+ * has been migrated.
+ *
+ * @param[in] hash_table Hash table to search.
+ * @param[in] hash Hash of the key.
+ * @return Pointer to the bucket or NULL if the bucket is empty.
+ */
+static ebpf_hash_bucket_header_t*
+_ebpf_hash_table_get_bucket(_In_ const ebpf_hash_table_t* hash_table, uint32_t hash)
+{
+    for (;;) {
+        ebpf_hash_bucket_array_t* bucket_array = hash_table->bucket_array;
+        ebpf_hash_bucket_array_t* previous = bucket_array->previous;
+        ebpf_hash_bucket_header_t* bucket = EBPF_HASH_BUCKET_MOVED;
+
+        if (previous) {
+            bucket = previous->buckets[hash % previous->bucket_count];
+        }
+        if (bucket == EBPF_HASH_BUCKET_MOVED) {
+            bucket = bucket_array->buckets[hash % bucket_array->bucket_count];
+        }
+        // A moved bucket means a newer array was published after it was captured.
+        if (bucket != EBPF_HASH_BUCKET_MOVED) {
+            return _ebpf_hash_bucket_unfrozen(bucket);
+        }
+    }
+}
+
+/**
+ * @brief Determine if the load factor of the hash table requires a resize.
+ *
+ * @param[in] hash_table Hash table to check.
+ * @param[in] bucket_count Current count of buckets.
+ * @param[out] new_bucket_count Count of buckets the table should have.
+ * @retval true The hash table should be resized.
+ * @retval false The load factor is within range.
+ */
+static bool
+_ebpf_hash_table_get_new_bucket_count(
+    _In_ const ebpf_hash_table_t* hash_table, uint32_t bucket_count, _Out_ uint32_t* new_bucket_count)
+{
+    size_t entry_count = (size_t)hash_table->entry_count;
+
+    *new_bucket_count = bucket_count;
+    if (entry_count > (size_t)bucket_count * EBPF_HASH_TABLE_GROW_LOAD_FACTOR && bucket_count <= MAXUINT32 / 2) {
+        *new_bucket_count = bucket_count * 2;
+    } else if (
+        entry_count * EBPF_HASH_TABLE_SHRINK_LOAD_FACTOR < bucket_count && (bucket_count % 2) == 0 &&
+        bucket_count / 2 >= hash_table->minimum_bucket_count) {
+        *new_bucket_count = bucket_count / 2;
+    }
+    return *new_bucket_count != bucket_count;
+}
+
+/**
+ * @brief Rebuild a bucket in the current array so that it also contains the
+ * entries of source_bucket that hash to it. Entries already present that
+ * belong to source_index were left behind by a failed migration and are
+ * dropped.
+ *
+ * @param[in] hash_table Hash table being resized.
+ * @param[in] bucket_array Current bucket array.
+ * @param[in] target_index Index of the bucket to rebuild.
+ * @param[in] source_bucket Bucket being migrated from the previous array.
+ * @param[in] source_index Index of source_bucket in the previous array.
+ * @retval EBPF_SUCCESS The operation succeeded.
+ * @retval EBPF_NO_MEMORY Insufficient memory to construct new bucket.
+ */
+_Requires_lock_held_(&hash_table->resize_lock) static ebpf_result_t _ebpf_hash_table_merge_bucket(
+    _In_ ebpf_hash_table_t* hash_table,
+    _Inout_ ebpf_hash_bucket_array_t* bucket_array,
+    uint32_t target_index,
+    _In_ ebpf_hash_bucket_header_t* source_bucket,
+    uint32_t source_index)
+{
+    uint32_t previous_bucket_count = bucket_array->previous->bucket_count;
+    ebpf_hash_bucket_header_t* volatile* bucket_slot = &bucket_array->buckets[target_index];
+    size_t index;
+
+    for (;;) {
+        ebpf_hash_bucket_header_t* old_bucket = *bucket_slot;
+        ebpf_hash_bucket_header_t* new_bucket;
+        size_t old_bucket_count = old_bucket ? old_bucket->count : 0;
+
+        new_bucket = _ebpf_hash_table_allocate_bucket(hash_table, old_bucket_count + source_bucket->count);
+        if (!new_bucket) {
+            return EBPF_NO_MEMORY;
+        }
+
+        for (index = 0; index < old_bucket_count; index++) {
+            ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, old_bucket, index);
+            if (_ebpf_hash_table_compute_hash(hash_table, entry->key) % previous_bucket_count == source_index) {
+                continue;
+            }
+            _ebpf_hash_bucket_append(
+                hash_table->key_size, new_bucket, old_bucket->fingerprints[index], entry->key, entry->data);
+        }
+
+        for (index = 0; index < source_bucket->count; index++) {
+            ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, source_bucket, index);
+            if (_ebpf_hash_table_compute_hash(hash_table, entry->key) % bucket_array->bucket_count != target_index) {
+                continue;
+            }
+            _ebpf_hash_bucket_append(
+                hash_table->key_size, new_bucket, source_bucket->fingerprints[index], entry->key, entry->data);
+        }
+
+        if (new_bucket->count == 0) {
+            hash_table->free(new_bucket);
+            new_bucket = NULL;
+        }
+
+        if (ebpf_interlocked_compare_exchange_pointer((void* volatile*)bucket_slot, new_bucket, old_bucket) ==
+            old_bucket) {
+            // Only the bucket is released, the data is now referenced from new_bucket.
+            hash_table->free(old_bucket);
+            return EBPF_SUCCESS;
+        }
+
+        // A writer replaced the bucket, try again.
+        hash_table->free(new_bucket);
+    }
+}
+
+/**
+ * @brief Move the entries of one bucket in the previous array into the
+ * current array. On failure the bucket is left in the previous array and
+ * the migration can be retried.
+ *
+ * @param[in] hash_table Hash table being resized.
+ * @param[in] bucket_array Current bucket array.
+ * @param[in] index Index of the bucket to migrate in the previous array.
+ * @retval EBPF_SUCCESS The operation succeeded.
+ * @retval EBPF_NO_MEMORY Insufficient memory to construct new buckets.
+ */
+_Requires_lock_held_(&hash_table->resize_lock) static ebpf_result_t _ebpf_hash_table_migrate_bucket(
+    _In_ ebpf_hash_table_t* hash_table, _Inout_ ebpf_hash_bucket_array_t* bucket_array, uint32_t index)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_hash_bucket_array_t* previous = bucket_array->previous;
+    ebpf_hash_bucket_header_t* volatile* bucket_slot = &previous->buckets[index];
+    ebpf_hash_bucket_header_t* bucket;
+    ebpf_hash_bucket_header_t* frozen_bucket;
+    uint32_t target_index;
+
+    // Freeze the bucket so that writers still using the previous array can't replace it.
+    for (;;) {
+        bucket = *bucket_slot;
+        if (bucket == EBPF_HASH_BUCKET_MOVED) {
+            return EBPF_SUCCESS;
+        }
+        frozen_bucket = (ebpf_hash_bucket_header_t*)((uintptr_t)bucket | EBPF_HASH_BUCKET_FROZEN);
+        if (ebpf_interlocked_compare_exchange_pointer((void* volatile*)bucket_slot, frozen_bucket, bucket) == bucket) {
+            break;
+        }
+    }
+
+    // Bucket counts always change by a factor of two, so entries of a bucket land either in the buckets congruent
+    // to index (grow) or in a single bucket (shrink).
+    if (bucket && bucket_array->bucket_count > previous->bucket_count) {
+        for (target_index = index; target_index < bucket_array->bucket_count; target_index += previous->bucket_count) {
+            result = _ebpf_hash_table_merge_bucket(hash_table, bucket_array, target_index, bucket, index);
+            if (result != EBPF_SUCCESS) {
+                break;
+            }
+        }
+    } else if (bucket) {
+        result =
+            _ebpf_hash_table_merge_bucket(hash_table, bucket_array, index % bucket_array->bucket_count, bucket, index);
+    }
+
+    if (result != EBPF_SUCCESS) {
+        ebpf_interlocked_compare_exchange_pointer((void* volatile*)bucket_slot, bucket, frozen_bucket);
+        return result;
+    }
+
+    ebpf_interlocked_compare_exchange_pointer((void* volatile*)bucket_slot, EBPF_HASH_BUCKET_MOVED, frozen_bucket);
+    hash_table->free(bucket);
+    return EBPF_SUCCESS;
+}
+
+/**
+ * @brief Start a resize if the load factor requires one, then migrate up to
+ * bucket_limit buckets from the previous bucket array. The previous array is
+ * released once all of its buckets have been migrated.
+ *
+ * @param[in] hash_table Hash table to resize.
+ * @param[in] bucket_limit Maximum number of buckets to migrate.
+ * @retval EBPF_SUCCESS The operation succeeded.
+ * @retval EBPF_NO_MEMORY Insufficient memory to resize the hash table.
+ */
+static ebpf_result_t
+_ebpf_hash_table_resize(_Inout_ ebpf_hash_table_t* hash_table, uint32_t bucket_limit)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_lock_state_t state = ebpf_lock_lock(&hash_table->resize_lock);
+    ebpf_hash_bucket_array_t* bucket_array = hash_table->bucket_array;
+    ebpf_hash_bucket_array_t* previous = bucket_array->previous;
+    uint32_t new_bucket_count;
+
+    if (!previous) {
+        if (!_ebpf_hash_table_get_new_bucket_count(hash_table, bucket_array->bucket_count, &new_bucket_count)) {
+            goto Done;
+        }
+
+        previous = bucket_array;
+        bucket_array = _ebpf_hash_table_allocate_bucket_array(hash_table->allocate, new_bucket_count);
+        if (!bucket_array) {
+            result = EBPF_NO_MEMORY;
+            goto Done;
+        }
+        bucket_array->previous = previous;
+
+        ebpf_interlocked_compare_exchange_pointer((void* volatile*)&hash_table->bucket_array, bucket_array, previous);
+    }
+
+    while (bucket_limit > 0 && bucket_array->migration_index < previous->bucket_count) {
+        result = _ebpf_hash_table_migrate_bucket(hash_table, bucket_array, bucket_array->migration_index);
+        if (result != EBPF_SUCCESS) {
+            goto Done;
+        }
+        bucket_array->migration_index++;
+        bucket_limit--;
+    }
+
+    if (bucket_array->migration_index == previous->bucket_count) {
+        ebpf_interlocked_compare_exchange_pointer((void* volatile*)&bucket_array->previous, NULL, previous);
+        hash_table->free(previous);
+    }
+
+Done:
+    ebpf_lock_unlock(&hash_table->resize_lock, state);
+    return result;
+}
+
 /**
  * @brief Perform an atomic replacement of a bucket in the hash table.
  * Operations include insert and delete of elements.
  *
  * @param[in] hash_table Hash table to update.
  * @param[in] key Key to operate on.
- * @param[in] value Value to be inserted or NULL.
+ * @param[in] value Value to be inserted or NULL. For EBPF_HASH_BUCKET_OPERATION_DELETE_VALUE, the value
+ *  pointer the key must map to.
  * @param[in] operation Operation to perform.
  * @retval EBPF_SUCCESS The operation succeeded.
- * @retval EBPF_KEY_NOT_FOUND The specified key is not present in the bucket.
+ * @retval EBPF_KEY_NOT_FOUND The specified key is not present in the bucket, or maps to a different value.
  * @retval EBPF_NO_MEMORY Insufficient memory to construct new bucket or value.
  */
 static ebpf_result_t
@@ -235,21 +752,29 @@ _ebpf_hash_table_replace_bucket(
 {
     ebpf_result_t result;
     size_t index;
-    size_t entry_size = EBPF_OFFSET_OF(ebpf_hash_bucket_entry_t, key) + hash_table->key_size;
     uint8_t* old_data = NULL;
     uint8_t* new_data = NULL;
     uint8_t* delete_data = NULL;
     uint32_t hash;
+    ebpf_hash_bucket_array_t* bucket_array;
+    ebpf_hash_bucket_array_t* previous;
+    ebpf_hash_bucket_header_t* volatile* bucket_slot;
     ebpf_hash_bucket_header_t* old_bucket = NULL;
     ebpf_hash_bucket_header_t* new_bucket = NULL;
     ebpf_hash_bucket_header_t* delete_bucket = NULL;
+    uint32_t new_bucket_array_count;
+    uint8_t fingerprint;
     hash = _ebpf_hash_table_compute_hash(hash_table, key);
+    fingerprint = _ebpf_hash_table_fingerprint(hash);
 
     switch (operation) {
     case EBPF_HASH_BUCKET_OPERATION_INSERT_OR_UPDATE:
     case EBPF_HASH_BUCKET_OPERATION_INSERT:
     case EBPF_HASH_BUCKET_OPERATION_UPDATE:
-        new_data = hash_table->allocate(hash_table->value_size);
+        new_data = hash_table->allocate(
+            hash_table->supplemental_value_size
+                ? _ebpf_hash_table_supplemental_value_offset(hash_table) + hash_table->supplemental_value_size
+                : hash_table->value_size);
         if (!new_data) {
             result = EBPF_NO_MEMORY;
             goto Done;
@@ -258,8 +783,10 @@ _ebpf_hash_table_replace_bucket(
         if (value) {
             memcpy(new_data, value, hash_table->value_size);
         }
+        _ebpf_hash_table_notify(hash_table, EBPF_HASH_TABLE_NOTIFICATION_TYPE_ALLOCATE, key, new_data);
         break;
     case EBPF_HASH_BUCKET_OPERATION_DELETE:
+    case EBPF_HASH_BUCKET_OPERATION_DELETE_VALUE:
         break;
     }
 
@@ -273,8 +800,31 @@ _ebpf_hash_table_replace_bucket(
         delete_bucket = new_bucket;
         delete_data = new_data;
 
+        bucket_array = hash_table->bucket_array;
+        previous = bucket_array->previous;
+
+        // The bucket holding this key must be migrated before it can be modified in the new array.
+        if (previous && previous->buckets[hash % previous->bucket_count] != EBPF_HASH_BUCKET_MOVED) {
+            ebpf_lock_state_t state = ebpf_lock_lock(&hash_table->resize_lock);
+            result = EBPF_SUCCESS;
+            if (bucket_array->previous == previous) {
+                result = _ebpf_hash_table_migrate_bucket(hash_table, bucket_array, hash % previous->bucket_count);
+            }
+            ebpf_lock_unlock(&hash_table->resize_lock, state);
+            if (result != EBPF_SUCCESS) {
+                goto Done;
+            }
+            continue;
+        }
+
         // Capture current bucket pointer.
-        old_bucket = hash_table->buckets[hash % hash_table->bucket_count];
+        bucket_slot = &bucket_array->buckets[hash % bucket_array->bucket_count];
+        old_bucket = *bucket_slot;
+
+        // The captured array is being migrated to a newer one, retry against it.
+        if (old_bucket == EBPF_HASH_BUCKET_MOVED || _ebpf_hash_bucket_is_frozen(old_bucket)) {
+            continue;
+        }
 
         // If the old_bucket exists, capture its count.
         if (old_bucket) {
@@ -283,16 +833,10 @@ _ebpf_hash_table_replace_bucket(
 
         // Find the old key index if it exists.
         if (old_bucket) {
-            for (index = 0; index < old_bucket_count; index++) {
-                ebpf_hash_bucket_entry_t* entry =
-                    _ebpf_hash_table_bucket_entry(hash_table->key_size, old_bucket, index);
-                ebpf_assert(entry);
-                if (_ebpf_hash_table_compare(hash_table, key, entry->key) == 0) {
-                    // If old_data exists, remove it.
-                    old_data = entry->data;
-                    old_data_index = index;
-                    break;
-                }
+            old_data_index = _ebpf_hash_bucket_find(hash_table, old_bucket, key, fingerprint);
+            if (old_data_index != MAXSIZE_T) {
+                // If old_data exists, remove it.
+                old_data = _ebpf_hash_table_bucket_entry(hash_table->key_size, old_bucket, old_data_index)->data;
             }
         }
 
@@ -315,6 +859,14 @@ _ebpf_hash_table_replace_bucket(
                 new_bucket_count--;
             }
             break;
+        case EBPF_HASH_BUCKET_OPERATION_DELETE_VALUE:
+            if (old_data_index == MAXSIZE_T || old_data != value) {
+                result = EBPF_KEY_NOT_FOUND;
+                goto Done;
+            } else {
+                new_bucket_count--;
+            }
+            break;
         // Permit it if this is an insert or insert_or_update.
         case EBPF_HASH_BUCKET_OPERATION_INSERT:
             if (old_data_index != MAXSIZE_T) {
@@ -334,7 +886,7 @@ _ebpf_hash_table_replace_bucket(
         ebpf_assert(new_bucket_count < MAXUINT32);
 
         if (new_bucket_count) {
-            new_bucket = hash_table->allocate(entry_size * new_bucket_count + sizeof(ebpf_hash_bucket_header_t));
+            new_bucket = _ebpf_hash_table_allocate_bucket(hash_table, new_bucket_count);
             if (!new_bucket) {
                 result = EBPF_NO_MEMORY;
                 goto Done;
@@ -345,24 +897,18 @@ _ebpf_hash_table_replace_bucket(
             for (index = 0; index < old_bucket_count; index++) {
                 ebpf_hash_bucket_entry_t* old_entry =
                     _ebpf_hash_table_bucket_entry(hash_table->key_size, old_bucket, index);
-                ebpf_hash_bucket_entry_t* new_entry =
-                    _ebpf_hash_table_bucket_entry(hash_table->key_size, new_bucket, new_bucket->count);
 
                 if (index == old_data_index) {
                     continue;
                 }
-                memcpy(new_entry, old_entry, entry_size);
-                new_bucket->count++;
+                _ebpf_hash_bucket_append(
+                    hash_table->key_size, new_bucket, old_bucket->fingerprints[index], old_entry->key, old_entry->data);
             }
 
             // If new_data exists, add it to the end.
             if (new_data) {
                 ebpf_assert(new_bucket_count > new_bucket->count);
-                ebpf_hash_bucket_entry_t* new_entry =
-                    _ebpf_hash_table_bucket_entry(hash_table->key_size, new_bucket, new_bucket->count);
-                new_entry->data = new_data;
-                memcpy(new_entry->key, key, hash_table->key_size);
-                new_bucket->count++;
+                _ebpf_hash_bucket_append(hash_table->key_size, new_bucket, fingerprint, key, new_data);
             }
         }
 
@@ -370,8 +916,7 @@ _ebpf_hash_table_replace_bucket(
             (new_bucket == NULL && new_bucket_count == 0) || // No new bucket.
             (new_bucket_count == new_bucket->count));        // New bucket is full.
 
-        if (ebpf_interlocked_compare_exchange_pointer(
-                (void* volatile*)&hash_table->buckets[hash % hash_table->bucket_count], new_bucket, old_bucket) ==
+        if (ebpf_interlocked_compare_exchange_pointer((void* volatile*)bucket_slot, new_bucket, old_bucket) ==
             old_bucket) {
             delete_bucket = old_bucket;
             delete_data = old_data;
@@ -382,6 +927,10 @@ _ebpf_hash_table_replace_bucket(
         }
     }
 
+    if (new_data) {
+        _ebpf_hash_table_notify(hash_table, EBPF_HASH_TABLE_NOTIFICATION_TYPE_INSERT, key, new_data);
+    }
+
     switch (operation) {
     case EBPF_HASH_BUCKET_OPERATION_INSERT:
         ebpf_interlocked_increment_int32(&hash_table->entry_count);
@@ -393,85 +942,152 @@ _ebpf_hash_table_replace_bucket(
     case EBPF_HASH_BUCKET_OPERATION_UPDATE:
         break;
     case EBPF_HASH_BUCKET_OPERATION_DELETE:
+    case EBPF_HASH_BUCKET_OPERATION_DELETE_VALUE:
         ebpf_interlocked_decrement_int32(&hash_table->entry_count);
         break;
     }
 
+    // Spread the cost of a resize across updates. Failure is not fatal, the
+    // next update will try again.
+    bucket_array = hash_table->bucket_array;
+    if (bucket_array->previous ||
+        _ebpf_hash_table_get_new_bucket_count(hash_table, bucket_array->bucket_count, &new_bucket_array_count)) {
+        (void)_ebpf_hash_table_resize(hash_table, EBPF_HASH_TABLE_MIGRATION_BATCH_SIZE);
+    }
+
     result = EBPF_SUCCESS;
 
 Done:
     hash_table->free(delete_bucket);
+    if (delete_data) {
+        _ebpf_hash_table_notify(hash_table, EBPF_HASH_TABLE_NOTIFICATION_TYPE_FREE, key, delete_data);
+    }
     hash_table->free(delete_data);
     return result;
 }
 
 ebpf_result_t
-ebpf_hash_table_create(
-    _Out_ ebpf_hash_table_t** hash_table,
-    _In_ void* (*allocate)(size_t size),
-    _In_ void (*free)(void* memory),
-    size_t key_size,
-    size_t value_size,
-    size_t bucket_count,
-    _In_opt_ void (*extract)(
-        _In_ const uint8_t* value,
-        _Outptr_result_buffer_((*length_in_bits + 7) / 8) const uint8_t** data,
-        _Out_ size_t* length_in_bits))
+ebpf_hash_table_create_with_options(
+    _Out_ ebpf_hash_table_t** hash_table, _In_ const ebpf_hash_table_creation_options_t* options)
 {
     ebpf_result_t retval;
     ebpf_hash_table_t* table = NULL;
-    size_t table_size = 0;
-    retval = ebpf_safe_size_t_multiply(sizeof(ebpf_hash_bucket_header_t*), bucket_count, &table_size);
-    if (retval != EBPF_SUCCESS) {
-        goto Done;
-    }
-    retval = ebpf_safe_size_t_add(table_size, EBPF_OFFSET_OF(ebpf_hash_table_t, buckets), &table_size);
-    if (retval != EBPF_SUCCESS) {
+
+    table = options->allocate(sizeof(ebpf_hash_table_t));
+    if (table == NULL) {
+        retval = EBPF_NO_MEMORY;
         goto Done;
     }
 
-    table = allocate(table_size);
-    if (table == NULL) {
+    table->bucket_array = _ebpf_hash_table_allocate_bucket_array(options->allocate, options->bucket_count);
+    if (table->bucket_array == NULL) {
         retval = EBPF_NO_MEMORY;
         goto Done;
     }
 
-    table->key_size = key_size;
-    table->value_size = value_size;
-    table->allocate = allocate;
-    table->free = free;
-    table->bucket_count = (uint32_t)bucket_count;
+    table->key_size = options->key_size;
+    table->value_size = options->value_size;
+    table->supplemental_value_size = options->supplemental_value_size;
+    table->allocate = options->allocate;
+    table->free = options->free;
+    table->minimum_bucket_count = (uint32_t)options->bucket_count;
     table->entry_count = 0;
     table->seed = ebpf_random_uint32();
-    table->extract = extract;
+    table->extract = options->extract_function;
+    table->notification_context = options->notification_context;
+    table->notification_callback = options->notification_callback;
+    ebpf_lock_create(&table->resize_lock);
 
     *hash_table = table;
+    table = NULL;
     retval = EBPF_SUCCESS;
 Done:
+    if (table) {
+        options->free(table);
+    }
     return retval;
 }
 
+ebpf_result_t
+ebpf_hash_table_create(
+    _Out_ ebpf_hash_table_t** hash_table,
+    _In_ void* (*allocate)(size_t size),
+    _In_ void (*free)(void* memory),
+    size_t key_size,
+    size_t value_size,
+    size_t bucket_count,
+    _In_opt_ void (*extract)(
+        _In_ const uint8_t* value,
+        _Outptr_result_buffer_((*length_in_bits + 7) / 8) const uint8_t** data,
+        _Out_ size_t* length_in_bits))
+{
+    ebpf_hash_table_creation_options_t options = {
+        .allocate = allocate,
+        .free = free,
+        .key_size = key_size,
+        .value_size = value_size,
+        .bucket_count = bucket_count,
+        .extract_function = extract,
+    };
+    return ebpf_hash_table_create_with_options(hash_table, &options);
+}
+
 void
 ebpf_hash_table_destroy(_In_opt_ _Post_ptr_invalid_ ebpf_hash_table_t* hash_table)
 {
     size_t index;
+    ebpf_hash_bucket_array_t* bucket_array;
+    ebpf_hash_bucket_array_t* previous;
     if (!hash_table) {
         return;
     }
 
-    for (index = 0; index < hash_table->bucket_count; index++) {
-        ebpf_hash_bucket_header_t* bucket = (ebpf_hash_bucket_header_t*)hash_table->buckets[index];
+    bucket_array = hash_table->bucket_array;
+    previous = bucket_array->previous;
+
+    for (index = 0; index < bucket_array->bucket_count; index++) {
+        ebpf_hash_bucket_header_t* bucket = (ebpf_hash_bucket_header_t*)bucket_array->buckets[index];
         if (bucket) {
             size_t inner_index;
             for (inner_index = 0; inner_index < bucket->count; inner_index++) {
                 ebpf_hash_bucket_entry_t* entry =
                     _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, inner_index);
+                // Skip entries left behind by a failed migration, the data is owned by the previous array.
+                if (previous) {
+                    uint32_t hash = _ebpf_hash_table_compute_hash(hash_table, entry->key);
+                    if (previous->buckets[hash % previous->bucket_count] != EBPF_HASH_BUCKET_MOVED) {
+                        continue;
+                    }
+                }
+                _ebpf_hash_table_notify(hash_table, EBPF_HASH_TABLE_NOTIFICATION_TYPE_FREE, entry->key, entry->data);
                 hash_table->free(entry->data);
             }
             hash_table->free(bucket);
-            hash_table->buckets[index] = NULL;
+            bucket_array->buckets[index] = NULL;
+        }
+    }
+
+    if (previous) {
+        for (index = 0; index < previous->bucket_count; index++) {
+            ebpf_hash_bucket_header_t* bucket = (ebpf_hash_bucket_header_t*)previous->buckets[index];
+            if (bucket && bucket != EBPF_HASH_BUCKET_MOVED) {
+                size_t inner_index;
+                for (inner_index = 0; inner_index < bucket->count; inner_index++) {
+                    ebpf_hash_bucket_entry_t* entry =
+                        _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, inner_index);
+                    _ebpf_hash_table_notify(
+                        hash_table, EBPF_HASH_TABLE_NOTIFICATION_TYPE_FREE, entry->key, entry->data);
+                    hash_table->free(entry->data);
+                }
+                hash_table->free(bucket);
+            }
+            previous->buckets[index] = NULL;
         }
+        hash_table->free(previous);
     }
+
+    hash_table->free(bucket_array);
+    ebpf_lock_destroy(&hash_table->resize_lock);
     hash_table->free(hash_table);
 }
 
@@ -480,7 +1096,6 @@ ebpf_hash_table_find(_In_ ebpf_hash_table_t* hash_table, _In_ const uint8_t* key
 {
     ebpf_result_t retval;
     uint32_t hash;
-    uint8_t* data = NULL;
     size_t index;
     ebpf_hash_bucket_header_t* bucket;
 
@@ -490,26 +1105,20 @@ ebpf_hash_table_find(_In_ ebpf_hash_table_t* hash_table, _In_ const uint8_t* key
     }
 
     hash = _ebpf_hash_table_compute_hash(hash_table, key);
-    bucket = hash_table->buckets[hash % hash_table->bucket_count];
+    bucket = _ebpf_hash_table_get_bucket(hash_table, hash);
     if (!bucket) {
         retval = EBPF_KEY_NOT_FOUND;
         goto Done;
     }
 
-    for (index = 0; index < bucket->count; index++) {
-        ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, index);
-        if (_ebpf_hash_table_compare(hash_table, key, entry->key) == 0) {
-            data = entry->data;
-            break;
-        }
-    }
-
-    if (!data) {
+    index = _ebpf_hash_bucket_find(hash_table, bucket, key, _ebpf_hash_table_fingerprint(hash));
+    if (index == MAXSIZE_T) {
         retval = EBPF_KEY_NOT_FOUND;
         goto Done;
     }
 
-    *value = data;
+    *value = _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, index)->data;
+    _ebpf_hash_table_notify(hash_table, EBPF_HASH_TABLE_NOTIFICATION_TYPE_USE, key, *value);
     retval = EBPF_SUCCESS;
 Done:
     return retval;
@@ -567,59 +1176,248 @@ Done:
 }
 
 ebpf_result_t
-ebpf_hash_table_next_key_pointer_and_value(
+ebpf_hash_table_delete_value(_In_ ebpf_hash_table_t* hash_table, _In_ const uint8_t* key, _In_ const uint8_t* value)
+{
+    ebpf_result_t retval;
+
+    if (!hash_table || !key || !value) {
+        retval = EBPF_INVALID_ARGUMENT;
+        goto Done;
+    }
+
+    retval = _ebpf_hash_table_replace_bucket(hash_table, key, value, EBPF_HASH_BUCKET_OPERATION_DELETE_VALUE);
+
+Done:
+    return retval;
+}
+
+/**
+ * @brief Buckets holding the keys that belong to one bucket index of the current array. While a resize is in
+ * progress, keys that hash to the index may still be in up to two unmigrated buckets of the previous array.
+ */
+typedef struct _ebpf_hash_table_iteration_bucket
+{
+    uint32_t bucket_count;                 // Count of buckets in the current array.
+    uint32_t index;                        // Index of the bucket in the current array.
+    uint32_t previous_bucket_count;        // Count of buckets in the previous array, zero if there is none.
+    ebpf_hash_bucket_header_t* bucket;     // Bucket in the current array.
+    uint32_t source_count;                 // Count of unmigrated buckets of the previous array feeding this index.
+    uint32_t source_indices[2];            // Index of each unmigrated bucket in the previous array.
+    ebpf_hash_bucket_header_t* sources[2]; // Each unmigrated bucket.
+} ebpf_hash_table_iteration_bucket_t;
+
+/**
+ * @brief Capture the buckets holding the keys of one bucket index of the current array.
+ *
+ * @param[in] bucket_array Current bucket array.
+ * @param[in] index Index of the bucket in bucket_array.
+ * @param[out] iteration_bucket Captured buckets.
+ * @retval true The buckets were captured.
+ * @retval false A newer bucket array was published; the caller must restart with it.
+ */
+static bool
+_ebpf_hash_table_capture_iteration_bucket(
+    _In_ const ebpf_hash_bucket_array_t* bucket_array,
+    uint32_t index,
+    _Out_ ebpf_hash_table_iteration_bucket_t* iteration_bucket)
+{
+    ebpf_hash_bucket_array_t* previous = bucket_array->previous;
+    ebpf_hash_bucket_header_t* bucket;
+
+    iteration_bucket->bucket_count = bucket_array->bucket_count;
+    iteration_bucket->index = index;
+    iteration_bucket->previous_bucket_count = previous ? previous->bucket_count : 0;
+    iteration_bucket->source_count = 0;
+
+    // Capture the source buckets before the current one. A source that migrates in between then has its keys
+    // in both captures and the copies in the current bucket are skipped, instead of being in neither.
+    if (previous) {
+        // Bucket counts change by a factor of two, so a grow has one source bucket and a shrink has two.
+        for (uint32_t source_index = index % previous->bucket_count; source_index < previous->bucket_count;
+             source_index += bucket_array->bucket_count) {
+            ebpf_hash_bucket_header_t* source = previous->buckets[source_index];
+            if (source != EBPF_HASH_BUCKET_MOVED) {
+                iteration_bucket->source_indices[iteration_bucket->source_count] = source_index;
+                iteration_bucket->sources[iteration_bucket->source_count] = _ebpf_hash_bucket_unfrozen(source);
+                iteration_bucket->source_count++;
+            }
+        }
+    }
+
+    bucket = bucket_array->buckets[index];
+    if (bucket == EBPF_HASH_BUCKET_MOVED) {
+        return false;
+    }
+    iteration_bucket->bucket = _ebpf_hash_bucket_unfrozen(bucket);
+    return true;
+}
+
+/**
+ * @brief Determine if an entry of a captured bucket is the authoritative copy of its key. Entries of the current
+ * bucket that came from a bucket that is still unmigrated were left behind by a failed migration; entries of an
+ * unmigrated bucket only belong to the index they hash to in the current array.
+ *
+ * @param[in] hash_table Hash table being iterated.
+ * @param[in] iteration_bucket Captured buckets.
+ * @param[in] part 0 for the current bucket, otherwise one more than the index of the source bucket.
+ * @param[in] entry Entry to check.
+ * @retval true The entry is returned by iteration.
+ * @retval false The entry is skipped.
+ */
+static bool
+_ebpf_hash_table_iteration_entry_included(
+    _In_ const ebpf_hash_table_t* hash_table,
+    _In_ const ebpf_hash_table_iteration_bucket_t* iteration_bucket,
+    uint32_t part,
+    _In_ const ebpf_hash_bucket_entry_t* entry)
+{
+    uint32_t hash;
+
+    if (iteration_bucket->source_count == 0) {
+        return true;
+    }
+
+    hash = _ebpf_hash_table_compute_hash(hash_table, entry->key);
+    if (part == 0) {
+        for (uint32_t source = 0; source < iteration_bucket->source_count; source++) {
+            if (hash % iteration_bucket->previous_bucket_count == iteration_bucket->source_indices[source]) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return (hash % iteration_bucket->bucket_count) == iteration_bucket->index;
+}
+
+/**
+ * @brief Find an entry of a captured bucket by position. The entries of the current bucket come first, followed
+ * by the entries of each unmigrated source bucket, so positions stay stable as keys are added and removed.
+ *
+ * @param[in] hash_table Hash table being iterated.
+ * @param[in] iteration_bucket Captured buckets.
+ * @param[in] key If non-NULL, find this key instead of the entry at position.
+ * @param[in, out] position On input the position to find when key is NULL. On output the position of the entry.
+ * @param[out] fingerprint Fingerprint of the entry.
+ * @return The entry or NULL if there is none.
+ */
+static ebpf_hash_bucket_entry_t*
+_ebpf_hash_table_iteration_entry(
+    _In_ const ebpf_hash_table_t* hash_table,
+    _In_ const ebpf_hash_table_iteration_bucket_t* iteration_bucket,
+    _In_opt_ const uint8_t* key,
+    _Inout_ size_t* position,
+    _Out_ uint8_t* fingerprint)
+{
+    size_t current_position = 0;
+
+    *fingerprint = 0;
+
+    // Without a resize in progress positions are the bucket's own indices.
+    if (!key && iteration_bucket->source_count == 0) {
+        if (!iteration_bucket->bucket || *position >= iteration_bucket->bucket->count) {
+            return NULL;
+        }
+        *fingerprint = iteration_bucket->bucket->fingerprints[*position];
+        return _ebpf_hash_table_bucket_entry(hash_table->key_size, iteration_bucket->bucket, *position);
+    }
+
+    for (uint32_t part = 0; part <= iteration_bucket->source_count; part++) {
+        ebpf_hash_bucket_header_t* bucket =
+            (part == 0) ? iteration_bucket->bucket : iteration_bucket->sources[part - 1];
+        if (!bucket) {
+            continue;
+        }
+        for (size_t index = 0; index < bucket->count; index++) {
+            ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, index);
+            if (!_ebpf_hash_table_iteration_entry_included(hash_table, iteration_bucket, part, entry)) {
+                continue;
+            }
+            if (key ? _ebpf_hash_table_key_equal(hash_table, key, entry->key) : (current_position == *position)) {
+                *position = current_position;
+                *fingerprint = bucket->fingerprints[index];
+                return entry;
+            }
+            current_position++;
+        }
+    }
+    return NULL;
+}
+
+ebpf_result_t
+ebpf_hash_table_next_key_with_cursor(
     _In_ ebpf_hash_table_t* hash_table,
+    _Inout_ ebpf_hash_table_cursor_t* cursor,
     _In_opt_ const uint8_t* previous_key,
     _Outptr_ uint8_t** next_key_pointer,
     _Outptr_opt_ uint8_t** value)
 {
     ebpf_result_t result = EBPF_SUCCESS;
     uint32_t hash;
-    ebpf_hash_bucket_entry_t* next_entry = NULL;
+    ebpf_hash_bucket_array_t* bucket_array;
+    ebpf_hash_table_iteration_bucket_t iteration_bucket;
+    ebpf_hash_bucket_entry_t* next_entry;
+    uint8_t fingerprint;
     size_t bucket_index;
-    size_t data_index;
-    bool found_entry = false;
+    size_t data_index = 0;
 
-    if (!hash_table || !next_key_pointer) {
+    if (!hash_table || !cursor || !next_key_pointer) {
         result = EBPF_INVALID_ARGUMENT;
         goto Done;
     }
 
-    hash = (previous_key != NULL) ? _ebpf_hash_table_compute_hash(hash_table, previous_key) : 0;
+Retry:
+    // Keys that a resize in progress has not migrated yet are read from the previous array, so iteration never
+    // has to finish the resize itself.
+    bucket_array = hash_table->bucket_array;
 
-    for (bucket_index = hash % hash_table->bucket_count; bucket_index < hash_table->bucket_count; bucket_index++) {
-        ebpf_hash_bucket_header_t* bucket = hash_table->buckets[bucket_index];
-        // Skip empty buckets.
-        if (!bucket) {
-            continue;
+    if (!previous_key) {
+        bucket_index = 0;
+        data_index = 0;
+    } else {
+        // Fast path, previous_key is still where the cursor recorded it.
+        if (cursor->bucket_count == bucket_array->bucket_count && cursor->bucket_index < bucket_array->bucket_count) {
+            if (!_ebpf_hash_table_capture_iteration_bucket(bucket_array, cursor->bucket_index, &iteration_bucket)) {
+                goto Retry;
+            }
+            data_index = cursor->entry_index;
+            next_entry =
+                _ebpf_hash_table_iteration_entry(hash_table, &iteration_bucket, NULL, &data_index, &fingerprint);
+            if (next_entry && _ebpf_hash_table_key_equal(hash_table, previous_key, next_entry->key)) {
+                bucket_index = cursor->bucket_index;
+                data_index++;
+                goto Scan;
+            }
         }
 
-        // Pick first entry if no previous key.
-        if (!previous_key) {
-            next_entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, 0);
-            break;
+        // Otherwise locate previous_key in its bucket.
+        hash = _ebpf_hash_table_compute_hash(hash_table, previous_key);
+        bucket_index = hash % bucket_array->bucket_count;
+        if (!_ebpf_hash_table_capture_iteration_bucket(bucket_array, (uint32_t)bucket_index, &iteration_bucket)) {
+            goto Retry;
         }
+        if (_ebpf_hash_table_iteration_entry(hash_table, &iteration_bucket, previous_key, &data_index, &fingerprint)) {
+            data_index++;
+        } else if (
+            cursor->bucket_count == bucket_array->bucket_count && cursor->bucket_index == bucket_index &&
+            cursor->fingerprint == _ebpf_hash_table_fingerprint(hash)) {
+            // previous_key was deleted, the entries that followed it moved down a slot.
+            data_index = cursor->entry_index;
+        } else {
+            data_index = 0;
+        }
+    }
 
-        for (data_index = 0; data_index < bucket->count; data_index++) {
-            ebpf_hash_bucket_entry_t* entry = _ebpf_hash_table_bucket_entry(hash_table->key_size, bucket, data_index);
-            if (!entry) {
-                result = EBPF_INVALID_ARGUMENT;
-                goto Done;
-            }
-            // Do we have the previous key?
-            if (found_entry) {
-                // Yes, then this is the next key.
-                next_entry = entry;
-                break;
-            }
-
-            // Is this the previous key?
-            if (_ebpf_hash_table_compare(hash_table, previous_key, entry->key) == 0) {
-                // Yes, record its location.
-                found_entry = true;
-            }
+Scan:
+    next_entry = NULL;
+    for (; bucket_index < bucket_array->bucket_count; bucket_index++, data_index = 0) {
+        // A resize started after the array was captured.
+        if (!_ebpf_hash_table_capture_iteration_bucket(bucket_array, (uint32_t)bucket_index, &iteration_bucket)) {
+            goto Retry;
         }
+
+        next_entry = _ebpf_hash_table_iteration_entry(hash_table, &iteration_bucket, NULL, &data_index, &fingerprint);
         if (next_entry) {
+            cursor->fingerprint = fingerprint;
             break;
         }
     }
@@ -628,6 +1426,10 @@ ebpf_hash_table_next_key_pointer_and_value(
         goto Done;
     }
 
+    cursor->bucket_count = bucket_array->bucket_count;
+    cursor->bucket_index = (uint32_t)bucket_index;
+    cursor->entry_index = (uint32_t)data_index;
+
     result = EBPF_SUCCESS;
 
     if (value)
@@ -640,6 +1442,17 @@ Done:
     return result;
 }
 
+ebpf_result_t
+ebpf_hash_table_next_key_pointer_and_value(
+    _In_ ebpf_hash_table_t* hash_table,
+    _In_opt_ const uint8_t* previous_key,
+    _Outptr_ uint8_t** next_key_pointer,
+    _Outptr_opt_ uint8_t** value)
+{
+    ebpf_hash_table_cursor_t cursor = {0};
+    return ebpf_hash_table_next_key_with_cursor(hash_table, &cursor, previous_key, next_key_pointer, value);
+}
+
 ebpf_result_t
 ebpf_hash_table_next_key_and_value(
     _In_ ebpf_hash_table_t* hash_table,
@@ -147,6 +147,7 @@ ebpf_object_initialize(
     object->type = object_type;
     object->free_function = free_function;
     object->get_program_type = get_program_type_function;
+    object->close_instance_function = NULL;
     ebpf_list_initialize(&object->object_list_entry);
 
     return _ebpf_object_tracking_list_insert(object);
@@ -207,6 +208,15 @@ ebpf_object_release_reference(ebpf_object_t* object)
     }
 }
 
+void
+ebpf_object_close_instance(_Inout_ ebpf_object_t* object, uintptr_t instance)
+{
+    ebpf_assert(object->marker == _ebpf_object_marker);
+    if (object->close_instance_function) {
+        object->close_instance_function(object, instance);
+    }
+}
+
 ebpf_object_type_t
 ebpf_object_get_type(ebpf_object_t* object)
 {
@@ -23,6 +23,7 @@ extern "C"
     typedef struct _ebpf_object ebpf_object_t;
     typedef void (*ebpf_free_object_t)(ebpf_object_t* object);
     typedef const ebpf_program_type_t* (*ebpf_object_get_program_type_t)(_In_ const ebpf_object_t* object);
+    typedef void (*ebpf_object_close_instance_t)(_Inout_ ebpf_object_t* object, uintptr_t instance);
 
     // This type probably ought to be renamed to avoid confusion with
     // ebpf_object_t in libs\api\api_internal.h
@@ -33,6 +34,8 @@ extern "C"
         ebpf_object_type_t type;
         ebpf_free_object_t free_function;
         ebpf_object_get_program_type_t get_program_type;
+        // Called when a handle instance that references this object is closed, or NULL.
+        ebpf_object_close_instance_t close_instance_function;
         // ID for this object.
         ebpf_id_t id;
         // Used to insert object in an object specific list.
@@ -91,6 +94,16 @@ extern "C"
     void
     ebpf_object_release_reference(ebpf_object_t* object);
 
+    /**
+     * @brief Release the per-handle state an object holds for a handle instance that is being closed. Called at
+     * PASSIVE_LEVEL before the handle's reference on the object is released.
+     *
+     * @param[in,out] object Object the handle references.
+     * @param[in] instance Handle instance being closed, as returned by ebpf_handle_get_instance.
+     */
+    void
+    ebpf_object_close_instance(_Inout_ ebpf_object_t* object, uintptr_t instance);
+
     /**
      * @brief Query the stored type of the object.
      *
@@ -32,6 +32,10 @@ extern "C"
 #define EBPF_CACHE_LINE_SIZE 64
 #define EBPF_CACHE_ALIGN_POINTER(P) (void*)(((uintptr_t)P + EBPF_CACHE_LINE_SIZE - 1) & ~(EBPF_CACHE_LINE_SIZE - 1))
 
+// Number of per-thread slots in the epoch and state tables. Threads beyond this fall back to a slower locked path.
+// Must be a power of 2.
+#define EBPF_THREAD_SLOT_COUNT 512
+
     /**
      * @brief A UTF-8 encoded string.
      * Notes:
@@ -160,6 +164,7 @@ extern "C"
 
     typedef struct _ebpf_memory_descriptor ebpf_memory_descriptor_t;
     typedef struct _ebpf_ring_descriptor ebpf_ring_descriptor_t;
+    typedef struct _ebpf_user_mapping ebpf_user_mapping_t;
 
     /**
      * @brief Allocate pages from physical memory and create a mapping into the
@@ -237,14 +242,42 @@ extern "C"
     ebpf_ring_descriptor_get_base_address(_In_ ebpf_ring_descriptor_t* ring);
 
     /**
-     * @brief Create a read-only mapping in the calling process of the ring buffer.
+     * @brief Create a read-only, non-executable mapping in the calling process of the ring buffer.
      *
      * @param[in] ring Ring buffer to map.
-     * @return Pointer to the base of the ring buffer.
+     * @return Pointer to the mapping, or NULL on failure. The ring must outlive the mapping.
      */
-    _Ret_maybenull_ void*
+    _Ret_maybenull_ ebpf_user_mapping_t*
     ebpf_ring_map_readonly_user(_In_ ebpf_ring_descriptor_t* ring);
 
+    /**
+     * @brief Create a read-write, non-executable mapping in the calling process of memory allocated via
+     * ebpf_map_memory.
+     *
+     * @param[in] memory_descriptor Pointer to an ebpf_memory_descriptor_t describing allocated pages.
+     * @return Pointer to the mapping, or NULL on failure. The memory must outlive the mapping.
+     */
+    _Ret_maybenull_ ebpf_user_mapping_t*
+    ebpf_memory_descriptor_map_writable_user(_In_ ebpf_memory_descriptor_t* memory_descriptor);
+
+    /**
+     * @brief Get the address of a mapping in the process that created it.
+     *
+     * @param[in] mapping Mapping to query.
+     * @return Base address of the mapping in the process that created it.
+     */
+    void*
+    ebpf_user_mapping_get_address(_In_ const ebpf_user_mapping_t* mapping);
+
+    /**
+     * @brief Remove a mapping created via ebpf_ring_map_readonly_user or ebpf_memory_descriptor_map_writable_user
+     * from the process that created it. Can be called from any process, at PASSIVE_LEVEL.
+     *
+     * @param[in] mapping Mapping to remove.
+     */
+    void
+    ebpf_user_mapping_unmap(_Frees_ptr_opt_ ebpf_user_mapping_t* mapping);
+
     /**
      * @brief Allocate and copy a UTF-8 string.
      *
@@ -335,6 +368,21 @@ extern "C"
     _Requires_lock_held_(*lock) _Releases_lock_(*lock) _IRQL_requires_(DISPATCH_LEVEL) void ebpf_lock_unlock(
         _In_ ebpf_lock_t* lock, _IRQL_restores_ ebpf_lock_state_t state);
 
+    /**
+     * @brief Raise the IRQL of the current CPU to DISPATCH_LEVEL, so the caller can't be preempted by other
+     *  execution on this CPU.
+     * @returns - The previous IRQL, required for ebpf_lower_irql.
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_saves_ _IRQL_raises_(DISPATCH_LEVEL) uint8_t
+        ebpf_raise_irql_to_dispatch();
+
+    /**
+     * @brief Restore the IRQL saved by ebpf_raise_irql_to_dispatch.
+     * @param[in] old_irql The IRQL returned from ebpf_raise_irql_to_dispatch.
+     */
+    _IRQL_requires_(DISPATCH_LEVEL) void
+    ebpf_lower_irql(_IRQL_restores_ uint8_t old_irql);
+
     /**
      * @brief Query the platform for the total number of CPUs.
      * @return The count of logical cores in the system.
@@ -449,6 +497,19 @@ extern "C"
 
     typedef struct _ebpf_hash_table ebpf_hash_table_t;
 
+    /**
+     * @brief Position of an iteration over a hash table. The fields are
+     * private to the hash table. Zero initialize the cursor to start an
+     * iteration.
+     */
+    typedef struct _ebpf_hash_table_cursor
+    {
+        uint32_t bucket_count; ///< Count of buckets when the position was recorded, zero if none.
+        uint32_t bucket_index; ///< Bucket holding the last key returned.
+        uint32_t entry_index;  ///< Index of the last key returned in its bucket.
+        uint8_t fingerprint;   ///< Fingerprint of the last key returned.
+    } ebpf_hash_table_cursor_t;
+
     /**
      * @brief Allocate and initialize a hash table.
      *
@@ -459,7 +520,8 @@ extern "C"
      * @param[in] free Function to use when freeing elements in the hash table.
      * @param[in] key_size Size of the keys used in the hash table.
      * @param[in] value_size Size of the values used in the hash table.
-     * @param[in] bucket_count Count of buckets to use.
+     * @param[in] bucket_count Initial count of buckets to use. The hash table
+     *  grows and shrinks with the number of entries, but never below this count.
      * @param[in] extract_function Function used to convert a key into a value
      * that can be hashed and compared. If NULL, key is assumes to be
      * comparable.
@@ -480,6 +542,59 @@ extern "C"
             _Outptr_result_buffer_((*length_in_bits + 7) / 8) const uint8_t** data,
             _Out_ size_t* length_in_bits));
 
+    typedef enum _ebpf_hash_table_notification_type
+    {
+        EBPF_HASH_TABLE_NOTIFICATION_TYPE_ALLOCATE, ///< A value was allocated for a key and is about to be inserted.
+        EBPF_HASH_TABLE_NOTIFICATION_TYPE_FREE,     ///< A value is about to be freed.
+        EBPF_HASH_TABLE_NOTIFICATION_TYPE_USE,      ///< A value was returned by ebpf_hash_table_find.
+        EBPF_HASH_TABLE_NOTIFICATION_TYPE_INSERT,   ///< An allocated value was published in the hash table.
+    } ebpf_hash_table_notification_type_t;
+
+    /**
+     * @brief Options for creating a hash table.
+     */
+    typedef struct _ebpf_hash_table_creation_options
+    {
+        void* (*allocate)(size_t size); ///< Function to use when allocating elements in the hash table.
+        void (*free)(void* memory);     ///< Function to use when freeing elements in the hash table.
+        size_t key_size;                ///< Size of the keys used in the hash table.
+        size_t value_size;              ///< Size of the values used in the hash table.
+        size_t bucket_count;            ///< Initial and minimum count of buckets to use.
+        void (*extract_function)(
+            _In_ const uint8_t* value,
+            _Outptr_result_buffer_((*length_in_bits + 7) / 8) const uint8_t** data,
+            _Out_ size_t* length_in_bits); ///< Optional function to convert a key into a value to hash and compare.
+        size_t supplemental_value_size;    ///< Size of caller owned data allocated with each value.
+        void* notification_context;        ///< Context passed to notification_callback.
+        void (*notification_callback)(
+            _In_opt_ void* context,
+            ebpf_hash_table_notification_type_t type,
+            _In_ const uint8_t* key,
+            _Inout_ uint8_t* value,
+            _Inout_opt_ uint8_t* supplemental_value); ///< Optional function called as values are used and released.
+    } ebpf_hash_table_creation_options_t;
+
+    /**
+     * @brief Allocate and initialize a hash table with the given options.
+     * Values are allocated with supplemental_value_size bytes of zeroed,
+     * pointer aligned storage that the hash table doesn't interpret.
+     * notification_callback is invoked with the value and its supplemental
+     * storage when a value is allocated, published, returned by
+     * ebpf_hash_table_find, or freed. It's invoked without hash table locks
+     * held, so a concurrent delete can free a value before the notification
+     * that it was published.
+     *
+     * @param[out] hash_table Pointer to memory that will contain hash table on
+     *   success.
+     * @param[in] options Options for the hash table.
+     * @retval EBPF_SUCCESS The operation was successful.
+     * @retval EBPF_NO_MEMORY Unable to allocate resources for this
+     *  hash table.
+     */
+    ebpf_result_t
+    ebpf_hash_table_create_with_options(
+        _Out_ ebpf_hash_table_t** hash_table, _In_ const ebpf_hash_table_creation_options_t* options);
+
     /**
      * @brief Remove all items from the hash table and release memory.
      *
@@ -529,6 +644,22 @@ extern "C"
     ebpf_result_t
     ebpf_hash_table_delete(_In_ ebpf_hash_table_t* hash_table, _In_ const uint8_t* key);
 
+    /**
+     * @brief Remove an entry from the hash table if the key still maps to
+     * the given value.
+     *
+     * @param[in] hash_table Hash-table to update.
+     * @param[in] key Key to find and remove.
+     * @param[in] value Value pointer returned for the key by an earlier
+     *  find or notification.
+     * @retval EBPF_SUCCESS The operation was successful.
+     * @retval EBPF_KEY_NOT_FOUND The key is not present or maps to a
+     *  different value.
+     */
+    ebpf_result_t
+    ebpf_hash_table_delete_value(
+        _In_ ebpf_hash_table_t* hash_table, _In_ const uint8_t* key, _In_ const uint8_t* value);
+
     /**
      * @brief Find the next key in the hash table.
      *
@@ -579,6 +710,33 @@ extern "C"
         _Outptr_ uint8_t** next_key_pointer,
         _Outptr_opt_ uint8_t** next_value);
 
+    /**
+     * @brief Returns the next (key, value) pair in the hash table, resuming
+     * from the position recorded in the cursor. If previous_key is still at
+     * that position each step is O(1), otherwise the position is recomputed
+     * from previous_key. If previous_key was deleted since it was returned,
+     * the iteration continues with the key that followed it. Keys inserted,
+     * updated or deleted during an iteration may be skipped or returned twice.
+     *
+     * @param[in] hash_table Hash-table to query.
+     * @param[in, out] cursor Position of the iteration. On success, updated to
+     *  the position of the returned key.
+     * @param[in] previous_key Key returned by the previous call or NULL to
+     *  restart.
+     * @param[out] next_key_pointer Pointer to next key if one exists.
+     * @param[out] next_value If non-NULL, returns the next value if it exists.
+     * @retval EBPF_SUCCESS The operation was successful.
+     * @retval EBPF_NO_MORE_KEYS No keys exist in the hash table after the
+     *  specified key.
+     */
+    ebpf_result_t
+    ebpf_hash_table_next_key_with_cursor(
+        _In_ ebpf_hash_table_t* hash_table,
+        _Inout_ ebpf_hash_table_cursor_t* cursor,
+        _In_opt_ const uint8_t* previous_key,
+        _Outptr_ uint8_t** next_key_pointer,
+        _Outptr_opt_ uint8_t** next_value);
+
     /**
      * @brief Get the number of keys in the hash table
      *
@@ -646,6 +804,24 @@ extern "C"
     int32_t
     ebpf_interlocked_compare_exchange_int32(_Inout_ volatile int32_t* destination, int32_t exchange, int32_t comperand);
 
+    /**
+     * @brief Performs an atomic operation that compares the input value pointed
+     *  to by destination with the value of comperand and replaces it with
+     *  exchange.
+     *
+     * @param[in,out] destination A pointer to the input value that is compared
+     *  with the value of comperand.
+     * @param[in] exchange Specifies the output value pointed to by destination
+     *  if the input value pointed to by destination equals the value of
+     *  comperand.
+     * @param[in] comperand Specifies the value that is compared with the input
+     *  value pointed to by destination.
+     * @return Returns the original value of memory pointed to by
+     *  destination.
+     */
+    int64_t
+    ebpf_interlocked_compare_exchange_int64(_Inout_ volatile int64_t* destination, int64_t exchange, int64_t comperand);
+
     /**
      * @brief Performs an atomic operation that compares the input value pointed
      *  to by destination with the value of comperand and replaces it with
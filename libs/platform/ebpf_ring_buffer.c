@@ -4,14 +4,72 @@
 #include "ebpf_epoch.h"
 #include "ebpf_ring_buffer.h"
 
+// Producers don't take a lock. Each producer claims space by advancing producer_reserve_offset with a
+// compare-exchange, writes a locked record header, and then publishes the record by advancing producer_offset.
+// Records are published in the order they were reserved, so the consumer only ever sees records whose header
+// has been written. The locked and discarded bits in the header tell the consumer when the data is ready.
+
+// The ring memory is mapped twice back to back (see ebpf_allocate_ring_buffer_memory), so a record that runs past the
+// end of the ring is still contiguous in both the kernel and user views. Offsets only need reducing modulo the ring
+// length to find where a record starts; nothing ever splits or copies a record.
+
+// The consumer can return space either explicitly through ebpf_ring_buffer_return, or by storing its offset in the
+// consumer page, which is mapped writable into the consumer's process. The page is never trusted: producers only
+// read it when they run out of space, and apply it after the same validation as ebpf_ring_buffer_return. Producers
+// also copy the producer offset to the page, so a consumer can read new records without a query.
+
+#define EBPF_RING_BUFFER_CONSUMER_PAGE_SIZE 4096
+
+// Each consumer that maps the ring into its process gets its own views of the ring and the consumer page. The views
+// are tracked by the handle instance that asked for them, removed when that instance closes, and any that are left
+// are removed before the pages are freed.
+
+typedef struct _ebpf_ring_buffer_user_mapping
+{
+    ebpf_list_entry_t entry;
+    uintptr_t instance;
+    ebpf_user_mapping_t* buffer;
+    ebpf_user_mapping_t* consumer_offset;
+} ebpf_ring_buffer_user_mapping_t;
+
+// Freezes are also tracked by handle instance, so a handle can only thaw its own freezes and the ones it leaves behind
+// are thawed when it closes.
+
+typedef struct _ebpf_ring_buffer_freeze
+{
+    ebpf_list_entry_t entry;
+    uintptr_t instance;
+} ebpf_ring_buffer_freeze_t;
+
+// Returned space must end on a record boundary. Rather than walking the records being returned, the ring keeps a
+// bitmap with one bit per byte that is set where a record starts. The producer publishing a record rewrites the bits
+// for every byte of the record, so the bits between the consumer and producer offsets always describe the current
+// contents of the ring. Producers publish one at a time, in order, so they update the bitmap without atomics, and
+// the consumer only reads it.
+
+// A ring created with EBPF_RING_BUFFER_FLAG_OVERWRITE never runs out of space while it holds committed records: a
+// producer that can't fit its record advances the consumer offset past the oldest records instead, as if the consumer
+// had returned them. Records that are still locked are never dropped, so an overwriting producer may still fail if
+// the oldest record hasn't been submitted yet. Freezing the ring pauses overwriting so that the records between the
+// consumer and producer offsets stay put while they are read; new records are dropped if the ring fills meanwhile.
+
 typedef struct _ebpf_ring_buffer
 {
-    ebpf_lock_t lock;
+    ebpf_lock_t lock; // Serializes consumers returning space to the ring.
     size_t length;
-    size_t consumer_offset;
-    size_t producer_offset;
+    volatile size_t consumer_offset;
+    volatile size_t producer_offset;
+    volatile size_t producer_reserve_offset;
     uint8_t* shared_buffer;
     ebpf_ring_descriptor_t* ring_descriptor;
+    ebpf_memory_descriptor_t* consumer_page;
+    volatile const size_t* published_consumer_offset; // Written by the consumer, in the consumer page.
+    volatile size_t* published_producer_offset;       // Written by producers, in the consumer page.
+    uint32_t* record_starts;                          // Bit per byte of the ring, set where a record starts.
+    bool overwrite;                                   // Drop the oldest records when the ring is full.
+    uint32_t freeze_count;                            // Protected by lock. Overwriting is paused while non-zero.
+    ebpf_list_entry_t freezes;                        // Protected by lock. One ebpf_ring_buffer_freeze_t per freeze.
+    ebpf_list_entry_t user_mappings;                  // Protected by lock. ebpf_ring_buffer_user_mapping_t entries.
 } ebpf_ring_buffer_t;
 
 inline static size_t
@@ -20,24 +78,12 @@ _ring_get_length(_In_ const ebpf_ring_buffer_t* ring)
     return ring->length;
 }
 
-inline static size_t
-_ring_get_producer_offset(_In_ const ebpf_ring_buffer_t* ring)
-{
-    return ring->producer_offset % ring->length;
-}
-
 inline static size_t
 _ring_get_consumer_offset(_In_ const ebpf_ring_buffer_t* ring)
 {
     return ring->consumer_offset % ring->length;
 }
 
-inline static void
-_ring_advance_producer_offset(_Inout_ ebpf_ring_buffer_t* ring, size_t length)
-{
-    ring->producer_offset += length;
-}
-
 inline static void
 _ring_advance_consumer_offset(_Inout_ ebpf_ring_buffer_t* ring, size_t length)
 {
@@ -56,40 +102,202 @@ _ring_next_consumer_record(_In_ const ebpf_ring_buffer_t* ring)
     return _ring_record_at_offset(ring, _ring_get_consumer_offset(ring));
 }
 
+/**
+ * @brief Record that a record of length bytes starts at offset. Only called by the producer publishing the record.
+ */
+inline static void
+_ring_mark_record_start(_Inout_ ebpf_ring_buffer_t* ring, size_t offset, size_t length)
+{
+    size_t position = offset % ring->length;
+    size_t remaining = length;
+
+    // Clear the bits left over from earlier records that covered the same bytes. The ring length is a power of two
+    // larger than 32, so a run of bits never straddles the end of the bitmap.
+    while (remaining != 0) {
+        size_t bit = position % 32;
+        size_t count = (32 - bit < remaining) ? 32 - bit : remaining;
+        uint32_t mask = (count == 32) ? UINT32_MAX : (((1u << count) - 1) << bit);
+        ring->record_starts[position / 32] &= ~mask;
+        position = (position + count) % ring->length;
+        remaining -= count;
+    }
+
+    position = offset % ring->length;
+    ring->record_starts[position / 32] |= 1u << (position % 32);
+}
+
+inline static bool
+_ring_is_record_start(_In_ const ebpf_ring_buffer_t* ring, size_t offset)
+{
+    size_t position = offset % ring->length;
+    return (ring->record_starts[position / 32] & (1u << (position % 32))) != 0;
+}
+
+static _Requires_lock_held_(ring->lock) ebpf_result_t
+    _ring_return_locked(_Inout_ ebpf_ring_buffer_t* ring, size_t length)
+{
+    size_t producer_offset = ring->producer_offset;
+
+    // Check if length is valid.
+    if ((length > _ring_get_length(ring)) || (length > producer_offset - ring->consumer_offset)) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+
+    // Order reading the producer offset before reading the bitmap, which producers update before publishing.
+    MemoryBarrier();
+
+    // Does it end on a record boundary? The producer offset always does, but its bit may not be set yet.
+    size_t consumer_offset = ring->consumer_offset + length;
+    if ((consumer_offset != producer_offset) && !_ring_is_record_start(ring, consumer_offset)) {
+        return EBPF_INVALID_ARGUMENT;
+    }
+
+    _ring_advance_consumer_offset(ring, length);
+    return EBPF_SUCCESS;
+}
+
+/**
+ * @brief Apply the consumer offset published in the consumer page.
+ *
+ * @retval true The consumer offset advanced.
+ * @retval false There was nothing new to apply, or the published offset isn't valid.
+ */
+static bool
+_ring_apply_published_consumer_offset(_Inout_ ebpf_ring_buffer_t* ring)
+{
+    size_t published_offset = *ring->published_consumer_offset;
+    if (published_offset <= ring->consumer_offset) {
+        return false;
+    }
+
+    bool advanced = false;
+    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
+    // Recheck under the lock, as another producer or the consumer may have moved the offset.
+    if (published_offset > ring->consumer_offset) {
+        advanced = _ring_return_locked(ring, published_offset - ring->consumer_offset) == EBPF_SUCCESS;
+    }
+    ebpf_lock_unlock(&ring->lock, state);
+    return advanced;
+}
+
+/**
+ * @brief Drop the oldest committed records until there is room for a record of requested_length bytes.
+ *
+ * @retval true The consumer offset advanced.
+ * @retval false Nothing could be dropped, either because the ring is frozen or the oldest record is still locked.
+ */
+static bool
+_ring_overwrite_oldest(_Inout_ ebpf_ring_buffer_t* ring, size_t requested_length)
+{
+    bool advanced = false;
+    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
+    if (ring->freeze_count == 0) {
+        size_t producer_offset = ring->producer_offset;
+        // Order reading the producer offset before reading the headers of the records it published.
+        MemoryBarrier();
+        while (ring->consumer_offset != producer_offset) {
+            size_t remaining_space = ring->length - (ring->producer_reserve_offset - ring->consumer_offset);
+            if (remaining_space > requested_length) {
+                break;
+            }
+            const ebpf_ring_buffer_record_t* record = _ring_next_consumer_record(ring);
+            if (record->header.locked) {
+                break;
+            }
+            _ring_advance_consumer_offset(ring, record->header.length);
+            advanced = true;
+        }
+    }
+    ebpf_lock_unlock(&ring->lock, state);
+    return advanced;
+}
+
 inline static _Ret_maybenull_ ebpf_ring_buffer_record_t*
 _ring_buffer_acquire_record(_Inout_ ebpf_ring_buffer_t* ring, size_t requested_length)
 {
-    ebpf_ring_buffer_record_t* record = NULL;
+    ebpf_ring_buffer_record_t* record;
+    size_t reserve_offset;
+    uint8_t old_irql;
     requested_length += EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data);
-    size_t remaining_space = ring->length - (ring->producer_offset - ring->consumer_offset);
-
-    if (remaining_space > requested_length) {
-        record = _ring_record_at_offset(ring, _ring_get_producer_offset(ring));
-        _ring_advance_producer_offset(ring, requested_length);
-        record->header.length = (uint32_t)requested_length;
-        record->header.locked = 1;
-        record->header.discarded = 0;
+
+    // Once space is reserved, later producers wait for this record to be published. Run at DISPATCH_LEVEL until
+    // then, so a producer at DISPATCH_LEVEL on this CPU can't preempt us and spin forever waiting on our record.
+    old_irql = ebpf_raise_irql_to_dispatch();
+
+    for (;;) {
+        reserve_offset = ring->producer_reserve_offset;
+        size_t remaining_space = ring->length - (reserve_offset - ring->consumer_offset);
+        if (remaining_space <= requested_length) {
+            if (_ring_apply_published_consumer_offset(ring)) {
+                continue;
+            }
+            if (ring->overwrite && _ring_overwrite_oldest(ring, requested_length)) {
+                continue;
+            }
+            ebpf_lower_irql(old_irql);
+            return NULL;
+        }
+        if ((size_t)ebpf_interlocked_compare_exchange_int64(
+                (volatile int64_t*)&ring->producer_reserve_offset,
+                (int64_t)(reserve_offset + requested_length),
+                (int64_t)reserve_offset) == reserve_offset) {
+            break;
+        }
     }
+
+    record = _ring_record_at_offset(ring, reserve_offset);
+    record->header.length = (uint32_t)requested_length;
+    record->header.locked = 1;
+    record->header.discarded = 0;
+
+    // Wait for producers that reserved earlier space to publish their records. They only need to write a header
+    // before doing so, so the wait is short.
+    while (ring->producer_offset != reserve_offset) {
+        YieldProcessor();
+    }
+    _ring_mark_record_start(ring, reserve_offset, requested_length);
+    MemoryBarrier();
+    // Copy the offset to the consumer page first. The next producer waits for producer_offset, so the copies are
+    // made in order too.
+    *ring->published_producer_offset = reserve_offset + requested_length;
+    MemoryBarrier();
+    ring->producer_offset = reserve_offset + requested_length;
+    ebpf_lower_irql(old_irql);
     return record;
 }
 
 ebpf_result_t
 ebpf_ring_buffer_create(_Outptr_ ebpf_ring_buffer_t** ring, size_t capacity)
+{
+    return ebpf_ring_buffer_create_with_flags(ring, capacity, 0);
+}
+
+ebpf_result_t
+ebpf_ring_buffer_create_with_flags(_Outptr_ ebpf_ring_buffer_t** ring, size_t capacity, uint32_t flags)
 {
     EBPF_LOG_ENTRY();
     ebpf_result_t result;
+    ebpf_ring_buffer_consumer_page_t* consumer_page;
     ebpf_ring_buffer_t* local_ring_buffer = ebpf_epoch_allocate(sizeof(ebpf_ring_buffer_t));
     if (!local_ring_buffer) {
         result = EBPF_NO_MEMORY;
         goto Error;
     }
+    ebpf_list_initialize(&local_ring_buffer->freezes);
+    ebpf_list_initialize(&local_ring_buffer->user_mappings);
 
     if ((capacity & ~(capacity - 1)) != capacity) {
         result = EBPF_INVALID_ARGUMENT;
         goto Error;
     }
 
+    if (flags & ~EBPF_RING_BUFFER_FLAG_OVERWRITE) {
+        result = EBPF_INVALID_ARGUMENT;
+        goto Error;
+    }
+
     local_ring_buffer->length = capacity;
+    local_ring_buffer->overwrite = (flags & EBPF_RING_BUFFER_FLAG_OVERWRITE) != 0;
 
     local_ring_buffer->ring_descriptor = ebpf_allocate_ring_buffer_memory(capacity);
     if (!local_ring_buffer->ring_descriptor) {
@@ -98,6 +306,23 @@ ebpf_ring_buffer_create(_Outptr_ ebpf_ring_buffer_t** ring, size_t capacity)
     }
     local_ring_buffer->shared_buffer = ebpf_ring_descriptor_get_base_address(local_ring_buffer->ring_descriptor);
 
+    local_ring_buffer->record_starts = ebpf_allocate(capacity / 8);
+    if (!local_ring_buffer->record_starts) {
+        result = EBPF_NO_MEMORY;
+        goto Error;
+    }
+
+    local_ring_buffer->consumer_page = ebpf_map_memory(EBPF_RING_BUFFER_CONSUMER_PAGE_SIZE);
+    if (!local_ring_buffer->consumer_page) {
+        result = EBPF_NO_MEMORY;
+        goto Error;
+    }
+    consumer_page =
+        (ebpf_ring_buffer_consumer_page_t*)ebpf_memory_descriptor_get_base_address(local_ring_buffer->consumer_page);
+    memset(consumer_page, 0, EBPF_RING_BUFFER_CONSUMER_PAGE_SIZE);
+    local_ring_buffer->published_consumer_offset = &consumer_page->consumer_offset;
+    local_ring_buffer->published_producer_offset = &consumer_page->producer_offset;
+
     *ring = local_ring_buffer;
     local_ring_buffer = NULL;
     return EBPF_SUCCESS;
@@ -108,11 +333,34 @@ Error:
     EBPF_RETURN_RESULT(result);
 }
 
+static void
+_ring_buffer_free_user_mapping(_Frees_ptr_opt_ ebpf_ring_buffer_user_mapping_t* user_mapping)
+{
+    if (user_mapping) {
+        ebpf_user_mapping_unmap(user_mapping->buffer);
+        ebpf_user_mapping_unmap(user_mapping->consumer_offset);
+        ebpf_free(user_mapping);
+    }
+}
+
 void
 ebpf_ring_buffer_destroy(_Frees_ptr_opt_ ebpf_ring_buffer_t* ring)
 {
     EBPF_LOG_ENTRY();
     if (ring) {
+        while (!ebpf_list_is_empty(&ring->user_mappings)) {
+            ebpf_ring_buffer_user_mapping_t* user_mapping =
+                EBPF_FROM_FIELD(ebpf_ring_buffer_user_mapping_t, entry, ring->user_mappings.Flink);
+            ebpf_list_remove_entry(&user_mapping->entry);
+            _ring_buffer_free_user_mapping(user_mapping);
+        }
+        while (!ebpf_list_is_empty(&ring->freezes)) {
+            ebpf_list_entry_t* entry = ring->freezes.Flink;
+            ebpf_list_remove_entry(entry);
+            ebpf_free(EBPF_FROM_FIELD(ebpf_ring_buffer_freeze_t, entry, entry));
+        }
+        ebpf_free(ring->record_starts);
+        ebpf_unmap_memory(ring->consumer_page);
         ebpf_free_ring_buffer_memory(ring->ring_descriptor);
         ebpf_epoch_free(ring);
     }
@@ -122,22 +370,14 @@ ebpf_ring_buffer_destroy(_Frees_ptr_opt_ ebpf_ring_buffer_t* ring)
 ebpf_result_t
 ebpf_ring_buffer_output(_Inout_ ebpf_ring_buffer_t* ring, _In_reads_bytes_(length) uint8_t* data, size_t length)
 {
-    ebpf_result_t result;
-    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
     ebpf_ring_buffer_record_t* record = _ring_buffer_acquire_record(ring, length);
 
     if (record == NULL) {
-        result = EBPF_OUT_OF_SPACE;
-        goto Done;
+        return EBPF_OUT_OF_SPACE;
     }
 
-    record->header.discarded = 0;
-    record->header.locked = 0;
     memcpy(record->data, data, length);
-    result = EBPF_SUCCESS;
-Done:
-    ebpf_lock_unlock(&ring->lock, state);
-    return result;
+    return ebpf_ring_buffer_submit(record->data);
 }
 
 void
@@ -147,74 +387,189 @@ ebpf_ring_buffer_query(_In_ const ebpf_ring_buffer_t* ring, _Out_ size_t* consum
     *producer = ring->producer_offset;
 }
 
+bool
+ebpf_ring_buffer_is_oldest_record_locked(_In_ const ebpf_ring_buffer_t* ring)
+{
+    if (ring->consumer_offset == ring->producer_offset) {
+        return false;
+    }
+    // Order reading the producer offset before reading the header of the record it published.
+    MemoryBarrier();
+    return _ring_next_consumer_record(ring)->header.locked;
+}
+
 ebpf_result_t
 ebpf_ring_buffer_return(_Inout_ ebpf_ring_buffer_t* ring, size_t length)
 {
-    ebpf_result_t result;
     ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
-    size_t local_length = length;
-    size_t offset = _ring_get_consumer_offset(ring);
+    ebpf_result_t result = _ring_return_locked(ring, length);
+    ebpf_lock_unlock(&ring->lock, state);
+    return result;
+}
 
-    // Check if length is valid.
-    if ((length > _ring_get_length(ring)) ||
-        (length + _ring_get_consumer_offset(ring) > _ring_get_producer_offset(ring))) {
+ebpf_result_t
+ebpf_ring_buffer_freeze(
+    _Inout_ ebpf_ring_buffer_t* ring, uintptr_t instance, _Out_ size_t* consumer, _Out_ size_t* producer)
+{
+    ebpf_ring_buffer_freeze_t* freeze = ebpf_allocate(sizeof(ebpf_ring_buffer_freeze_t));
+    if (!freeze) {
+        return EBPF_NO_MEMORY;
+    }
+    freeze->instance = instance;
+
+    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
+    ebpf_list_insert_tail(&ring->freezes, &freeze->entry);
+    ring->freeze_count++;
+    *consumer = ring->consumer_offset;
+    *producer = ring->producer_offset;
+    ebpf_lock_unlock(&ring->lock, state);
+    return EBPF_SUCCESS;
+}
+
+/**
+ * @brief Remove the freezes held by a handle instance.
+ *
+ * @param[in,out] ring Ring buffer to thaw.
+ * @param[in] instance Handle instance whose freezes are removed.
+ * @param[in] all Remove all of the instance's freezes rather than just one.
+ * @return Number of freezes removed.
+ */
+static uint32_t
+_ring_buffer_thaw(_Inout_ ebpf_ring_buffer_t* ring, uintptr_t instance, bool all)
+{
+    uint32_t thawed = 0;
+    ebpf_list_entry_t thawed_freezes;
+    ebpf_list_initialize(&thawed_freezes);
+
+    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
+    ebpf_list_entry_t* entry = ring->freezes.Flink;
+    while (entry != &ring->freezes) {
+        ebpf_ring_buffer_freeze_t* freeze = EBPF_FROM_FIELD(ebpf_ring_buffer_freeze_t, entry, entry);
+        entry = entry->Flink;
+        if (freeze->instance == instance) {
+            ebpf_list_remove_entry(&freeze->entry);
+            ebpf_list_insert_tail(&thawed_freezes, &freeze->entry);
+            ring->freeze_count--;
+            thawed++;
+            if (!all) {
+                break;
+            }
+        }
+    }
+    ebpf_lock_unlock(&ring->lock, state);
+
+    while (!ebpf_list_is_empty(&thawed_freezes)) {
+        entry = thawed_freezes.Flink;
+        ebpf_list_remove_entry(entry);
+        ebpf_free(EBPF_FROM_FIELD(ebpf_ring_buffer_freeze_t, entry, entry));
+    }
+    return thawed;
+}
+
+ebpf_result_t
+ebpf_ring_buffer_thaw(_Inout_ ebpf_ring_buffer_t* ring, uintptr_t instance)
+{
+    return (_ring_buffer_thaw(ring, instance, false) != 0) ? EBPF_SUCCESS : EBPF_INVALID_ARGUMENT;
+}
+
+ebpf_result_t
+ebpf_ring_buffer_read(
+    _Inout_ ebpf_ring_buffer_t* ring, size_t offset, _Out_writes_bytes_(length) uint8_t* buffer, size_t length)
+{
+    ebpf_result_t result = EBPF_SUCCESS;
+    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
+    // The bytes must still be in the ring; they may have been returned or overwritten since they were produced.
+    size_t producer_offset = ring->producer_offset;
+    if ((offset < ring->consumer_offset) || (offset > producer_offset) || (length > producer_offset - offset)) {
         result = EBPF_INVALID_ARGUMENT;
         goto Done;
     }
+    MemoryBarrier();
+    // The ring is mapped twice back to back, so the bytes are contiguous.
+    memcpy(buffer, &ring->shared_buffer[offset % ring->length], length);
 
-    // Verify count.
-    while (local_length != 0) {
-        ebpf_ring_buffer_record_t* record = _ring_record_at_offset(ring, offset);
-        if (local_length < record->header.length) {
-            break;
-        }
-        offset += record->header.length;
-        local_length -= record->header.length;
+Done:
+    ebpf_lock_unlock(&ring->lock, state);
+    return result;
+}
+
+ebpf_result_t
+ebpf_ring_buffer_map_user(
+    _Inout_ ebpf_ring_buffer_t* ring,
+    uintptr_t instance,
+    _Outptr_ uint8_t** buffer,
+    _Outptr_ size_t** consumer_offset)
+{
+    ebpf_result_t result;
+    ebpf_lock_state_t state;
+    ebpf_ring_buffer_user_mapping_t* user_mapping = ebpf_allocate(sizeof(ebpf_ring_buffer_user_mapping_t));
+    if (!user_mapping) {
+        result = EBPF_NO_MEMORY;
+        goto Done;
     }
-    // Did it end on a record boundary?
-    if (local_length != 0) {
+    user_mapping->instance = instance;
+
+    // Mapping into a process can't be done at DISPATCH_LEVEL, so the views are created before taking the lock.
+    user_mapping->buffer = ebpf_ring_map_readonly_user(ring->ring_descriptor);
+    user_mapping->consumer_offset = ebpf_memory_descriptor_map_writable_user(ring->consumer_page);
+    if (!user_mapping->buffer || !user_mapping->consumer_offset) {
         result = EBPF_INVALID_ARGUMENT;
         goto Done;
     }
 
-    _ring_advance_consumer_offset(ring, length);
+    *buffer = ebpf_user_mapping_get_address(user_mapping->buffer);
+    *consumer_offset = ebpf_user_mapping_get_address(user_mapping->consumer_offset);
+
+    state = ebpf_lock_lock(&ring->lock);
+    ebpf_list_insert_tail(&ring->user_mappings, &user_mapping->entry);
+    ebpf_lock_unlock(&ring->lock, state);
+    user_mapping = NULL;
     result = EBPF_SUCCESS;
 
 Done:
-    ebpf_lock_unlock(&ring->lock, state);
+    _ring_buffer_free_user_mapping(user_mapping);
     return result;
 }
 
-ebpf_result_t
-ebpf_ring_buffer_map_buffer(_In_ const ebpf_ring_buffer_t* ring, _Outptr_ uint8_t** buffer)
+void
+ebpf_ring_buffer_close_instance(_Inout_ ebpf_ring_buffer_t* ring, uintptr_t instance)
 {
-    *buffer = ebpf_ring_map_readonly_user(ring->ring_descriptor);
-    if (!*buffer) {
-        return EBPF_INVALID_ARGUMENT;
-    } else {
-        return EBPF_SUCCESS;
+    _ring_buffer_thaw(ring, instance, true);
+
+    ebpf_list_entry_t unmapped;
+    ebpf_list_initialize(&unmapped);
+
+    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
+    ebpf_list_entry_t* entry = ring->user_mappings.Flink;
+    while (entry != &ring->user_mappings) {
+        ebpf_ring_buffer_user_mapping_t* user_mapping = EBPF_FROM_FIELD(ebpf_ring_buffer_user_mapping_t, entry, entry);
+        entry = entry->Flink;
+        if (user_mapping->instance == instance) {
+            ebpf_list_remove_entry(&user_mapping->entry);
+            ebpf_list_insert_tail(&unmapped, &user_mapping->entry);
+        }
+    }
+    ebpf_lock_unlock(&ring->lock, state);
+
+    // Removing the views has the same IRQL requirement as creating them, so it is done after dropping the lock.
+    while (!ebpf_list_is_empty(&unmapped)) {
+        ebpf_ring_buffer_user_mapping_t* user_mapping =
+            EBPF_FROM_FIELD(ebpf_ring_buffer_user_mapping_t, entry, unmapped.Flink);
+        ebpf_list_remove_entry(&user_mapping->entry);
+        _ring_buffer_free_user_mapping(user_mapping);
     }
 }
 
 ebpf_result_t
 ebpf_ring_buffer_reserve(_Inout_ ebpf_ring_buffer_t* ring, _Outptr_ uint8_t** data, size_t length)
 {
-    ebpf_result_t result;
-    ebpf_lock_state_t state = ebpf_lock_lock(&ring->lock);
     ebpf_ring_buffer_record_t* record = _ring_buffer_acquire_record(ring, length);
     if (record == NULL) {
-        result = EBPF_INVALID_ARGUMENT;
-        goto Done;
+        return EBPF_INVALID_ARGUMENT;
     }
 
-    record->header.locked = 1;
-    MemoryBarrier();
-
     *data = record->data;
-    result = EBPF_SUCCESS;
-Done:
-    ebpf_lock_unlock(&ring->lock, state);
-    return result;
+    return EBPF_SUCCESS;
 }
 
 ebpf_result_t
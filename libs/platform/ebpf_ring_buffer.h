@@ -23,6 +23,18 @@ extern "C"
 
     typedef struct _ebpf_ring_buffer ebpf_ring_buffer_t;
 
+    // Layout of the consumer page. The consumer stores its offset in consumer_offset. Producers copy the producer
+    // offset to producer_offset as they publish records, so a consumer can find new records without asking the ring;
+    // the ring never reads it back.
+    typedef struct _ebpf_ring_buffer_consumer_page
+    {
+        volatile size_t consumer_offset;
+        uint8_t padding[EBPF_CACHE_LINE_SIZE - sizeof(size_t)];
+        volatile size_t producer_offset;
+    } ebpf_ring_buffer_consumer_page_t;
+
+#define EBPF_RING_BUFFER_FLAG_OVERWRITE 0x1 // When full, drop the oldest committed records to make room.
+
     /**
      * @brief Allocate a ring_buffer with capacity.
      *
@@ -34,6 +46,19 @@ extern "C"
     ebpf_result_t
     ebpf_ring_buffer_create(_Outptr_ ebpf_ring_buffer_t** ring_buffer, size_t capacity);
 
+    /**
+     * @brief Allocate a ring_buffer with capacity and flags.
+     *
+     * @param[out] ring_buffer Pointer to buffer that holds ring buffer pointer on success.
+     * @param[in] capacity Size in bytes of ring buffer.
+     * @param[in] flags EBPF_RING_BUFFER_FLAG_* values.
+     * @retval EPBF_SUCCESS Successfully allocated ring buffer.
+     * @retval EBPF_NO_MEMORY Unable to allocate ring buffer.
+     * @retval EBPF_INVALID_ARGUMENT The capacity or flags are invalid.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_create_with_flags(_Outptr_ ebpf_ring_buffer_t** ring_buffer, size_t capacity, uint32_t flags);
+
     /**
      * @brief Free a ring buffer.
      *
@@ -65,6 +90,17 @@ extern "C"
     void
     ebpf_ring_buffer_query(_In_ const ebpf_ring_buffer_t* ring_buffer, _Out_ size_t* consumer, _Out_ size_t* producer);
 
+    /**
+     * @brief Check whether the record at the consumer offset is still being written by its producer. The consumer
+     * can't get past it until the producer submits or discards it.
+     *
+     * @param[in] ring_buffer Ring buffer to query.
+     * @retval true The oldest record in the ring is locked.
+     * @retval false The ring is empty or its oldest record can be consumed.
+     */
+    bool
+    ebpf_ring_buffer_is_oldest_record_locked(_In_ const ebpf_ring_buffer_t* ring_buffer);
+
     /**
      * @brief Mark one or more records in the ring buffer as returned to the ring.
      *
@@ -77,15 +113,81 @@ extern "C"
     ebpf_ring_buffer_return(_Inout_ ebpf_ring_buffer_t* ring_buffer, size_t length);
 
     /**
-     * @brief Get pointer to the ring buffer shared data.
+     * @brief Stop producers from overwriting records and get the range of records currently in the ring. Until the
+     * matching call to ebpf_ring_buffer_thaw, the records in the range stay in place unless the consumer returns
+     * them, and producers drop new records that don't fit. Freezes nest, and belong to the handle instance that
+     * made them. An instance's freezes are thawed by ebpf_ring_buffer_close_instance.
      *
-     * @param[in] ring_buffer Ring buffer to query.
+     * @param[in,out] ring_buffer Ring buffer to freeze.
+     * @param[in] instance Handle instance the freeze belongs to.
+     * @param[out] consumer Offset of the first record in the ring.
+     * @param[out] producer Offset of the end of the last record in the ring.
+     * @retval EPBF_SUCCESS Successfully froze the ring.
+     * @retval EBPF_NO_MEMORY Unable to allocate resources for this operation.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_freeze(
+        _Inout_ ebpf_ring_buffer_t* ring_buffer, uintptr_t instance, _Out_ size_t* consumer, _Out_ size_t* producer);
+
+    /**
+     * @brief Undo a call to ebpf_ring_buffer_freeze made by the same handle instance.
+     *
+     * @param[in,out] ring_buffer Ring buffer to thaw.
+     * @param[in] instance Handle instance the freeze belongs to.
+     * @retval EPBF_SUCCESS Successfully thawed the ring.
+     * @retval EBPF_INVALID_ARGUMENT The instance has no freeze on the ring.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_thaw(_Inout_ ebpf_ring_buffer_t* ring_buffer, uintptr_t instance);
+
+    /**
+     * @brief Copy bytes that are currently in the ring without consuming them.
+     *
+     * @param[in,out] ring_buffer Ring buffer to read from.
+     * @param[in] offset Offset of the first byte to copy, as returned by ebpf_ring_buffer_freeze or
+     * ebpf_ring_buffer_query.
+     * @param[out] buffer Buffer to copy into.
+     * @param[in] length Number of bytes to copy.
+     * @retval EPBF_SUCCESS Successfully copied the bytes.
+     * @retval EBPF_INVALID_ARGUMENT The bytes are not between the consumer and producer offsets.
+     */
+    ebpf_result_t
+    ebpf_ring_buffer_read(
+        _Inout_ ebpf_ring_buffer_t* ring_buffer,
+        size_t offset,
+        _Out_writes_bytes_(length) uint8_t* buffer,
+        size_t length);
+
+    /**
+     * @brief Map the ring buffer shared data and the consumer page into the calling process. Storing an offset
+     * through the consumer offset pointer returns the space before it to the ring without a call into the ring
+     * buffer. Producers apply the offset when they run out of space, if it is a valid argument to
+     * ebpf_ring_buffer_return. The pointer is to the start of an ebpf_ring_buffer_consumer_page_t.
+     *
+     * @param[in,out] ring_buffer Ring buffer to map.
+     * @param[in] instance Handle instance the mappings belong to, passed to ebpf_ring_buffer_close_instance.
      * @param[out] buffer Pointer to ring buffer data.
+     * @param[out] consumer_offset Pointer to the published consumer offset.
      * @retval EPBF_SUCCESS Successfully mapped the ring buffer.
+     * @retval EBPF_NO_MEMORY Unable to allocate resources for this operation.
      * @retval EBPF_INVALID_ARGUMENT Unable to map the ring buffer.
      */
     ebpf_result_t
-    ebpf_ring_buffer_map_buffer(_In_ const ebpf_ring_buffer_t* ring_buffer, _Outptr_ uint8_t** buffer);
+    ebpf_ring_buffer_map_user(
+        _Inout_ ebpf_ring_buffer_t* ring_buffer,
+        uintptr_t instance,
+        _Outptr_ uint8_t** buffer,
+        _Outptr_ size_t** consumer_offset);
+
+    /**
+     * @brief Release what a handle instance holds on the ring: the mappings created by ebpf_ring_buffer_map_user
+     * and the freezes made by ebpf_ring_buffer_freeze.
+     *
+     * @param[in,out] ring_buffer Ring buffer to release.
+     * @param[in] instance Handle instance that is closing.
+     */
+    void
+    ebpf_ring_buffer_close_instance(_Inout_ ebpf_ring_buffer_t* ring_buffer, uintptr_t instance);
 
     /**
      * @brief Reserve a buffer in the ring buffer. Buffer is valid until either ebpf_ring_buffer_submit,
@@ -124,6 +226,10 @@ extern "C"
      * @brief Locate the next record in the ring buffer's data buffer and
      * advance consumer offset.
      *
+     * The data buffer is mapped twice back to back, so the returned record is
+     * contiguous even when it runs past the end of the ring and can be read in
+     * place.
+     *
      * @param[in] buffer Pointer to the start of the ring buffer's data buffer.
      * @param[in] buffer_length Length of the ring buffer's data buffer.
      * @param[in] consumer Consumer offset.
@@ -2,13 +2,9 @@
 // SPDX-License-Identifier: MIT
 
 #include "ebpf_state.h"
-#include "ebpf_epoch.h"
 
 #define EBPF_MAX_STATE_ENTRIES 64
 
-// Table to track what state for each thread.
-static ebpf_hash_table_t* _ebpf_state_thread_table = NULL;
-
 static int64_t _ebpf_state_next_index;
 
 // Table to track what state for each CPU.
@@ -17,6 +13,38 @@ typedef struct _ebpf_state_entry
     uintptr_t state[EBPF_MAX_STATE_ENTRIES];
 } ebpf_state_entry_t;
 
+// Slot to track the state of a thread.
+// A thread claims a slot when it first stores a non-zero value and releases it once all of its values are zero again,
+// so a thread that exits without leaving state behind doesn't hold on to a slot.
+typedef struct _ebpf_state_thread_slot
+{
+    void* volatile owner; // Thread id of the owning thread or NULL if the slot is free.
+    size_t value_count;   // Number of non-zero values in entry. Only accessed by the owning thread.
+    ebpf_state_entry_t entry;
+    uintptr_t padding[6];
+} ebpf_state_thread_slot_t;
+
+C_ASSERT(sizeof(ebpf_state_thread_slot_t) % EBPF_CACHE_LINE_SIZE == 0);
+
+// Table to track what state for each thread.
+static _Writable_elements_(EBPF_THREAD_SLOT_COUNT) ebpf_state_thread_slot_t* _ebpf_state_thread_slots = NULL;
+
+// Longest probe sequence needed by any thread that claimed a slot. Bounds the search for a thread without a slot.
+static volatile int32_t _ebpf_state_thread_slot_max_probe;
+
+// Slot allocated for a thread that found every slot in the table owned by another thread.
+typedef struct _ebpf_state_overflow_slot
+{
+    ebpf_list_entry_t list_entry;
+    ebpf_state_thread_slot_t slot;
+} ebpf_state_overflow_slot_t;
+
+// List of overflow slots, protected by _ebpf_state_overflow_lock. The count lets lookups skip the lock while the table
+// hasn't overflowed.
+static ebpf_lock_t _ebpf_state_overflow_lock;
+static ebpf_list_entry_t _ebpf_state_overflow_slots;
+static volatile int32_t _ebpf_state_overflow_slot_count;
+
 static _Writable_elements_(_ebpf_state_cpu_table_size) ebpf_state_entry_t* _ebpf_state_cpu_table = NULL;
 static uint32_t _ebpf_state_cpu_table_size = 0;
 
@@ -39,18 +67,18 @@ ebpf_state_initiate()
         }
     }
 
-    return_value = ebpf_hash_table_create(
-        &_ebpf_state_thread_table,
-        ebpf_epoch_allocate,
-        ebpf_epoch_free,
-        sizeof(uint64_t),
-        sizeof(ebpf_state_entry_t),
-        ebpf_get_cpu_count(),
-        NULL);
-    if (return_value != EBPF_SUCCESS) {
+    _ebpf_state_thread_slot_max_probe = 0;
+    _ebpf_state_thread_slots =
+        ebpf_allocate_cache_aligned(sizeof(ebpf_state_thread_slot_t) * EBPF_THREAD_SLOT_COUNT);
+    if (!_ebpf_state_thread_slots) {
+        return_value = EBPF_NO_MEMORY;
         goto Error;
     }
 
+    ebpf_lock_create(&_ebpf_state_overflow_lock);
+    ebpf_list_initialize(&_ebpf_state_overflow_slots);
+    _ebpf_state_overflow_slot_count = 0;
+
     EBPF_RETURN_RESULT(return_value);
 
 Error:
@@ -66,8 +94,19 @@ void
 ebpf_state_terminate()
 {
     EBPF_LOG_ENTRY();
-    ebpf_hash_table_destroy(_ebpf_state_thread_table);
+    if (_ebpf_state_thread_slots) {
+        // Free the slots of threads that exited without clearing their state.
+        while (!ebpf_list_is_empty(&_ebpf_state_overflow_slots)) {
+            ebpf_list_entry_t* entry = ebpf_list_remove_head_entry(&_ebpf_state_overflow_slots);
+            ebpf_free(CONTAINING_RECORD(entry, ebpf_state_overflow_slot_t, list_entry));
+        }
+        _ebpf_state_overflow_slot_count = 0;
+        ebpf_lock_destroy(&_ebpf_state_overflow_lock);
+    }
+    ebpf_free_cache_aligned(_ebpf_state_thread_slots);
+    _ebpf_state_thread_slots = NULL;
     ebpf_free_cache_aligned(_ebpf_state_cpu_table);
+    _ebpf_state_cpu_table = NULL;
     EBPF_RETURN_VOID();
 }
 
@@ -83,43 +122,138 @@ ebpf_state_allocate_index(_Out_ size_t* new_index)
     EBPF_RETURN_RESULT(EBPF_SUCCESS);
 }
 
-ebpf_result_t
-_ebpf_state_get_entry(_Out_ ebpf_state_entry_t** entry)
+/**
+ * @brief Compute the first slot to probe for a given thread.
+ *
+ * @param[in] thread_id Thread id to hash.
+ * @return Index of the first slot to probe.
+ */
+static inline uint32_t
+_ebpf_state_thread_slot_hash(uint64_t thread_id)
 {
-    // High frequency call, don't log entry/exit.
-    ebpf_state_entry_t* local_entry = NULL;
+    // Fibonacci hashing spreads thread ids (which are typically aligned pointers or multiples of 4) across the table.
+    return (uint32_t)((thread_id * 0x9E3779B97F4A7C15ull) >> 32) % EBPF_THREAD_SLOT_COUNT;
+}
 
-    if (!ebpf_is_non_preemptible_work_item_supported() || ebpf_is_preemptible()) {
-        ebpf_result_t return_value;
-        uint64_t current_thread_id = ebpf_get_current_thread_id();
+/**
+ * @brief Find the overflow slot owned by a thread.
+ *
+ * @param[in] owner Thread id of the owning thread.
+ * @return Slot owned by the thread, or NULL if it doesn't own an overflow slot.
+ */
+static ebpf_state_thread_slot_t*
+_ebpf_state_find_overflow_slot(_In_ const void* owner)
+{
+    ebpf_state_thread_slot_t* slot = NULL;
+    ebpf_lock_state_t lock_state = ebpf_lock_lock(&_ebpf_state_overflow_lock);
+    for (ebpf_list_entry_t* entry = _ebpf_state_overflow_slots.Flink; entry != &_ebpf_state_overflow_slots;
+         entry = entry->Flink) {
+        ebpf_state_overflow_slot_t* overflow_slot = CONTAINING_RECORD(entry, ebpf_state_overflow_slot_t, list_entry);
+        if (overflow_slot->slot.owner == owner) {
+            slot = &overflow_slot->slot;
+            break;
+        }
+    }
+    ebpf_lock_unlock(&_ebpf_state_overflow_lock, lock_state);
+    return slot;
+}
 
-        return_value =
-            ebpf_hash_table_find(_ebpf_state_thread_table, (const uint8_t*)&current_thread_id, (uint8_t**)&local_entry);
+/**
+ * @brief Release a slot once the owning thread has no state left in it.
+ *
+ * @param[in] slot Slot to release.
+ */
+static void
+_ebpf_state_release_thread_slot(_In_ ebpf_state_thread_slot_t* slot)
+{
+    ebpf_state_overflow_slot_t* overflow_slot;
+    ebpf_lock_state_t lock_state;
 
-        if (return_value == EBPF_KEY_NOT_FOUND) {
-            ebpf_state_entry_t new_entry = {0};
+    if (slot >= _ebpf_state_thread_slots && slot < _ebpf_state_thread_slots + EBPF_THREAD_SLOT_COUNT) {
+        ebpf_interlocked_compare_exchange_pointer(&slot->owner, NULL, slot->owner);
+        return;
+    }
 
-            return_value = ebpf_hash_table_update(
-                _ebpf_state_thread_table,
-                (const uint8_t*)&current_thread_id,
-                (const uint8_t*)&new_entry,
-                EBPF_HASH_TABLE_OPERATION_INSERT);
+    overflow_slot = CONTAINING_RECORD(slot, ebpf_state_overflow_slot_t, slot);
+    lock_state = ebpf_lock_lock(&_ebpf_state_overflow_lock);
+    ebpf_list_remove_entry(&overflow_slot->list_entry);
+    _ebpf_state_overflow_slot_count--;
+    ebpf_lock_unlock(&_ebpf_state_overflow_lock, lock_state);
+    ebpf_free(overflow_slot);
+}
 
-            if (return_value != EBPF_SUCCESS) {
-                return return_value;
-            }
+/**
+ * @brief Find the slot owned by the current thread, optionally claiming one if it doesn't own one. If every slot in
+ * the table is owned by another thread, the current thread gets an overflow slot instead.
+ *
+ * @param[in] claim Claim a free slot if the current thread doesn't own one.
+ * @param[out] slot Slot owned by the current thread, or NULL if it doesn't own one and claim is false.
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_NO_MEMORY Unable to allocate an overflow slot.
+ */
+static ebpf_result_t
+_ebpf_state_get_thread_slot(bool claim, _Outptr_result_maybenull_ ebpf_state_thread_slot_t** slot)
+{
+    uint64_t current_thread_id = ebpf_get_current_thread_id();
+    void* owner = (void*)(uintptr_t)current_thread_id;
+    uint32_t start = _ebpf_state_thread_slot_hash(current_thread_id);
+    uint32_t max_probe = (uint32_t)_ebpf_state_thread_slot_max_probe;
+    uint32_t probe;
+    ebpf_state_overflow_slot_t* overflow_slot;
+    ebpf_lock_state_t lock_state;
 
-            return_value = ebpf_hash_table_find(
-                _ebpf_state_thread_table, (const uint8_t*)&current_thread_id, (uint8_t**)&local_entry);
+    // A slot claimed by this thread is never further than the longest probe sequence seen so far.
+    for (probe = 0; probe <= max_probe && probe < EBPF_THREAD_SLOT_COUNT; probe++) {
+        ebpf_state_thread_slot_t* candidate = &_ebpf_state_thread_slots[(start + probe) % EBPF_THREAD_SLOT_COUNT];
+        if (candidate->owner == owner) {
+            *slot = candidate;
+            return EBPF_SUCCESS;
         }
-    } else {
-        uint32_t current_cpu = ebpf_get_current_cpu();
-        if (current_cpu >= _ebpf_state_cpu_table_size) {
-            return EBPF_OPERATION_NOT_SUPPORTED;
+    }
+
+    // This thread added any overflow slot it owns, so it observes the count that includes it.
+    *slot = (_ebpf_state_overflow_slot_count != 0) ? _ebpf_state_find_overflow_slot(owner) : NULL;
+    if (*slot || !claim) {
+        return EBPF_SUCCESS;
+    }
+
+    for (probe = 0; probe < EBPF_THREAD_SLOT_COUNT; probe++) {
+        ebpf_state_thread_slot_t* candidate = &_ebpf_state_thread_slots[(start + probe) % EBPF_THREAD_SLOT_COUNT];
+        if (candidate->owner != NULL ||
+            ebpf_interlocked_compare_exchange_pointer(&candidate->owner, owner, NULL) != NULL) {
+            continue;
         }
-        local_entry = _ebpf_state_cpu_table + current_cpu;
+
+        // Raise the probe bound so that later lookups by this thread find the slot.
+        for (;;) {
+            int32_t old_max_probe = _ebpf_state_thread_slot_max_probe;
+            if ((int32_t)probe <= old_max_probe) {
+                break;
+            }
+            if (ebpf_interlocked_compare_exchange_int32(
+                    &_ebpf_state_thread_slot_max_probe, (int32_t)probe, old_max_probe) == old_max_probe) {
+                break;
+            }
+        }
+
+        candidate->value_count = 0;
+        *slot = candidate;
+        return EBPF_SUCCESS;
     }
-    *entry = local_entry;
+
+    overflow_slot = ebpf_allocate(sizeof(ebpf_state_overflow_slot_t));
+    if (!overflow_slot) {
+        return EBPF_NO_MEMORY;
+    }
+    memset(overflow_slot, 0, sizeof(*overflow_slot));
+    overflow_slot->slot.owner = owner;
+
+    lock_state = ebpf_lock_lock(&_ebpf_state_overflow_lock);
+    ebpf_list_insert_tail(&_ebpf_state_overflow_slots, &overflow_slot->list_entry);
+    _ebpf_state_overflow_slot_count++;
+    ebpf_lock_unlock(&_ebpf_state_overflow_lock, lock_state);
+
+    *slot = &overflow_slot->slot;
     return EBPF_SUCCESS;
 }
 
@@ -127,26 +261,54 @@ ebpf_result_t
 ebpf_state_store(size_t index, uintptr_t value)
 {
     // High frequency call, don't log entry/exit.
-    ebpf_state_entry_t* entry = NULL;
-    ebpf_result_t return_value;
+    if (!ebpf_is_non_preemptible_work_item_supported() || ebpf_is_preemptible()) {
+        ebpf_state_thread_slot_t* slot = NULL;
+        ebpf_result_t return_value = _ebpf_state_get_thread_slot(value != 0, &slot);
+        if (return_value != EBPF_SUCCESS) {
+            return return_value;
+        }
+        if (!slot) {
+            // Storing zero for a thread without state is a no-op.
+            return EBPF_SUCCESS;
+        }
 
-    return_value = _ebpf_state_get_entry(&entry);
-    if (return_value == EBPF_SUCCESS) {
-        entry->state[index] = value;
+        if (slot->entry.state[index] == 0 && value != 0) {
+            slot->value_count++;
+        } else if (slot->entry.state[index] != 0 && value == 0) {
+            slot->value_count--;
+        }
+        slot->entry.state[index] = value;
+        if (slot->value_count == 0) {
+            // All values are zero again, so release the slot for reuse.
+            _ebpf_state_release_thread_slot(slot);
+        }
+    } else {
+        uint32_t current_cpu = ebpf_get_current_cpu();
+        if (current_cpu >= _ebpf_state_cpu_table_size) {
+            return EBPF_OPERATION_NOT_SUPPORTED;
+        }
+        _ebpf_state_cpu_table[current_cpu].state[index] = value;
     }
-    return return_value;
+    return EBPF_SUCCESS;
 }
 
 ebpf_result_t
 ebpf_state_load(size_t index, _Out_ uintptr_t* value)
 {
     // High frequency call, don't log entry/exit.
-    ebpf_state_entry_t* entry = NULL;
-    ebpf_result_t return_value;
-
-    return_value = _ebpf_state_get_entry(&entry);
-    if (return_value == EBPF_SUCCESS) {
-        *value = entry->state[index];
+    if (!ebpf_is_non_preemptible_work_item_supported() || ebpf_is_preemptible()) {
+        ebpf_state_thread_slot_t* slot = NULL;
+        ebpf_result_t return_value = _ebpf_state_get_thread_slot(false, &slot);
+        if (return_value != EBPF_SUCCESS) {
+            return return_value;
+        }
+        *value = slot ? slot->entry.state[index] : 0;
+    } else {
+        uint32_t current_cpu = ebpf_get_current_cpu();
+        if (current_cpu >= _ebpf_state_cpu_table_size) {
+            return EBPF_OPERATION_NOT_SUPPORTED;
+        }
+        *value = _ebpf_state_cpu_table[current_cpu].state[index];
     }
-    return return_value;
+    return EBPF_SUCCESS;
 }
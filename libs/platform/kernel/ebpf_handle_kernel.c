@@ -128,6 +128,35 @@ Done:
     return return_value;
 }
 
+ebpf_result_t
+ebpf_handle_get_instance(ebpf_handle_t handle, _Out_ uintptr_t* instance)
+{
+    ebpf_result_t return_value;
+    NTSTATUS status;
+    FILE_OBJECT* file_object = NULL;
+
+    status = ObReferenceObjectByHandle((HANDLE)handle, 0, NULL, UserMode, &file_object, NULL);
+    if (!NT_SUCCESS(status)) {
+        EBPF_LOG_NTSTATUS_API_FAILURE(EBPF_TRACELOG_KEYWORD_BASE, ObReferenceObjectByHandle, status);
+        return_value = EBPF_INVALID_OBJECT;
+        goto Done;
+    }
+
+    if (file_object->DeviceObject != ebpf_driver_get_device_object()) {
+        return_value = EBPF_INVALID_OBJECT;
+        goto Done;
+    }
+
+    // The file object is what the driver's cleanup callback sees when the last handle to it is closed.
+    *instance = (uintptr_t)file_object;
+    return_value = EBPF_SUCCESS;
+
+Done:
+    if (file_object)
+        ObDereferenceObject(file_object);
+    return return_value;
+}
+
 ebpf_result_t
 ebpf_get_next_handle_by_type(ebpf_handle_t previous_handle, ebpf_object_type_t object_type, ebpf_handle_t* next_handle)
 {
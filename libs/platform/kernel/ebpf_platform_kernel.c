@@ -22,6 +22,14 @@ struct _ebpf_ring_descriptor
 };
 typedef struct _ebpf_ring_descriptor ebpf_ring_descriptor_t;
 
+struct _ebpf_user_mapping
+{
+    MDL* memory_descriptor_list;
+    void* base_address;
+    PEPROCESS process; // Referenced. The mapping can only be removed in this process.
+};
+typedef struct _ebpf_user_mapping ebpf_user_mapping_t;
+
 typedef enum _ebpf_pool_tag
 {
     EBPF_POOL_TAG = 'fpbe'
@@ -275,17 +283,79 @@ ebpf_ring_descriptor_get_base_address(_In_ ebpf_ring_descriptor_t* memory_descri
     return memory_descriptor->base_address;
 }
 
-_Ret_maybenull_ void*
-ebpf_ring_map_readonly_user(_In_ ebpf_ring_descriptor_t* ring)
+static _Ret_maybenull_ ebpf_user_mapping_t*
+_ebpf_map_user(_In_ MDL* memory_descriptor_list, ULONG protection)
 {
+    ebpf_user_mapping_t* mapping = ebpf_allocate(sizeof(ebpf_user_mapping_t));
+    if (!mapping) {
+        return NULL;
+    }
+
     __try {
-        return MmMapLockedPagesSpecifyCache(
-            ring->memory_descriptor_list, UserMode, MmCached, NULL, FALSE, NormalPagePriority | MdlMappingNoWrite);
+        mapping->base_address = MmMapLockedPagesSpecifyCache(
+            memory_descriptor_list,
+            UserMode,
+            MmCached,
+            NULL,
+            FALSE,
+            NormalPagePriority | MdlMappingNoExecute | protection);
     } __except (EXCEPTION_EXECUTE_HANDLER) {
         EBPF_LOG_NTSTATUS_API_FAILURE(EBPF_TRACELOG_KEYWORD_BASE, MmMapLockedPagesSpecifyCache, STATUS_NO_MEMORY);
+        mapping->base_address = NULL;
+    }
+    if (!mapping->base_address) {
+        ebpf_free(mapping);
         return NULL;
     }
+
+    mapping->memory_descriptor_list = memory_descriptor_list;
+    mapping->process = PsGetCurrentProcess();
+    ObReferenceObject(mapping->process);
+    return mapping;
+}
+
+_Ret_maybenull_ ebpf_user_mapping_t*
+ebpf_ring_map_readonly_user(_In_ ebpf_ring_descriptor_t* ring)
+{
+    return _ebpf_map_user(ring->memory_descriptor_list, MdlMappingNoWrite);
+}
+
+_Ret_maybenull_ ebpf_user_mapping_t*
+ebpf_memory_descriptor_map_writable_user(_In_ ebpf_memory_descriptor_t* memory_descriptor)
+{
+    return _ebpf_map_user(&memory_descriptor->memory_descriptor_list, 0);
+}
+
+void*
+ebpf_user_mapping_get_address(_In_ const ebpf_user_mapping_t* mapping)
+{
+    return mapping->base_address;
 }
+
+void
+ebpf_user_mapping_unmap(_Frees_ptr_opt_ ebpf_user_mapping_t* mapping)
+{
+    KAPC_STATE apc_state;
+    bool attached = false;
+
+    if (!mapping) {
+        return;
+    }
+
+    // The last handle to an object can be closed by a process other than the one that mapped it.
+    if (mapping->process != PsGetCurrentProcess()) {
+        KeStackAttachProcess(mapping->process, &apc_state);
+        attached = true;
+    }
+    MmUnmapLockedPages(mapping->base_address, mapping->memory_descriptor_list);
+    if (attached) {
+        KeUnstackDetachProcess(&apc_state);
+    }
+
+    ObDereferenceObject(mapping->process);
+    ebpf_free(mapping);
+}
+
 // There isn't an official API to query this information from kernel.
 // Use NtQuerySystemInformation with struct + header from winternl.h.
 
@@ -373,6 +443,18 @@ _Requires_lock_held_(*lock) _Releases_lock_(*lock) _IRQL_requires_(DISPATCH_LEVE
     KeReleaseSpinLock(lock, state);
 }
 
+_IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_saves_ _IRQL_raises_(DISPATCH_LEVEL) uint8_t
+    ebpf_raise_irql_to_dispatch()
+{
+    return KeRaiseIrqlToDpcLevel();
+}
+
+_IRQL_requires_(DISPATCH_LEVEL) void
+ebpf_lower_irql(_IRQL_restores_ uint8_t old_irql)
+{
+    KeLowerIrql(old_irql);
+}
+
 int32_t
 ebpf_interlocked_increment_int32(_Inout_ volatile int32_t* addend)
 {
@@ -403,6 +485,12 @@ ebpf_interlocked_compare_exchange_int32(_Inout_ volatile int32_t* destination, i
     return InterlockedCompareExchange((long volatile*)destination, exchange, comperand);
 }
 
+int64_t
+ebpf_interlocked_compare_exchange_int64(_Inout_ volatile int64_t* destination, int64_t exchange, int64_t comperand)
+{
+    return InterlockedCompareExchange64(destination, exchange, comperand);
+}
+
 void*
 ebpf_interlocked_compare_exchange_pointer(
     _Inout_ void* volatile* destination, _In_opt_ const void* exchange, _In_opt_ const void* comperand)
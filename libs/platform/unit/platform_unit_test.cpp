@@ -6,6 +6,7 @@
 #include <Windows.h>
 
 #include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <sddl.h>
@@ -126,6 +127,183 @@ TEST_CASE("hash_table_test", "[platform]")
     // Find not found
     REQUIRE(ebpf_hash_table_find(table, key_1.data(), &returned_value) == EBPF_KEY_NOT_FOUND);
 
+    // Delete by value only removes the key while it still maps to that value.
+    uint8_t* replaced_value = nullptr;
+    REQUIRE(ebpf_hash_table_find(table, key_2.data(), &replaced_value) == EBPF_SUCCESS);
+    REQUIRE(
+        ebpf_hash_table_update(table, key_2.data(), data_1.data(), EBPF_HASH_TABLE_OPERATION_REPLACE) == EBPF_SUCCESS);
+    REQUIRE(ebpf_hash_table_find(table, key_2.data(), &returned_value) == EBPF_SUCCESS);
+    if (returned_value != replaced_value) {
+        REQUIRE(ebpf_hash_table_delete_value(table, key_2.data(), replaced_value) == EBPF_KEY_NOT_FOUND);
+    }
+    REQUIRE(ebpf_hash_table_delete_value(table, key_2.data(), returned_value) == EBPF_SUCCESS);
+    REQUIRE(ebpf_hash_table_delete_value(table, key_2.data(), returned_value) == EBPF_KEY_NOT_FOUND);
+
+    ebpf_hash_table_destroy(table);
+}
+
+TEST_CASE("hash_table_resize_test", "[platform]")
+{
+    ebpf_hash_table_t* table = nullptr;
+    const uint32_t key_count = 10000;
+    uint8_t* returned_value = nullptr;
+
+    // Start with a single bucket so the table has to grow.
+    REQUIRE(
+        ebpf_hash_table_create(&table, ebpf_allocate, ebpf_free, sizeof(uint32_t), sizeof(uint64_t), 1, NULL) ==
+        EBPF_SUCCESS);
+
+    for (uint32_t key = 0; key < key_count; key++) {
+        uint64_t value = key;
+        REQUIRE(
+            ebpf_hash_table_update(
+                table,
+                reinterpret_cast<const uint8_t*>(&key),
+                reinterpret_cast<const uint8_t*>(&value),
+                EBPF_HASH_TABLE_OPERATION_INSERT) == EBPF_SUCCESS);
+    }
+    REQUIRE(ebpf_hash_table_key_count(table) == key_count);
+
+    for (uint32_t key = 0; key < key_count; key++) {
+        REQUIRE(ebpf_hash_table_find(table, reinterpret_cast<const uint8_t*>(&key), &returned_value) == EBPF_SUCCESS);
+        REQUIRE(*reinterpret_cast<uint64_t*>(returned_value) == key);
+    }
+
+    // Every key is visited exactly once.
+    std::vector<bool> visited(key_count);
+    uint32_t visited_count = 0;
+    uint32_t next_key;
+    ebpf_result_t result = ebpf_hash_table_next_key(table, nullptr, reinterpret_cast<uint8_t*>(&next_key));
+    while (result == EBPF_SUCCESS) {
+        REQUIRE(next_key < key_count);
+        REQUIRE(!visited[next_key]);
+        visited[next_key] = true;
+        visited_count++;
+        uint32_t previous_key = next_key;
+        result = ebpf_hash_table_next_key(
+            table, reinterpret_cast<const uint8_t*>(&previous_key), reinterpret_cast<uint8_t*>(&next_key));
+    }
+    REQUIRE(result == EBPF_NO_MORE_KEYS);
+    REQUIRE(visited_count == key_count);
+
+    // Remove most keys so the table shrinks.
+    for (uint32_t key = 0; key < key_count; key++) {
+        if (key % 100 != 0) {
+            REQUIRE(ebpf_hash_table_delete(table, reinterpret_cast<const uint8_t*>(&key)) == EBPF_SUCCESS);
+        }
+    }
+    REQUIRE(ebpf_hash_table_key_count(table) == key_count / 100);
+
+    for (uint32_t key = 0; key < key_count; key++) {
+        REQUIRE(
+            ebpf_hash_table_find(table, reinterpret_cast<const uint8_t*>(&key), &returned_value) ==
+            ((key % 100 == 0) ? EBPF_SUCCESS : EBPF_KEY_NOT_FOUND));
+    }
+
+    ebpf_hash_table_destroy(table);
+}
+
+TEST_CASE("hash_table_iterate_during_resize_test", "[platform]")
+{
+    ebpf_hash_table_t* table = nullptr;
+    const uint32_t bucket_count = 64;
+    // One past the grow threshold: the resize has started but only a few buckets have been migrated.
+    const uint32_t key_count = bucket_count * 2 + 2;
+
+    REQUIRE(
+        ebpf_hash_table_create(
+            &table, ebpf_allocate, ebpf_free, sizeof(uint32_t), sizeof(uint64_t), bucket_count, NULL) ==
+        EBPF_SUCCESS);
+
+    for (uint32_t key = 0; key < key_count; key++) {
+        uint64_t value = key;
+        REQUIRE(
+            ebpf_hash_table_update(
+                table,
+                reinterpret_cast<const uint8_t*>(&key),
+                reinterpret_cast<const uint8_t*>(&value),
+                EBPF_HASH_TABLE_OPERATION_INSERT) == EBPF_SUCCESS);
+    }
+
+    // Every key is visited exactly once, whether it has been migrated or not.
+    std::vector<bool> visited(key_count);
+    uint32_t visited_count = 0;
+    uint32_t next_key;
+    ebpf_result_t result = ebpf_hash_table_next_key(table, nullptr, reinterpret_cast<uint8_t*>(&next_key));
+    while (result == EBPF_SUCCESS) {
+        REQUIRE(next_key < key_count);
+        REQUIRE(!visited[next_key]);
+        visited[next_key] = true;
+        visited_count++;
+        uint32_t previous_key = next_key;
+        result = ebpf_hash_table_next_key(
+            table, reinterpret_cast<const uint8_t*>(&previous_key), reinterpret_cast<uint8_t*>(&next_key));
+    }
+    REQUIRE(result == EBPF_NO_MORE_KEYS);
+    REQUIRE(visited_count == key_count);
+
+    ebpf_hash_table_destroy(table);
+}
+
+TEST_CASE("hash_table_cursor_test", "[platform]")
+{
+    ebpf_hash_table_t* table = nullptr;
+    const uint32_t key_count = 1000;
+    ebpf_hash_table_cursor_t cursor = {0};
+    uint8_t* next_key_pointer;
+    uint8_t* next_value;
+
+    REQUIRE(
+        ebpf_hash_table_create(&table, ebpf_allocate, ebpf_free, sizeof(uint32_t), sizeof(uint64_t), 16, NULL) ==
+        EBPF_SUCCESS);
+
+    for (uint32_t key = 0; key < key_count; key++) {
+        uint64_t value = key;
+        REQUIRE(
+            ebpf_hash_table_update(
+                table,
+                reinterpret_cast<const uint8_t*>(&key),
+                reinterpret_cast<const uint8_t*>(&value),
+                EBPF_HASH_TABLE_OPERATION_INSERT) == EBPF_SUCCESS);
+    }
+
+    // Every key is visited exactly once.
+    std::vector<bool> visited(key_count);
+    uint32_t visited_count = 0;
+    uint32_t previous_key;
+    ebpf_result_t result =
+        ebpf_hash_table_next_key_with_cursor(table, &cursor, nullptr, &next_key_pointer, &next_value);
+    while (result == EBPF_SUCCESS) {
+        previous_key = *reinterpret_cast<uint32_t*>(next_key_pointer);
+        REQUIRE(previous_key < key_count);
+        REQUIRE(*reinterpret_cast<uint64_t*>(next_value) == previous_key);
+        REQUIRE(!visited[previous_key]);
+        visited[previous_key] = true;
+        visited_count++;
+        result = ebpf_hash_table_next_key_with_cursor(
+            table, &cursor, reinterpret_cast<const uint8_t*>(&previous_key), &next_key_pointer, &next_value);
+    }
+    REQUIRE(result == EBPF_NO_MORE_KEYS);
+    REQUIRE(visited_count == key_count);
+
+    // Deleting the previous key before advancing doesn't end the iteration early.
+    std::fill(visited.begin(), visited.end(), false);
+    visited_count = 0;
+    cursor = {0};
+    result = ebpf_hash_table_next_key_with_cursor(table, &cursor, nullptr, &next_key_pointer, nullptr);
+    while (result == EBPF_SUCCESS) {
+        previous_key = *reinterpret_cast<uint32_t*>(next_key_pointer);
+        REQUIRE(!visited[previous_key]);
+        visited[previous_key] = true;
+        visited_count++;
+        REQUIRE(ebpf_hash_table_delete(table, reinterpret_cast<const uint8_t*>(&previous_key)) == EBPF_SUCCESS);
+        result = ebpf_hash_table_next_key_with_cursor(
+            table, &cursor, reinterpret_cast<const uint8_t*>(&previous_key), &next_key_pointer, nullptr);
+    }
+    REQUIRE(result == EBPF_NO_MORE_KEYS);
+    REQUIRE(visited_count == key_count);
+    REQUIRE(ebpf_hash_table_key_count(table) == 0);
+
     ebpf_hash_table_destroy(table);
 }
 
@@ -285,6 +463,177 @@ TEST_CASE("epoch_test_two_threads", "[platform]")
     thread_2.join();
 }
 
+typedef struct _epoch_test_work_item_context
+{
+    ebpf_epoch_work_item_t* work_item;
+    uint32_t run_count;
+} epoch_test_work_item_context_t;
+
+static void
+_epoch_test_work_item_callback(void* context)
+{
+    epoch_test_work_item_context_t* work_item_context = reinterpret_cast<epoch_test_work_item_context_t*>(context);
+    work_item_context->run_count++;
+    ebpf_free(work_item_context->work_item);
+}
+
+TEST_CASE("epoch_test_nested_epoch", "[platform]")
+{
+    epoch_test_work_item_context_t context = {};
+    {
+        _test_helper test_helper;
+
+        context.work_item = ebpf_epoch_allocate_work_item(&context, _epoch_test_work_item_callback);
+        REQUIRE(context.work_item != nullptr);
+
+        REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+        REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+        ebpf_epoch_schedule_work_item(context.work_item);
+        ebpf_epoch_exit();
+
+        // The outer epoch is still active, so the work item must not run.
+        ebpf_epoch_flush();
+        ebpf_epoch_exit();
+        REQUIRE(context.run_count == 0);
+    }
+    // Terminating the epoch module runs all pending work items.
+    REQUIRE(context.run_count == 1);
+}
+
+TEST_CASE("epoch_test_thread_slot_overflow", "[platform]")
+{
+    epoch_test_work_item_context_t context = {};
+    {
+        _test_helper test_helper;
+        // More threads than there are epoch thread slots.
+        const size_t thread_count = 600;
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable condition;
+        size_t entered_count = 0;
+        size_t failed_count = 0;
+        bool release = false;
+
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([&]() {
+                ebpf_result_t result = ebpf_epoch_enter();
+                std::unique_lock<std::mutex> lock(mutex);
+                entered_count++;
+                if (result != EBPF_SUCCESS) {
+                    failed_count++;
+                }
+                condition.notify_all();
+                condition.wait(lock, [&]() { return release; });
+                lock.unlock();
+                ebpf_epoch_exit();
+            });
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return entered_count == thread_count; });
+        }
+
+        // Every slot is taken, so this enter overflows and must still hold back the work item.
+        context.work_item = ebpf_epoch_allocate_work_item(&context, _epoch_test_work_item_callback);
+        REQUIRE(context.work_item != nullptr);
+        REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+        ebpf_epoch_schedule_work_item(context.work_item);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            release = true;
+            condition.notify_all();
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(failed_count == 0);
+
+        ebpf_epoch_flush();
+        REQUIRE(context.run_count == 0);
+        ebpf_epoch_exit();
+
+        ebpf_epoch_flush();
+        REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+        ebpf_epoch_exit();
+        REQUIRE(context.run_count == 1);
+    }
+}
+
+TEST_CASE("epoch_test_many_generations", "[platform]")
+{
+    _test_helper test_helper;
+    uintptr_t old_affinity_mask;
+    const size_t work_item_count = 64;
+    std::vector<epoch_test_work_item_context_t> contexts(work_item_count);
+
+    // Stay on one CPU so all work items land in the same free list.
+    REQUIRE(ebpf_set_current_thread_affinity(1, &old_affinity_mask) == EBPF_SUCCESS);
+
+    // Free one work item per epoch, which is more epochs than a free list tracks separately.
+    REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+    for (auto& context : contexts) {
+        context.work_item = ebpf_epoch_allocate_work_item(&context, _epoch_test_work_item_callback);
+        REQUIRE(context.work_item != nullptr);
+        ebpf_epoch_schedule_work_item(context.work_item);
+        ebpf_epoch_flush();
+    }
+    ebpf_epoch_exit();
+    for (auto& context : contexts) {
+        REQUIRE(context.run_count == 0);
+    }
+
+    // Once no epoch is active, every generation is released.
+    ebpf_epoch_flush();
+    REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+    ebpf_epoch_exit();
+    for (auto& context : contexts) {
+        REQUIRE(context.run_count == 1);
+    }
+
+    ebpf_restore_current_thread_affinity(old_affinity_mask);
+}
+
+TEST_CASE("epoch_test_cache", "[platform]")
+{
+    _test_helper test_helper;
+    uintptr_t old_affinity_mask;
+    uint64_t hit_count;
+    uint64_t miss_count;
+
+    // Stay on one CPU so the released block lands in the cache the next allocation uses.
+    REQUIRE(ebpf_set_current_thread_affinity(1, &old_affinity_mask) == EBPF_SUCCESS);
+
+    REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+    uint8_t* memory = reinterpret_cast<uint8_t*>(ebpf_epoch_allocate(10));
+    REQUIRE(memory != nullptr);
+    memset(memory, 0xAA, 10);
+    ebpf_epoch_free(memory);
+    ebpf_epoch_exit();
+    ebpf_epoch_flush();
+
+    // Reap the free list, returning the block to this CPU's cache.
+    REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+    ebpf_epoch_exit();
+    ebpf_epoch_get_cache_statistics(&hit_count, &miss_count);
+
+    REQUIRE(ebpf_epoch_enter() == EBPF_SUCCESS);
+    uint8_t* reused = reinterpret_cast<uint8_t*>(ebpf_epoch_allocate(10));
+    REQUIRE(reused == memory);
+    for (size_t i = 0; i < 10; i++) {
+        REQUIRE(reused[i] == 0);
+    }
+    ebpf_epoch_free(reused);
+    ebpf_epoch_exit();
+
+    uint64_t new_hit_count;
+    uint64_t new_miss_count;
+    ebpf_epoch_get_cache_statistics(&new_hit_count, &new_miss_count);
+    REQUIRE(new_hit_count == hit_count + 1);
+    REQUIRE(new_miss_count == miss_count);
+
+    ebpf_restore_current_thread_affinity(old_affinity_mask);
+}
+
 TEST_CASE("extension_test", "[platform]")
 {
     _test_helper test_helper;
@@ -669,6 +1018,59 @@ TEST_CASE("state_test", "[state]")
     REQUIRE(ebpf_state_store(allocated_index_1, reinterpret_cast<uintptr_t>(&foo)) == EBPF_SUCCESS);
     REQUIRE(ebpf_state_load(allocated_index_1, &retreived_value) == EBPF_SUCCESS);
     REQUIRE(retreived_value == reinterpret_cast<uintptr_t>(&foo));
+
+    // State is per-thread.
+    uintptr_t other_thread_value = 1;
+    std::thread([&]() { ebpf_state_load(allocated_index_1, &other_thread_value); }).join();
+    REQUIRE(other_thread_value == 0);
+
+    // Clearing the only value releases the thread's slot, after which loads return zero.
+    REQUIRE(ebpf_state_store(allocated_index_1, 0) == EBPF_SUCCESS);
+    REQUIRE(ebpf_state_load(allocated_index_1, &retreived_value) == EBPF_SUCCESS);
+    REQUIRE(retreived_value == 0);
+    REQUIRE(ebpf_state_load(allocated_index_2, &retreived_value) == EBPF_SUCCESS);
+    REQUIRE(retreived_value == 0);
+    ebpf_state_terminate();
+}
+
+TEST_CASE("state_test_thread_slot_overflow", "[state]")
+{
+    size_t allocated_index = 0;
+    // More threads than there are state thread slots.
+    const size_t thread_count = 600;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t stored_count = 0;
+    size_t failed_count = 0;
+
+    REQUIRE(ebpf_state_initiate() == EBPF_SUCCESS);
+    REQUIRE(ebpf_state_allocate_index(&allocated_index) == EBPF_SUCCESS);
+
+    // Every thread holds a value until all of them have stored one, so the last threads overflow the table.
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&, i]() {
+            uintptr_t value = 0;
+            bool succeeded = ebpf_state_store(allocated_index, i + 1) == EBPF_SUCCESS;
+            std::unique_lock<std::mutex> lock(mutex);
+            stored_count++;
+            condition.notify_all();
+            condition.wait(lock, [&]() { return stored_count == thread_count; });
+            lock.unlock();
+
+            succeeded = succeeded && ebpf_state_load(allocated_index, &value) == EBPF_SUCCESS && value == i + 1;
+            succeeded = succeeded && ebpf_state_store(allocated_index, 0) == EBPF_SUCCESS;
+            if (!succeeded) {
+                lock.lock();
+                failed_count++;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(failed_count == 0);
+
     ebpf_state_terminate();
 }
 
@@ -775,11 +1177,12 @@ TEST_CASE("ring_buffer", "[platform]")
     ebpf_ring_buffer_t* ring_buffer;
 
     uint8_t* buffer;
+    size_t* published_consumer_offset;
     std::vector<uint8_t> data(10);
     size_t size = 64 * 1024;
 
     REQUIRE(ebpf_ring_buffer_create(&ring_buffer, size) == EBPF_SUCCESS);
-    REQUIRE(ebpf_ring_buffer_map_buffer(ring_buffer, &buffer) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_user(ring_buffer, 1, &buffer, &published_consumer_offset) == EBPF_SUCCESS);
 
     ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
 
@@ -795,6 +1198,10 @@ TEST_CASE("ring_buffer", "[platform]")
     REQUIRE(producer == data.size() + EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
     REQUIRE(consumer == 0);
 
+    // The producer offset is also copied to the consumer page.
+    auto consumer_page = reinterpret_cast<ebpf_ring_buffer_consumer_page_t*>(published_consumer_offset);
+    REQUIRE(consumer_page->producer_offset == producer);
+
     auto record = ebpf_ring_buffer_next_record(buffer, size, consumer, producer);
     REQUIRE(record != nullptr);
     REQUIRE(record->header.length == data.size() + EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
@@ -808,6 +1215,16 @@ TEST_CASE("ring_buffer", "[platform]")
     REQUIRE(producer == data.size() + EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
     REQUIRE(consumer == data.size() + EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
 
+    // The oldest record stays locked until it is submitted.
+    uint8_t* reserved;
+    REQUIRE(!ebpf_ring_buffer_is_oldest_record_locked(ring_buffer));
+    REQUIRE(ebpf_ring_buffer_reserve(ring_buffer, &reserved, data.size()) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_is_oldest_record_locked(ring_buffer));
+    REQUIRE(ebpf_ring_buffer_submit(reserved) == EBPF_SUCCESS);
+    REQUIRE(!ebpf_ring_buffer_is_oldest_record_locked(ring_buffer));
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(ebpf_ring_buffer_return(ring_buffer, producer - consumer) == EBPF_SUCCESS);
+
     data.resize(1023);
     while (ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS) {
     }
@@ -819,6 +1236,321 @@ TEST_CASE("ring_buffer", "[platform]")
     // Fill ring
     REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
 
+    // Closing an instance removes only its own mappings; destroying the ring removes the rest.
+    REQUIRE(ebpf_ring_buffer_map_user(ring_buffer, 2, &buffer, &published_consumer_offset) == EBPF_SUCCESS);
+    ebpf_ring_buffer_close_instance(ring_buffer, 1);
+    ebpf_ring_buffer_close_instance(ring_buffer, 1);
+
+    ebpf_ring_buffer_destroy(ring_buffer);
+    ring_buffer = nullptr;
+}
+
+TEST_CASE("ring_buffer_memory_double_mapped", "[platform]")
+{
+    _test_helper test_helper;
+    size_t size = 64 * 1024;
+
+    ebpf_ring_descriptor_t* descriptor = ebpf_allocate_ring_buffer_memory(size);
+    REQUIRE(descriptor != nullptr);
+    uint8_t* base = reinterpret_cast<uint8_t*>(ebpf_ring_descriptor_get_base_address(descriptor));
+    REQUIRE(base != nullptr);
+
+    // Writes through either view are visible through the other.
+    for (size_t offset = 0; offset < size; offset += 4096) {
+        base[offset] = static_cast<uint8_t>(offset / 4096);
+        REQUIRE(base[size + offset] == static_cast<uint8_t>(offset / 4096));
+        base[size + offset + 1] = 0x5a;
+        REQUIRE(base[offset + 1] == 0x5a);
+    }
+
+    ebpf_free_ring_buffer_memory(descriptor);
+}
+
+TEST_CASE("ring_buffer_wrapped_record_contiguous", "[platform]")
+{
+    _test_helper test_helper;
+    size_t consumer;
+    size_t producer;
+    ebpf_ring_buffer_t* ring_buffer;
+    uint8_t* buffer;
+    size_t* published_consumer_offset;
+    size_t size = 64 * 1024;
+    size_t header_size = EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data);
+
+    REQUIRE(ebpf_ring_buffer_create(&ring_buffer, size) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_user(ring_buffer, 1, &buffer, &published_consumer_offset) == EBPF_SUCCESS);
+
+    // Move the producer to 100 bytes before the end of the ring.
+    std::vector<uint8_t> data(size - 100 - header_size);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_return(ring_buffer, size - 100) == EBPF_SUCCESS);
+
+    // Write a record that runs past the end of the ring.
+    data.resize(1000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+
+    // The consumer sees the whole record at one address, without reassembling it from the two ends of the ring.
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == size - 100);
+    auto record = ebpf_ring_buffer_next_record(buffer, size, consumer, producer);
+    REQUIRE(record != nullptr);
+    REQUIRE(reinterpret_cast<const uint8_t*>(record) == buffer + size - 100);
+    REQUIRE(record->header.length == header_size + data.size());
+    REQUIRE(memcmp(record->data, data.data(), data.size()) == 0);
+
+    REQUIRE(ebpf_ring_buffer_return(ring_buffer, record->header.length) == EBPF_SUCCESS);
+
+    ebpf_ring_buffer_destroy(ring_buffer);
+    ring_buffer = nullptr;
+}
+
+TEST_CASE("ring_buffer_published_consumer_offset", "[platform]")
+{
+    _test_helper test_helper;
+    size_t consumer;
+    size_t producer;
+    ebpf_ring_buffer_t* ring_buffer;
+    uint8_t* buffer;
+    size_t* published_consumer_offset;
+    std::vector<uint8_t> data(1024 - EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
+    size_t size = 64 * 1024;
+
+    REQUIRE(ebpf_ring_buffer_create(&ring_buffer, size) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_user(ring_buffer, 1, &buffer, &published_consumer_offset) == EBPF_SUCCESS);
+
+    // Fill the ring.
+    while (ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS) {
+    }
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 0);
+
+    // An offset that isn't on a record boundary is ignored.
+    *published_consumer_offset = 10;
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_OUT_OF_SPACE);
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 0);
+
+    // As is an offset past the producer.
+    *published_consumer_offset = producer + 1024;
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_OUT_OF_SPACE);
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 0);
+
+    // Publishing a valid offset returns the space without calling ebpf_ring_buffer_return. The producer only picks
+    // it up once it runs out of space.
+    *published_consumer_offset = 2 * 1024;
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 0);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 2 * 1024);
+
+    // Returning through ebpf_ring_buffer_return still works, and stale published offsets are ignored.
+    REQUIRE(ebpf_ring_buffer_return(ring_buffer, 1024) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_OUT_OF_SPACE);
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 3 * 1024);
+
+    ebpf_ring_buffer_destroy(ring_buffer);
+    ring_buffer = nullptr;
+}
+
+TEST_CASE("ring_buffer_overwrite", "[platform]")
+{
+    _test_helper test_helper;
+    size_t consumer;
+    size_t producer;
+    ebpf_ring_buffer_t* ring_buffer;
+    std::vector<uint8_t> data(1024 - EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data));
+    size_t size = 64 * 1024;
+
+    REQUIRE(ebpf_ring_buffer_create_with_flags(&ring_buffer, size, 0x80000000) == EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_ring_buffer_create_with_flags(&ring_buffer, size, EBPF_RING_BUFFER_FLAG_OVERWRITE) == EBPF_SUCCESS);
+
+    // Fill the ring, tagging each record with its sequence number. A record can never fill the ring completely, so
+    // the last slot is left empty.
+    uint32_t sequence = 0;
+    for (; sequence < size / 1024 - 1; sequence++) {
+        *(uint32_t*)data.data() = sequence;
+        REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+    }
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 0);
+
+    // Writing to the full ring drops the oldest records instead of failing.
+    for (uint32_t i = 0; i < 3; i++, sequence++) {
+        *(uint32_t*)data.data() = sequence;
+        REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+    }
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == 3 * 1024);
+    REQUIRE(producer - consumer == size - 1024);
+
+    // Freezing stops the overwriting, so new records are dropped and the contents stay readable.
+    size_t frozen_consumer;
+    size_t frozen_producer;
+    REQUIRE(ebpf_ring_buffer_freeze(ring_buffer, 1, &frozen_consumer, &frozen_producer) == EBPF_SUCCESS);
+    REQUIRE(frozen_consumer == consumer);
+    REQUIRE(frozen_producer == producer);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_OUT_OF_SPACE);
+
+    std::vector<uint8_t> snapshot(frozen_producer - frozen_consumer);
+    REQUIRE(ebpf_ring_buffer_read(ring_buffer, frozen_consumer, snapshot.data(), snapshot.size()) == EBPF_SUCCESS);
+    for (size_t offset = 0; offset < snapshot.size(); offset += 1024) {
+        auto record = reinterpret_cast<const ebpf_ring_buffer_record_t*>(snapshot.data() + offset);
+        REQUIRE(record->header.length == 1024);
+        REQUIRE(*(const uint32_t*)record->data == 3 + offset / 1024);
+    }
+
+    // Reads outside the records in the ring fail.
+    REQUIRE(ebpf_ring_buffer_read(ring_buffer, frozen_consumer - 1, snapshot.data(), 1) == EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_ring_buffer_read(ring_buffer, frozen_producer, snapshot.data(), 1) == EBPF_INVALID_ARGUMENT);
+
+    // A freeze can only be thawed by the instance that made it.
+    REQUIRE(ebpf_ring_buffer_thaw(ring_buffer, 2) == EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_OUT_OF_SPACE);
+
+    // Closing the instance thaws the freezes it left behind.
+    size_t refrozen_consumer;
+    size_t refrozen_producer;
+    REQUIRE(ebpf_ring_buffer_freeze(ring_buffer, 1, &refrozen_consumer, &refrozen_producer) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_thaw(ring_buffer, 1) == EBPF_SUCCESS);
+    ebpf_ring_buffer_close_instance(ring_buffer, 1);
+    REQUIRE(ebpf_ring_buffer_thaw(ring_buffer, 1) == EBPF_INVALID_ARGUMENT);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == frozen_consumer + 1024);
+    REQUIRE(ebpf_ring_buffer_read(ring_buffer, frozen_consumer, snapshot.data(), 1) == EBPF_INVALID_ARGUMENT);
+
+    // A record that is still reserved is never dropped.
+    uint8_t* reserved;
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(ebpf_ring_buffer_return(ring_buffer, producer - consumer) == EBPF_SUCCESS);
+    size_t reserved_offset = producer;
+    REQUIRE(ebpf_ring_buffer_reserve(ring_buffer, &reserved, data.size()) == EBPF_SUCCESS);
+    while (ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS) {
+        ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+        REQUIRE(producer - consumer < size);
+    }
+    ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+    REQUIRE(consumer == reserved_offset);
+    REQUIRE(ebpf_ring_buffer_submit(reserved) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+
+    ebpf_ring_buffer_destroy(ring_buffer);
+    ring_buffer = nullptr;
+}
+
+TEST_CASE("ring_buffer_multiple_producers", "[platform]")
+{
+    _test_helper test_helper;
+    ebpf_ring_buffer_t* ring_buffer;
+    uint8_t* buffer;
+    size_t* published_consumer_offset;
+    size_t size = 64 * 1024;
+    const uint32_t producer_count = 4;
+    const uint32_t records_per_producer = 10000;
+
+    REQUIRE(ebpf_ring_buffer_create(&ring_buffer, size) == EBPF_SUCCESS);
+    REQUIRE(ebpf_ring_buffer_map_user(ring_buffer, 1, &buffer, &published_consumer_offset) == EBPF_SUCCESS);
+
+    // Each record holds the producer index and a per-producer sequence number.
+    std::vector<std::thread> producers;
+    for (uint32_t producer_index = 0; producer_index < producer_count; producer_index++) {
+        producers.emplace_back([&, producer_index]() {
+            for (uint32_t sequence = 0; sequence < records_per_producer; sequence++) {
+                uint32_t data[2] = {producer_index, sequence};
+                if (sequence % 2) {
+                    while (ebpf_ring_buffer_output(ring_buffer, reinterpret_cast<uint8_t*>(data), sizeof(data)) !=
+                           EBPF_SUCCESS) {
+                        std::this_thread::yield();
+                    }
+                } else {
+                    uint8_t* record;
+                    while (ebpf_ring_buffer_reserve(ring_buffer, &record, sizeof(data)) != EBPF_SUCCESS) {
+                        std::this_thread::yield();
+                    }
+                    memcpy(record, data, sizeof(data));
+                    ebpf_ring_buffer_submit(record);
+                }
+            }
+        });
+    }
+
+    // Consume records in order, checking that each producer's records arrive in sequence.
+    std::vector<uint32_t> next_sequence(producer_count);
+    uint32_t received = 0;
+    while (received < producer_count * records_per_producer) {
+        size_t consumer;
+        size_t producer;
+        size_t length = 0;
+        ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+        for (;;) {
+            auto record = ebpf_ring_buffer_next_record(buffer, size, consumer + length, producer);
+            if (record == nullptr || record->header.locked) {
+                break;
+            }
+            MemoryBarrier();
+            REQUIRE(record->header.length == EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data) + 2 * sizeof(uint32_t));
+            uint32_t data[2];
+            memcpy(data, record->data, sizeof(data));
+            REQUIRE(data[0] < producer_count);
+            REQUIRE(data[1] == next_sequence[data[0]]);
+            next_sequence[data[0]]++;
+            received++;
+            length += record->header.length;
+        }
+        if (length != 0) {
+            REQUIRE(ebpf_ring_buffer_return(ring_buffer, length) == EBPF_SUCCESS);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto& thread : producers) {
+        thread.join();
+    }
+
+    ebpf_ring_buffer_destroy(ring_buffer);
+    ring_buffer = nullptr;
+}
+
+TEST_CASE("ring_buffer_return_validation", "[platform]")
+{
+    _test_helper test_helper;
+
+    ebpf_ring_buffer_t* ring_buffer;
+    size_t consumer;
+    size_t producer;
+    size_t size = 64 * 1024;
+    std::vector<uint8_t> data(40);
+    size_t record_length = EBPF_OFFSET_OF(ebpf_ring_buffer_record_t, data) + data.size();
+
+    REQUIRE(ebpf_ring_buffer_create(&ring_buffer, size) == EBPF_SUCCESS);
+
+    // Run enough laps that records straddle the end of the ring.
+    for (size_t lap = 0; lap < 3 * size / record_length; lap++) {
+        REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+        REQUIRE(ebpf_ring_buffer_output(ring_buffer, data.data(), data.size()) == EBPF_SUCCESS);
+
+        // Anything that doesn't end on a record boundary is rejected.
+        for (size_t length = 1; length < 2 * record_length; length++) {
+            if (length != record_length) {
+                REQUIRE(ebpf_ring_buffer_return(ring_buffer, length) == EBPF_INVALID_ARGUMENT);
+            }
+        }
+        REQUIRE(ebpf_ring_buffer_return(ring_buffer, 2 * record_length + 1) == EBPF_INVALID_ARGUMENT);
+
+        REQUIRE(ebpf_ring_buffer_return(ring_buffer, record_length) == EBPF_SUCCESS);
+        REQUIRE(ebpf_ring_buffer_return(ring_buffer, record_length) == EBPF_SUCCESS);
+        ebpf_ring_buffer_query(ring_buffer, &consumer, &producer);
+        REQUIRE(consumer == producer);
+    }
+
     ebpf_ring_buffer_destroy(ring_buffer);
     ring_buffer = nullptr;
 }
@@ -72,16 +72,19 @@ ebpf_handle_close(ebpf_handle_t handle)
 {
     // High volume call - Skip entry/exit logging.
     ebpf_lock_state_t state;
-    ebpf_result_t return_value;
+    ebpf_object_t* object;
     state = ebpf_lock_lock(&_ebpf_handle_table_lock);
-    if (_ebpf_handle_table[handle] != NULL) {
-        ebpf_object_release_reference(_ebpf_handle_table[handle]);
-        _ebpf_handle_table[handle] = NULL;
-        return_value = EBPF_SUCCESS;
-    } else
-        return_value = EBPF_INVALID_OBJECT;
+    object = _ebpf_handle_table[handle];
+    _ebpf_handle_table[handle] = NULL;
     ebpf_lock_unlock(&_ebpf_handle_table_lock, state);
-    return return_value;
+
+    if (object == NULL)
+        return EBPF_INVALID_OBJECT;
+
+    // Each handle is its own instance. The object releases its state for the handle before losing the reference.
+    ebpf_object_close_instance(object, (uintptr_t)handle);
+    ebpf_object_release_reference(object);
+    return EBPF_SUCCESS;
 }
 
 ebpf_result_t
@@ -108,6 +111,25 @@ ebpf_reference_object_by_handle(ebpf_handle_t handle, ebpf_object_type_t object_
     return return_value;
 }
 
+ebpf_result_t
+ebpf_handle_get_instance(ebpf_handle_t handle, _Out_ uintptr_t* instance)
+{
+    ebpf_result_t return_value;
+    ebpf_lock_state_t state;
+
+    if (handle >= EBPF_COUNT_OF(_ebpf_handle_table))
+        return EBPF_INVALID_OBJECT;
+
+    state = ebpf_lock_lock(&_ebpf_handle_table_lock);
+    if (_ebpf_handle_table[handle] != NULL) {
+        *instance = (uintptr_t)handle;
+        return_value = EBPF_SUCCESS;
+    } else
+        return_value = EBPF_INVALID_OBJECT;
+    ebpf_lock_unlock(&_ebpf_handle_table_lock, state);
+    return return_value;
+}
+
 ebpf_result_t
 ebpf_get_next_handle_by_type(ebpf_handle_t previous_handle, ebpf_object_type_t object_type, ebpf_handle_t* next_handle)
 {
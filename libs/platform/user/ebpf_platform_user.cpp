@@ -287,11 +287,47 @@ ebpf_ring_descriptor_get_base_address(_In_ ebpf_ring_descriptor_t* ring_descript
     return ring_descriptor->primary_view;
 }
 
-_Ret_maybenull_ void*
+struct _ebpf_user_mapping
+{
+    void* base_address;
+};
+
+static _Ret_maybenull_ ebpf_user_mapping_t*
+_ebpf_map_user(_In_ void* base_address)
+{
+    // User mode shares one address space, so the mapping is the existing view.
+    ebpf_user_mapping_t* mapping = (ebpf_user_mapping_t*)ebpf_allocate(sizeof(ebpf_user_mapping_t));
+    if (mapping) {
+        mapping->base_address = base_address;
+    }
+    return mapping;
+}
+
+_Ret_maybenull_ ebpf_user_mapping_t*
 ebpf_ring_map_readonly_user(_In_ ebpf_ring_descriptor_t* ring)
 {
     EBPF_LOG_ENTRY();
-    EBPF_RETURN_POINTER(void*, ebpf_ring_descriptor_get_base_address(ring));
+    EBPF_RETURN_POINTER(ebpf_user_mapping_t*, _ebpf_map_user(ebpf_ring_descriptor_get_base_address(ring)));
+}
+
+_Ret_maybenull_ ebpf_user_mapping_t*
+ebpf_memory_descriptor_map_writable_user(_In_ ebpf_memory_descriptor_t* memory_descriptor)
+{
+    EBPF_LOG_ENTRY();
+    EBPF_RETURN_POINTER(
+        ebpf_user_mapping_t*, _ebpf_map_user(ebpf_memory_descriptor_get_base_address(memory_descriptor)));
+}
+
+void*
+ebpf_user_mapping_get_address(_In_ const ebpf_user_mapping_t* mapping)
+{
+    return mapping->base_address;
+}
+
+void
+ebpf_user_mapping_unmap(_Frees_ptr_opt_ ebpf_user_mapping_t* mapping)
+{
+    ebpf_free(mapping);
 }
 
 ebpf_result_t
@@ -375,6 +411,18 @@ _Requires_lock_held_(*lock) _Releases_lock_(*lock) _IRQL_requires_(DISPATCH_LEVE
     ReleaseSRWLockExclusive(reinterpret_cast<PSRWLOCK>(lock));
 }
 
+_IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_saves_ _IRQL_raises_(DISPATCH_LEVEL) uint8_t
+    ebpf_raise_irql_to_dispatch()
+{
+    return 0;
+}
+
+_IRQL_requires_(DISPATCH_LEVEL) void
+ebpf_lower_irql(_IRQL_restores_ uint8_t old_irql)
+{
+    UNREFERENCED_PARAMETER(old_irql);
+}
+
 int32_t
 ebpf_interlocked_increment_int32(_Inout_ volatile int32_t* addend)
 {
@@ -405,6 +453,12 @@ ebpf_interlocked_compare_exchange_int32(_Inout_ volatile int32_t* destination, i
     return InterlockedCompareExchange((long volatile*)destination, exchange, comperand);
 }
 
+int64_t
+ebpf_interlocked_compare_exchange_int64(_Inout_ volatile int64_t* destination, int64_t exchange, int64_t comperand)
+{
+    return InterlockedCompareExchange64(destination, exchange, comperand);
+}
+
 void*
 ebpf_interlocked_compare_exchange_pointer(
     _Inout_ void* volatile* destination, _In_opt_ const void* exchange, _In_opt_ const void* comperand)
@@ -86,7 +86,7 @@ net_ebpf_ext_bind_register_providers()
         goto Exit;
 
     status = net_ebpf_extension_hook_provider_register(
-        &_ebpf_bind_hook_provider_characteristics, EXECUTION_PASSIVE, &_ebpf_bind_hook_provider_context);
+        &_ebpf_bind_hook_provider_characteristics, EXECUTION_PASSIVE, NULL, &_ebpf_bind_hook_provider_context);
     if (status != EBPF_SUCCESS) {
         goto Exit;
     }
@@ -134,22 +134,17 @@ net_ebpf_ext_resource_allocation_classify(
     SOCKADDR_IN addr = {AF_INET};
     uint32_t result;
     bind_md_t ctx;
-    net_ebpf_extension_hook_client_t* attached_client = NULL;
+    const net_ebpf_extension_hook_dispatch_table_t* dispatch_table;
 
     UNREFERENCED_PARAMETER(layer_data);
     UNREFERENCED_PARAMETER(classify_context);
     UNREFERENCED_PARAMETER(filter);
     UNREFERENCED_PARAMETER(flow_context);
 
-    attached_client = net_ebpf_extension_get_attached_client(_ebpf_bind_hook_provider_context);
-    if (attached_client == NULL)
+    dispatch_table = net_ebpf_extension_hook_enter_rundown(_ebpf_bind_hook_provider_context);
+    if (dispatch_table == NULL)
         goto Exit;
 
-    if (!net_ebpf_extension_attach_enter_rundown(attached_client, EXECUTION_PASSIVE)) {
-        classify_output->actionType = FWP_ACTION_PERMIT;
-        goto Exit;
-    }
-
     addr.sin_port =
         incoming_fixed_values->incomingValue[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_IP_LOCAL_PORT].value.uint16;
     addr.sin_addr.S_un.S_addr =
@@ -167,7 +162,9 @@ net_ebpf_ext_resource_allocation_classify(
         incoming_fixed_values->incomingValue[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_ALE_APP_ID].value.byteBlob->size;
 
     _net_ebpf_ext_resource_truncate_appid(&ctx);
-    if (net_ebpf_extension_hook_invoke_program(attached_client, &ctx, &result) == EBPF_SUCCESS) {
+    // Attached programs run in attach order until one returns a verdict other than BIND_PERMIT.
+    if (net_ebpf_extension_hook_invoke_programs(
+            _ebpf_bind_hook_provider_context, dispatch_table, &ctx, BIND_PERMIT, &result) == EBPF_SUCCESS) {
         switch (result) {
         case BIND_PERMIT:
         case BIND_REDIRECT:
@@ -179,8 +176,7 @@ net_ebpf_ext_resource_allocation_classify(
     }
 
 Exit:
-    if (attached_client)
-        net_ebpf_extension_attach_leave_rundown(attached_client, EXECUTION_PASSIVE);
+    net_ebpf_extension_hook_leave_rundown(_ebpf_bind_hook_provider_context);
     return;
 }
 
@@ -197,22 +193,17 @@ net_ebpf_ext_resource_release_classify(
     SOCKADDR_IN addr = {AF_INET};
     uint32_t result;
     bind_md_t ctx;
-    net_ebpf_extension_hook_client_t* attached_client = NULL;
+    const net_ebpf_extension_hook_dispatch_table_t* dispatch_table;
 
     UNREFERENCED_PARAMETER(layer_data);
     UNREFERENCED_PARAMETER(classify_context);
     UNREFERENCED_PARAMETER(filter);
     UNREFERENCED_PARAMETER(flow_context);
 
-    attached_client = net_ebpf_extension_get_attached_client(_ebpf_bind_hook_provider_context);
-    if (attached_client == NULL)
+    dispatch_table = net_ebpf_extension_hook_enter_rundown(_ebpf_bind_hook_provider_context);
+    if (dispatch_table == NULL)
         goto Exit;
 
-    if (!net_ebpf_extension_attach_enter_rundown(attached_client, EXECUTION_PASSIVE)) {
-        classify_output->actionType = FWP_ACTION_PERMIT;
-        goto Exit;
-    }
-
     addr.sin_port = incoming_fixed_values->incomingValue[FWPS_FIELD_ALE_RESOURCE_RELEASE_V4_IP_LOCAL_PORT].value.uint16;
     addr.sin_addr.S_un.S_addr =
         incoming_fixed_values->incomingValue[FWPS_FIELD_ALE_RESOURCE_RELEASE_V4_IP_LOCAL_ADDRESS].value.uint32;
@@ -230,12 +221,12 @@ net_ebpf_ext_resource_release_classify(
 
     _net_ebpf_ext_resource_truncate_appid(&ctx);
 
-    net_ebpf_extension_hook_invoke_program(attached_client, &ctx, &result);
+    net_ebpf_extension_hook_invoke_programs(
+        _ebpf_bind_hook_provider_context, dispatch_table, &ctx, BIND_PERMIT, &result);
 
     classify_output->actionType = FWP_ACTION_PERMIT;
 
 Exit:
-    if (attached_client)
-        net_ebpf_extension_attach_leave_rundown(attached_client, EXECUTION_PASSIVE);
+    net_ebpf_extension_hook_leave_rundown(_ebpf_bind_hook_provider_context);
     return;
 }
\ No newline at end of file
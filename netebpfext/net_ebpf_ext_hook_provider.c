@@ -4,14 +4,13 @@
 #include "net_ebpf_ext_hook_provider.h"
 
 /**
- *  @brief This is the only function in the eBPF hook NPI client dispatch table.
+ *  @brief This is the first function in the eBPF hook NPI client dispatch table.
  */
 typedef ebpf_result_t (*ebpf_invoke_program_function_t)(
     _In_ const void* client_binding_context, _In_ const void* context, _Out_ uint32_t* result);
 
-typedef struct _net_ebpf_ext_hook_client_rundown
+typedef struct _net_ebpf_ext_hook_rundown
 {
-    bool rundown_occurred;
     struct
     {
         KDPC rundown_dpc;
@@ -21,28 +20,59 @@ typedef struct _net_ebpf_ext_hook_client_rundown
     {
         EX_PUSH_LOCK lock;
     } passive;
-} net_ebpf_ext_hook_client_rundown_t;
+} net_ebpf_ext_hook_rundown_t;
 
 struct _net_ebpf_extension_hook_provider;
 
 typedef struct _net_ebpf_extension_hook_client
 {
+    LIST_ENTRY link;
     HANDLE nmr_binding_handle;
     GUID client_module_id;
     const void* client_binding_context;
     const ebpf_extension_data_t* client_data;
     ebpf_invoke_program_function_t invoke_program;
     struct _net_ebpf_extension_hook_provider* provider_context;
-    net_ebpf_extension_hook_execution_t execution_type;
     PIO_WORKITEM detach_work_item;
-    net_ebpf_ext_hook_client_rundown_t rundown;
 } net_ebpf_extension_hook_client_t;
 
+/**
+ *  @brief Entry point of one attached program, copied out of its hook client.
+ */
+typedef struct _net_ebpf_extension_hook_dispatch_entry
+{
+    ebpf_invoke_program_function_t invoke_program;
+    const void* client_binding_context;
+    const ebpf_extension_data_t* client_data;
+} net_ebpf_extension_hook_dispatch_entry_t;
+
+/**
+ *  @brief Immutable array of the attached programs' entry points, in attach order. A new table
+ *         is published on every attach and detach, so invocation never walks the client list.
+ */
+struct _net_ebpf_extension_hook_dispatch_table
+{
+    uint32_t capacity;
+    uint32_t count;
+    net_ebpf_extension_hook_dispatch_entry_t entries[1];
+};
+
 typedef struct _net_ebpf_extension_hook_provider
 {
     HANDLE nmr_provider_handle;
     net_ebpf_extension_hook_execution_t execution_type;
-    net_ebpf_extension_hook_client_t* attached_client;
+    net_ebpf_extension_hook_client_filter_t client_filter;
+    // Serializes changes to attached_clients and publication of dispatch_table.
+    FAST_MUTEX attach_lock;
+    // Attached clients, in attach order.
+    LIST_ENTRY attached_clients;
+    uint32_t attached_client_count;
+    // Published dispatch table, or NULL if no client is attached. Written with release semantics and read once
+    // per invocation with acquire semantics, under rundown protection.
+    net_ebpf_extension_hook_dispatch_table_t* volatile dispatch_table;
+    // Previously published table, kept so that a detach can always publish without allocating.
+    net_ebpf_extension_hook_dispatch_table_t* spare_dispatch_table;
+    net_ebpf_ext_hook_rundown_t rundown;
 } net_ebpf_extension_hook_provider_t;
 
 static _Function_class_(KDEFERRED_ROUTINE) _IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_requires_min_(DISPATCH_LEVEL)
@@ -52,7 +82,7 @@ static _Function_class_(KDEFERRED_ROUTINE) _IRQL_requires_max_(DISPATCH_LEVEL) _
         _In_opt_ void* system_argument_1,
         _In_opt_ void* system_argument_2)
 {
-    net_ebpf_ext_hook_client_rundown_t* rundown = (net_ebpf_ext_hook_client_rundown_t*)deferred_context;
+    net_ebpf_ext_hook_rundown_t* rundown = (net_ebpf_ext_hook_rundown_t*)deferred_context;
 
     UNREFERENCED_PARAMETER(dpc);
     UNREFERENCED_PARAMETER(system_argument_1);
@@ -62,60 +92,52 @@ static _Function_class_(KDEFERRED_ROUTINE) _IRQL_requires_max_(DISPATCH_LEVEL) _
 }
 
 /**
- * @brief Initialize the hook client rundown state.
- *
- * @param[in, out] hook_client Pointer to the attached hook NPI client.
+ * @brief Initialize the hook provider rundown state.
  *
- * @retval STATUS_SUCCESS Operation succeeded.
- * @retval STATUS_INSUFFICIENT_RESOURCES IO work item could not be allocated.
+ * @param[in, out] provider_context Pointer to the hook NPI provider.
  */
-static NTSTATUS
-_ebpf_ext_attach_init_rundown(net_ebpf_extension_hook_client_t* hook_client)
+static void
+_ebpf_ext_attach_init_rundown(_Inout_ net_ebpf_extension_hook_provider_t* provider_context)
 {
-    NTSTATUS status = STATUS_SUCCESS;
-    net_ebpf_ext_hook_client_rundown_t* rundown = &hook_client->rundown;
-    net_ebpf_extension_hook_execution_t execution_type = hook_client->execution_type;
-
-    //
-    // Allocate work item for client detach processing.
-    //
-    hook_client->detach_work_item = IoAllocateWorkItem(_net_ebpf_ext_driver_device_object);
-    if (hook_client->detach_work_item == NULL) {
-        status = STATUS_INSUFFICIENT_RESOURCES;
-        goto Exit;
-    }
+    net_ebpf_ext_hook_rundown_t* rundown = &provider_context->rundown;
 
-    if (execution_type == EXECUTION_PASSIVE) {
+    if (provider_context->execution_type == EXECUTION_PASSIVE) {
         ExInitializePushLock(&rundown->passive.lock);
     } else {
         KeInitializeEvent(&(rundown->dispatch.rundown_wait), SynchronizationEvent, FALSE);
         KeInitializeDpc(&(rundown->dispatch.rundown_dpc), _ebpf_ext_attach_rundown, rundown);
     }
-    rundown->rundown_occurred = FALSE;
-
-Exit:
-    return status;
 }
 
 /**
- * @brief Block execution of the thread until all invocations are completed.
+ * @brief Publish a new dispatch table and block execution of the thread until all
+ * invocations that could still be using the old table are completed.
  *
- * @param[in, out] rundown Rundown object to wait for.
- * @param[in]  execution_type Execution type for the hook (passive or dispatch).
+ * @param[in, out] provider_context Pointer to the hook NPI provider.
+ * @param[in] dispatch_table Dispatch table to publish, or NULL if no client is attached.
  *
+ * @returns The previously published dispatch table, which is no longer in use.
  */
-static void
-_ebpf_ext_attach_wait_for_rundown(
-    _Inout_ net_ebpf_ext_hook_client_rundown_t* rundown, net_ebpf_extension_hook_execution_t execution_type)
+static _Requires_lock_held_(&provider_context->attach_lock) net_ebpf_extension_hook_dispatch_table_t*
+    _ebpf_ext_attach_publish_and_wait_for_rundown(
+        _Inout_ net_ebpf_extension_hook_provider_t* provider_context,
+        _In_opt_ net_ebpf_extension_hook_dispatch_table_t* dispatch_table)
 {
-    rundown->rundown_occurred = TRUE;
-    if (execution_type == EXECUTION_PASSIVE) {
+    net_ebpf_ext_hook_rundown_t* rundown = &provider_context->rundown;
+    net_ebpf_extension_hook_dispatch_table_t* old_dispatch_table = provider_context->dispatch_table;
+
+    if (provider_context->execution_type == EXECUTION_PASSIVE) {
+        // Invocations hold the lock shared for as long as they use the table.
         ExAcquirePushLockExclusive(&rundown->passive.lock);
+        WritePointerRelease((void* volatile*)&provider_context->dispatch_table, dispatch_table);
         ExReleasePushLockExclusive(&rundown->passive.lock);
     } else {
+        // The release store makes the table's entries visible before the pointer to it.
+        WritePointerRelease((void* volatile*)&provider_context->dispatch_table, dispatch_table);
+
         // Queue a DPC to each CPU and wait for it to run.
         // After it has run on each CPU we can be sure that no
-        // DPC is busy processing a hook.
+        // DPC is busy processing a hook with the old table.
         uint32_t maximum_processor = KeQueryMaximumProcessorCount();
         uint32_t processor;
         for (processor = 0; processor < maximum_processor; processor++) {
@@ -125,6 +147,68 @@ _ebpf_ext_attach_wait_for_rundown(
             }
         }
     }
+
+    return old_dispatch_table;
+}
+
+/**
+ * @brief Build and publish the dispatch table for the clients currently attached.
+ *
+ * A detach never needs to allocate: the spare table is the previously published one, and it
+ * held at least as many entries as remain after any single detach.
+ *
+ * @param[in, out] provider_context Pointer to the hook NPI provider.
+ *
+ * @retval STATUS_SUCCESS Operation succeeded.
+ * @retval STATUS_NO_MEMORY Failed to allocate the dispatch table.
+ */
+static _Requires_lock_held_(&provider_context->attach_lock) NTSTATUS
+    _ebpf_ext_attach_publish_clients(_Inout_ net_ebpf_extension_hook_provider_t* provider_context)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    uint32_t count = provider_context->attached_client_count;
+    net_ebpf_extension_hook_dispatch_table_t* dispatch_table = NULL;
+
+    if (count > 0) {
+        dispatch_table = provider_context->spare_dispatch_table;
+        if ((dispatch_table == NULL) || (dispatch_table->capacity < count)) {
+            dispatch_table = (net_ebpf_extension_hook_dispatch_table_t*)ExAllocatePoolUninitialized(
+                NonPagedPoolNx,
+                FIELD_OFFSET(net_ebpf_extension_hook_dispatch_table_t, entries[count]),
+                NET_EBPF_EXTENSION_POOL_TAG);
+            if (dispatch_table == NULL) {
+                status = STATUS_NO_MEMORY;
+                goto Exit;
+            }
+            dispatch_table->capacity = count;
+            if (provider_context->spare_dispatch_table != NULL)
+                ExFreePool(provider_context->spare_dispatch_table);
+        }
+        provider_context->spare_dispatch_table = NULL;
+
+        uint32_t index = 0;
+        for (LIST_ENTRY* entry = provider_context->attached_clients.Flink; entry != &provider_context->attached_clients;
+             entry = entry->Flink) {
+            net_ebpf_extension_hook_client_t* hook_client =
+                CONTAINING_RECORD(entry, net_ebpf_extension_hook_client_t, link);
+            dispatch_table->entries[index].invoke_program = hook_client->invoke_program;
+            dispatch_table->entries[index].client_binding_context = hook_client->client_binding_context;
+            dispatch_table->entries[index].client_data = hook_client->client_data;
+            index++;
+        }
+        ASSERT(index == count);
+        dispatch_table->count = count;
+    }
+
+    net_ebpf_extension_hook_dispatch_table_t* old_dispatch_table =
+        _ebpf_ext_attach_publish_and_wait_for_rundown(provider_context, dispatch_table);
+
+    if (provider_context->spare_dispatch_table != NULL)
+        ExFreePool(provider_context->spare_dispatch_table);
+    provider_context->spare_dispatch_table = old_dispatch_table;
+
+Exit:
+    return status;
 }
 
 IO_WORKITEM_ROUTINE _net_ebpf_extension_detach_client_completion;
@@ -141,6 +225,8 @@ void
 _net_ebpf_extension_detach_client_completion(_In_ PDEVICE_OBJECT device_object, _In_opt_ void* context)
 {
     net_ebpf_extension_hook_client_t* hook_client = (net_ebpf_extension_hook_client_t*)context;
+    net_ebpf_extension_hook_provider_t* provider_context;
+    NTSTATUS status;
 
     PAGED_CODE();
 
@@ -149,8 +235,16 @@ _net_ebpf_extension_detach_client_completion(_In_ PDEVICE_OBJECT device_object,
     ASSERT(hook_client != NULL);
     _Analysis_assume_(hook_client != NULL);
 
-    // Wait for any in progress callbacks to complete.
-    _ebpf_ext_attach_wait_for_rundown(&hook_client->rundown, hook_client->execution_type);
+    provider_context = hook_client->provider_context;
+
+    // Publish a dispatch table without this client and wait for any in progress callbacks to complete.
+    ExAcquireFastMutex(&provider_context->attach_lock);
+    RemoveEntryList(&hook_client->link);
+    provider_context->attached_client_count--;
+    status = _ebpf_ext_attach_publish_clients(provider_context);
+    ASSERT(NT_SUCCESS(status));
+    UNREFERENCED_PARAMETER(status);
+    ExReleaseFastMutex(&provider_context->attach_lock);
 
     NmrProviderDetachClientComplete(hook_client->nmr_binding_handle);
 
@@ -158,41 +252,79 @@ _net_ebpf_extension_detach_client_completion(_In_ PDEVICE_OBJECT device_object,
     ExFreePool(hook_client);
 }
 
-_Acquires_lock_(hook_client) bool net_ebpf_extension_attach_enter_rundown(
-    _Inout_ net_ebpf_extension_hook_client_t* hook_client, net_ebpf_extension_hook_execution_t execution_type)
+_Acquires_lock_(provider_context) _Ret_maybenull_ const net_ebpf_extension_hook_dispatch_table_t*
+    net_ebpf_extension_hook_enter_rundown(_Inout_ net_ebpf_extension_hook_provider_t* provider_context)
 {
-    net_ebpf_ext_hook_client_rundown_t* rundown = &hook_client->rundown;
-    if (execution_type == EXECUTION_PASSIVE) {
+    net_ebpf_ext_hook_rundown_t* rundown = &provider_context->rundown;
+    if (provider_context->execution_type == EXECUTION_PASSIVE) {
         ExAcquirePushLockShared(&rundown->passive.lock);
     }
 
-    return (rundown->rundown_occurred == FALSE);
+    // Pairs with the release store in _ebpf_ext_attach_publish_and_wait_for_rundown.
+    return (const net_ebpf_extension_hook_dispatch_table_t*)ReadPointerAcquire(
+        (void* const volatile*)&provider_context->dispatch_table);
 }
 
-_Releases_lock_(hook_client) void net_ebpf_extension_attach_leave_rundown(
-    _Inout_ net_ebpf_extension_hook_client_t* hook_client, net_ebpf_extension_hook_execution_t execution_type)
+_Releases_lock_(provider_context) void net_ebpf_extension_hook_leave_rundown(
+    _Inout_ net_ebpf_extension_hook_provider_t* provider_context)
 {
-    net_ebpf_ext_hook_client_rundown_t* rundown = &hook_client->rundown;
-    if (execution_type == EXECUTION_PASSIVE) {
+    net_ebpf_ext_hook_rundown_t* rundown = &provider_context->rundown;
+    if (provider_context->execution_type == EXECUTION_PASSIVE) {
         _Analysis_assume_lock_held_(&rundown->passive.lock);
         ExReleasePushLockShared(&rundown->passive.lock);
     }
 }
 
-const ebpf_extension_data_t*
-net_ebpf_extension_get_client_data(_In_ const net_ebpf_extension_hook_client_t* hook_client)
+bool
+net_ebpf_extension_hook_check_attached_clients(
+    _In_ const net_ebpf_extension_hook_provider_t* provider_context,
+    _In_opt_ const net_ebpf_extension_hook_dispatch_table_t* dispatch_table,
+    _In_ const void* program_context)
 {
-    return hook_client->client_data;
+    net_ebpf_extension_hook_client_filter_t client_filter = provider_context->client_filter;
+
+    if (dispatch_table == NULL)
+        return false;
+
+    if (client_filter == NULL)
+        return true;
+
+    for (uint32_t index = 0; index < dispatch_table->count; index++) {
+        if (client_filter(dispatch_table->entries[index].client_data, program_context))
+            return true;
+    }
+    return false;
 }
 
 ebpf_result_t
-net_ebpf_extension_hook_invoke_program(
-    _In_ const net_ebpf_extension_hook_client_t* client, _In_ void* context, _Out_ uint32_t* result)
+net_ebpf_extension_hook_invoke_programs(
+    _In_ const net_ebpf_extension_hook_provider_t* provider_context,
+    _In_opt_ const net_ebpf_extension_hook_dispatch_table_t* dispatch_table,
+    _In_ void* program_context,
+    uint32_t pass_result,
+    _Out_ uint32_t* result)
 {
-    ebpf_invoke_program_function_t invoke_program = client->invoke_program;
-    const void* client_binding_context = client->client_binding_context;
+    ebpf_result_t return_value = EBPF_SUCCESS;
+    net_ebpf_extension_hook_client_filter_t client_filter = provider_context->client_filter;
+
+    *result = pass_result;
+
+    if (dispatch_table == NULL)
+        goto Exit;
+
+    for (uint32_t index = 0; index < dispatch_table->count; index++) {
+        const net_ebpf_extension_hook_dispatch_entry_t* entry = &dispatch_table->entries[index];
 
-    return invoke_program(client_binding_context, context, result);
+        if ((client_filter != NULL) && !client_filter(entry->client_data, program_context))
+            continue;
+
+        return_value = entry->invoke_program(entry->client_binding_context, program_context, result);
+        if ((return_value != EBPF_SUCCESS) || (*result != pass_result))
+            break;
+    }
+
+Exit:
+    return return_value;
 }
 
 NTSTATUS
@@ -237,20 +369,38 @@ net_ebpf_extension_hook_provider_attach_client(
     }
     hook_client->invoke_program = (ebpf_invoke_program_function_t)client_dispatch_table->function[0];
     hook_client->provider_context = local_provider_context;
-    hook_client->execution_type = local_provider_context->execution_type;
-    // The following line can cause a leak if the provider has already an attached client.
-    // This will be fixed as part of issue #754.
-    local_provider_context->attached_client = hook_client;
 
-    status = _ebpf_ext_attach_init_rundown(hook_client);
+    //
+    // Allocate work item for client detach processing.
+    //
+    hook_client->detach_work_item = IoAllocateWorkItem(_net_ebpf_ext_driver_device_object);
+    if (hook_client->detach_work_item == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    // Programs run in attach order, so a new client goes to the end of the list.
+    ExAcquireFastMutex(&local_provider_context->attach_lock);
+    InsertTailList(&local_provider_context->attached_clients, &hook_client->link);
+    local_provider_context->attached_client_count++;
+    status = _ebpf_ext_attach_publish_clients(local_provider_context);
+    if (!NT_SUCCESS(status)) {
+        RemoveEntryList(&hook_client->link);
+        local_provider_context->attached_client_count--;
+    }
+    ExReleaseFastMutex(&local_provider_context->attach_lock);
+
 Exit:
 
     if (NT_SUCCESS(status)) {
         *provider_binding_context = hook_client;
         hook_client = NULL;
     } else {
-        if (hook_client)
+        if (hook_client) {
+            if (hook_client->detach_work_item)
+                IoFreeWorkItem(hook_client->detach_work_item);
             ExFreePool(hook_client);
+        }
     }
 
     return status;
@@ -263,16 +413,13 @@ net_ebpf_extension_hook_provider_detach_client(_In_ void* provider_binding_conte
 
     net_ebpf_extension_hook_client_t* local_client_context =
         (net_ebpf_extension_hook_client_t*)provider_binding_context;
-    net_ebpf_extension_hook_provider_t* provider_context = NULL;
 
     if (local_client_context == NULL) {
         status = STATUS_INVALID_PARAMETER;
         goto Exit;
     }
 
-    provider_context = local_client_context->provider_context;
-    provider_context->attached_client = NULL;
-
+    // The client is removed from the dispatch table by the work item, which then completes the detach.
     IoQueueWorkItem(
         local_client_context->detach_work_item,
         _net_ebpf_extension_detach_client_completion,
@@ -291,6 +438,9 @@ net_ebpf_extension_hook_provider_unregister(_Frees_ptr_opt_ net_ebpf_extension_h
         if (status == STATUS_PENDING)
             // Wait for clients to detach.
             NmrWaitForProviderDeregisterComplete(provider_context->nmr_provider_handle);
+        ASSERT(provider_context->dispatch_table == NULL);
+        if (provider_context->spare_dispatch_table != NULL)
+            ExFreePool(provider_context->spare_dispatch_table);
         ExFreePool(provider_context);
     }
 }
@@ -299,6 +449,7 @@ NTSTATUS
 net_ebpf_extension_hook_provider_register(
     _In_ const NPI_PROVIDER_CHARACTERISTICS* provider_characteristics,
     net_ebpf_extension_hook_execution_t execution_type,
+    _In_opt_ net_ebpf_extension_hook_client_filter_t client_filter,
     _Outptr_ net_ebpf_extension_hook_provider_t** provider_context)
 {
     NTSTATUS status = STATUS_SUCCESS;
@@ -313,6 +464,10 @@ net_ebpf_extension_hook_provider_register(
     memset(local_provider_context, 0, sizeof(net_ebpf_extension_hook_provider_t));
 
     local_provider_context->execution_type = execution_type;
+    local_provider_context->client_filter = client_filter;
+    ExInitializeFastMutex(&local_provider_context->attach_lock);
+    InitializeListHead(&local_provider_context->attached_clients);
+    _ebpf_ext_attach_init_rundown(local_provider_context);
     status = NmrRegisterProvider(
         provider_characteristics, local_provider_context, &local_provider_context->nmr_provider_handle);
     if (!NT_SUCCESS(status))
@@ -327,9 +482,3 @@ Exit:
 
     return status;
 }
-
-net_ebpf_extension_hook_client_t*
-net_ebpf_extension_get_attached_client(_In_ const net_ebpf_extension_hook_provider_t* provider_context)
-{
-    return provider_context->attached_client;
-}
\ No newline at end of file
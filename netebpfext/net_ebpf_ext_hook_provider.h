@@ -18,41 +18,28 @@ typedef enum _net_ebpf_extension_hook_execution
 typedef struct _net_ebpf_extension_hook_client net_ebpf_extension_hook_client_t;
 
 /**
- * @brief Attempt to acquire rundown.
+ * @brief Optional per-hook callback that decides whether an attached client's program
+ * should run for a given program context.
  *
- * @param[in, out] hook_client Pointer to attached hook NPI client.
- * @param[in] execution_type Execution type for the hook (passive or dispatch).
- *
- * @retval true The caller should proceed.
- * @retval false Rundown has occurred.
- */
-_Acquires_lock_(hook_client) bool net_ebpf_extension_attach_enter_rundown(
-    _Inout_ net_ebpf_extension_hook_client_t* hook_client, net_ebpf_extension_hook_execution_t execution_type);
-
-/**
- * @brief Release rundown.
+ * @param[in] client_data Hook-specific data supplied by the client when it attached.
+ * @param[in] program_context Context that would be passed to the eBPF program.
  *
- * @param[in, out] hook_client Pointer to attached hook NPI client.
- * @param[in] execution_type Execution type for the hook (passive or dispatch).
-
+ * @retval true Run the client's program.
+ * @retval false Skip the client's program.
  */
-_Releases_lock_(hook_client) void net_ebpf_extension_attach_leave_rundown(
-    _Inout_ net_ebpf_extension_hook_client_t* hook_client, net_ebpf_extension_hook_execution_t execution_type);
+typedef bool (*net_ebpf_extension_hook_client_filter_t)(
+    _In_opt_ const ebpf_extension_data_t* client_data, _In_ const void* program_context);
 
 /**
- * @brief Get the hook-specific data for a given client registration.
- *
- * @param[in] hook_client Pointer to attached hook NPI client.
- *
- * @returns Hook-specific client data.
+ *  @brief This is the provider context of eBPF Hook NPI provider.
  */
-const ebpf_extension_data_t*
-net_ebpf_extension_get_client_data(_In_ const net_ebpf_extension_hook_client_t* hook_client);
+typedef struct _net_ebpf_extension_hook_provider net_ebpf_extension_hook_provider_t;
 
 /**
- *  @brief This is the provider context of eBPF Hook NPI provider.
+ *  @brief Published array of the programs attached to a hook, returned by
+ *         net_ebpf_extension_hook_enter_rundown.
  */
-typedef struct _net_ebpf_extension_hook_provider net_ebpf_extension_hook_provider_t;
+typedef struct _net_ebpf_extension_hook_dispatch_table net_ebpf_extension_hook_dispatch_table_t;
 
 /**
  * @brief Unregister the hook NPI provider.
@@ -67,6 +54,7 @@ net_ebpf_extension_hook_provider_unregister(_Frees_ptr_opt_ net_ebpf_extension_h
  *
  * @param[in] provider_characteristics Pointer to the NPI provider characteristics struct.
  * @param[in] execution_type Execution type for the hook (passive or dispatch).
+ * @param[in] client_filter Optional callback that selects which attached programs run for a given context.
  * @param[in,out] provider_context Pointer to the provider context being registered.
  *
  * @retval STATUS_SUCCESS Operation succeeded.
@@ -76,6 +64,7 @@ NTSTATUS
 net_ebpf_extension_hook_provider_register(
     _In_ const NPI_PROVIDER_CHARACTERISTICS* provider_characteristics,
     net_ebpf_extension_hook_execution_t execution_type,
+    _In_opt_ net_ebpf_extension_hook_client_filter_t client_filter,
     _Outptr_ net_ebpf_extension_hook_provider_t** provider_context);
 
 /**
@@ -115,26 +104,64 @@ NTSTATUS
 net_ebpf_extension_hook_provider_detach_client(_In_ void* provider_binding_context);
 
 /**
- * @brief Invoke the eBPF program attached to this hook. This must be called
- * inside a net_ebpf_extension_attach_enter_rundown/net_ebpf_extension_attach_leave_rundown block.
+ * @brief Enter rundown protection for the programs attached to this hook and read the published
+ * dispatch table. Every call must be paired with net_ebpf_extension_hook_leave_rundown, whatever it
+ * returns. The table stays valid until then and is what the caller passes to the functions below.
  *
- * @param[in] client Pointer to Hook NPI Client (a.k.a. eBPF Link object).
- * @param[in] context Context to pass to eBPF program.
- * @param[out] result Return value from the eBPF program.
- * @retval EBPF_SUCCESS The operation was successful.
- * @retval EBPF_NO_MEMORY Unable to allocate resources for this
- * operation.
+ * @param[in, out] provider_context Hook NPI provider.
+ *
+ * @returns The dispatch table of the attached programs, or NULL if no program is attached.
  */
-ebpf_result_t
-net_ebpf_extension_hook_invoke_program(
-    _In_ const net_ebpf_extension_hook_client_t* client, _In_ void* context, _Out_ uint32_t* result);
+_Acquires_lock_(provider_context) _Ret_maybenull_ const net_ebpf_extension_hook_dispatch_table_t*
+    net_ebpf_extension_hook_enter_rundown(_Inout_ net_ebpf_extension_hook_provider_t* provider_context);
 
 /**
- * @brief Return client attached to the hook NPI provider.
- * @param[in] provider_context Provider module's context.
- * @returns Attached client.
- * (Note: this is a temporary helper routine that will be re-written when multiple attached clients are supported as fix
- * to #754)
+ * @brief Leave rundown protection entered by net_ebpf_extension_hook_enter_rundown.
+ *
+ * @param[in, out] provider_context Hook NPI provider.
+ */
+_Releases_lock_(provider_context) void net_ebpf_extension_hook_leave_rundown(
+    _Inout_ net_ebpf_extension_hook_provider_t* provider_context);
+
+/**
+ * @brief Check whether the client filter accepts at least one attached program for this context.
+ * Hooks use this to skip preparing a context that no program would see. This must be called
+ * inside a net_ebpf_extension_hook_enter_rundown/net_ebpf_extension_hook_leave_rundown block.
+ *
+ * @param[in] provider_context Hook NPI provider.
+ * @param[in] dispatch_table Dispatch table returned by net_ebpf_extension_hook_enter_rundown.
+ * @param[in] program_context Context to pass to the eBPF programs.
+ *
+ * @retval true At least one attached program would run.
+ * @retval false No attached program would run.
  */
-net_ebpf_extension_hook_client_t*
-net_ebpf_extension_get_attached_client(_In_ const net_ebpf_extension_hook_provider_t* provider_context);
\ No newline at end of file
+bool
+net_ebpf_extension_hook_check_attached_clients(
+    _In_ const net_ebpf_extension_hook_provider_t* provider_context,
+    _In_opt_ const net_ebpf_extension_hook_dispatch_table_t* dispatch_table,
+    _In_ const void* program_context);
+
+/**
+ * @brief Invoke the eBPF programs attached to this hook. This must be called inside a
+ * net_ebpf_extension_hook_enter_rundown/net_ebpf_extension_hook_leave_rundown block.
+ *
+ * Programs run in the order they were attached, skipping those rejected by the hook's client filter.
+ * Each program sees the context as left by the previous one. The chain stops at the first program
+ * that returns something other than pass_result, and that value becomes the result. If every program
+ * passes, or none runs, the result is pass_result.
+ *
+ * @param[in] provider_context Hook NPI provider.
+ * @param[in] dispatch_table Dispatch table returned by net_ebpf_extension_hook_enter_rundown.
+ * @param[in] program_context Context to pass to the eBPF programs.
+ * @param[in] pass_result Program result that lets the next attached program run.
+ * @param[out] result Combined result of the programs.
+ * @retval EBPF_SUCCESS The operation was successful.
+ * @retval EBPF_FAILED A program could not be invoked; the programs before it have run.
+ */
+ebpf_result_t
+net_ebpf_extension_hook_invoke_programs(
+    _In_ const net_ebpf_extension_hook_provider_t* provider_context,
+    _In_opt_ const net_ebpf_extension_hook_dispatch_table_t* dispatch_table,
+    _In_ void* program_context,
+    uint32_t pass_result,
+    _Out_ uint32_t* result);
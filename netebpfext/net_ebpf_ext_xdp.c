@@ -75,6 +75,30 @@ const NPI_PROVIDER_CHARACTERISTICS _ebpf_xdp_hook_provider_characteristics = {
 
 static net_ebpf_extension_hook_provider_t* _ebpf_xdp_hook_provider_context = NULL;
 
+/**
+ * @brief Run an attached XDP program only for the ingress interface it attached to, if any.
+ *
+ * @param[in] client_data Interface index the link was attached to, or NULL for all interfaces.
+ * @param[in] program_context Pointer to the net_ebpf_xdp_md_t of the packet.
+ *
+ * @retval true Run the program for this packet.
+ * @retval false Skip the program.
+ */
+static bool
+_net_ebpf_ext_xdp_filter_client(_In_opt_ const ebpf_extension_data_t* client_data, _In_ const void* program_context)
+{
+    const net_ebpf_xdp_md_t* net_xdp_ctx = (const net_ebpf_xdp_md_t*)program_context;
+
+    if ((client_data != NULL) && (client_data->data != NULL)) {
+        uint32_t client_ifindex = *(const uint32_t*)client_data->data;
+        if (client_ifindex != 0 && client_ifindex != net_xdp_ctx->ingress_ifindex) {
+            // The client is not interested in this ingress ifindex.
+            return false;
+        }
+    }
+    return true;
+}
+
 //
 // NMR Registration Helper Routines.
 //
@@ -91,7 +115,10 @@ net_ebpf_ext_xdp_register_providers()
         goto Exit;
 
     status = net_ebpf_extension_hook_provider_register(
-        &_ebpf_xdp_hook_provider_characteristics, EXECUTION_DISPATCH, &_ebpf_xdp_hook_provider_context);
+        &_ebpf_xdp_hook_provider_characteristics,
+        EXECUTION_DISPATCH,
+        _net_ebpf_ext_xdp_filter_client,
+        &_ebpf_xdp_hook_provider_context);
     if (status != EBPF_SUCCESS) {
         goto Exit;
     }
@@ -386,18 +413,16 @@ net_ebpf_ext_layer_2_classify(
     uint8_t* packet_buffer;
     uint32_t result = 0;
     net_ebpf_xdp_md_t net_xdp_ctx = {0};
-    net_ebpf_extension_hook_client_t* attached_client = NULL;
+    const net_ebpf_extension_hook_dispatch_table_t* dispatch_table;
 
     UNREFERENCED_PARAMETER(incoming_metadata_values);
     UNREFERENCED_PARAMETER(classify_context);
     UNREFERENCED_PARAMETER(filter);
     UNREFERENCED_PARAMETER(flow_context);
 
-    attached_client = net_ebpf_extension_get_attached_client(_ebpf_xdp_hook_provider_context);
-    if (attached_client == NULL)
-        goto Done;
-
-    if (!net_ebpf_extension_attach_enter_rundown(attached_client, EXECUTION_DISPATCH))
+    // The dispatch table is read once, with acquire semantics, and used for the whole classify.
+    dispatch_table = net_ebpf_extension_hook_enter_rundown(_ebpf_xdp_hook_provider_context);
+    if (dispatch_table == NULL)
         goto Done;
 
     //
@@ -420,20 +445,9 @@ net_ebpf_ext_layer_2_classify(
     net_xdp_ctx.ingress_ifindex =
         incoming_fixed_values->incomingValue[FWPS_FIELD_INBOUND_MAC_FRAME_NATIVE_INTERFACE_INDEX].value.uint32;
 
-    // TODO(issue #754): Support multiple clients and iterate through them.
-    // Also, the net_ebpf_extension_get_client_data() function is used because currently
-    // the structure is opaque except inside ebpf_ext_attach_provider.c.  However,
-    // this results in a slightly longer cycle count in the hot path to get to
-    // the client data here.   In the future, the client data field should be
-    // exposed in the .h file for us to access here.
-    const ebpf_extension_data_t* client_data = net_ebpf_extension_get_client_data(attached_client);
-    if ((client_data != NULL) && (client_data->data != NULL)) {
-        uint32_t client_ifindex = *(const uint32_t*)client_data->data;
-        if (client_ifindex != 0 && client_ifindex != net_xdp_ctx.ingress_ifindex) {
-            // The client is not interested in this ingress ifindex.
-            goto Done;
-        }
-    }
+    // Don't prepare (and possibly clone) the packet if no attached program is interested in this ingress ifindex.
+    if (!net_ebpf_extension_hook_check_attached_clients(_ebpf_xdp_hook_provider_context, dispatch_table, &net_xdp_ctx))
+        goto Done;
 
     net_xdp_ctx.original_nbl = nbl;
 
@@ -456,7 +470,9 @@ net_ebpf_ext_layer_2_classify(
         net_xdp_ctx.data_end = packet_buffer + net_buffer->DataLength;
     }
 
-    if (net_ebpf_extension_hook_invoke_program(attached_client, &net_xdp_ctx, &result) == EBPF_SUCCESS) {
+    // Attached programs run in attach order until one returns a verdict other than XDP_PASS.
+    if (net_ebpf_extension_hook_invoke_programs(
+            _ebpf_xdp_hook_provider_context, dispatch_table, &net_xdp_ctx, XDP_PASS, &result) == EBPF_SUCCESS) {
         switch (result) {
         case XDP_PASS:
             if (net_xdp_ctx.cloned_nbl != NULL) {
@@ -492,8 +508,7 @@ net_ebpf_ext_layer_2_classify(
 Done:
     classify_output->actionType = action;
 
-    if (attached_client)
-        net_ebpf_extension_attach_leave_rundown(attached_client, EXECUTION_DISPATCH);
+    net_ebpf_extension_hook_leave_rundown(_ebpf_xdp_hook_provider_context);
 
     return;
 }
\ No newline at end of file
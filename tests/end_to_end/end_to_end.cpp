@@ -10,6 +10,7 @@
 #include <WinSock2.h>
 #include <in6addr.h> // Must come after Winsock2.h
 
+#include "api_internal.h"
 #include "bpf2c.h"
 #include "bpf/bpf.h"
 #include "bpf/libbpf.h"
@@ -615,6 +616,86 @@ bindmonitor_ring_buffer_test(ebpf_execution_type_t execution_type)
     bpf_object__close(object);
 }
 
+static void
+_bindmonitor_ring_buffer_poll_test(ebpf_execution_type_t execution_type)
+{
+    _test_helper_end_to_end test_helper;
+
+    const char* error_message = nullptr;
+    bpf_object* object = nullptr;
+    bpf_link* link = nullptr;
+    fd_t program_fd;
+
+    program_info_provider_t bind_program_info(EBPF_PROGRAM_TYPE_BIND);
+
+    ebpf_result_t result = ebpf_program_load(
+        SAMPLE_PATH "bindmonitor_ringbuf.o", nullptr, nullptr, execution_type, &object, &program_fd, &error_message);
+    if (error_message) {
+        printf("ebpf_program_load failed with %s\n", error_message);
+        ebpf_free_string(error_message);
+        error_message = nullptr;
+    }
+    REQUIRE(result == EBPF_SUCCESS);
+
+    fd_t process_map_fd = bpf_object__find_map_fd_by_name(object, "process_map");
+    REQUIRE(process_map_fd > 0);
+
+    single_instance_hook_t hook(EBPF_PROGRAM_TYPE_BIND, EBPF_ATTACH_TYPE_BIND);
+    REQUIRE(hook.attach_link(program_fd, nullptr, 0, &link) == EBPF_SUCCESS);
+
+    // A second, idle map shares the manager's wait with the map the program writes to.
+    fd_t idle_map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, "idle_map", 0, 0, 64 * 1024, nullptr);
+    REQUIRE(idle_map_fd > 0);
+
+    std::vector<std::string> records;
+    auto sample_callback = [](void* ctx, void* data, size_t size) -> int {
+        reinterpret_cast<std::vector<std::string>*>(ctx)->emplace_back(reinterpret_cast<char*>(data), size);
+        return 0;
+    };
+    struct ring_buffer* ring_buffer = ring_buffer__new(idle_map_fd, sample_callback, &records, nullptr);
+    REQUIRE(ring_buffer != nullptr);
+    REQUIRE(ring_buffer__add(ring_buffer, process_map_fd, sample_callback, &records) == 0);
+
+    REQUIRE(ring_buffer__consume(ring_buffer) == 0);
+    REQUIRE(ring_buffer__poll(ring_buffer, 0) == 0);
+
+    std::function<ebpf_result_t(void*, int*)> invoke = [&hook](void* context, int* result) -> ebpf_result_t {
+        return hook.fire(context, result);
+    };
+    std::vector<std::string> app_ids = {"fake_app_0", "fake_app_1", "fake_app_2"};
+    for (size_t i = 0; i < app_ids.size(); i++) {
+        REQUIRE(emulate_bind(invoke, 12345 + i, app_ids[i].c_str()) == BIND_PERMIT);
+    }
+
+    // Nothing is delivered until the manager is polled.
+    REQUIRE(records.empty());
+    int record_count = 0;
+    while (record_count < static_cast<int>(app_ids.size())) {
+        int poll_result = ring_buffer__poll(ring_buffer, 1000);
+        REQUIRE(poll_result > 0);
+        record_count += poll_result;
+    }
+    REQUIRE(records == app_ids);
+    REQUIRE(ring_buffer__poll(ring_buffer, 10) == 0);
+
+    // Records below the wakeup watermark don't wake the manager, but consume still reads them.
+    REQUIRE(ebpf_ring_buffer_map_set_wakeup_watermark(process_map_fd, 128 * 1024) == EBPF_SUCCESS);
+    records.clear();
+    for (size_t i = 0; i < app_ids.size(); i++) {
+        REQUIRE(emulate_bind(invoke, 12345 + i, app_ids[i].c_str()) == BIND_PERMIT);
+    }
+    REQUIRE(ring_buffer__consume(ring_buffer) == static_cast<int>(app_ids.size()));
+    REQUIRE(records == app_ids);
+
+    ring_buffer__free(ring_buffer);
+    Platform::_close(idle_map_fd);
+
+    hook.detach_link(link);
+    hook.close_link(link);
+
+    bpf_object__close(object);
+}
+
 static void
 _utility_helper_functions_test(ebpf_execution_type_t execution_type)
 {
@@ -650,6 +731,11 @@ TEST_CASE("droppacket-interpret", "[end_to_end]") { droppacket_test(EBPF_EXECUTI
 TEST_CASE("divide_by_zero_interpret", "[end_to_end]") { divide_by_zero_test_um(EBPF_EXECUTION_INTERPRET); }
 TEST_CASE("bindmonitor-interpret", "[end_to_end]") { bindmonitor_test(EBPF_EXECUTION_INTERPRET); }
 TEST_CASE("bindmonitor-ringbuf-interpret", "[end_to_end]") { bindmonitor_ring_buffer_test(EBPF_EXECUTION_INTERPRET); }
+TEST_CASE("bindmonitor-ringbuf-poll-jit", "[end_to_end]") { _bindmonitor_ring_buffer_poll_test(EBPF_EXECUTION_JIT); }
+TEST_CASE("bindmonitor-ringbuf-poll-interpret", "[end_to_end]")
+{
+    _bindmonitor_ring_buffer_poll_test(EBPF_EXECUTION_INTERPRET);
+}
 TEST_CASE("utility-helpers-jit", "[end_to_end]") { _utility_helper_functions_test(EBPF_EXECUTION_JIT); }
 TEST_CASE("utility-helpers-interpret", "[end_to_end]") { _utility_helper_functions_test(EBPF_EXECUTION_INTERPRET); }
 
@@ -1701,6 +1787,67 @@ TEST_CASE("map_reuse_3", "[end_to_end]")
     REQUIRE(ebpf_object_unpin("/ebpf/global/port_map") == EBPF_SUCCESS);
 }
 
+TEST_CASE("map_batch_protocol_separate_reply", "[end_to_end]")
+{
+    _test_helper_end_to_end test_helper;
+    const uint32_t entry_count = 4;
+
+    fd_t map_fd = bpf_map_create(BPF_MAP_TYPE_HASH, "batch_map", sizeof(uint32_t), sizeof(uint64_t), 16, nullptr);
+    REQUIRE(map_fd > 0);
+    ebpf_handle_t map_handle = static_cast<ebpf_handle_t>(Platform::_get_osfhandle(map_fd));
+    REQUIRE(map_handle != ebpf_handle_invalid);
+
+    // The driver hands handlers a reply buffer that aliases the request. Use separate buffers here, with a reply
+    // header that doesn't describe the reply, so that the handlers have to fill in the length themselves.
+    std::vector<uint8_t> update_buffer(
+        EBPF_OFFSET_OF(ebpf_operation_map_update_batch_request_t, data) +
+        entry_count * (sizeof(uint32_t) + sizeof(uint64_t)));
+    auto update_request = reinterpret_cast<ebpf_operation_map_update_batch_request_t*>(update_buffer.data());
+    update_request->header.length = static_cast<uint16_t>(update_buffer.size());
+    update_request->header.id = ebpf_operation_id_t::EBPF_OPERATION_MAP_UPDATE_BATCH;
+    update_request->handle = map_handle;
+    update_request->option = EBPF_ANY;
+    for (uint32_t key = 0; key < entry_count; key++) {
+        uint64_t value = key * 10ull;
+        uint8_t* entry = update_request->data + key * (sizeof(uint32_t) + sizeof(uint64_t));
+        memcpy(entry, &key, sizeof(key));
+        memcpy(entry + sizeof(key), &value, sizeof(value));
+    }
+
+    ebpf_operation_map_batch_reply_t reply;
+    memset(&reply, 0xcc, sizeof(reply));
+    REQUIRE(
+        ebpf_core_invoke_protocol_handler(
+            update_request->header.id, update_request, &reply, sizeof(reply), nullptr, nullptr) == EBPF_SUCCESS);
+    REQUIRE(reply.header.length == sizeof(reply));
+    REQUIRE(reply.result == EBPF_SUCCESS);
+    REQUIRE(reply.count == entry_count);
+
+    std::vector<uint8_t> delete_buffer(
+        EBPF_OFFSET_OF(ebpf_operation_map_delete_batch_request_t, keys) + entry_count * sizeof(uint32_t));
+    auto delete_request = reinterpret_cast<ebpf_operation_map_delete_batch_request_t*>(delete_buffer.data());
+    delete_request->header.length = static_cast<uint16_t>(delete_buffer.size());
+    delete_request->header.id = ebpf_operation_id_t::EBPF_OPERATION_MAP_DELETE_BATCH;
+    delete_request->handle = map_handle;
+    for (uint32_t key = 0; key < entry_count; key++) {
+        memcpy(delete_request->keys + key * sizeof(uint32_t), &key, sizeof(key));
+    }
+
+    memset(&reply, 0xcc, sizeof(reply));
+    REQUIRE(
+        ebpf_core_invoke_protocol_handler(
+            delete_request->header.id, delete_request, &reply, sizeof(reply), nullptr, nullptr) == EBPF_SUCCESS);
+    REQUIRE(reply.header.length == sizeof(reply));
+    REQUIRE(reply.result == EBPF_SUCCESS);
+    REQUIRE(reply.count == entry_count);
+
+    uint32_t key = 0;
+    uint64_t value;
+    REQUIRE(bpf_map_lookup_elem(map_fd, &key, &value) < 0);
+
+    Platform::_close(map_fd);
+}
+
 TEST_CASE("bpf2c_droppacket", "[bpf2c]")
 {
     _test_helper_end_to_end test_helper;
@@ -96,23 +96,13 @@ typedef struct _ring_buffer_test_event_context
     std::promise<void> ring_buffer_event_promise;
     struct ring_buffer* ring_buffer;
     std::vector<std::vector<char>>* records;
-    bool canceled;
     int matched_entry_count;
-    _ring_buffer_test_event_context() : ring_buffer(nullptr), records(nullptr), canceled(false), matched_entry_count(0)
-    {}
+    _ring_buffer_test_event_context() : ring_buffer(nullptr), records(nullptr), matched_entry_count(0) {}
     ~_ring_buffer_test_event_context()
     {
         if (ring_buffer != nullptr)
             ring_buffer__free(ring_buffer);
     }
-    void
-    unsubscribe()
-    {
-        struct ring_buffer* temp = ring_buffer;
-        ring_buffer = nullptr;
-        // Unsubscribe.
-        ring_buffer__free(temp);
-    }
 } ring_buffer_test_event_context_t;
 
 int
@@ -120,13 +110,6 @@ ring_buffer_test_event_handler(_In_ void* ctx, _In_opt_ void* data, size_t size)
 {
     ring_buffer_test_event_context_t* event_context = reinterpret_cast<ring_buffer_test_event_context_t*>(ctx);
 
-    if (event_context->canceled) {
-        // Ring buffer subscription is canceled.
-        // Free the callback context and return error so that no further callback is made.
-        delete event_context;
-        return -1;
-    }
-
     if (event_context->matched_entry_count == RING_BUFFER_TEST_EVENT_COUNT)
         // Required number of event notifications already received.
         return 0;
@@ -166,25 +149,24 @@ ring_buffer_api_test_helper(
     // once notifications for all events are received.
     auto ring_buffer_event_callback = context->ring_buffer_event_promise.get_future();
 
-    // Create a new ring buffer manager and subscribe to ring buffer events.
-    // The notifications for the events that were generated before should occur after the subscribe call.
+    // Create a new ring buffer manager.
+    // The events that were generated before should be delivered once the manager is polled.
     context->ring_buffer = ring_buffer__new(ring_buffer_map, ring_buffer_test_event_handler, context.get(), nullptr);
     REQUIRE(context->ring_buffer != nullptr);
 
-    // Generate more events, post-subscription.
+    // Generate more events, after the manager was created.
     for (int i = RING_BUFFER_TEST_EVENT_COUNT / 2; i < RING_BUFFER_TEST_EVENT_COUNT; i++) {
         generate_event(i);
     }
 
-    // Wait for event handler getting notifications for all RING_BUFFER_TEST_EVENT_COUNT events.
-    REQUIRE(ring_buffer_event_callback.wait_for(1s) == std::future_status::ready);
-
-    // Mark the event context as canceled, such that the event callback stops processing events.
-    context->canceled = true;
-
-    // Release the raw pointer such that the final callback frees the callback context.
-    ring_buffer_test_event_context_t* raw_context = context.release();
+    // Poll until the event handler has been called for all RING_BUFFER_TEST_EVENT_COUNT events. The manager only
+    // calls the handler from ring_buffer__poll, on this thread.
+    auto deadline = std::chrono::steady_clock::now() + 1s;
+    while (ring_buffer_event_callback.wait_for(0s) != std::future_status::ready) {
+        REQUIRE(std::chrono::steady_clock::now() < deadline);
+        REQUIRE(ring_buffer__poll(context->ring_buffer, 100) >= 0);
+    }
 
-    // Unsubscribe.
-    raw_context->unsubscribe();
+    // Free the ring buffer manager and the callback context.
+    context.reset();
 }
\ No newline at end of file
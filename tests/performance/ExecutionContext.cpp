@@ -3,6 +3,8 @@
 
 #define TEST_AREA "ExecutionContext"
 
+#include <array>
+#include <map>
 #include <numeric>
 #include <optional>
 
@@ -13,6 +15,11 @@ extern "C"
 #include "ubpf.h"
 }
 
+// bpf_helpers.h conflicts with libbpf, so mirror its tail call limit here.
+#ifndef MAX_TAIL_CALL_CNT
+#define MAX_TAIL_CALL_CNT 32
+#endif
+
 typedef class _ebpf_program_test_state
 {
   public:
@@ -83,7 +90,7 @@ typedef class _ebpf_program_test_state
 typedef class _ebpf_map_test_state
 {
   public:
-    _ebpf_map_test_state(ebpf_map_type_t type, std::optional<uint32_t> map_size = {})
+    _ebpf_map_test_state(ebpf_map_type_t type, std::optional<uint32_t> map_size = {}, uint32_t map_flags = 0)
     {
         ebpf_utf8_string_t name{(uint8_t*)"test", 4};
         ebpf_map_definition_in_memory_t definition{
@@ -92,6 +99,7 @@ typedef class _ebpf_map_test_state
             sizeof(uint32_t),
             sizeof(uint64_t),
             map_size.has_value() ? map_size.value() : ebpf_get_cpu_count()};
+        definition.map_flags = map_flags;
 
         REQUIRE(ebpf_core_initiate() == EBPF_SUCCESS);
         REQUIRE(ebpf_map_create(&name, &definition, ebpf_handle_invalid, &map) == EBPF_SUCCESS);
@@ -107,6 +115,16 @@ typedef class _ebpf_map_test_state
         ebpf_core_terminate();
     }
 
+    void
+    populate(uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t key = ebpf_random_uint32();
+            uint64_t value = 0;
+            ebpf_map_update_entry(map, 0, (uint8_t*)&key, 0, (uint8_t*)&value, EBPF_ANY, EBPF_MAP_FLAG_HELPER);
+        }
+    }
+
     void
     test_find_read(uint32_t cpu_id)
     {
@@ -141,6 +159,17 @@ typedef class _ebpf_map_test_state
         ebpf_epoch_exit();
     }
 
+    void
+    test_update_delete(uint32_t cpu_id)
+    {
+        uint32_t key = cpu_id;
+        uint64_t value = 0;
+        ebpf_epoch_enter();
+        ebpf_map_delete_entry(map, 0, (uint8_t*)&key, EBPF_MAP_FLAG_HELPER);
+        ebpf_map_update_entry(map, 0, (uint8_t*)&key, 0, (uint8_t*)&value, EBPF_ANY, EBPF_MAP_FLAG_HELPER);
+        ebpf_epoch_exit();
+    }
+
     void
     test_update_lru()
     {
@@ -194,6 +223,50 @@ typedef class _ebpf_map_lpm_trie_test_state
         }
     }
 
+    void
+    populate_ipv6_routes(size_t route_count)
+    {
+        ebpf_utf8_string_t name{(uint8_t*)"ipv6_route_table", 16};
+        ebpf_map_definition_in_memory_t definition{
+            sizeof(ebpf_map_definition_in_memory_t),
+            BPF_MAP_TYPE_LPM_TRIE,
+            sizeof(uint32_t) + sizeof(ipv6_address_t),
+            sizeof(uint64_t),
+            static_cast<uint32_t>(route_count)};
+
+        REQUIRE(ebpf_map_create(&name, &definition, ebpf_handle_invalid, &map) == EBPF_SUCCESS);
+
+        // Approximate Prefix Length Distribution from https://bgp.potaroo.net/v6/as2.0/index.html
+        std::map<uint32_t, size_t> ipv6_prefix_length_distribution{
+            {16, 10},    {19, 10},   {20, 100},   {22, 50},   {24, 300},    {28, 1500}, {29, 14000},
+            {30, 1200},  {31, 700},  {32, 21000}, {33, 2200}, {34, 2300},   {35, 1300}, {36, 6500},
+            {37, 800},   {38, 1500}, {39, 600},   {40, 9000}, {41, 600},    {42, 1900}, {43, 500},
+            {44, 15000}, {45, 1600}, {46, 5000},  {47, 4000}, {48, 115000}, {56, 500},  {64, 1200},
+        };
+
+        size_t total = 0;
+        for (auto& [prefix_length, count] : ipv6_prefix_length_distribution) {
+            total += count;
+        }
+        for (auto& [prefix_length, count] : ipv6_prefix_length_distribution) {
+            size_t scaled_size = count * route_count / total;
+            for (size_t index = 0; index < scaled_size; index++) {
+                ipv6_address_t prefix;
+                // Global unicast addresses all start with 2000::/3.
+                for (auto& byte : prefix) {
+                    byte = static_cast<uint8_t>(ebpf_random_uint32());
+                }
+                prefix[0] = (prefix[0] & ~0xE0) | 0x20;
+                ipv6_routes.push_back({prefix_length, prefix});
+            }
+        }
+        for (auto& [prefix_length, prefix] : ipv6_routes) {
+            std::vector<uint8_t> prefix_bytes(sizeof(ipv6_address_t));
+            memcpy(prefix_bytes.data(), prefix.data(), prefix_bytes.size());
+            populate_route(prefix_bytes, prefix_length);
+        }
+    }
+
     void
     populate_route(const std::vector<uint8_t>& prefix, uint32_t length)
     {
@@ -224,6 +297,25 @@ typedef class _ebpf_map_lpm_trie_test_state
         ebpf_epoch_exit();
     }
 
+    void
+    test_find_ipv6_route()
+    {
+        struct _key
+        {
+            uint32_t prefix_length;
+            ipv6_address_t prefix;
+        } ipv6_key = {128, ipv6_routes[ebpf_random_uint32() % ipv6_routes.size()].second};
+        volatile uint64_t* value = nullptr;
+
+        // Look up an address inside the route rather than the route itself.
+        *reinterpret_cast<uint64_t*>(&ipv6_key.prefix[8]) = ebpf_random_uint32();
+
+        ebpf_epoch_enter();
+        ebpf_map_find_entry(map, sizeof(ipv6_key), (uint8_t*)&ipv6_key, sizeof(value), (uint8_t*)&value, 0);
+        UNREFERENCED_PARAMETER(value);
+        ebpf_epoch_exit();
+    }
+
     ~_ebpf_map_lpm_trie_test_state()
     {
         ebpf_object_release_reference((ebpf_object_t*)map);
@@ -231,13 +323,232 @@ typedef class _ebpf_map_lpm_trie_test_state
     }
 
   private:
+    typedef std::array<uint8_t, 16> ipv6_address_t;
     ebpf_map_t* map;
     std::vector<std::pair<uint32_t, uint32_t>> ipv4_routes;
+    std::vector<std::pair<uint32_t, ipv6_address_t>> ipv6_routes;
 } ebpf_map_lpm_trie_test_state_t;
 
+typedef class _ebpf_tail_call_chain_test_state
+{
+  public:
+    _ebpf_tail_call_chain_test_state(uint32_t depth) : program_info_provider(EBPF_PROGRAM_TYPE_XDP)
+    {
+        ebpf_utf8_string_t name{(uint8_t*)"tail_call_chain", 15};
+        ebpf_map_definition_in_memory_t definition{
+            sizeof(ebpf_map_definition_in_memory_t),
+            BPF_MAP_TYPE_PROG_ARRAY,
+            sizeof(uint32_t),
+            sizeof(uint32_t),
+            MAX_TAIL_CALL_CNT};
+
+        REQUIRE(ebpf_core_initiate() == EBPF_SUCCESS);
+        REQUIRE(ebpf_map_create(&name, &definition, ebpf_handle_invalid, &map) == EBPF_SUCCESS);
+
+        // Program N tail calls program N + 1 and the last program in the chain returns.
+        uint32_t helper_function_id = BPF_FUNC_tail_call;
+        uint64_t map_address = reinterpret_cast<uint64_t>(map);
+        for (uint32_t index = 0; index < depth; index++) {
+            bool tail_call = (index + 1) < depth;
+            std::vector<ebpf_instruction_t> byte_code;
+            if (tail_call) {
+                // r2 = map, r3 = index + 1, call helper 0 (bpf_tail_call).
+                byte_code.push_back({EBPF_OP_LDDW, 2, 0, 0, static_cast<int32_t>(map_address)});
+                byte_code.push_back({0, 0, 0, 0, static_cast<int32_t>(map_address >> 32)});
+                byte_code.push_back({EBPF_OP_MOV64_IMM, 3, 0, 0, static_cast<int32_t>(index + 1)});
+                byte_code.push_back({EBPF_OP_CALL, 0, 0, 0, 0});
+            }
+            byte_code.push_back({EBPF_OP_MOV_IMM, 0, 0, 0, 42});
+            byte_code.push_back({EBPF_OP_EXIT});
+
+            ebpf_program_t* program = nullptr;
+            ebpf_program_parameters_t parameters = {EBPF_PROGRAM_TYPE_XDP};
+            REQUIRE(ebpf_program_create(&program) == EBPF_SUCCESS);
+            programs.push_back(program);
+            REQUIRE(ebpf_program_initialize(program, &parameters) == EBPF_SUCCESS);
+            if (tail_call) {
+                REQUIRE(ebpf_program_set_helper_function_ids(program, 1, &helper_function_id) == EBPF_SUCCESS);
+            }
+            REQUIRE(
+                ebpf_program_load_code(
+                    program,
+                    EBPF_CODE_EBPF,
+                    reinterpret_cast<uint8_t*>(byte_code.data()),
+                    byte_code.size() * sizeof(ebpf_instruction_t)) == EBPF_SUCCESS);
+
+            ebpf_handle_t handle;
+            REQUIRE(ebpf_handle_create(&handle, reinterpret_cast<ebpf_object_t*>(program)) == EBPF_SUCCESS);
+            REQUIRE(
+                ebpf_map_update_entry_with_handle(
+                    map, sizeof(index), reinterpret_cast<uint8_t*>(&index), handle, EBPF_ANY) == EBPF_SUCCESS);
+            ebpf_handle_close(handle);
+        }
+    }
+    ~_ebpf_tail_call_chain_test_state()
+    {
+        ebpf_object_release_reference(reinterpret_cast<ebpf_object_t*>(map));
+        for (auto& program : programs) {
+            ebpf_object_release_reference(reinterpret_cast<ebpf_object_t*>(program));
+        }
+        ebpf_core_terminate();
+    }
+
+    void
+    test(void* context)
+    {
+        uint32_t result;
+        ebpf_epoch_enter();
+        ebpf_program_invoke(programs[0], context, &result);
+        ebpf_epoch_exit();
+    }
+
+  private:
+    ebpf_map_t* map;
+    std::vector<ebpf_program_t*> programs;
+    _program_info_provider program_info_provider;
+} ebpf_tail_call_chain_test_state_t;
+
+typedef class _ebpf_multiple_link_test_state
+{
+  public:
+    _ebpf_multiple_link_test_state(uint32_t program_count) : program_info_provider(EBPF_PROGRAM_TYPE_XDP)
+    {
+        GUID module_id;
+        REQUIRE(ebpf_core_initiate() == EBPF_SUCCESS);
+        REQUIRE(ebpf_guid_create(&attach_type) == EBPF_SUCCESS);
+        REQUIRE(ebpf_guid_create(&module_id) == EBPF_SUCCESS);
+        attach_provider_data.supported_program_type = EBPF_PROGRAM_TYPE_XDP;
+        REQUIRE(
+            ebpf_provider_load(
+                &provider,
+                &attach_type,
+                &module_id,
+                nullptr,
+                &provider_data,
+                nullptr,
+                this,
+                client_attach_callback,
+                client_detach_callback) == EBPF_SUCCESS);
+
+        // Every program passes, so each invocation runs the whole chain.
+        std::vector<ebpf_instruction_t> byte_code = {{EBPF_OP_MOV_IMM, 0, 0, 0, XDP_PASS}, {EBPF_OP_EXIT}};
+        for (uint32_t index = 0; index < program_count; index++) {
+            ebpf_program_t* program = nullptr;
+            ebpf_program_parameters_t parameters = {EBPF_PROGRAM_TYPE_XDP};
+            REQUIRE(ebpf_program_create(&program) == EBPF_SUCCESS);
+            programs.push_back(program);
+            REQUIRE(ebpf_program_initialize(program, &parameters) == EBPF_SUCCESS);
+            REQUIRE(
+                ebpf_program_load_code(
+                    program,
+                    EBPF_CODE_EBPF,
+                    reinterpret_cast<uint8_t*>(byte_code.data()),
+                    byte_code.size() * sizeof(ebpf_instruction_t)) == EBPF_SUCCESS);
+
+            ebpf_link_t* link = nullptr;
+            REQUIRE(ebpf_link_create(&link) == EBPF_SUCCESS);
+            links.push_back(link);
+            REQUIRE(ebpf_link_initialize(link, attach_type, nullptr, 0) == EBPF_SUCCESS);
+            REQUIRE(ebpf_link_attach_program(link, program) == EBPF_SUCCESS);
+        }
+        REQUIRE(entries.size() == program_count);
+    }
+    ~_ebpf_multiple_link_test_state()
+    {
+        for (auto& link : links) {
+            ebpf_link_detach_program(link);
+            ebpf_object_release_reference(reinterpret_cast<ebpf_object_t*>(link));
+        }
+        ebpf_provider_unload(provider);
+        for (auto& program : programs) {
+            ebpf_object_release_reference(reinterpret_cast<ebpf_object_t*>(program));
+        }
+        ebpf_core_terminate();
+    }
+
+    void
+    test(void* context)
+    {
+        // Same ordering and result rules as the hook providers: attach order, stop at the first non-pass verdict.
+        uint32_t result = XDP_PASS;
+        for (auto& entry : entries) {
+            if (entry.invoke_program(entry.client_binding_context, context, &result) != EBPF_SUCCESS ||
+                result != XDP_PASS) {
+                break;
+            }
+        }
+    }
+
+    void
+    test_batch(void** contexts, uint32_t count, uint32_t* results)
+    {
+        // Every program passes, so each link runs over the whole batch.
+        for (auto& entry : entries) {
+            if (entry.invoke_program_batch(entry.client_binding_context, contexts, count, results) != EBPF_SUCCESS) {
+                break;
+            }
+        }
+    }
+
+  private:
+    typedef ebpf_result_t (*invoke_program_t)(const void* client_binding_context, void* context, uint32_t* result);
+    typedef ebpf_result_t (*invoke_program_batch_t)(
+        const void* client_binding_context, void** contexts, uint32_t count, uint32_t* results);
+    typedef struct _entry
+    {
+        GUID client_id;
+        invoke_program_t invoke_program;
+        invoke_program_batch_t invoke_program_batch;
+        const void* client_binding_context;
+    } entry_t;
+
+    static ebpf_result_t
+    client_attach_callback(
+        void* context,
+        const GUID* client_id,
+        void* client_binding_context,
+        const ebpf_extension_data_t* client_data,
+        const ebpf_extension_dispatch_table_t* client_dispatch_table)
+    {
+        auto state = reinterpret_cast<_ebpf_multiple_link_test_state*>(context);
+        UNREFERENCED_PARAMETER(client_data);
+        state->entries.push_back(
+            {*client_id,
+             reinterpret_cast<invoke_program_t>(client_dispatch_table->function[0]),
+             reinterpret_cast<invoke_program_batch_t>(client_dispatch_table->function[1]),
+             client_binding_context});
+        return EBPF_SUCCESS;
+    }
+
+    static ebpf_result_t
+    client_detach_callback(void* context, const GUID* client_id)
+    {
+        auto state = reinterpret_cast<_ebpf_multiple_link_test_state*>(context);
+        for (auto entry = state->entries.begin(); entry != state->entries.end(); entry++) {
+            if (IsEqualGUID(entry->client_id, *client_id)) {
+                state->entries.erase(entry);
+                break;
+            }
+        }
+        return EBPF_SUCCESS;
+    }
+
+    ebpf_attach_type_t attach_type;
+    ebpf_attach_provider_data_t attach_provider_data;
+    ebpf_extension_data_t provider_data = {
+        EBPF_ATTACH_PROVIDER_DATA_VERSION, sizeof(attach_provider_data), &attach_provider_data};
+    ebpf_extension_provider_t* provider;
+    std::vector<entry_t> entries;
+    std::vector<ebpf_link_t*> links;
+    std::vector<ebpf_program_t*> programs;
+    _program_info_provider program_info_provider;
+} ebpf_multiple_link_test_state_t;
+
 static ebpf_program_test_state_t* _ebpf_program_test_state_instance = nullptr;
 static ebpf_map_test_state_t* _ebpf_map_test_state_instance = nullptr;
 static ebpf_map_lpm_trie_test_state_t* _ebpf_map_lpm_trie_test_state_instance = nullptr;
+static ebpf_tail_call_chain_test_state_t* _ebpf_tail_call_chain_test_state_instance = nullptr;
+static ebpf_multiple_link_test_state_t* _ebpf_multiple_link_test_state_instance = nullptr;
 
 static void
 _ebpf_program_invoke()
@@ -245,6 +556,27 @@ _ebpf_program_invoke()
     _ebpf_program_test_state_instance->test(nullptr);
 }
 
+static void
+_ebpf_tail_call_chain_invoke()
+{
+    _ebpf_tail_call_chain_test_state_instance->test(nullptr);
+}
+
+static void
+_ebpf_multiple_link_invoke()
+{
+    _ebpf_multiple_link_test_state_instance->test(nullptr);
+}
+
+template <uint32_t batch_size>
+static void
+_ebpf_multiple_link_invoke_batch()
+{
+    std::array<void*, batch_size> contexts{};
+    std::array<uint32_t, batch_size> results;
+    _ebpf_multiple_link_test_state_instance->test_batch(contexts.data(), batch_size, results.data());
+}
+
 static void
 _map_find_read_test(uint32_t cpu_id)
 {
@@ -263,6 +595,12 @@ _map_update_test(uint32_t cpu_id)
     _ebpf_map_test_state_instance->test_update(cpu_id);
 }
 
+static void
+_map_update_delete_test(uint32_t cpu_id)
+{
+    _ebpf_map_test_state_instance->test_update_delete(cpu_id);
+}
+
 static void
 _map_update_lru_test()
 {
@@ -275,6 +613,12 @@ _lpm_trie_ipv4_find()
     _ebpf_map_lpm_trie_test_state_instance->test_find_ipv4_route();
 }
 
+static void
+_lpm_trie_ipv6_find()
+{
+    _ebpf_map_lpm_trie_test_state_instance->test_find_ipv6_route();
+}
+
 static const char*
 _ebpf_map_type_t_to_string(ebpf_map_type_t type)
 {
@@ -351,14 +695,61 @@ test_bpf_map_update_elem(bool preemptible)
 
 template <ebpf_map_type_t map_type>
 void
+test_bpf_map_update_elem_in_place(bool preemptible)
+{
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT;
+    ebpf_map_test_state_t map_test_state(map_type, {}, BPF_F_UPDATE_IN_PLACE);
+    _ebpf_map_test_state_instance = &map_test_state;
+    std::string name = __FUNCTION__;
+    name += "<";
+    name += _ebpf_map_type_t_to_string(map_type);
+    name += ">";
+    _performance_measure measure(name.c_str(), preemptible, _map_update_test, iterations);
+    measure.run_test();
+}
+
+template <ebpf_map_type_t map_type>
+void
+test_bpf_map_update_delete_elem(bool preemptible)
+{
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT;
+    ebpf_map_test_state_t map_test_state(map_type);
+    _ebpf_map_test_state_instance = &map_test_state;
+    std::string name = __FUNCTION__;
+    name += "<";
+    name += _ebpf_map_type_t_to_string(map_type);
+    name += ">";
+    uint64_t start_hit_count;
+    uint64_t start_miss_count;
+    ebpf_epoch_get_cache_statistics(&start_hit_count, &start_miss_count);
+    _performance_measure measure(name.c_str(), preemptible, _map_update_delete_test, iterations);
+    measure.run_test();
+
+    // Report how often the per-CPU epoch caches satisfied the allocations.
+    uint64_t hit_count;
+    uint64_t miss_count;
+    ebpf_epoch_get_cache_statistics(&hit_count, &miss_count);
+    printf(
+        "%s epoch cache hits,%llu,misses,%llu\n",
+        name.c_str(),
+        (unsigned long long)(hit_count - start_hit_count),
+        (unsigned long long)(miss_count - start_miss_count));
+}
+
+template <ebpf_map_type_t map_type, uint32_t map_size>
+void
 test_bpf_map_update_lru_elem(bool preemptible)
 {
-    size_t iterations = 1000;
-    ebpf_map_test_state_t map_test_state(map_type, {100});
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT;
+    ebpf_map_test_state_t map_test_state(map_type, {map_size});
+    // Fill the map so every update of a new key has to evict one.
+    map_test_state.populate(map_size);
     _ebpf_map_test_state_instance = &map_test_state;
     std::string name = __FUNCTION__;
     name += "<";
     name += _ebpf_map_type_t_to_string(map_type);
+    name += ", ";
+    name += std::to_string(map_size);
     name += ">";
     _performance_measure measure(name.c_str(), preemptible, _map_update_lru_test, iterations);
     measure.run_test();
@@ -391,6 +782,55 @@ test_program_invoke_interpret(bool preemptible)
     measure.run_test();
 }
 
+template <uint32_t depth>
+void
+test_program_invoke_tail_call_chain(bool preemptible)
+{
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT;
+    _ebpf_tail_call_chain_test_state tail_call_chain_state(depth);
+    _ebpf_tail_call_chain_test_state_instance = &tail_call_chain_state;
+    std::string name = __FUNCTION__;
+    name += "<";
+    name += std::to_string(depth);
+    name += ">";
+
+    _performance_measure measure(name.c_str(), preemptible, _ebpf_tail_call_chain_invoke, iterations);
+    measure.run_test();
+}
+
+template <uint32_t program_count>
+void
+test_program_invoke_multiple_links(bool preemptible)
+{
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT;
+    _ebpf_multiple_link_test_state multiple_link_state(program_count);
+    _ebpf_multiple_link_test_state_instance = &multiple_link_state;
+    std::string name = __FUNCTION__;
+    name += "<";
+    name += std::to_string(program_count);
+    name += ">";
+
+    _performance_measure measure(name.c_str(), preemptible, _ebpf_multiple_link_invoke, iterations);
+    measure.run_test();
+}
+
+template <uint32_t batch_size>
+void
+test_program_invoke_batch(bool preemptible)
+{
+    // Report the cost per context so that it can be compared across batch sizes.
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT / batch_size;
+    _ebpf_multiple_link_test_state multiple_link_state(1);
+    _ebpf_multiple_link_test_state_instance = &multiple_link_state;
+    std::string name = __FUNCTION__;
+    name += "<";
+    name += std::to_string(batch_size);
+    name += ">";
+
+    _performance_measure measure(name.c_str(), preemptible, _ebpf_multiple_link_invoke_batch<batch_size>, iterations);
+    measure.run_test(batch_size);
+}
+
 template <size_t route_count>
 void
 test_lpm_trie_ipv4(bool preemptible)
@@ -408,8 +848,37 @@ test_lpm_trie_ipv4(bool preemptible)
     measure.run_test();
 }
 
+template <size_t route_count>
+void
+test_lpm_trie_ipv6(bool preemptible)
+{
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT;
+    _ebpf_map_lpm_trie_test_state lpm_trie_state;
+    lpm_trie_state.populate_ipv6_routes(route_count);
+    _ebpf_map_lpm_trie_test_state_instance = &lpm_trie_state;
+    std::string name = __FUNCTION__;
+    name += "<";
+    name += std::to_string(route_count);
+    name += ">";
+
+    _performance_measure measure(name.c_str(), preemptible, _lpm_trie_ipv6_find, iterations);
+    measure.run_test();
+}
+
 PERF_TEST(test_program_invoke_jit);
 PERF_TEST(test_program_invoke_interpret);
+PERF_TEST(test_program_invoke_tail_call_chain<1>);
+// Same chain length as tests/sample/tail_call_multiple.c, run concurrently on every CPU.
+PERF_TEST(test_program_invoke_tail_call_chain<3>);
+PERF_TEST(test_program_invoke_tail_call_chain<MAX_TAIL_CALL_CNT>);
+PERF_TEST(test_program_invoke_multiple_links<1>);
+PERF_TEST(test_program_invoke_multiple_links<4>);
+PERF_TEST(test_program_invoke_multiple_links<16>);
+PERF_TEST(test_program_invoke_batch<1>);
+PERF_TEST(test_program_invoke_batch<8>);
+PERF_TEST(test_program_invoke_batch<32>);
+PERF_TEST(test_program_invoke_batch<64>);
+PERF_TEST(test_program_invoke_batch<256>);
 
 PERF_TEST(test_bpf_map_lookup_elem_read<BPF_MAP_TYPE_HASH>);
 PERF_TEST(test_bpf_map_lookup_elem_read<BPF_MAP_TYPE_ARRAY>);
@@ -429,9 +898,22 @@ PERF_TEST(test_bpf_map_update_elem<BPF_MAP_TYPE_PERCPU_HASH>);
 PERF_TEST(test_bpf_map_update_elem<BPF_MAP_TYPE_PERCPU_ARRAY>);
 PERF_TEST(test_bpf_map_update_elem<BPF_MAP_TYPE_LRU_HASH>);
 
-PERF_TEST(test_bpf_map_update_lru_elem<BPF_MAP_TYPE_LRU_HASH>);
+PERF_TEST(test_bpf_map_update_elem_in_place<BPF_MAP_TYPE_HASH>);
+PERF_TEST(test_bpf_map_update_elem_in_place<BPF_MAP_TYPE_PERCPU_HASH>);
+
+PERF_TEST(test_bpf_map_update_delete_elem<BPF_MAP_TYPE_HASH>);
+PERF_TEST(test_bpf_map_update_delete_elem<BPF_MAP_TYPE_PERCPU_HASH>);
+
+PERF_TEST(test_bpf_map_update_lru_elem<BPF_MAP_TYPE_LRU_HASH, 100>);
+PERF_TEST(test_bpf_map_update_lru_elem<BPF_MAP_TYPE_LRU_HASH, 1024 * 16>);
+PERF_TEST(test_bpf_map_update_lru_elem<BPF_MAP_TYPE_LRU_HASH, 1024 * 1024>);
 
 PERF_TEST(test_lpm_trie_ipv4<1024>);
 PERF_TEST(test_lpm_trie_ipv4<1024 * 16>);
 PERF_TEST(test_lpm_trie_ipv4<1024 * 256>);
 PERF_TEST(test_lpm_trie_ipv4<1024 * 1024>);
+
+// A full IPv6 table has roughly 200K routes.
+PERF_TEST(test_lpm_trie_ipv6<1024>);
+PERF_TEST(test_lpm_trie_ipv6<1024 * 16>);
+PERF_TEST(test_lpm_trie_ipv6<1024 * 256>);
@@ -13,6 +13,7 @@
 #include "bpf/libbpf.h"
 #include "performance_measure.h"
 
-#define PERF_TEST(FUNCTION)                                                               \
-    TEST_CASE(#FUNCTION "_preemption", "[performance_" TEST_AREA "]") { FUNCTION(true); } \
-    TEST_CASE(#FUNCTION "_no_preemption", "[performance_" TEST_AREA "]") { FUNCTION(false); }
+// Variadic so that template instantiations with more than one argument can be registered.
+#define PERF_TEST(...)                                                                            \
+    TEST_CASE(#__VA_ARGS__ "_preemption", "[performance_" TEST_AREA "]") { __VA_ARGS__(true); } \
+    TEST_CASE(#__VA_ARGS__ "_no_preemption", "[performance_" TEST_AREA "]") { __VA_ARGS__(false); }
@@ -3,6 +3,10 @@
 
 #define TEST_AREA "platform"
 #include "performance.h"
+#include "ebpf_ring_buffer.h"
+#include "ebpf_state.h"
+
+#include <mutex>
 
 static void
 _perf_epoch_enter_exit()
@@ -26,6 +30,21 @@ _perf_epoch_enter_alloc_free_exit()
     ebpf_epoch_exit();
 }
 
+static size_t _perf_state_index;
+
+// Mirrors the state accesses made by ebpf_program_invoke and a single tail call.
+static void
+_perf_state_store_load()
+{
+    uintptr_t state = 0;
+    uintptr_t value;
+    ebpf_epoch_enter();
+    ebpf_state_store(_perf_state_index, reinterpret_cast<uintptr_t>(&state));
+    ebpf_state_load(_perf_state_index, &value);
+    ebpf_state_store(_perf_state_index, 0);
+    ebpf_epoch_exit();
+}
+
 static void
 _perf_bpf_get_prandom_u32()
 {
@@ -131,6 +150,19 @@ typedef class _ebpf_hash_table_test_state
         }
     }
 
+    void
+    test_next_key_with_cursor()
+    {
+        ebpf_hash_table_cursor_t cursor = {0};
+        uint8_t* previous_key = nullptr;
+        uint8_t* next_key;
+        ebpf_epoch_enter();
+        while (ebpf_hash_table_next_key_with_cursor(table, &cursor, previous_key, &next_key, nullptr) == EBPF_SUCCESS) {
+            previous_key = next_key;
+        }
+        ebpf_epoch_exit();
+    }
+
     void
     test_replace_value(uint32_t current_cpu)
     {
@@ -182,7 +214,316 @@ typedef class _ebpf_hash_table_test_state
 
 } ebpf_hash_table_test_state_t;
 
+#define EBPF_HASH_TABLE_RESIZE_INITIAL_BUCKET_COUNT 1024
+#define EBPF_HASH_TABLE_RESIZE_SAMPLE_COUNT 1024
+
+/**
+ * @brief Helper class to measure the hash-table while it resizes. The table
+ * starts with EBPF_HASH_TABLE_RESIZE_INITIAL_BUCKET_COUNT buckets and grows
+ * to hold entry_count entries.
+ */
+typedef class _ebpf_hash_table_resize_test_state
+{
+  public:
+    _ebpf_hash_table_resize_test_state(size_t entry_count)
+    {
+        cpu_count = ebpf_get_cpu_count();
+        REQUIRE(ebpf_platform_initiate() == EBPF_SUCCESS);
+        platform_initiated = true;
+        REQUIRE(ebpf_epoch_initiate() == EBPF_SUCCESS);
+        epoch_initated = true;
+
+        REQUIRE(
+            ebpf_hash_table_create(
+                &table,
+                ebpf_epoch_allocate,
+                ebpf_epoch_free,
+                sizeof(uint32_t),
+                sizeof(uint64_t),
+                EBPF_HASH_TABLE_RESIZE_INITIAL_BUCKET_COUNT,
+                nullptr) == EBPF_SUCCESS);
+
+        // Each CPU owns a disjoint range of keys.
+        keys.resize(entry_count);
+        for (size_t index = 0; index < keys.size(); index++) {
+            keys[index] = static_cast<uint32_t>(index);
+        }
+        keys_per_cpu = keys.size() / cpu_count;
+    }
+    ~_ebpf_hash_table_resize_test_state()
+    {
+        ebpf_hash_table_destroy(table);
+
+        if (epoch_initated)
+            ebpf_epoch_terminate();
+        if (platform_initiated)
+            ebpf_platform_terminate();
+    }
+
+    void
+    populate()
+    {
+        uint64_t value = 12345678;
+        ebpf_epoch_enter();
+        for (auto& key : keys) {
+            REQUIRE(
+                ebpf_hash_table_update(
+                    table,
+                    reinterpret_cast<uint8_t*>(&key),
+                    reinterpret_cast<uint8_t*>(&value),
+                    EBPF_HASH_TABLE_OPERATION_ANY) == EBPF_SUCCESS);
+        }
+        ebpf_epoch_exit();
+    }
+
+    void
+    test_find()
+    {
+        uint8_t* value;
+        for (size_t index = 0; index < EBPF_HASH_TABLE_RESIZE_SAMPLE_COUNT; index++) {
+            uint32_t key = keys[ebpf_random_uint32() % keys.size()];
+            ebpf_epoch_enter();
+            ebpf_hash_table_find(table, reinterpret_cast<uint8_t*>(&key), &value);
+            ebpf_epoch_exit();
+        }
+    }
+
+    void
+    test_grow_shrink(uint32_t current_cpu)
+    {
+        uint64_t value = 12345678;
+        size_t start = current_cpu * keys_per_cpu;
+        size_t end = start + keys_per_cpu;
+        // Insert then remove this CPU's keys, growing the table to entry_count and back.
+        for (size_t index = start; index < end; index++) {
+            ebpf_epoch_enter();
+            ebpf_hash_table_update(
+                table,
+                reinterpret_cast<uint8_t*>(&keys[index]),
+                reinterpret_cast<uint8_t*>(&value),
+                EBPF_HASH_TABLE_OPERATION_ANY);
+            ebpf_epoch_exit();
+        }
+        for (size_t index = start; index < end; index++) {
+            ebpf_epoch_enter();
+            ebpf_hash_table_delete(table, reinterpret_cast<uint8_t*>(&keys[index]));
+            ebpf_epoch_exit();
+        }
+    }
+
+    size_t
+    find_multiplier()
+    {
+        return EBPF_HASH_TABLE_RESIZE_SAMPLE_COUNT;
+    }
+
+    size_t
+    grow_shrink_multiplier()
+    {
+        return keys_per_cpu * 2;
+    }
+
+  private:
+    ebpf_hash_table_t* table;
+    std::vector<uint32_t> keys;
+    size_t keys_per_cpu;
+    bool platform_initiated = false;
+    bool epoch_initated = false;
+    uint32_t cpu_count;
+
+} ebpf_hash_table_resize_test_state_t;
+
+typedef struct _ebpf_5_tuple
+{
+    uint32_t source_address;
+    uint32_t destination_address;
+    uint16_t source_port;
+    uint16_t destination_port;
+    uint8_t protocol;
+    uint8_t padding[3];
+} ebpf_5_tuple_t;
+
+/**
+ * @brief Helper class to measure lookups of 5-tuple keys in a hash-table
+ * holding entry_count entries.
+ */
+typedef class _ebpf_hash_table_5_tuple_test_state
+{
+  public:
+    _ebpf_hash_table_5_tuple_test_state(size_t entry_count)
+    {
+        REQUIRE(ebpf_platform_initiate() == EBPF_SUCCESS);
+        platform_initiated = true;
+        REQUIRE(ebpf_epoch_initiate() == EBPF_SUCCESS);
+        epoch_initated = true;
+
+        REQUIRE(
+            ebpf_hash_table_create(
+                &table,
+                ebpf_epoch_allocate,
+                ebpf_epoch_free,
+                sizeof(ebpf_5_tuple_t),
+                sizeof(uint64_t),
+                EBPF_HASH_TABLE_RESIZE_INITIAL_BUCKET_COUNT,
+                nullptr) == EBPF_SUCCESS);
+
+        // Flows from many clients to a handful of services.
+        uint64_t value = 12345678;
+        keys.resize(entry_count);
+        ebpf_epoch_enter();
+        for (auto& key : keys) {
+            key = {};
+            key.source_address = ebpf_random_uint32();
+            key.destination_address = 0x0a000000 | (ebpf_random_uint32() % 16);
+            key.source_port = static_cast<uint16_t>(ebpf_random_uint32());
+            key.destination_port = 443;
+            key.protocol = 6;
+            REQUIRE(
+                ebpf_hash_table_update(
+                    table,
+                    reinterpret_cast<uint8_t*>(&key),
+                    reinterpret_cast<uint8_t*>(&value),
+                    EBPF_HASH_TABLE_OPERATION_ANY) == EBPF_SUCCESS);
+        }
+        ebpf_epoch_exit();
+    }
+    ~_ebpf_hash_table_5_tuple_test_state()
+    {
+        ebpf_hash_table_destroy(table);
+
+        if (epoch_initated)
+            ebpf_epoch_terminate();
+        if (platform_initiated)
+            ebpf_platform_terminate();
+    }
+
+    void
+    test_find()
+    {
+        uint8_t* value;
+        for (size_t index = 0; index < EBPF_HASH_TABLE_RESIZE_SAMPLE_COUNT; index++) {
+            ebpf_5_tuple_t& key = keys[ebpf_random_uint32() % keys.size()];
+            ebpf_epoch_enter();
+            ebpf_hash_table_find(table, reinterpret_cast<uint8_t*>(&key), &value);
+            ebpf_epoch_exit();
+        }
+    }
+
+    size_t
+    multiplier()
+    {
+        return EBPF_HASH_TABLE_RESIZE_SAMPLE_COUNT;
+    }
+
+  private:
+    ebpf_hash_table_t* table;
+    std::vector<ebpf_5_tuple_t> keys;
+    bool platform_initiated = false;
+    bool epoch_initated = false;
+
+} ebpf_hash_table_5_tuple_test_state_t;
+
+#define EBPF_RING_BUFFER_TEST_SIZE (256 * 1024)
+
+/**
+ * @brief Helper class to measure every CPU writing record_size byte records
+ * into a single ring buffer. A producer that finds the ring full drains the
+ * records that have been submitted and then retries.
+ */
+typedef class _ebpf_ring_buffer_test_state
+{
+  public:
+    _ebpf_ring_buffer_test_state(
+        size_t record_size, bool publish_consumer_offset = false, size_t ring_size = EBPF_RING_BUFFER_TEST_SIZE)
+        : ring_size(ring_size), record(record_size), publish_consumer_offset(publish_consumer_offset)
+    {
+        REQUIRE(ebpf_platform_initiate() == EBPF_SUCCESS);
+        platform_initiated = true;
+        REQUIRE(ebpf_epoch_initiate() == EBPF_SUCCESS);
+        epoch_initated = true;
+
+        REQUIRE(ebpf_ring_buffer_create(&ring, ring_size) == EBPF_SUCCESS);
+        REQUIRE(ebpf_ring_buffer_map_user(ring, 1, &buffer, &published_consumer_offset) == EBPF_SUCCESS);
+    }
+    ~_ebpf_ring_buffer_test_state()
+    {
+        ebpf_ring_buffer_destroy(ring);
+
+        if (epoch_initated)
+            ebpf_epoch_terminate();
+        if (platform_initiated)
+            ebpf_platform_terminate();
+    }
+
+    void
+    test_output()
+    {
+        while (ebpf_ring_buffer_output(ring, record.data(), record.size()) == EBPF_OUT_OF_SPACE) {
+            drain();
+        }
+    }
+
+    void
+    test_reserve_submit()
+    {
+        uint8_t* data;
+        while (ebpf_ring_buffer_reserve(ring, &data, record.size()) != EBPF_SUCCESS) {
+            drain();
+        }
+        memcpy(data, record.data(), record.size());
+        ebpf_ring_buffer_submit(data);
+    }
+
+  private:
+    void
+    drain()
+    {
+        std::unique_lock<std::mutex> lock(consumer_lock, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+
+        size_t consumer;
+        size_t producer;
+        size_t length = 0;
+        ebpf_ring_buffer_query(ring, &consumer, &producer);
+        // The ring only picks up a published offset when it runs out of space, so it can lag behind.
+        consumer = consumer_offset;
+        for (;;) {
+            auto next = ebpf_ring_buffer_next_record(buffer, ring_size, consumer + length, producer);
+            if (next == nullptr || next->header.locked) {
+                break;
+            }
+            length += next->header.length;
+        }
+        if (length == 0) {
+            return;
+        }
+        consumer_offset = consumer + length;
+        if (publish_consumer_offset) {
+            *published_consumer_offset = consumer_offset;
+        } else {
+            REQUIRE(ebpf_ring_buffer_return(ring, length) == EBPF_SUCCESS);
+        }
+    }
+
+    size_t ring_size;
+    ebpf_ring_buffer_t* ring = nullptr;
+    uint8_t* buffer = nullptr;
+    size_t* published_consumer_offset = nullptr;
+    std::vector<uint8_t> record;
+    std::mutex consumer_lock;
+    size_t consumer_offset = 0; // Guarded by consumer_lock.
+    bool publish_consumer_offset;
+    bool platform_initiated = false;
+    bool epoch_initated = false;
+
+} ebpf_ring_buffer_test_state_t;
+
 static ebpf_hash_table_test_state_t* _ebpf_hash_table_test_state_instance = nullptr;
+static ebpf_hash_table_resize_test_state_t* _ebpf_hash_table_resize_test_state_instance = nullptr;
+static ebpf_hash_table_5_tuple_test_state_t* _ebpf_hash_table_5_tuple_test_state_instance = nullptr;
+static ebpf_ring_buffer_test_state_t* _ebpf_ring_buffer_test_state_instance = nullptr;
 
 static void
 _ebpf_hash_table_test_find()
@@ -196,6 +537,12 @@ _ebpf_hash_table_test_next_key()
     _ebpf_hash_table_test_state_instance->test_next_key();
 }
 
+static void
+_ebpf_hash_table_test_next_key_with_cursor()
+{
+    _ebpf_hash_table_test_state_instance->test_next_key_with_cursor();
+}
+
 static void
 _ebpf_hash_table_test_replace_value(uint32_t current_cpu)
 {
@@ -208,6 +555,36 @@ _ebpf_hash_table_test_replace_value_overlap()
     _ebpf_hash_table_test_state_instance->test_replace_value_overlap();
 }
 
+static void
+_ebpf_hash_table_resize_test_find()
+{
+    _ebpf_hash_table_resize_test_state_instance->test_find();
+}
+
+static void
+_ebpf_hash_table_resize_test_grow_shrink(uint32_t current_cpu)
+{
+    _ebpf_hash_table_resize_test_state_instance->test_grow_shrink(current_cpu);
+}
+
+static void
+_ebpf_hash_table_5_tuple_test_find()
+{
+    _ebpf_hash_table_5_tuple_test_state_instance->test_find();
+}
+
+static void
+_ebpf_ring_buffer_test_output()
+{
+    _ebpf_ring_buffer_test_state_instance->test_output();
+}
+
+static void
+_ebpf_ring_buffer_test_reserve_submit()
+{
+    _ebpf_ring_buffer_test_state_instance->test_reserve_submit();
+}
+
 void
 test_bpf_get_prandom_u32(bool preemptible)
 {
@@ -258,6 +635,17 @@ test_epoch_enter_exit(bool preemptible)
     ebpf_core_terminate();
 }
 
+void
+test_state_store_load(bool preemptible)
+{
+    REQUIRE(ebpf_core_initiate() == EBPF_SUCCESS);
+    REQUIRE(ebpf_state_allocate_index(&_perf_state_index) == EBPF_SUCCESS);
+    size_t iterations = PERFORMANCE_MEASURE_ITERATION_COUNT * 10;
+    _performance_measure measure(__FUNCTION__, preemptible, _perf_state_store_load, iterations);
+    measure.run_test();
+    ebpf_core_terminate();
+}
+
 void
 test_epoch_enter_exit_alloc_free(bool preemptible)
 {
@@ -286,6 +674,15 @@ test_ebpf_hash_table_next_key(bool preemptible)
     measure.run_test(instance.multiplier());
 }
 
+void
+test_ebpf_hash_table_next_key_with_cursor(bool preemptible)
+{
+    _ebpf_hash_table_test_state instance;
+    _ebpf_hash_table_test_state_instance = &instance;
+    _performance_measure measure(__FUNCTION__, preemptible, _ebpf_hash_table_test_next_key_with_cursor);
+    measure.run_test(instance.multiplier());
+}
+
 void
 test_ebpf_hash_table_update(bool preemptible)
 {
@@ -309,12 +706,115 @@ test_ebpf_hash_table_update_overlapping(bool preemptible)
     measure.run_test(instance.multiplier());
 }
 
+template <size_t entry_count>
+void
+test_ebpf_hash_table_find_after_grow(bool preemptible)
+{
+    _ebpf_hash_table_resize_test_state instance(entry_count);
+    _ebpf_hash_table_resize_test_state_instance = &instance;
+    instance.populate();
+    _performance_measure measure(
+        __FUNCTION__, preemptible, _ebpf_hash_table_resize_test_find, PERFORMANCE_MEASURE_ITERATION_COUNT / 100);
+    measure.run_test(instance.find_multiplier());
+}
+
+template <size_t entry_count>
+void
+test_ebpf_hash_table_grow_shrink(bool preemptible)
+{
+    _ebpf_hash_table_resize_test_state instance(entry_count);
+    _ebpf_hash_table_resize_test_state_instance = &instance;
+    _performance_measure measure(__FUNCTION__, preemptible, _ebpf_hash_table_resize_test_grow_shrink, 10);
+    measure.run_test(instance.grow_shrink_multiplier());
+}
+
+template <size_t entry_count>
+void
+test_ebpf_hash_table_find_5_tuple(bool preemptible)
+{
+    _ebpf_hash_table_5_tuple_test_state instance(entry_count);
+    _ebpf_hash_table_5_tuple_test_state_instance = &instance;
+    _performance_measure measure(
+        __FUNCTION__, preemptible, _ebpf_hash_table_5_tuple_test_find, PERFORMANCE_MEASURE_ITERATION_COUNT / 100);
+    measure.run_test(instance.multiplier());
+}
+
+template <size_t record_size>
+void
+test_ebpf_ring_buffer_output(bool preemptible)
+{
+    _ebpf_ring_buffer_test_state instance(record_size);
+    _ebpf_ring_buffer_test_state_instance = &instance;
+    _performance_measure measure(
+        __FUNCTION__, preemptible, _ebpf_ring_buffer_test_output, PERFORMANCE_MEASURE_ITERATION_COUNT / 10);
+    measure.run_test();
+}
+
+template <size_t record_size>
+void
+test_ebpf_ring_buffer_reserve_submit(bool preemptible)
+{
+    _ebpf_ring_buffer_test_state instance(record_size);
+    _ebpf_ring_buffer_test_state_instance = &instance;
+    _performance_measure measure(
+        __FUNCTION__, preemptible, _ebpf_ring_buffer_test_reserve_submit, PERFORMANCE_MEASURE_ITERATION_COUNT / 10);
+    measure.run_test();
+}
+
+// Same as test_ebpf_ring_buffer_output, but the consumer returns space by storing its offset in the consumer page
+// instead of calling ebpf_ring_buffer_return. Both run in-process, so this compares only the producer-side cost of
+// picking up a stored offset against a direct return; the IOCTL round trip that a user-mode consumer saves is not
+// part of either measurement.
+template <size_t record_size>
+void
+test_ebpf_ring_buffer_output_in_process_consumer_offset_store(bool preemptible)
+{
+    _ebpf_ring_buffer_test_state instance(record_size, true);
+    _ebpf_ring_buffer_test_state_instance = &instance;
+    _performance_measure measure(
+        __FUNCTION__, preemptible, _ebpf_ring_buffer_test_output, PERFORMANCE_MEASURE_ITERATION_COUNT / 10);
+    measure.run_test();
+}
+
+// Same as test_ebpf_ring_buffer_output, but with a 64MB ring so each return hands back about a million small records
+// while the other CPUs keep producing. Return validation must not scale with the amount of space returned.
+template <size_t record_size>
+void
+test_ebpf_ring_buffer_output_large_return(bool preemptible)
+{
+    _ebpf_ring_buffer_test_state instance(record_size, false, 64 * 1024 * 1024);
+    _ebpf_ring_buffer_test_state_instance = &instance;
+    _performance_measure measure(
+        __FUNCTION__, preemptible, _ebpf_ring_buffer_test_output, PERFORMANCE_MEASURE_ITERATION_COUNT);
+    measure.run_test();
+}
+
 PERF_TEST(test_epoch_enter_exit);
 PERF_TEST(test_epoch_enter_exit_alloc_free);
+PERF_TEST(test_state_store_load);
 PERF_TEST(test_ebpf_hash_table_find);
 PERF_TEST(test_ebpf_hash_table_next_key);
+PERF_TEST(test_ebpf_hash_table_next_key_with_cursor);
 PERF_TEST(test_ebpf_hash_table_update);
 PERF_TEST(test_ebpf_hash_table_update_overlapping);
+PERF_TEST(test_ebpf_hash_table_find_after_grow<1024>);
+PERF_TEST(test_ebpf_hash_table_find_after_grow<1024 * 16>);
+PERF_TEST(test_ebpf_hash_table_find_after_grow<1024 * 256>);
+PERF_TEST(test_ebpf_hash_table_find_after_grow<1024 * 1024>);
+PERF_TEST(test_ebpf_hash_table_grow_shrink<1024>);
+PERF_TEST(test_ebpf_hash_table_grow_shrink<1024 * 16>);
+PERF_TEST(test_ebpf_hash_table_grow_shrink<1024 * 256>);
+PERF_TEST(test_ebpf_hash_table_grow_shrink<1024 * 1024>);
+PERF_TEST(test_ebpf_hash_table_find_5_tuple<1024 * 16>);
+PERF_TEST(test_ebpf_hash_table_find_5_tuple<1024 * 256>);
+PERF_TEST(test_ebpf_hash_table_find_5_tuple<1024 * 1024>);
+PERF_TEST(test_ebpf_ring_buffer_output<64>);
+PERF_TEST(test_ebpf_ring_buffer_output<1024>);
+PERF_TEST(test_ebpf_ring_buffer_reserve_submit<64>);
+PERF_TEST(test_ebpf_ring_buffer_reserve_submit<1024>);
+PERF_TEST(test_ebpf_ring_buffer_output_in_process_consumer_offset_store<64>);
+PERF_TEST(test_ebpf_ring_buffer_output_in_process_consumer_offset_store<1024>);
+PERF_TEST(test_ebpf_ring_buffer_output_large_return<64>);
 
 PERF_TEST(test_bpf_get_prandom_u32);
 PERF_TEST(test_bpf_ktime_get_boot_ns);
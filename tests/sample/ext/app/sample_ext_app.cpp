@@ -162,6 +162,28 @@ utility_helpers_test(ebpf_execution_type_t execution_type)
 TEST_CASE("utility_helpers_test_interpret", "[sample_ext_test]") { utility_helpers_test(EBPF_EXECUTION_INTERPRET); }
 #endif
 TEST_CASE("utility_helpers_test_jit", "[sample_ext_test]") { utility_helpers_test(EBPF_EXECUTION_JIT); }
+
+TEST_CASE("multiple_programs_test", "[sample_ext_test]")
+{
+    struct bpf_object* object = nullptr;
+    struct bpf_program* program = nullptr;
+    bpf_link* link = nullptr;
+    hook_helper_t hook(EBPF_ATTACH_TYPE_SAMPLE);
+
+    // test_utility_helpers returns 0, so the program attached after it also runs.
+    program_load_attach_helper_t _helper(
+        "test_sample_ebpf.o", EBPF_PROGRAM_TYPE_SAMPLE, "test_utility_helpers", EBPF_EXECUTION_JIT, nullptr, 0, hook);
+    object = _helper.get_object();
+
+    program = bpf_object__find_program_by_name(object, "test_program_entry");
+    REQUIRE(program != nullptr);
+    REQUIRE(hook.attach_link(bpf_program__fd(program), nullptr, 0, &link) == EBPF_SUCCESS);
+
+    sample_ebpf_ext_test(object);
+    verify_utility_helper_results(object);
+
+    bpf_link__destroy(link);
+}
 TEST_CASE("netsh_add_program_test_sample_ebpf", "[sample_ext_test]")
 {
     int result;
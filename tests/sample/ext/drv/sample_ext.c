@@ -14,6 +14,7 @@
 #include "ebpf_platform.h"
 #include "ebpf_program_types.h"
 
+#include "sample_ext.h"
 #include "sample_ext_program_info.h"
 #include "sample_ext_helpers.h"
 #include "sample_ext_ioctls.h"
@@ -160,7 +161,7 @@ _sample_ebpf_extension_hook_provider_attach_client(
  * @brief Callback invoked when a Hook NPI client detaches.
  *
  * @param[in] client_binding_context Provider module's context for binding with the client.
- * @retval STATUS_SUCCESS The operation succeeded.
+ * @retval STATUS_PENDING The detach completes asynchronously from a work item.
  * @retval STATUS_INVALID_PARAMETER One or more parameters are invalid.
  */
 NTSTATUS
@@ -189,11 +190,24 @@ const NPI_PROVIDER_CHARACTERISTICS _sample_ebpf_extension_hook_provider_characte
 };
 
 /**
- *  @brief This is the only function in the eBPF hook NPI client dispatch table.
+ *  @brief This is the first function in the eBPF hook NPI client dispatch table.
  */
 typedef ebpf_result_t (*ebpf_invoke_program_function_t)(
     _In_ const void* client_binding_context, _In_ const void* context, _Out_ uint32_t* result);
 
+/**
+ *  @brief This is the second function in the eBPF hook NPI client dispatch table. It runs the program
+ *         once for each context in a batch, within a single epoch.
+ */
+typedef ebpf_result_t (*ebpf_invoke_program_batch_function_t)(
+    _In_ const void* client_binding_context,
+    _In_reads_(count) void** contexts,
+    uint32_t count,
+    _Out_writes_(count) uint32_t* results);
+
+// Largest batch the profile request passes to the attached programs at once.
+#define SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE 64
+
 typedef struct _sample_ebpf_extension_hook_provider sample_ebpf_extension_hook_provider_t;
 /**
  *  @brief This is the per client binding context for the eBPF Hook
@@ -201,13 +215,36 @@ typedef struct _sample_ebpf_extension_hook_provider sample_ebpf_extension_hook_p
  */
 typedef struct _sample_ebpf_extension_hook_client
 {
+    LIST_ENTRY link;
     HANDLE nmr_binding_handle;
     GUID client_module_id;
     const void* client_binding_context;
     const ebpf_extension_data_t* client_data;
     ebpf_invoke_program_function_t invoke_program;
+    ebpf_invoke_program_batch_function_t invoke_program_batch;
+    PIO_WORKITEM detach_work_item;
 } sample_ebpf_extension_hook_client_t;
 
+/**
+ *  @brief Entry point of one attached program, copied out of its hook client.
+ */
+typedef struct _sample_ebpf_extension_hook_dispatch_entry
+{
+    ebpf_invoke_program_function_t invoke_program;
+    ebpf_invoke_program_batch_function_t invoke_program_batch;
+    const void* client_binding_context;
+} sample_ebpf_extension_hook_dispatch_entry_t;
+
+/**
+ *  @brief Immutable array of the attached programs' entry points, in attach order.
+ */
+typedef struct _sample_ebpf_extension_hook_dispatch_table
+{
+    uint32_t capacity;
+    uint32_t count;
+    sample_ebpf_extension_hook_dispatch_entry_t entries[1];
+} sample_ebpf_extension_hook_dispatch_table_t;
+
 /**
  *  @brief This is the provider context of eBPF Hook NPI provider that
  *         maintains the provider registration state.
@@ -215,7 +252,18 @@ typedef struct _sample_ebpf_extension_hook_client
 typedef struct _sample_ebpf_extension_hook_provider
 {
     HANDLE nmr_provider_handle;
-    sample_ebpf_extension_hook_client_t* attached_client;
+    // Serializes attach and detach.
+    FAST_MUTEX attach_lock;
+    LIST_ENTRY attached_clients;
+    uint32_t attached_client_count;
+    // Published dispatch table. Invocations below DISPATCH_LEVEL hold rundown_lock shared while using it;
+    // invocations at DISPATCH_LEVEL are waited for with a DPC on each CPU.
+    sample_ebpf_extension_hook_dispatch_table_t* volatile dispatch_table;
+    // Previously published table, kept so that a detach can always publish without allocating.
+    sample_ebpf_extension_hook_dispatch_table_t* spare_dispatch_table;
+    EX_PUSH_LOCK rundown_lock;
+    KDPC rundown_dpc;
+    KEVENT rundown_wait;
 } sample_ebpf_extension_hook_provider_t;
 
 static sample_ebpf_extension_hook_provider_t _sample_ebpf_extension_hook_provider_context = {0};
@@ -319,6 +367,88 @@ Exit:
 // Hook Provider.
 //
 
+static _Function_class_(KDEFERRED_ROUTINE) _IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_requires_min_(DISPATCH_LEVEL)
+    _IRQL_requires_(DISPATCH_LEVEL) _IRQL_requires_same_ void _sample_ebpf_extension_hook_rundown(
+        _In_ KDPC* dpc,
+        _In_opt_ void* deferred_context,
+        _In_opt_ void* system_argument_1,
+        _In_opt_ void* system_argument_2)
+{
+    sample_ebpf_extension_hook_provider_t* provider_context = (sample_ebpf_extension_hook_provider_t*)deferred_context;
+
+    UNREFERENCED_PARAMETER(dpc);
+    UNREFERENCED_PARAMETER(system_argument_1);
+    UNREFERENCED_PARAMETER(system_argument_2);
+    if (provider_context)
+        KeSetEvent(&provider_context->rundown_wait, 0, FALSE);
+}
+
+/**
+ * @brief Build and publish the dispatch table for the currently attached clients, then wait until
+ * no invocation can still be using the previous table.
+ *
+ * @param[in, out] provider_context Hook provider.
+ * @retval STATUS_SUCCESS The operation succeeded.
+ * @retval STATUS_NO_MEMORY Failed to allocate the dispatch table. Never returned after a detach,
+ * because the spare table held at least as many entries as remain.
+ */
+static _Requires_lock_held_(&provider_context->attach_lock) NTSTATUS
+    _sample_ebpf_extension_hook_publish_clients(_Inout_ sample_ebpf_extension_hook_provider_t* provider_context)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    uint32_t count = provider_context->attached_client_count;
+    sample_ebpf_extension_hook_dispatch_table_t* dispatch_table = NULL;
+    sample_ebpf_extension_hook_dispatch_table_t* old_dispatch_table;
+
+    if (count > 0) {
+        dispatch_table = provider_context->spare_dispatch_table;
+        if ((dispatch_table == NULL) || (dispatch_table->capacity < count)) {
+            dispatch_table = (sample_ebpf_extension_hook_dispatch_table_t*)ebpf_allocate(
+                FIELD_OFFSET(sample_ebpf_extension_hook_dispatch_table_t, entries[count]));
+            if (dispatch_table == NULL) {
+                status = STATUS_NO_MEMORY;
+                goto Exit;
+            }
+            dispatch_table->capacity = count;
+            ebpf_free(provider_context->spare_dispatch_table);
+        }
+        provider_context->spare_dispatch_table = NULL;
+
+        uint32_t index = 0;
+        for (LIST_ENTRY* entry = provider_context->attached_clients.Flink; entry != &provider_context->attached_clients;
+             entry = entry->Flink) {
+            sample_ebpf_extension_hook_client_t* hook_client =
+                CONTAINING_RECORD(entry, sample_ebpf_extension_hook_client_t, link);
+            dispatch_table->entries[index].invoke_program = hook_client->invoke_program;
+            dispatch_table->entries[index].invoke_program_batch = hook_client->invoke_program_batch;
+            dispatch_table->entries[index].client_binding_context = hook_client->client_binding_context;
+            index++;
+        }
+        dispatch_table->count = index;
+    }
+
+    old_dispatch_table = provider_context->dispatch_table;
+    ExAcquirePushLockExclusive(&provider_context->rundown_lock);
+    // Pairs with the acquire reads in the invoke functions.
+    WritePointerRelease((void* volatile*)&provider_context->dispatch_table, dispatch_table);
+    ExReleasePushLockExclusive(&provider_context->rundown_lock);
+
+    // Wait for invocations at DISPATCH_LEVEL to finish with the old table.
+    uint32_t maximum_processor = KeQueryMaximumProcessorCount();
+    for (uint32_t processor = 0; processor < maximum_processor; processor++) {
+        KeSetTargetProcessorDpc(&provider_context->rundown_dpc, (uint8_t)processor);
+        if (KeInsertQueueDpc(&provider_context->rundown_dpc, NULL, NULL)) {
+            KeWaitForSingleObject(&provider_context->rundown_wait, Executive, KernelMode, FALSE, NULL);
+        }
+    }
+
+    ebpf_free(provider_context->spare_dispatch_table);
+    provider_context->spare_dispatch_table = old_dispatch_table;
+
+Exit:
+    return status;
+}
+
 NTSTATUS
 _sample_ebpf_extension_hook_provider_attach_client(
     _In_ HANDLE nmr_binding_handle,
@@ -340,12 +470,6 @@ _sample_ebpf_extension_hook_provider_attach_client(
         goto Exit;
     }
 
-    if (local_provider_context->attached_client != NULL) {
-        // Currently only a single client is allowed to attach.
-        status = STATUS_INVALID_PARAMETER;
-        goto Exit;
-    }
-
     *provider_binding_context = NULL;
     *provider_dispatch = NULL;
 
@@ -366,38 +490,106 @@ _sample_ebpf_extension_hook_provider_attach_client(
         goto Exit;
     }
     hook_client->invoke_program = (ebpf_invoke_program_function_t)client_dispatch_table->function[0];
+    // Clients whose dispatch table has no batch entry are invoked once per context.
+    if (client_dispatch_table->size >= FIELD_OFFSET(ebpf_extension_dispatch_table_t, function[2]))
+        hook_client->invoke_program_batch = (ebpf_invoke_program_batch_function_t)client_dispatch_table->function[1];
+
+    //
+    // Allocate work item for client detach processing.
+    //
+    hook_client->detach_work_item = IoAllocateWorkItem(_sample_ebpf_ext_driver_device_object);
+    if (hook_client->detach_work_item == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
 
-    local_provider_context->attached_client = hook_client;
+    // Programs run in attach order.
+    ExAcquireFastMutex(&local_provider_context->attach_lock);
+    InsertTailList(&local_provider_context->attached_clients, &hook_client->link);
+    local_provider_context->attached_client_count++;
+    status = _sample_ebpf_extension_hook_publish_clients(local_provider_context);
+    if (!NT_SUCCESS(status)) {
+        RemoveEntryList(&hook_client->link);
+        local_provider_context->attached_client_count--;
+    }
+    ExReleaseFastMutex(&local_provider_context->attach_lock);
 
 Exit:
 
     if (NT_SUCCESS(status)) {
         *provider_binding_context = hook_client;
         hook_client = NULL;
-    } else
-        ebpf_free(hook_client);
+    } else {
+        if (hook_client) {
+            if (hook_client->detach_work_item)
+                IoFreeWorkItem(hook_client->detach_work_item);
+            ebpf_free(hook_client);
+        }
+    }
 
     return status;
 }
 
+IO_WORKITEM_ROUTINE _sample_ebpf_extension_detach_client_completion;
+#pragma alloc_text(PAGE, _sample_ebpf_extension_detach_client_completion)
+
+/**
+ * @brief IO work item routine callback that removes the client from the dispatch table, waits for in progress
+ * invocations and completes the detach.
+ *
+ * @param[in] device_object IO Device object.
+ * @param[in] context Pointer to work item context.
+ *
+ */
+void
+_sample_ebpf_extension_detach_client_completion(_In_ PDEVICE_OBJECT device_object, _In_opt_ void* context)
+{
+    sample_ebpf_extension_hook_client_t* hook_client = (sample_ebpf_extension_hook_client_t*)context;
+    sample_ebpf_extension_hook_provider_t* provider_context = &_sample_ebpf_extension_hook_provider_context;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(device_object);
+
+    ASSERT(hook_client != NULL);
+    _Analysis_assume_(hook_client != NULL);
+
+    // Publishing waits for in progress invocations, so the client can be freed once it returns.
+    ExAcquireFastMutex(&provider_context->attach_lock);
+    RemoveEntryList(&hook_client->link);
+    provider_context->attached_client_count--;
+    status = _sample_ebpf_extension_hook_publish_clients(provider_context);
+    ASSERT(NT_SUCCESS(status));
+    UNREFERENCED_PARAMETER(status);
+    ExReleaseFastMutex(&provider_context->attach_lock);
+
+    NmrProviderDetachClientComplete(hook_client->nmr_binding_handle);
+
+    IoFreeWorkItem(hook_client->detach_work_item);
+    ebpf_free(hook_client);
+}
+
 NTSTATUS
 _sample_ebpf_extension_hook_provider_detach_client(_In_ void* provider_binding_context)
 {
-    NTSTATUS status = STATUS_SUCCESS;
+    NTSTATUS status = STATUS_PENDING;
 
     sample_ebpf_extension_hook_client_t* local_client_context =
         (sample_ebpf_extension_hook_client_t*)provider_binding_context;
-    sample_ebpf_extension_hook_provider_t* provider_context = NULL;
 
     if (local_client_context == NULL) {
         status = STATUS_INVALID_PARAMETER;
         goto Exit;
     }
 
-    provider_context = &_sample_ebpf_extension_hook_provider_context;
-    provider_context->attached_client = NULL;
-
-    ebpf_free(local_client_context);
+    // The detach callback can run at DISPATCH_LEVEL, where the publish can't wait. The work item removes the
+    // client from the dispatch table and then completes the detach.
+    IoQueueWorkItem(
+        local_client_context->detach_work_item,
+        _sample_ebpf_extension_detach_client_completion,
+        DelayedWorkQueue,
+        (PVOID)local_client_context);
 
 Exit:
     return status;
@@ -412,6 +604,9 @@ sample_ebpf_extension_hook_provider_unregister()
     if (status == STATUS_PENDING)
         // Wait for clients to detach.
         NmrWaitForProviderDeregisterComplete(provider_context->nmr_provider_handle);
+
+    ebpf_free(provider_context->spare_dispatch_table);
+    provider_context->spare_dispatch_table = NULL;
 }
 
 NTSTATUS
@@ -423,6 +618,11 @@ sample_ebpf_extension_hook_provider_register()
     _sample_ebpf_extension_attach_provider_data.supported_program_type = EBPF_PROGRAM_TYPE_SAMPLE;
 
     local_provider_context = &_sample_ebpf_extension_hook_provider_context;
+    ExInitializeFastMutex(&local_provider_context->attach_lock);
+    InitializeListHead(&local_provider_context->attached_clients);
+    ExInitializePushLock(&local_provider_context->rundown_lock);
+    KeInitializeEvent(&local_provider_context->rundown_wait, SynchronizationEvent, FALSE);
+    KeInitializeDpc(&local_provider_context->rundown_dpc, _sample_ebpf_extension_hook_rundown, local_provider_context);
 
     status = NmrRegisterProvider(
         &_sample_ebpf_extension_hook_provider_characteristics,
@@ -438,26 +638,123 @@ Exit:
     return status;
 }
 
+/**
+ * @brief Run the programs in a dispatch table in attach order. The chain stops at the first program
+ * that fails or returns a non-zero result, and that result is returned. If every program returns 0,
+ * the result is 0.
+ *
+ * @param[in] dispatch_table Published dispatch table.
+ * @param[in] context Pointer to eBPF program context.
+ * @param[out] result Result of the last program that ran.
+ * @returns Result of the last invocation.
+ */
+static ebpf_result_t
+_sample_ebpf_extension_invoke_programs(
+    _In_ const sample_ebpf_extension_hook_dispatch_table_t* dispatch_table,
+    _In_ const sample_program_context_t* context,
+    _Out_ uint32_t* result)
+{
+    ebpf_result_t return_value = EBPF_SUCCESS;
+
+    *result = 0;
+    for (uint32_t index = 0; index < dispatch_table->count; index++) {
+        const sample_ebpf_extension_hook_dispatch_entry_t* entry = &dispatch_table->entries[index];
+        return_value = entry->invoke_program(entry->client_binding_context, context, result);
+        if ((return_value != EBPF_SUCCESS) || (*result != 0))
+            break;
+    }
+
+    return return_value;
+}
+
+/**
+ * @brief Run the programs in a dispatch table over a batch of contexts, following the same rules as
+ * _sample_ebpf_extension_invoke_programs for each context. Each program runs once over the contexts that
+ * every earlier program returned 0 for, or once per context if its client has no batch entry.
+ *
+ * @param[in] dispatch_table Published dispatch table.
+ * @param[in] contexts Array of pointers to eBPF program contexts.
+ * @param[in] count Number of contexts, at most SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE.
+ * @param[out] results Result for each context.
+ * @returns Result of the last invocation.
+ */
+static ebpf_result_t
+_sample_ebpf_extension_invoke_programs_batch(
+    _In_ const sample_ebpf_extension_hook_dispatch_table_t* dispatch_table,
+    _In_reads_(count) sample_program_context_t** contexts,
+    uint32_t count,
+    _Out_writes_(count) uint32_t* results)
+{
+    ebpf_result_t return_value = EBPF_SUCCESS;
+    void* pending_contexts[SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE];
+    uint32_t pending_indices[SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE];
+    uint32_t pending_results[SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE];
+    uint32_t pending_count = count;
+
+    ASSERT(count <= SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE);
+    for (uint32_t index = 0; index < count; index++) {
+        pending_contexts[index] = contexts[index];
+        pending_indices[index] = index;
+        results[index] = 0;
+    }
+
+    for (uint32_t index = 0; (index < dispatch_table->count) && (pending_count > 0); index++) {
+        const sample_ebpf_extension_hook_dispatch_entry_t* entry = &dispatch_table->entries[index];
+        if (entry->invoke_program_batch != NULL) {
+            return_value = entry->invoke_program_batch(
+                entry->client_binding_context, pending_contexts, pending_count, pending_results);
+        } else {
+            for (uint32_t pending = 0; pending < pending_count; pending++) {
+                return_value = entry->invoke_program(
+                    entry->client_binding_context, pending_contexts[pending], &pending_results[pending]);
+                if (return_value != EBPF_SUCCESS)
+                    break;
+            }
+        }
+        if (return_value != EBPF_SUCCESS)
+            break;
+
+        // Only contexts that this program passed go on to the next program.
+        uint32_t remaining_count = 0;
+        for (uint32_t pending = 0; pending < pending_count; pending++) {
+            results[pending_indices[pending]] = pending_results[pending];
+            if (pending_results[pending] == 0) {
+                pending_contexts[remaining_count] = pending_contexts[pending];
+                pending_indices[remaining_count] = pending_indices[pending];
+                remaining_count++;
+            }
+        }
+        pending_count = remaining_count;
+    }
+
+    return return_value;
+}
+
 ebpf_result_t
 sample_ebpf_extension_invoke_program(_In_ const sample_program_context_t* context, _Out_ uint32_t* result)
 {
     ebpf_result_t return_value = EBPF_SUCCESS;
+    bool passive = (KeGetCurrentIrql() < DISPATCH_LEVEL);
 
     sample_ebpf_extension_hook_provider_t* hook_provider_context = &_sample_ebpf_extension_hook_provider_context;
 
-    sample_ebpf_extension_hook_client_t* hook_client = hook_provider_context->attached_client;
+    if (passive)
+        ExAcquirePushLockShared(&hook_provider_context->rundown_lock);
 
-    if (hook_client == NULL) {
+    const sample_ebpf_extension_hook_dispatch_table_t* dispatch_table =
+        (const sample_ebpf_extension_hook_dispatch_table_t*)ReadPointerAcquire(
+            (void* const volatile*)&hook_provider_context->dispatch_table);
+
+    if (dispatch_table == NULL) {
         return_value = EBPF_FAILED;
         goto Exit;
     }
-    ebpf_invoke_program_function_t invoke_program = hook_client->invoke_program;
-    const void* client_binding_context = hook_client->client_binding_context;
 
-    // Run the eBPF program using cached copies of invoke_program and client_binding_context.
-    return_value = invoke_program(client_binding_context, context, result);
+    return_value = _sample_ebpf_extension_invoke_programs(dispatch_table, context, result);
 
 Exit:
+    if (passive)
+        ExReleasePushLockShared(&hook_provider_context->rundown_lock);
     return return_value;
 }
 
@@ -471,20 +768,25 @@ sample_ebpf_extension_profile_program(
     LARGE_INTEGER start;
     LARGE_INTEGER end;
     uint32_t result;
+    uint32_t batch_results[SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE];
+    sample_program_context_t* batch_contexts[SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE];
     KIRQL old_irql = PASSIVE_LEVEL;
     sample_program_context_t program_context = {
         request->data, request->data + request_length - FIELD_OFFSET(sample_ebpf_ext_profile_request_t, data)};
 
     sample_ebpf_extension_hook_provider_t* hook_provider_context = &_sample_ebpf_extension_hook_provider_context;
 
-    sample_ebpf_extension_hook_client_t* hook_client = hook_provider_context->attached_client;
+    // Hold off detach for the whole run; every attached program runs on each iteration.
+    ExAcquirePushLockShared(&hook_provider_context->rundown_lock);
 
-    if (hook_client == NULL) {
+    const sample_ebpf_extension_hook_dispatch_table_t* dispatch_table =
+        (const sample_ebpf_extension_hook_dispatch_table_t*)ReadPointerAcquire(
+            (void* const volatile*)&hook_provider_context->dispatch_table);
+
+    if (dispatch_table == NULL) {
         return_value = EBPF_FAILED;
         goto Exit;
     }
-    ebpf_invoke_program_function_t invoke_program = hook_client->invoke_program;
-    const void* client_binding_context = hook_client->client_binding_context;
 
     program_context.uint32_data = KeGetCurrentProcessorNumber();
 
@@ -492,8 +794,21 @@ sample_ebpf_extension_profile_program(
     if (request->flags & SAMPLE_EBPF_EXT_FLAG_DISPATCH) {
         KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
     }
-    for (size_t i = 0; i < request->iterations; i++) {
-        invoke_program(client_binding_context, &program_context, &result);
+    if (request->flags & SAMPLE_EBPF_EXT_FLAG_BATCH) {
+        // Every iteration is one context, passed to the programs SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE at a time.
+        for (uint32_t i = 0; i < SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE; i++) {
+            batch_contexts[i] = &program_context;
+        }
+        for (size_t i = 0; i < request->iterations; i += SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE) {
+            uint64_t remaining = request->iterations - i;
+            uint32_t count = (remaining < SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE) ? (uint32_t)remaining
+                                                                               : SAMPLE_EBPF_EXT_PROFILE_BATCH_SIZE;
+            _sample_ebpf_extension_invoke_programs_batch(dispatch_table, batch_contexts, count, batch_results);
+        }
+    } else {
+        for (size_t i = 0; i < request->iterations; i++) {
+            _sample_ebpf_extension_invoke_programs(dispatch_table, &program_context, &result);
+        }
     }
     if (request->flags & SAMPLE_EBPF_EXT_FLAG_DISPATCH) {
         KeLowerIrql(old_irql);
@@ -503,6 +818,7 @@ sample_ebpf_extension_profile_program(
     reply->duration = end.QuadPart - start.QuadPart;
 
 Exit:
+    ExReleasePushLockShared(&hook_provider_context->rundown_lock);
     return return_value;
 }
 
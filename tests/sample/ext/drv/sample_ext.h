@@ -13,6 +13,9 @@
 
 typedef struct _sample_program_context sample_program_context_t;
 
+// Globals.
+extern DEVICE_OBJECT* _sample_ebpf_ext_driver_device_object;
+
 /**
  * @brief Register program information NPI provider.
  *
@@ -19,7 +19,7 @@
 #define SAMPLE_EBPF_EXT_SYMBOLIC_DEVICE_NAME L"\\GLOBAL??\\" SAMPLE_EBPF_EXT_DEVICE_BASE_NAME
 
 // Driver global variables
-static DEVICE_OBJECT* _sample_ebpf_ext_driver_device_object;
+DEVICE_OBJECT* _sample_ebpf_ext_driver_device_object;
 static BOOLEAN _sample_ebpf_ext_driver_unloading_flag = FALSE;
 
 //
@@ -123,6 +123,9 @@ _sample_ebpf_ext_driver_initialize_objects(
 
     device_create_flag = TRUE;
 
+    // Hook clients allocate their detach work items against this device object, so set it before registering.
+    _sample_ebpf_ext_driver_device_object = WdfDeviceWdmGetDeviceObject(*device);
+
     // Create symbolic link for control object for user mode.
     RtlInitUnicodeString(&sample_ebpf_ext_symbolic_device_name, SAMPLE_EBPF_EXT_SYMBOLIC_DEVICE_NAME);
     status = WdfDeviceCreateSymbolicLink(*device, &sample_ebpf_ext_symbolic_device_name);
@@ -189,8 +192,6 @@ DriverEntry(_In_ DRIVER_OBJECT* driver_object, _In_ UNICODE_STRING* registry_pat
         goto Exit;
     }
 
-    _sample_ebpf_ext_driver_device_object = WdfDeviceWdmGetDeviceObject(device);
-
 Exit:
 
     return status;
@@ -27,7 +27,8 @@ typedef enum _sample_ebfp_ext_control_code
 
 typedef enum _sample_ebpf_ext_flag
 {
-    SAMPLE_EBPF_EXT_FLAG_DISPATCH,
+    SAMPLE_EBPF_EXT_FLAG_DISPATCH = 0x1,
+    SAMPLE_EBPF_EXT_FLAG_BATCH = 0x2,
 } sample_ebpf_ext_flag_t;
 
 typedef struct _sample_ebpf_ext_profile_request
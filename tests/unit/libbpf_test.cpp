@@ -429,6 +429,37 @@ TEST_CASE("libbpf map", "[libbpf]")
     bpf_object__close(object);
 }
 
+TEST_CASE("libbpf map batch partial failure", "[libbpf]")
+{
+    _test_helper_libbpf test_helper;
+
+    int map_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint32_t), 10, 0);
+    REQUIRE(map_fd > 0);
+
+    std::vector<uint32_t> keys = {0, 1, 2, 3};
+    std::vector<uint32_t> values = {10, 11, 12, 13};
+    struct bpf_map_batch_opts opts = {sizeof(struct bpf_map_batch_opts), BPF_NOEXIST, 0};
+
+    // Key 2 already exists, so only the two entries before it are added.
+    uint32_t value = 0;
+    REQUIRE(bpf_map_update_elem(map_fd, &keys[2], &value, BPF_ANY) == 0);
+    uint32_t count = static_cast<uint32_t>(keys.size());
+    REQUIRE(bpf_map_update_batch(map_fd, keys.data(), values.data(), &count, &opts) < 0);
+    REQUIRE(count == 2);
+    REQUIRE(bpf_map_lookup_elem(map_fd, &keys[1], &value) == 0);
+    REQUIRE(value == values[1]);
+    REQUIRE(bpf_map_lookup_elem(map_fd, &keys[3], &value) < 0);
+
+    // Key 3 doesn't exist, so only the three keys before it are deleted.
+    count = static_cast<uint32_t>(keys.size());
+    REQUIRE(bpf_map_delete_batch(map_fd, keys.data(), &count, nullptr) < 0);
+    REQUIRE(errno == ENOENT);
+    REQUIRE(count == 3);
+    REQUIRE(bpf_map_lookup_elem(map_fd, &keys[2], &value) < 0);
+
+    Platform::_close(map_fd);
+}
+
 TEST_CASE("libbpf map binding", "[libbpf]")
 {
     _test_helper_libbpf test_helper;
@@ -1121,6 +1152,32 @@ TEST_CASE("create map with name", "[libbpf]")
     Platform::_close(map_fd);
 }
 
+TEST_CASE("create overwrite ring buffer map", "[libbpf]")
+{
+    _test_helper_end_to_end test_helper;
+
+    LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_RB_OVERWRITE);
+    int map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, "overwrite_map", 0, 0, 64 * 1024, &opts);
+    REQUIRE(map_fd > 0);
+
+    // Make sure the flag was passed through to the map.
+    bpf_map_info info;
+    uint32_t info_size = sizeof(info);
+    REQUIRE(bpf_obj_get_info_by_fd(map_fd, &info, &info_size) == 0);
+    REQUIRE(info.type == BPF_MAP_TYPE_RINGBUF);
+    REQUIRE(info.map_flags == BPF_F_RB_OVERWRITE);
+    Platform::_close(map_fd);
+
+    map_fd = bpf_map_create(BPF_MAP_TYPE_PERCPU_RINGBUF, "overwrite_map", 0, 0, 64 * 1024, &opts);
+    REQUIRE(map_fd > 0);
+    Platform::_close(map_fd);
+
+    // Only ring buffer maps can overwrite.
+    map_fd = bpf_map_create(BPF_MAP_TYPE_HASH, "overwrite_map", sizeof(uint32_t), sizeof(uint32_t), 1, &opts);
+    REQUIRE(map_fd < 0);
+    REQUIRE(errno == EINVAL);
+}
+
 TEST_CASE("enumerate map IDs", "[libbpf]")
 {
     _test_helper_end_to_end test_helper;